@@ -107,6 +107,9 @@ struct connection
 	uint32_t   confchg;     /* Registered for confchg */
 	struct list write_msgs; /* Queued messages to go to data clients */
 	uint32_t    num_write_msgs; /* Count of messages */
+	char       *rbuf;       /* Receive buffer for (pipelined) requests */
+	int         rbuf_len;   /* Bytes of unprocessed data in rbuf */
+	int         corked;     /* Replies are queued until the batch is done */
 	struct connection *next;
 	struct list list;       /* when on the client_list */
 };
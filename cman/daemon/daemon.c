@@ -12,6 +12,7 @@
 #include <sys/stat.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/signal.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -37,6 +38,31 @@
 
 LOGSYS_DECLARE_SUBSYS (CMAN_NAME);
 
+/* Largest single request a client can send us */
+#define MAX_CLIENT_REQUEST (MAX_CLUSTER_MESSAGE + sizeof(struct sock_header))
+
+/* Command handlers read their arguments as fixed-size structs */
+union request_args
+{
+	struct cl_cluster_node node;
+	struct cl_fence_info fence;
+	struct cl_barrier_info barrier;
+	struct cl_version version;
+	struct cl_listen_request listen;
+	struct cl_set_votes votes;
+};
+
+/* Requests shorter than this are zero-padded before being processed */
+#define MIN_CLIENT_REQUEST (sizeof(struct sock_header) + sizeof(union request_args))
+
+/* Room for several pipelined requests per read. The buffer is allocated
+   one byte larger to hold the NUL put after each request while it is
+   being processed */
+#define CLIENT_RBUF_SIZE (4 * MAX_CLIENT_REQUEST)
+
+/* Maximum number of queued replies flushed in one writev */
+#define MAX_WRITEV_MSGS 64
+
 struct queued_reply
 {
 	struct list list;
@@ -55,8 +81,14 @@ int num_connections = 0;
 hdb_handle_t cs_poll_handle;
 uint32_t max_outstanding_messages = DEFAULT_MAX_QUEUED;
 
+/* The connection whose requests are being dispatched, so we can tell if
+   it was removed underneath us */
+static struct connection *dispatch_con;
+static int dispatch_con_removed;
+
 static int process_client(hdb_handle_t handle, int fd, int revent, void *data);
 static void remove_client(hdb_handle_t handle, struct connection *con);
+static void send_queued_reply(struct connection *con);
 
 /* Send it, or queue it for later if the socket is busy */
 static int send_reply_message(struct connection *con, struct sock_header *msg)
@@ -65,9 +97,14 @@ static int send_reply_message(struct connection *con, struct sock_header *msg)
 
 	log_printf(LOGSYS_LEVEL_DEBUG, "daemon: sending reply %x to fd %d\n", msg->command, con->fd);
 
+	/* Don't let a long batch of pipelined requests grow the queue
+	   without bound, send what we have so far */
+	if (con->corked && con->num_write_msgs >= MAX_WRITEV_MSGS)
+		send_queued_reply(con);
+
 	/* If there are already queued messages then don't send this one
-	   out of order */
-	if (!list_empty(&con->write_msgs)) {
+	   out of order. Corked replies are sent when the batch is done */
+	if (!list_empty(&con->write_msgs) || con->corked) {
 		ret = -1;
 		errno = EAGAIN;
 	}
@@ -101,7 +138,8 @@ static int send_reply_message(struct connection *con, struct sock_header *msg)
 		list_add(&con->write_msgs, &qm->list);
 		con->num_write_msgs++;
 		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: queued last message, count is %d\n", con->num_write_msgs);
-		poll_dispatch_modify(cs_poll_handle, con->fd, POLLIN | POLLOUT, process_client);
+		if (!con->corked)
+			poll_dispatch_modify(cs_poll_handle, con->fd, POLLIN | POLLOUT, process_client);
 	}
 	return 0;
 }
@@ -129,194 +167,296 @@ static void remove_client(hdb_handle_t handle, struct connection *con)
 	}
 
 	log_printf(LOGSYS_LEVEL_DEBUG, "daemon: Freed %d queued messages\n", msgs);
+	if (con == dispatch_con)
+		dispatch_con_removed = 1;
+	free(con->rbuf);
 	free(con);
 	num_connections--;
 }
 
-/* Send as many as we can */
+/* Send as many as we can, gathering them into as few writev calls as
+   the socket will take */
 static void send_queued_reply(struct connection *con)
 {
+	struct iovec iov[MAX_WRITEV_MSGS];
 	struct queued_reply *qm;
 	struct sock_header *msg;
 	struct list *tmp, *qmh;
-	int ret;
+	int niov;
+	int remain;
+	ssize_t total;
+	ssize_t written;
+	ssize_t ret;
+
+	while (!list_empty(&con->write_msgs)) {
+		niov = 0;
+		total = 0;
+		list_iterate(qmh, &con->write_msgs) {
+			qm = list_item(qmh, struct queued_reply);
+			msg = (struct sock_header *)qm->buf;
+			iov[niov].iov_base = qm->buf + qm->offset;
+			iov[niov].iov_len = msg->length - qm->offset;
+			total += iov[niov].iov_len;
+			if (++niov == MAX_WRITEV_MSGS)
+				break;
+		}
 
-	list_iterate_safe(qmh, tmp, &con->write_msgs) {
-		qm = list_item(qmh, struct queued_reply);
-		msg = (struct sock_header *)qm->buf;
-		ret = send(con->fd, qm->buf + qm->offset, msg->length - qm->offset, MSG_DONTWAIT);
-		if (ret == msg->length - qm->offset)
-		{
+		ret = writev(con->fd, iov, niov);
+		if (ret <= 0)
+			break;
+		written = ret;
+
+		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: wrote %d bytes of %d queued replies to fd %d\n",
+			   (int)ret, niov, con->fd);
+
+		/* Free the ones that went completely */
+		list_iterate_safe(qmh, tmp, &con->write_msgs) {
+			qm = list_item(qmh, struct queued_reply);
+			msg = (struct sock_header *)qm->buf;
+			remain = msg->length - qm->offset;
+			if (ret < remain) {
+				qm->offset += ret;
+				break;
+			}
+			ret -= remain;
 			list_del(&qm->list);
 			free(qm);
 			con->num_write_msgs--;
+			if (!ret)
+				break;
 		}
-		else
-		{
-			if (ret > 0)
-				qm->offset += ret;
+
+		/* Socket is full */
+		if (written < total)
 			break;
-		}
 	}
 	if (list_empty(&con->write_msgs)) {
 		/* Remove POLLOUT callback */
 		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: Removing POLLOUT from fd %d\n", con->fd);
 		poll_dispatch_modify(cs_poll_handle, con->fd, POLLIN, process_client);
 	}
+	else {
+		poll_dispatch_modify(cs_poll_handle, con->fd, POLLIN | POLLOUT, process_client);
+	}
 }
 
-/* Dispatch a request from a CLIENT or ADMIN socket */
-static int process_client(hdb_handle_t handle, int fd, int revent, void *data)
+/* Validate and act on a single, complete request from a client */
+static void process_client_request(struct connection *con, struct sock_header *msg)
 {
-	struct connection *con = data;
-
-	if (revent == POLLOUT) {
-		send_queued_reply(con);
-	} else {
-		char buf[MAX_CLUSTER_MESSAGE + sizeof(struct sock_header)];
-		struct sock_header *msg = (struct sock_header *)buf;
-		int len;
-		int totallen = 0;
+	log_printf(LOGSYS_LEVEL_DEBUG, "daemon: client command is %x\n", msg->command);
 
-		memset(buf, 0, (MAX_CLUSTER_MESSAGE + sizeof(struct sock_header)));
+	/* Privileged functions can only be done on ADMIN sockets */
+	if (msg->command & CMAN_CMDFLAG_PRIV && con->type != CON_ADMIN) {
+		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: command disallowed from non-admin client\n");
+		send_status_return(con, msg->command, -EPERM);
+		return;
+	}
 
-		len = read(fd, buf, sizeof(struct sock_header));
+	/* Slightly arbitrary this one, don't allow ADMIN sockets to
+	   send/receive data. The main loop doesn't keep a backlog queue
+	   of messages for ADMIN sockets
+	*/
+	if ((msg->command == CMAN_CMD_DATA || msg->command == CMAN_CMD_BIND ||
+	     msg->command == CMAN_CMD_NOTIFY) && con->type == CON_ADMIN) {
+		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: can't send data down an admin socket, sorry\n");
+		send_status_return(con, msg->command, -EINVAL);
+		return;
+	}
 
-		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: read %d bytes from fd %d\n", len, fd);
+	if (msg->command == CMAN_CMD_DATA) {
+		char *databuf = (char *)msg;
+		int ret;
+		uint8_t port;
+		struct sock_data_header *dmsg = (struct sock_data_header *)msg;
 
-		if (len == 0) {
-			remove_client(handle, con);
-			return -1;
+		if (msg->length < sizeof(struct sock_data_header)) {
+			send_status_return(con, msg->command, -EINVAL);
+			return;
 		}
 
-		if (len < 0 &&
-		    (errno == EINTR || errno == EAGAIN))
-			return 0;
+		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: sending %lu bytes of data to node %d, port %d\n",
+			 (unsigned long)(msg->length - sizeof(struct sock_data_header)), dmsg->nodeid, dmsg->port);
 
-		if (len < 0) {
-			remove_client(handle, con);
-			return 0;
-		}
+		databuf += sizeof(struct sock_data_header);
 
-		if (msg->magic != CMAN_MAGIC) {
-			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: bad magic in client command %x\n", msg->magic);
+		if (dmsg->port > 255) {
 			send_status_return(con, msg->command, -EINVAL);
-			return 0;
+			return;
 		}
-		if (msg->version != CMAN_VERSION) {
-			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: bad version in client command. msg = 0x%x, us = 0x%x\n", msg->version, CMAN_VERSION);
-			send_status_return(con, msg->command, -EINVAL);
-			return 0;
-		}
-		if ((msg->length-len) > MAX_CLUSTER_MESSAGE) {
-			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: message on socket is too big\n");
-			send_status_return(con, msg->command, -EINVAL);
-			return 0;
+
+		if (dmsg->port)
+			port = dmsg->port;
+		else
+			port = con->port;
+
+		ret = comms_send_message(databuf, msg->length - sizeof(struct sock_data_header),
+					 port, con->port,
+					 dmsg->nodeid,
+					 msg->flags);
+		if (ret) {
+			send_status_return(con, msg->command, -EIO);
 		}
+	}
+	else {
+		char *cmdbuf = (char *)msg;
+		char small_retbuf[1024]; /* Enough for most needs */
+		char *retbuf = small_retbuf;
+		struct sock_reply_header *reply;
+		int ret;
+		int retlen = 0;
 
-		totallen = len;
+		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: About to process command\n");
 
-		/* Read the rest */
-		while (totallen != msg->length) {
-			len = read(fd, buf+len, msg->length-len);
-			if (len == 0)
-				return -1;
+		cmdbuf += sizeof(struct sock_header);
 
-			if (len < 0 &&
-			    (errno == EINTR || errno == EAGAIN))
-				return 0;
+		ret = process_command(con, msg->command, cmdbuf,
+				      &retbuf, &retlen, sizeof(small_retbuf),
+				      sizeof(struct sock_reply_header));
 
-			if (len < 0) {
-				remove_client(handle, con);
-				return -1;
-			}
-			totallen += len;
-		}
+		/* Reply message will come later on */
+		if (ret == -EWOULDBLOCK)
+			return;
 
-		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: client command is %x\n", msg->command);
+		reply = (struct sock_reply_header *)retbuf;
 
-		/* Privileged functions can only be done on ADMIN sockets */
-		if (msg->command & CMAN_CMDFLAG_PRIV && con->type != CON_ADMIN) {
-			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: command disallowed from non-admin client\n");
-			send_status_return(con, msg->command, -EPERM);
-			return 0;
-		}
+		reply->header.magic = CMAN_MAGIC;
+		reply->header.flags = 0;
+		reply->header.command = msg->command | CMAN_CMDFLAG_REPLY;
+		reply->header.length = retlen + sizeof(struct sock_reply_header);
+		reply->status = ret;
 
-		/* Slightly arbitrary this one, don't allow ADMIN sockets to
-		   send/receive data. The main loop doesn't keep a backlog queue
-		   of messages for ADMIN sockets
-		*/
-		if ((msg->command == CMAN_CMD_DATA || msg->command == CMAN_CMD_BIND ||
-		     msg->command == CMAN_CMD_NOTIFY) && con->type == CON_ADMIN) {
-			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: can't send data down an admin socket, sorry\n");
-			send_status_return(con, msg->command, -EINVAL);
-			return 0;
-		}
+		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: Returning command data. length = %d\n", retlen);
+		send_reply_message(con, (struct sock_header *)reply);
+
+		if (retbuf != small_retbuf)
+			free(retbuf);
+	}
+}
 
-		if (msg->command == CMAN_CMD_DATA) {
-			char *databuf = (char *)msg;
-			int ret;
-			uint8_t port;
-			struct sock_data_header *dmsg = (struct sock_data_header *)msg;
+/* Dispatch requests from a CLIENT or ADMIN socket.
+   As much as will fit is read into the connection's receive buffer and
+   every complete request in there is processed before returning. Any
+   replies generated are queued and flushed together at the end. */
+static int process_client(hdb_handle_t handle, int fd, int revent, void *data)
+{
+	struct connection *con = data;
+	struct sock_header *msg;
+	static union {
+		uint64_t align;
+		char buf[MIN_CLIENT_REQUEST + 1];
+	} short_req;
+	struct sock_header *req;
+	int offset = 0;
+	int len;
+	char saved = 0;
 
-			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: sending %lu bytes of data to node %d, port %d\n",
-				 (unsigned long)(msg->length - sizeof(struct sock_data_header)), dmsg->nodeid, dmsg->port);
+	if (revent == POLLOUT) {
+		send_queued_reply(con);
+		return 0;
+	}
 
-			databuf += sizeof(struct sock_data_header);
+	len = read(fd, con->rbuf + con->rbuf_len, CLIENT_RBUF_SIZE - con->rbuf_len);
 
-			if (dmsg->port > 255) {
-				send_status_return(con, msg->command, -EINVAL);
-				return 0;
-			}
+	log_printf(LOGSYS_LEVEL_DEBUG, "daemon: read %d bytes from fd %d\n", len, fd);
 
-			if (dmsg->port)
-				port = dmsg->port;
-			else
-				port = con->port;
-
-			ret = comms_send_message(databuf, msg->length - sizeof(struct sock_data_header),
-						 port, con->port,
-						 dmsg->nodeid,
-						 msg->flags);
-			if (ret) {
-				send_status_return(con, msg->command, -EIO);
-			}
-		}
-		else {
-			char *cmdbuf = (char *)msg;
-			char small_retbuf[1024]; /* Enough for most needs */
-			char *retbuf = small_retbuf;
-			struct sock_reply_header *reply;
-			int ret;
-			int retlen = 0;
+	if (len == 0) {
+		remove_client(handle, con);
+		return -1;
+	}
 
-			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: About to process command\n");
+	if (len < 0 &&
+	    (errno == EINTR || errno == EAGAIN))
+		return 0;
 
-			cmdbuf += sizeof(struct sock_header);
+	if (len < 0) {
+		remove_client(handle, con);
+		return 0;
+	}
 
-			ret = process_command(con, msg->command, cmdbuf,
-					      &retbuf, &retlen, sizeof(small_retbuf),
-					      sizeof(struct sock_reply_header));
+	con->rbuf_len += len;
+	con->corked = 1;
+	dispatch_con = con;
+	dispatch_con_removed = 0;
 
-			/* Reply message will come later on */
-			if (ret == -EWOULDBLOCK)
-				return 0;
+	while (con->rbuf_len - offset >= (int)sizeof(struct sock_header)) {
+		msg = (struct sock_header *)(con->rbuf + offset);
 
-			reply = (struct sock_reply_header *)retbuf;
+		/* Keep the request aligned for the command handlers */
+		if ((uintptr_t)msg & (sizeof(uint64_t) - 1)) {
+			memmove(con->rbuf, con->rbuf + offset, con->rbuf_len - offset);
+			con->rbuf_len -= offset;
+			offset = 0;
+			msg = (struct sock_header *)con->rbuf;
+		}
 
-			reply->header.magic = CMAN_MAGIC;
-			reply->header.flags = 0;
-			reply->header.command = msg->command | CMAN_CMDFLAG_REPLY;
-			reply->header.length = retlen + sizeof(struct sock_reply_header);
-			reply->status = ret;
+		if (msg->magic != CMAN_MAGIC) {
+			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: bad magic in client command %x\n", msg->magic);
+			send_status_return(con, msg->command, -EINVAL);
+			goto discard;
+		}
+		if (msg->version != CMAN_VERSION) {
+			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: bad version in client command. msg = 0x%x, us = 0x%x\n", msg->version, CMAN_VERSION);
+			send_status_return(con, msg->command, -EINVAL);
+			goto discard;
+		}
+		if (msg->length > MAX_CLIENT_REQUEST ||
+		    msg->length < sizeof(struct sock_header)) {
+			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: bad length in client command %d\n", msg->length);
+			send_status_return(con, msg->command, -EINVAL);
+			goto discard;
+		}
 
-			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: Returning command data. length = %d\n", retlen);
-			send_reply_message(con, (struct sock_header *)reply);
+		/* Wait for the rest */
+		if (con->rbuf_len - offset < msg->length)
+			break;
 
-			if (retbuf != small_retbuf)
-				free(retbuf);
+		/* Requests used to arrive in a zeroed buffer. Short ones are
+		   copied out so the handlers don't read the start of the next
+		   request as part of their arguments, longer ones just need
+		   any trailing string argument terminated */
+		len = msg->length;
+		if (len < (int)MIN_CLIENT_REQUEST) {
+			memcpy(short_req.buf, msg, len);
+			memset(short_req.buf + len, 0, sizeof(short_req.buf) - len);
+			req = (struct sock_header *)short_req.buf;
+		}
+		else {
+			saved = con->rbuf[offset + len];
+			con->rbuf[offset + len] = '\0';
+			req = msg;
 		}
+
+		process_client_request(con, req);
+		if (dispatch_con_removed)
+			goto removed;
+
+		if (req == msg)
+			con->rbuf[offset + len] = saved;
+		offset += len;
+	}
+
+	/* Keep any partial request at the start of the buffer */
+	if (offset) {
+		memmove(con->rbuf, con->rbuf + offset, con->rbuf_len - offset);
+		con->rbuf_len -= offset;
 	}
+	goto flush;
+
+ discard:
+	/* We have lost track of where requests start, throw away the rest */
+	if (dispatch_con_removed)
+		goto removed;
+	con->rbuf_len = 0;
+
+ flush:
+	con->corked = 0;
+	dispatch_con = NULL;
+	if (!list_empty(&con->write_msgs))
+		send_queued_reply(con);
+	return 0;
+
+ removed:
+	dispatch_con = NULL;
 	return 0;
 }
 
@@ -342,6 +482,14 @@ static int process_rendezvous(hdb_handle_t handle, int fd, int revent, void *dat
 		newcon->port = 0;
 		newcon->events = 0;
 		newcon->num_write_msgs = 0;
+		newcon->rbuf_len = 0;
+		newcon->corked = 0;
+		newcon->rbuf = malloc(CLIENT_RBUF_SIZE + 1);
+		if (!newcon->rbuf) {
+			free(newcon);
+			close(client_fd);
+			return 0;
+		}
 		list_init(&newcon->write_msgs);
 		fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK);
 
@@ -401,6 +549,9 @@ static int open_local_sock(const char *name, int name_len, mode_t mode, hdb_hand
 	con->type = type;
 	con->fd = local_socket;
 	con->num_write_msgs = 0;
+	con->rbuf = NULL;
+	con->rbuf_len = 0;
+	con->corked = 0;
 
 	poll_dispatch_add(handle, con->fd, POLLIN, con, process_rendezvous);
 
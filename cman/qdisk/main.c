@@ -776,6 +776,7 @@ update_local_status(qd_ctx *ctx, node_info_t *ni, int max, int score,
 	fprintf(fp, "Score: %d/%d (Minimum required = %d)\n",
 		score, score_max, score_req);
 	fprintf(fp, "Current state: %s\n", state_str(ctx->qc_status));
+	print_heuristic_status(fp);
 
 	/*
 	fprintf(fp, "Current disk state: %s\n",
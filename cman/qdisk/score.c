@@ -20,15 +20,38 @@
 static pthread_mutex_t sc_lock = PTHREAD_MUTEX_INITIALIZER;
 static int _score = 0, _maxscore = 0, _score_thread_running = 0;
 static pthread_t score_thread = (pthread_t)0;
+static struct h_data *_h_status = NULL;
+static int _h_count = 0;
 extern void set_priority(int, int);
 
 struct h_arg {
 	struct h_data *h;
+	qd_ctx *ctx;
 	int sched_queue;
 	int sched_prio;
 	int count;
 };
 
+
+static int
+ts_cmp(struct timespec *a, struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec ? -1 : 1;
+	if (a->tv_nsec != b->tv_nsec)
+		return a->tv_nsec < b->tv_nsec ? -1 : 1;
+	return 0;
+}
+
+
+/* a - b in milliseconds */
+static int
+ts_diff_ms(struct timespec *a, struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000 +
+	       (a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
 /*
   XXX Messy, but works for now... 
  */
@@ -71,6 +94,41 @@ restore_signals(void)
 }
 
 
+/**
+  Is it time to run a heuristic?  If so, it is scheduled to run again
+  after its current interval.
+ */
+static int
+heuristic_due(struct h_data *h, struct timespec *now)
+{
+	if (ts_cmp(now, &h->nextrun) < 0)
+		return 0;
+
+	h->nextrun.tv_sec = now->tv_sec + h->cur_interval;
+	h->nextrun.tv_nsec = now->tv_nsec;
+
+	h->failtime.tv_sec = now->tv_sec + h->maxtime;
+	h->failtime.tv_nsec = now->tv_nsec;
+
+	h->started = *now;
+	return 1;
+}
+
+
+/**
+  Add a run to a heuristic's history
+ */
+static void
+record_result(struct h_data *h, int result, struct timespec *now)
+{
+	h->history[h->hist_next].latency = ts_diff_ms(now, &h->started);
+	h->history[h->hist_next].result = result;
+	h->hist_next = (h->hist_next + 1) % HEUR_HISTORY;
+	if (h->hist_count < HEUR_HISTORY)
+		h->hist_count++;
+}
+
+
 /**
   Spin off a user-defined heuristic
  */
@@ -85,16 +143,9 @@ fork_heuristic(struct h_data *h, struct timespec *now)
 		return -1;
 	}
 
-	if (now->tv_sec < h->nextrun.tv_sec ||
-	    now->tv_nsec < h->nextrun.tv_nsec)
+	if (!heuristic_due(h, now))
 		return 0;
 
-	h->nextrun.tv_sec = now->tv_sec + h->interval;
-	h->nextrun.tv_nsec = now->tv_nsec;
-
-	h->failtime.tv_sec = now->tv_sec + h->maxtime;
-	h->failtime.tv_nsec = now->tv_nsec;
-
 	pid = fork();
 	if (pid < 0)
 		return -1;
@@ -162,61 +213,40 @@ total_score(struct h_data *h, int max, int *score, int *maxscore)
 
 
 /**
-  Check for response from a user-defined heuristic / script
+  A heuristic ran past its maxtime
  */
-static int
-check_heuristic(struct h_data *h, int block, struct timespec *now)
+static void
+heuristic_timedout(struct h_data *h, struct timespec *now)
 {
-	int ret;
-	int status;
-
-	if (h->childpid == 0)
-		/* No child to check */
-		return 0;
-
-	ret = waitpid(h->childpid, &status, block?0:WNOHANG);
-	if (!block && ret == 0) {
-		/* No children exited */
-
-		/* no timeout */
-		if (!h->maxtime)
-			return 0;
+	if (!h->failed)
+		record_result(h, H_TIMEDOUT, now);
 
-		/* If we overran our timeout, the heuristic is dead */
-		if (now->tv_sec > h->failtime.tv_sec ||
-		    (now->tv_sec == h->failtime.tv_sec &&
-		     now->tv_nsec > h->failtime.tv_nsec)) {
-			h->misses = h->tko;
-			h->failed = ETIMEDOUT;
-			if (h->available) {
-				logt_print(LOG_INFO, "Heuristic: '%s' DOWN - "
-					"Exceeded timeout of %d seconds\n",
-					h->program, h->maxtime);
-				h->available = 0;
-			}
-		}
-
-		return 0;
+	h->misses = h->tko;
+	h->failed = ETIMEDOUT;
+	if (h->available) {
+		logt_print(LOG_INFO, "Heuristic: '%s' DOWN - "
+			"Exceeded timeout of %d seconds\n",
+			h->program, h->maxtime);
+		h->available = 0;
 	}
+}
 
-	h->childpid = 0;
-	if (ret < 0 && errno == ECHILD)
-		/* wrong child? */
-		goto miss;
 
+/**
+  Account for a finished run of a heuristic
+ */
+static void
+heuristic_done(struct h_data *h, int result, struct timespec *now)
+{
 	/* Timed out previously; this run must be ignored.  */
 	if (h->failed) {
 		h->failed = 0;
 		goto miss;
 	}
-	if (!WIFEXITED(status)) {
-		ret = 0;
-		goto miss;
-	}
-	if (WEXITSTATUS(status) != 0) {
-		ret = 0;
+
+	record_result(h, result, now);
+	if (result != H_OK)
 		goto miss;
-	}
 
 	/* Returned 0 and was not killed */
 	if (!h->available) {
@@ -224,7 +254,7 @@ check_heuristic(struct h_data *h, int block, struct timespec *now)
 		logt_print(LOG_INFO, "Heuristic: '%s' UP\n", h->program);
 	}
 	h->misses = 0;
-	return 0;
+	return;
 	
 miss:
 	if (h->available) {
@@ -240,8 +270,49 @@ miss:
 				h->program, h->misses, h->tko);
 		}
 	}
-	
-	return ret;
+}
+
+
+/**
+  Check for response from a user-defined heuristic / script
+ */
+static int
+check_heuristic(struct h_data *h, int block, struct timespec *now)
+{
+	int ret;
+	int status;
+
+	if (h->childpid == 0)
+		/* No child to check */
+		return 0;
+
+	ret = waitpid(h->childpid, &status, block?0:WNOHANG);
+	if (!block && ret == 0) {
+		/* No children exited */
+
+		/* no timeout */
+		if (!h->maxtime)
+			return 0;
+
+		/* If we overran our timeout, the heuristic is dead */
+		if (ts_cmp(now, &h->failtime) > 0)
+			heuristic_timedout(h, now);
+
+		return 0;
+	}
+
+	h->childpid = 0;
+	if (ret < 0 && errno == ECHILD) {
+		/* wrong child? */
+		heuristic_done(h, H_FAILED, now);
+		return ret;
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		heuristic_done(h, H_FAILED, now);
+	else
+		heuristic_done(h, H_OK, now);
+	return 0;
 }
 
 
@@ -277,6 +348,68 @@ check_heuristics(struct h_data *h, int max, int block)
 }
 
 
+/**
+  How often to run a heuristic for the given score.  A heuristic whose
+  loss would take us under the required score, or any heuristic while
+  we are already under it, runs every min_interval.  The rest run at
+  their configured interval, relaxed toward max_interval as the score
+  left over without them nears the most we could have.
+ */
+static int
+heuristic_interval(struct h_data *h, int score, int maxscore, int score_req)
+{
+	int slack, span;
+
+	if (score < score_req)
+		return h->min_interval;
+	if (!h->available)
+		return h->interval;
+
+	slack = score - h->score - score_req;
+	if (slack < 0)
+		return h->min_interval;
+
+	span = maxscore - h->score - score_req;
+	if (span <= 0)
+		return h->interval;
+
+	return h->interval + (h->max_interval - h->interval) * slack / span;
+}
+
+
+/**
+  Reschedule all heuristics after the score changed.  A run which is
+  now due sooner is brought forward; a longer interval applies from the
+  next run.
+ */
+static void
+adapt_intervals(struct h_data *h, int max, int score, int maxscore,
+		int score_req, struct timespec *now)
+{
+	int x, interval;
+
+	for (x = 0; x < max; x++) {
+		interval = heuristic_interval(&h[x], score, maxscore,
+					      score_req);
+		if (interval == h[x].cur_interval)
+			continue;
+
+		logt_print(LOG_DEBUG, "Heuristic: '%s' interval %d -> %d "
+			   "(score %d/%d, required %d)\n", h[x].program,
+			   h[x].cur_interval, interval, score, maxscore,
+			   score_req);
+		h[x].cur_interval = interval;
+
+		if (h[x].childpid)
+			continue;
+		if (h[x].nextrun.tv_sec > now->tv_sec + interval) {
+			h[x].nextrun.tv_sec = now->tv_sec + interval;
+			h[x].nextrun.tv_nsec = now->tv_nsec;
+		}
+	}
+}
+
+
 /*
  * absmax should be qdiskd (interval * (tko-1))
  */
@@ -325,6 +458,10 @@ configure_heuristics(int ccsfd, struct h_data *h, int max, int maxtime)
 		auto_heuristic_timing(&h[x].interval, &h[x].tko, maxtime);
 		h[x].maxtime = maxtime;
 		h[x].score = 1;
+		h[x].min_interval = 0;
+		h[x].max_interval = 0;
+		h[x].hist_next = 0;
+		h[x].hist_count = 0;
 		h[x].childpid = 0;
 		h[x].nextrun.tv_sec = 0;
 		h[x].nextrun.tv_nsec = 0;
@@ -359,6 +496,32 @@ configure_heuristics(int ccsfd, struct h_data *h, int max, int maxtime)
 				h[x].interval = 2;
 		}
 		
+		/* Get the bounds of the adaptive interval */
+		snprintf(query, sizeof(query),
+			 "/cluster/quorumd/heuristic[%d]/@min_interval", x+1);
+		if (ccs_get(ccsfd, query, &val) == 0) {
+			h[x].min_interval = atoi(val);
+			free(val);
+		}
+		if (h[x].min_interval <= 0)
+			h[x].min_interval = h[x].interval / 2;
+		if (h[x].min_interval <= 0)
+			h[x].min_interval = 1;
+		if (h[x].min_interval > h[x].interval)
+			h[x].min_interval = h[x].interval;
+
+		snprintf(query, sizeof(query),
+			 "/cluster/quorumd/heuristic[%d]/@max_interval", x+1);
+		if (ccs_get(ccsfd, query, &val) == 0) {
+			h[x].max_interval = atoi(val);
+			free(val);
+		}
+		if (h[x].max_interval <= 0)
+			h[x].max_interval = h[x].interval * 2;
+		if (h[x].max_interval < h[x].interval)
+			h[x].max_interval = h[x].interval;
+		h[x].cur_interval = h[x].interval;
+
 		/* Get tko for this heuristic */
 		snprintf(query, sizeof(query),
 			 "/cluster/quorumd/heuristic[%d]/@tko", x+1);
@@ -370,8 +533,9 @@ configure_heuristics(int ccsfd, struct h_data *h, int max, int maxtime)
 		}
 
 		logt_print(LOG_DEBUG,
-		       "Heuristic: '%s' score=%d interval=%d tko=%d\n",
-		       h[x].program, h[x].score, h[x].interval, h[x].tko);
+		       "Heuristic: '%s' score=%d interval=%d (%d-%d) tko=%d\n",
+		       h[x].program, h[x].score, h[x].interval,
+		       h[x].min_interval, h[x].max_interval, h[x].tko);
 
 	} while (++x < max);
 
@@ -410,6 +574,64 @@ fudge_scoring(void)
 }
 
 
+/**
+  Publish the score and a copy of the heuristics for the status file
+ */
+static void
+update_score(struct h_data *h, int max, int score, int maxscore)
+{
+	pthread_mutex_lock(&sc_lock);
+	_score = score;
+	_maxscore = maxscore;
+	if (_h_status) {
+		memcpy(_h_status, h, sizeof(struct h_data) * max);
+		_h_count = max;
+	}
+	pthread_mutex_unlock(&sc_lock);
+}
+
+
+/**
+  Print each heuristic's state and its last HEUR_HISTORY results
+ */
+void
+print_heuristic_status(FILE *fp)
+{
+	struct h_data *h;
+	int x, y, ok, failed, timedout, total, worst;
+
+	pthread_mutex_lock(&sc_lock);
+	for (x = 0; x < _h_count; x++) {
+		h = &_h_status[x];
+		ok = failed = timedout = total = worst = 0;
+		for (y = 0; y < h->hist_count; y++) {
+			switch (h->history[y].result) {
+			case H_OK:
+				ok++;
+				break;
+			case H_FAILED:
+				failed++;
+				break;
+			default:
+				timedout++;
+			}
+			total += h->history[y].latency;
+			if (h->history[y].latency > worst)
+				worst = h->history[y].latency;
+		}
+
+		fprintf(fp, "Heuristic: '%s' %s score=%d interval=%d (%d-%d)\n",
+			h->program, h->available ? "UP" : "DOWN", h->score,
+			h->cur_interval, h->min_interval, h->max_interval);
+		fprintf(fp, "    Last %d runs: %d ok, %d failed, %d timed out; "
+			"latency avg %dms max %dms\n", h->hist_count, ok,
+			failed, timedout, h->hist_count ?
+			total / h->hist_count : 0, worst);
+	}
+	pthread_mutex_unlock(&sc_lock);
+}
+
+
 /**
   Loop for the scoring thread.
  */
@@ -417,7 +639,8 @@ static void *
 score_thread_main(void *arg)
 {
 	struct h_arg *args = (struct h_arg *)arg;
-	int score, maxscore;
+	struct timespec now;
+	int score, maxscore, score_req, x, running;
 	
 	set_priority(args->sched_queue, args->sched_prio);
 
@@ -426,15 +649,32 @@ score_thread_main(void *arg)
 		check_heuristics(args->h, args->count, 0);
 		total_score(args->h, args->count, &score, &maxscore);
 
-		pthread_mutex_lock(&sc_lock);
-		_score = score;
-		_maxscore = maxscore;
-		pthread_mutex_unlock(&sc_lock);
+		score_req = args->ctx->qc_scoremin;
+		if (score_req <= 0)
+			score_req = (maxscore/2 + 1);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		adapt_intervals(args->h, args->count, score, maxscore,
+				score_req, &now);
+
+		update_score(args->h, args->count, score, maxscore);
+
+		/* Look more often while heuristics are running, so their
+		   latency is measured to better than a second */
+		running = 0;
+		for (x = 0; x < args->count; x++)
+			if (args->h[x].childpid)
+				running = 1;
 
 		if (_score_thread_running)
-			sleep(1);
+			usleep(running ? 100000 : 1000000);
 	}
 
+	pthread_mutex_lock(&sc_lock);
+	free(_h_status);
+	_h_status = NULL;
+	_h_count = 0;
+	pthread_mutex_unlock(&sc_lock);
+
 	free(args->h);
 	free(args);
 	logt_print(LOG_INFO, "Score thread going away\n");
@@ -466,8 +706,16 @@ start_score_thread(qd_ctx *ctx, struct h_data *h, int count)
 		return -1;
 	}
 
+	_h_status = malloc(sizeof(struct h_data) * count);
+	if (!_h_status) {
+		free(args->h);
+		free(args);
+		return -1;
+	}
+
 	memcpy(args->h, h, (sizeof(struct h_data) * count));
 	args->count = count;
+	args->ctx = ctx;
 	args->sched_queue = ctx->qc_sched;
 	args->sched_prio = ctx->qc_sched_prio;
 
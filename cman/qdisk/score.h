@@ -4,22 +4,42 @@
 #ifndef _SCORE_H
 #define _SCORE_H
 
+#include <stdio.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
 
+#define HEUR_HISTORY	16
+
+/* h_result result */
+#define H_OK		0
+#define H_FAILED	1
+#define H_TIMEDOUT	2
+
+struct h_result {
+	int	latency;	/* ms */
+	int	result;
+};
+
 struct h_data {
 	char *	program;
 	struct timespec nextrun;
 	struct timespec failtime;
+	struct timespec started;
 	int	score;
 	int	available;
 	int	tko;
 	int	interval;
+	int	min_interval;
+	int	max_interval;
+	int	cur_interval;
 	int	maxtime;
 	int	misses;
 	int	failed;
 	pid_t	childpid;
+	int	hist_next;
+	int	hist_count;
+	struct h_result history[HEUR_HISTORY];
 };
 
 /*
@@ -43,5 +63,10 @@ int get_my_score(int *score, int *maxscore);
  */
 int fudge_scoring(void);
 
+/*
+   Print each heuristic's state and recent results (for the status file)
+ */
+void print_heuristic_status(FILE *fp);
+
 
 #endif
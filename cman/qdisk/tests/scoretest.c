@@ -0,0 +1,245 @@
+/* Check how often qdiskd runs its heuristics as the score moves toward
+   and away from the required minimum.  The real scheduling, result and
+   scoring code from score.c is run against a virtual clock, and the
+   heuristics themselves are simulated: each one "runs" for a fixed
+   latency and then passes or fails as the test says. */
+
+#include "score.c"
+
+#define NHEUR		3
+#define STEP_MS		100
+#define LATENCY_MS	300
+
+/* qdiskd globals and ccs */
+
+void set_priority(int queue, int prio)
+{
+}
+
+void logt_print(int level, const char *fmt, ...)
+{
+}
+
+static const char *config[][2] = {
+	{ "/cluster/quorumd/heuristic[1]/@program", "h0" },
+	{ "/cluster/quorumd/heuristic[1]/@interval", "2" },
+	{ "/cluster/quorumd/heuristic[1]/@tko", "1" },
+	{ "/cluster/quorumd/heuristic[2]/@program", "h1" },
+	{ "/cluster/quorumd/heuristic[2]/@interval", "2" },
+	{ "/cluster/quorumd/heuristic[2]/@tko", "1" },
+	{ "/cluster/quorumd/heuristic[3]/@program", "h2" },
+	{ "/cluster/quorumd/heuristic[3]/@interval", "2" },
+	{ "/cluster/quorumd/heuristic[3]/@tko", "1" },
+	{ "/cluster/quorumd/heuristic[4]/@program", "slow" },
+	{ "/cluster/quorumd/heuristic[4]/@interval", "3" },
+	{ "/cluster/quorumd/heuristic[4]/@min_interval", "2" },
+	{ "/cluster/quorumd/heuristic[4]/@max_interval", "9" },
+	{ NULL, NULL }
+};
+
+int ccs_get(int desc, const char *query, char **rtn)
+{
+	int i;
+
+	for (i = 0; config[i][0]; i++) {
+		if (!strcmp(config[i][0], query)) {
+			*rtn = strdup(config[i][1]);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* simulated heuristics */
+
+static struct timespec now;
+static struct timespec done_at[NHEUR + 1];
+static int down[NHEUR + 1];
+static int latency[NHEUR + 1];
+static int runs[NHEUR + 1];
+static int failures;
+
+static void advance(int ms)
+{
+	now.tv_nsec += ms * 1000000L;
+	while (now.tv_nsec >= 1000000000L) {
+		now.tv_nsec -= 1000000000L;
+		now.tv_sec++;
+	}
+}
+
+/* One pass of score_thread_main, then STEP_MS of virtual time */
+static void step(struct h_data *h, int count, int scoremin)
+{
+	int x, score, maxscore, score_req;
+
+	for (x = 0; x < count; x++) {
+		if (h[x].childpid || !heuristic_due(&h[x], &now))
+			continue;
+		h[x].childpid = 1;
+		runs[x]++;
+		done_at[x] = now;
+		done_at[x].tv_sec += latency[x] / 1000;
+		done_at[x].tv_nsec += (latency[x] % 1000) * 1000000L;
+	}
+
+	for (x = 0; x < count; x++) {
+		if (!h[x].childpid)
+			continue;
+		if (ts_cmp(&now, &done_at[x]) >= 0) {
+			h[x].childpid = 0;
+			heuristic_done(&h[x], down[x] ? H_FAILED : H_OK, &now);
+		} else if (h[x].maxtime && ts_cmp(&now, &h[x].failtime) > 0) {
+			heuristic_timedout(&h[x], &now);
+		}
+	}
+
+	total_score(h, count, &score, &maxscore);
+	score_req = scoremin;
+	if (score_req <= 0)
+		score_req = (maxscore/2 + 1);
+	adapt_intervals(h, count, score, maxscore, score_req, &now);
+	update_score(h, count, score, maxscore);
+
+	advance(STEP_MS);
+}
+
+static void run_for(struct h_data *h, int count, int scoremin, int secs)
+{
+	int i;
+
+	for (i = 0; i < secs * 1000 / STEP_MS; i++)
+		step(h, count, scoremin);
+}
+
+/* Let the intervals settle, then count the runs in <secs> seconds and
+   compare with the interval each heuristic should be using */
+static void phase(const char *desc, struct h_data *h, int scoremin,
+		  int secs, const int *expect)
+{
+	int x, want;
+
+	run_for(h, NHEUR, scoremin, 10);
+	memset(runs, 0, sizeof(runs));
+	run_for(h, NHEUR, scoremin, secs);
+
+	for (x = 0; x < NHEUR; x++) {
+		want = secs / expect[x];
+		if (h[x].cur_interval != expect[x] ||
+		    runs[x] < want - 1 || runs[x] > want + 1) {
+			printf("FAIL %s: %s ran %d times in %ds at interval %d, "
+			       "expected %d at interval %d\n", desc,
+			       h[x].program, runs[x], secs, h[x].cur_interval,
+			       want, expect[x]);
+			failures++;
+		}
+	}
+	printf("%s: intervals %d %d %d\n", desc, h[0].cur_interval,
+	       h[1].cur_interval, h[2].cur_interval);
+}
+
+static void check(int cond, const char *what)
+{
+	if (!cond) {
+		printf("FAIL %s\n", what);
+		failures++;
+	}
+}
+
+static void check_status(const char *what)
+{
+	char buf[4096];
+	FILE *fp;
+	size_t len;
+
+	fp = tmpfile();
+	if (!fp) {
+		perror("tmpfile");
+		exit(1);
+	}
+	print_heuristic_status(fp);
+	rewind(fp);
+	len = fread(buf, 1, sizeof(buf) - 1, fp);
+	buf[len] = 0;
+	fclose(fp);
+
+	if (!strstr(buf, what)) {
+		printf("FAIL status file lacks \"%s\":\n%s", what, buf);
+		failures++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct h_data h[10];
+	int count, x;
+	static const int relaxed[NHEUR] = { 4, 4, 4 };
+	static const int one_down[NHEUR] = { 2, 2, 2 };
+	static const int critical[NHEUR] = { 2, 2, 1 };
+	static const int below[NHEUR] = { 1, 1, 1 };
+
+	memset(h, 0, sizeof(h));
+	count = configure_heuristics(0, h, 10, 10);
+	check(count == NHEUR + 1, "heuristics configured");
+	check(h[0].min_interval == 1 && h[0].max_interval == 4 &&
+	      h[0].cur_interval == 2, "default interval bounds");
+	check(h[3].min_interval == 2 && h[3].max_interval == 9,
+	      "configured interval bounds");
+
+	_h_status = malloc(sizeof(h));
+	now.tv_sec = 1000;
+	for (x = 0; x < NHEUR; x++)
+		latency[x] = LATENCY_MS;
+
+	/* Three heuristics of score 1 and a minimum of 1: losing any one
+	   still leaves us well above it */
+	phase("all up", h, 1, 60, relaxed);
+	check(h[2].hist_count == HEUR_HISTORY, "history fills");
+	for (x = 0; x < HEUR_HISTORY; x++)
+		check(h[2].history[x].result == H_OK &&
+		      h[2].history[x].latency == LATENCY_MS, "history results");
+	check_status("Heuristic: 'h2' UP score=1 interval=4 (1-4)");
+	check_status("16 ok, 0 failed, 0 timed out; latency avg 300ms");
+
+	/* Losing the next one would leave exactly the minimum */
+	down[0] = 1;
+	phase("h0 down", h, 1, 40, one_down);
+	check(!h[0].available, "h0 DOWN");
+	check_status("Heuristic: 'h0' DOWN score=1 interval=2");
+	check_status("0 ok, 16 failed");
+
+	/* h2 is all that keeps us above the minimum */
+	down[1] = 1;
+	phase("h0, h1 down", h, 1, 40, critical);
+
+	/* Below the minimum, everything is run as often as possible to
+	   find out when we can come back */
+	down[2] = 1;
+	phase("all down", h, 1, 40, below);
+
+	/* The default minimum (more than half of 3) leaves no room to relax */
+	memset(down, 0, sizeof(down));
+	phase("recovered, default minimum", h, 0, 40, one_down);
+
+	/* Heuristics taking longer than maxtime time out once per run, and
+	   the late exit is not counted again */
+	memset(&h[3].history, 0, sizeof(h[3].history));
+	h[3].hist_count = h[3].hist_next = 0;
+	h[3].available = 1;
+	h[3].maxtime = 2;
+	latency[3] = 2500;
+	run_for(h, NHEUR + 1, 0, 30);
+	check(!h[3].available, "slow heuristic DOWN");
+	check(h[3].hist_count > 0, "slow heuristic ran");
+	for (x = 0; x < h[3].hist_count; x++)
+		check(h[3].history[x].result == H_TIMEDOUT,
+		      "slow heuristic timed out");
+	check_status("timed out; latency avg 2");
+
+	if (failures) {
+		printf("%d failed\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
@@ -0,0 +1,193 @@
+/* Client request load generator.
+ *
+ * Opens a connection to cman's client socket and fires CMAN_CMD_ISQUORATE
+ * requests at it as fast as the daemon will answer them for a fixed amount
+ * of time, then prints the achieved request rate. With a pipeline depth
+ * of 1 this behaves like a libcman client (one request, wait for the
+ * reply); larger depths keep that many requests in flight at once.
+ *
+ * usage: cmanload [-d depth] [-t seconds] [-c connections]
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "cnxman-socket.h"
+
+static int depth = 1;
+static int seconds = 10;
+static int connections = 1;
+
+static int open_cman_socket(void)
+{
+	struct sockaddr_un sockaddr;
+	int fd;
+
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&sockaddr, 0, sizeof(sockaddr));
+	memcpy(sockaddr.sun_path, CLIENT_SOCKNAME, sizeof(CLIENT_SOCKNAME));
+	sockaddr.sun_family = AF_UNIX;
+	if (connect(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int read_all(int fd, char *buf, int len)
+{
+	int done = 0;
+	int ret;
+
+	while (done < len) {
+		ret = read(fd, buf + done, len - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		done += ret;
+	}
+	return 0;
+}
+
+/* Read one reply, skipping any events that get in the way */
+static int read_reply(int fd)
+{
+	char buf[MAX_CLUSTER_MESSAGE + sizeof(struct sock_header)];
+	struct sock_header *msg = (struct sock_header *)buf;
+
+	do {
+		if (read_all(fd, buf, sizeof(struct sock_header)))
+			return -1;
+		if (msg->length < sizeof(struct sock_header) ||
+		    msg->length > sizeof(buf))
+			return -1;
+		if (read_all(fd, buf + sizeof(struct sock_header),
+			     msg->length - sizeof(struct sock_header)))
+			return -1;
+	} while (!(msg->command & CMAN_CMDFLAG_REPLY));
+
+	return 0;
+}
+
+static unsigned long run_load(void)
+{
+	struct sock_header req[depth];
+	struct timeval start, now;
+	unsigned long count = 0;
+	int fd;
+	int i;
+
+	fd = open_cman_socket();
+	if (fd < 0) {
+		perror("Can't connect to cman");
+		exit(1);
+	}
+
+	for (i = 0; i < depth; i++) {
+		req[i].magic = CMAN_MAGIC;
+		req[i].version = CMAN_VERSION;
+		req[i].length = sizeof(struct sock_header);
+		req[i].command = CMAN_CMD_ISQUORATE;
+		req[i].flags = 0;
+	}
+
+	gettimeofday(&start, NULL);
+	do {
+		/* All the requests for this round go in a single write */
+		if (write(fd, req, sizeof(req)) != sizeof(req)) {
+			perror("write");
+			exit(1);
+		}
+		for (i = 0; i < depth; i++) {
+			if (read_reply(fd)) {
+				fprintf(stderr, "lost connection to cman\n");
+				exit(1);
+			}
+		}
+		count += depth;
+		gettimeofday(&now, NULL);
+	} while (now.tv_sec - start.tv_sec < seconds);
+
+	close(fd);
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timeval start, end;
+	unsigned long total = 0;
+	double elapsed;
+	int pipes[64][2];
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "d:t:c:h")) != EOF) {
+		switch (opt) {
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'c':
+			connections = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d depth] [-t seconds] [-c connections]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (depth < 1 || seconds < 1 || connections < 1 || connections > 64) {
+		fprintf(stderr, "depth and seconds must be positive, connections 1-64\n");
+		return 1;
+	}
+
+	printf("%d connection(s), pipeline depth %d, %d seconds\n",
+	       connections, depth, seconds);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < connections; i++) {
+		if (pipe(pipes[i])) {
+			perror("pipe");
+			return 1;
+		}
+		if (fork() == 0) {
+			unsigned long count = run_load();
+
+			write(pipes[i][1], &count, sizeof(count));
+			exit(0);
+		}
+		close(pipes[i][1]);
+	}
+
+	for (i = 0; i < connections; i++) {
+		unsigned long count;
+
+		if (read(pipes[i][0], &count, sizeof(count)) == sizeof(count))
+			total += count;
+		close(pipes[i][0]);
+	}
+	while (wait(NULL) > 0)
+		;
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		  (end.tv_usec - start.tv_usec) / 1000000.0;
+
+	printf("%lu requests in %.2f seconds, %.0f requests/sec\n",
+	       total, elapsed, total / elapsed);
+	return 0;
+}
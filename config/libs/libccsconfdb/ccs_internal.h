@@ -25,5 +25,7 @@ char *_ccs_get_fullxpath(confdb_handle_t handle, hdb_handle_t connection_handle,
 int xpathfull_init(confdb_handle_t handle)
     __attribute__ ((visibility("hidden")));
 void xpathfull_finish(void) __attribute__ ((visibility("hidden")));
+int xpathfull_update(confdb_handle_t handle, int config_version)
+    __attribute__ ((visibility("hidden")));
 
 #endif /*  __CCS_INTERNAL_DOT_H__ */
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
@@ -9,185 +10,111 @@
 #include "ccs.h"
 #include "ccs_internal.h"
 
-#ifndef XMLBUFSIZE
-#define XMLBUFSIZE 64000
-#endif
-
 int fullxpath = 0;
 
+/*
+ * One document is shared by all the fullxpath handles in the process.  It
+ * is built straight from the confdb objects the first time it's queried,
+ * and again on the first query after the config version changes.
+ */
 static xmlDocPtr doc = NULL;
 static xmlXPathContextPtr ctx = NULL;
+static int doc_version;
+static int doc_users;
 
-static int add_to_buffer(char *data, char **buffer, int *bufsize)
+static int add_objdb_node(confdb_handle_t handle, hdb_handle_t object_handle,
+			  xmlNodePtr node)
 {
-	int datalen = 0, bufferlen = 0;
-	char *newbuf = NULL;
-
-	datalen = strlen(data);
-	bufferlen = strlen(*buffer);
-
-	if (datalen) {
-		if ((bufferlen + datalen) >= *bufsize) {
-			newbuf = malloc((*bufsize * 2));
-			if (!newbuf) {
-				errno = ENOMEM;
-				return -1;
-			}
-			*bufsize = *bufsize * 2;
-			memset(newbuf, 0, *bufsize);
-			memcpy(newbuf, *buffer, bufferlen);
-			free(*buffer);
-			*buffer = newbuf;
-		}
-		strncpy(*buffer + bufferlen, data, datalen);
-	}
-	return 0;
-}
+	hdb_handle_t child_handle;
+	xmlNodePtr child;
+	char name[PATH_MAX];
+	char value[PATH_MAX];
+	size_t name_len = 0, value_len = 0;
 
-static int dump_objdb_buff(confdb_handle_t dump_handle, hdb_handle_t cluster_handle,
-			   hdb_handle_t parent_object_handle, char **buffer,
-			   int *bufsize)
-{
-	hdb_handle_t object_handle;
-	char temp[PATH_MAX];
-	char object_name[PATH_MAX];
-	char key_name[PATH_MAX];
-	char key_value[PATH_MAX];
-	size_t key_value_len = 0, key_name_len = 0, object_name_len = 0;
-	int res;
-
-	res = confdb_key_iter_start(dump_handle, parent_object_handle);
-	if (res != CS_OK) {
+	if (confdb_key_iter_start(handle, object_handle) != CS_OK) {
 		errno = ENOMEM;
 		return -1;
 	}
 
-	if (!*buffer || ((*buffer) && !strlen(*buffer))) {
-		snprintf(temp, PATH_MAX - 1,
-			 "<?xml version=\"1.0\"?>\n<cluster");
-		if (add_to_buffer(temp, buffer, bufsize))
-			return -1;
-	}
+	while (confdb_key_iter(handle, object_handle, name, &name_len,
+			       value, &value_len) == CS_OK) {
+		name[name_len] = '\0';
+		value[value_len] = '\0';
 
-	while ((res =
-		confdb_key_iter(dump_handle, parent_object_handle, key_name,
-				&key_name_len, key_value,
-				&key_value_len)) == CS_OK) {
-		key_name[key_name_len] = '\0';
-		key_value[key_value_len] = '\0';
-
-		snprintf(temp, PATH_MAX - 1, " %s=\"%s\"", key_name, key_value);
-		if (add_to_buffer(temp, buffer, bufsize))
-			return -1;
-	}
-
-	if (parent_object_handle > 0) {
-		snprintf(temp, PATH_MAX - 1, ">\n");
-		if (add_to_buffer(temp, buffer, bufsize))
+		if (!xmlNewProp(node, (xmlChar *) name, (xmlChar *) value)) {
+			errno = ENOMEM;
 			return -1;
+		}
 	}
 
-	res = confdb_object_iter_start(dump_handle, parent_object_handle);
-	if (res != CS_OK) {
+	if (confdb_object_iter_start(handle, object_handle) != CS_OK) {
 		errno = ENOMEM;
 		return -1;
 	}
 
-	while ((res =
-		confdb_object_iter(dump_handle, parent_object_handle,
-				   &object_handle, object_name,
-				   &object_name_len)) == CS_OK) {
-		hdb_handle_t parent;
-
-		res =
-		    confdb_object_parent_get(dump_handle, object_handle,
-					     &parent);
-		if (res != CS_OK) {
-			errno = EINVAL;
-			return -1;
-		}
-
-		object_name[object_name_len] = '\0';
+	while (confdb_object_iter(handle, object_handle, &child_handle,
+				  name, &name_len) == CS_OK) {
+		name[name_len] = '\0';
 
-		snprintf(temp, PATH_MAX - 1, "<%s", object_name);
-		if (add_to_buffer(temp, buffer, bufsize))
+		child = xmlNewChild(node, NULL, (xmlChar *) name, NULL);
+		if (!child) {
+			errno = ENOMEM;
 			return -1;
-
-		res =
-		    dump_objdb_buff(dump_handle, cluster_handle, object_handle, buffer,
-				    bufsize);
-		if (res) {
-			errno = res;
-			return res;
 		}
 
-		if (object_handle != parent_object_handle) {
-			snprintf(temp, PATH_MAX - 1, "</%s>\n", object_name);
-			if (add_to_buffer(temp, buffer, bufsize))
-				return -1;
-		} else {
-			snprintf(temp, PATH_MAX - 1, ">\n");
-			if (add_to_buffer(temp, buffer, bufsize))
-				return -1;
-		}
-	}
-
-	if (parent_object_handle == cluster_handle) {
-		snprintf(temp, PATH_MAX - 1, "</cluster>\n");
-		if (add_to_buffer(temp, buffer, bufsize))
+		if (add_objdb_node(handle, child_handle, child))
 			return -1;
 	}
 
 	return 0;
 }
 
-int xpathfull_init(confdb_handle_t handle)
+static int build_doc(confdb_handle_t handle)
 {
-	int size = XMLBUFSIZE;
-	char *buffer, *newbuf;
 	hdb_handle_t cluster_handle;
+	xmlNodePtr root;
 
-	newbuf = buffer = malloc(XMLBUFSIZE);
-	if (!buffer) {
+	if (confdb_object_find_start(handle, OBJECT_PARENT_HANDLE) != CS_OK) {
 		errno = ENOMEM;
-		goto fail;
+		return -1;
 	}
 
-	memset(buffer, 0, XMLBUFSIZE);
+	if (confdb_object_find(handle, OBJECT_PARENT_HANDLE, "cluster",
+			       strlen("cluster"), &cluster_handle) != CS_OK) {
+		errno = ENOENT;
+		return -1;
+	}
 
-	if (confdb_object_find_start(handle, OBJECT_PARENT_HANDLE) != CS_OK)
-		goto fail;
+	confdb_object_find_destroy(handle, OBJECT_PARENT_HANDLE);
 
-	if (confdb_object_find(handle, OBJECT_PARENT_HANDLE, "cluster", strlen("cluster"), &cluster_handle) != CS_OK)
+	doc = xmlNewDoc((xmlChar *) "1.0");
+	if (!doc)
 		goto fail;
 
-	if (dump_objdb_buff(handle, cluster_handle, cluster_handle, &newbuf, &size))
+	root = xmlNewNode(NULL, (xmlChar *) "cluster");
+	if (!root)
 		goto fail;
+	xmlDocSetRootElement(doc, root);
 
-	if (newbuf != buffer) {
-		buffer = newbuf;
-		newbuf = NULL;
-	}
-
-	doc = xmlParseMemory(buffer, strlen(buffer));
-	if (!doc)
+	if (add_objdb_node(handle, cluster_handle, root))
 		goto fail;
 
-	free(buffer);
-
 	ctx = xmlXPathNewContext(doc);
-	if (!ctx) {
-		xmlFreeDoc(doc);
+	if (!ctx)
 		goto fail;
-	}
 
 	return 0;
 
 fail:
+	if (doc) {
+		xmlFreeDoc(doc);
+		doc = NULL;
+	}
+	errno = ENOMEM;
 	return -1;
 }
 
-void xpathfull_finish()
+static void free_doc(void)
 {
 	if (ctx) {
 		xmlXPathFreeContext(ctx);
@@ -197,9 +124,40 @@ void xpathfull_finish()
 		xmlFreeDoc(doc);
 		doc = NULL;
 	}
+}
+
+/* called for every new fullxpath handle; the document isn't built
+   until it's needed */
+int xpathfull_init(confdb_handle_t handle)
+{
+	doc_users++;
+	return 0;
+}
+
+void xpathfull_finish()
+{
+	if (doc_users > 0)
+		doc_users--;
+	if (!doc_users)
+		free_doc();
 	return;
 }
 
+/* make sure the shared document matches config_version */
+int xpathfull_update(confdb_handle_t handle, int config_version)
+{
+	if (ctx && doc_version == config_version)
+		return 0;
+
+	free_doc();
+
+	if (build_doc(handle))
+		return -1;
+
+	doc_version = config_version;
+	return 0;
+}
+
 /**
  * _ccs_get_fullxpath
  * @desc:
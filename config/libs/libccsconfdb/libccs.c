@@ -195,18 +195,17 @@ static int config_reload(confdb_handle_t handle,
 	if (get_running_config_version(handle, &running_version) < 0)
 		return -1;
 
+	/* the fullxpath document is shared, only the first handle to
+	   notice a new version rebuilds it */
+	if (fullxpathint && xpathfull_update(handle, running_version))
+		return -1;
+
 	if (get_stored_config_version(handle, connection_handle, &stored_version) < 0)
 		return -1;
 
 	if (running_version == stored_version)
 		return 0;
 
-	if (fullxpathint) {
-		xpathfull_finish();
-		if (xpathfull_init(handle))
-			return -1;
-	}
-
 	reset_iterator(handle, connection_handle);
 
 	if (set_previous_query(handle, connection_handle, "", 0))
@@ -0,0 +1,543 @@
+/*
+ * Time config reloads with full xpath queries against a synthetic config
+ * of about 5000 elements.  confdb is replaced by an in-memory object tree,
+ * so this measures libccs and libxml2 only.
+ *
+ * usage: ccsbench [-n nodes] [-i iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <corosync/corotypes.h>
+#include <corosync/confdb.h>
+
+#include "ccs.h"
+
+/* The fake object database */
+
+struct fake_key {
+	char *name;
+	void *value;
+	size_t value_len;
+};
+
+struct fake_obj {
+	char name[64];
+	hdb_handle_t parent;
+	int first_child;
+	int last_child;
+	int next_sibling;
+	int find_pos;
+	int iter_pos;
+	int key_pos;
+	int key_count;
+	int key_max;
+	struct fake_key *keys;
+	int dead;
+};
+
+static struct fake_obj *objs;
+static int obj_count, obj_max;
+static struct fake_obj root = { .first_child = -1, .last_child = -1 };
+static unsigned long key_iter_starts;
+
+static struct fake_obj *get_obj(hdb_handle_t h)
+{
+	if (h == OBJECT_PARENT_HANDLE)
+		return &root;
+	if (h < 1 || h > obj_count || objs[h - 1].dead)
+		return NULL;
+	return &objs[h - 1];
+}
+
+static hdb_handle_t add_obj(hdb_handle_t parent, const char *name)
+{
+	struct fake_obj *p, *o;
+	int i;
+
+	if (obj_count == obj_max) {
+		obj_max = obj_max ? obj_max * 2 : 1024;
+		objs = realloc(objs, obj_max * sizeof(struct fake_obj));
+	}
+	p = get_obj(parent);
+	i = obj_count++;
+	o = &objs[i];
+	memset(o, 0, sizeof(*o));
+	strncpy(o->name, name, sizeof(o->name) - 1);
+	o->parent = parent;
+	o->first_child = -1;
+	o->last_child = -1;
+	o->next_sibling = -1;
+
+	if (p->last_child < 0)
+		p->first_child = i;
+	else
+		objs[p->last_child].next_sibling = i;
+	p->last_child = i;
+
+	return i + 1;
+}
+
+static struct fake_key *find_key(struct fake_obj *o, const void *name,
+				 size_t name_len)
+{
+	int i;
+
+	for (i = 0; i < o->key_count; i++) {
+		if (strlen(o->keys[i].name) == name_len &&
+		    !memcmp(o->keys[i].name, name, name_len))
+			return &o->keys[i];
+	}
+	return NULL;
+}
+
+static void set_key(hdb_handle_t h, const char *name, const void *value,
+		    size_t value_len)
+{
+	struct fake_obj *o = get_obj(h);
+	struct fake_key *k;
+
+	k = find_key(o, name, strlen(name));
+	if (!k) {
+		if (o->key_count == o->key_max) {
+			o->key_max = o->key_max ? o->key_max * 2 : 4;
+			o->keys = realloc(o->keys,
+					  o->key_max * sizeof(struct fake_key));
+		}
+		k = &o->keys[o->key_count++];
+		k->name = strdup(name);
+	} else
+		free(k->value);
+
+	k->value = malloc(value_len);
+	memcpy(k->value, value, value_len);
+	k->value_len = value_len;
+}
+
+static void set_str(hdb_handle_t h, const char *name, const char *value)
+{
+	set_key(h, name, value, strlen(value) + 1);
+}
+
+cs_error_t confdb_initialize(confdb_handle_t *handle,
+			     confdb_callbacks_t *callbacks)
+{
+	*handle = 1;
+	return CS_OK;
+}
+
+cs_error_t confdb_finalize(confdb_handle_t handle)
+{
+	return CS_OK;
+}
+
+cs_error_t confdb_object_create(confdb_handle_t handle,
+				hdb_handle_t parent_object_handle,
+				const void *object_name, size_t object_name_len,
+				hdb_handle_t *object_handle)
+{
+	char name[64];
+
+	memset(name, 0, sizeof(name));
+	memcpy(name, object_name, object_name_len);
+	*object_handle = add_obj(parent_object_handle, name);
+	return CS_OK;
+}
+
+cs_error_t confdb_object_destroy(confdb_handle_t handle,
+				 hdb_handle_t object_handle)
+{
+	struct fake_obj *o = get_obj(object_handle);
+
+	if (!o)
+		return CS_ERR_NOT_EXIST;
+	o->dead = 1;
+	return CS_OK;
+}
+
+cs_error_t confdb_object_parent_get(confdb_handle_t handle,
+				    hdb_handle_t object_handle,
+				    hdb_handle_t *parent_object_handle)
+{
+	struct fake_obj *o = get_obj(object_handle);
+
+	if (!o)
+		return CS_ERR_NOT_EXIST;
+	*parent_object_handle = o->parent;
+	return CS_OK;
+}
+
+cs_error_t confdb_key_create_typed(confdb_handle_t handle,
+				   hdb_handle_t parent_object_handle,
+				   const char *key_name, const void *value,
+				   size_t value_len, confdb_value_types_t type)
+{
+	if (!get_obj(parent_object_handle))
+		return CS_ERR_NOT_EXIST;
+	set_key(parent_object_handle, key_name, value, value_len);
+	return CS_OK;
+}
+
+cs_error_t confdb_key_delete(confdb_handle_t handle,
+			     hdb_handle_t parent_object_handle,
+			     const void *key_name, size_t key_name_len,
+			     const void *value, size_t value_len)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+	struct fake_key *k;
+
+	if (!o || !(k = find_key(o, key_name, key_name_len)))
+		return CS_ERR_NOT_EXIST;
+	free(k->name);
+	free(k->value);
+	*k = o->keys[--o->key_count];
+	return CS_OK;
+}
+
+cs_error_t confdb_key_get(confdb_handle_t handle,
+			  hdb_handle_t parent_object_handle,
+			  const void *key_name, size_t key_name_len,
+			  void *value, size_t *value_len)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+	struct fake_key *k;
+
+	if (!o || !(k = find_key(o, key_name, key_name_len)))
+		return CS_ERR_NOT_EXIST;
+	memcpy(value, k->value, k->value_len);
+	*value_len = k->value_len;
+	return CS_OK;
+}
+
+cs_error_t confdb_key_replace(confdb_handle_t handle,
+			      hdb_handle_t parent_object_handle,
+			      const void *key_name, size_t key_name_len,
+			      const void *old_value, size_t old_value_len,
+			      const void *new_value, size_t new_value_len)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+	struct fake_key *k;
+
+	if (!o || !(k = find_key(o, key_name, key_name_len)))
+		return CS_ERR_NOT_EXIST;
+	free(k->value);
+	k->value = malloc(new_value_len);
+	memcpy(k->value, new_value, new_value_len);
+	k->value_len = new_value_len;
+	return CS_OK;
+}
+
+cs_error_t confdb_key_increment(confdb_handle_t handle,
+				hdb_handle_t parent_object_handle,
+				const void *key_name, size_t key_name_len,
+				unsigned int *value)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+	struct fake_key *k;
+
+	if (!o || !(k = find_key(o, key_name, key_name_len)))
+		return CS_ERR_NOT_EXIST;
+	(*(unsigned int *)k->value)++;
+	*value = *(unsigned int *)k->value;
+	return CS_OK;
+}
+
+cs_error_t confdb_object_find_start(confdb_handle_t handle,
+				    hdb_handle_t parent_object_handle)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+
+	if (!o)
+		return CS_ERR_NOT_EXIST;
+	o->find_pos = o->first_child;
+	return CS_OK;
+}
+
+cs_error_t confdb_object_find(confdb_handle_t handle,
+			      hdb_handle_t parent_object_handle,
+			      const void *object_name, size_t object_name_len,
+			      hdb_handle_t *object_handle)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+	int i;
+
+	if (!o)
+		return CS_ERR_NOT_EXIST;
+
+	for (i = o->find_pos; i >= 0; i = objs[i].next_sibling) {
+		if (objs[i].dead)
+			continue;
+		if (strlen(objs[i].name) == object_name_len &&
+		    !memcmp(objs[i].name, object_name, object_name_len)) {
+			o->find_pos = objs[i].next_sibling;
+			*object_handle = i + 1;
+			return CS_OK;
+		}
+	}
+	o->find_pos = -1;
+	return CS_ERR_NOT_EXIST;
+}
+
+cs_error_t confdb_object_find_destroy(confdb_handle_t handle,
+				      hdb_handle_t parent_object_handle)
+{
+	return CS_OK;
+}
+
+cs_error_t confdb_object_iter_start(confdb_handle_t handle,
+				    hdb_handle_t parent_object_handle)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+
+	if (!o)
+		return CS_ERR_NOT_EXIST;
+	o->iter_pos = o->first_child;
+	return CS_OK;
+}
+
+cs_error_t confdb_object_iter(confdb_handle_t handle,
+			      hdb_handle_t parent_object_handle,
+			      hdb_handle_t *object_handle,
+			      void *object_name, size_t *object_name_len)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+	int i;
+
+	if (!o)
+		return CS_ERR_NOT_EXIST;
+
+	for (i = o->iter_pos; i >= 0 && objs[i].dead; i = objs[i].next_sibling)
+		;
+	if (i < 0)
+		return CS_ERR_NOT_EXIST;
+
+	o->iter_pos = objs[i].next_sibling;
+	*object_handle = i + 1;
+	*object_name_len = strlen(objs[i].name);
+	memcpy(object_name, objs[i].name, *object_name_len);
+	return CS_OK;
+}
+
+cs_error_t confdb_object_iter_destroy(confdb_handle_t handle,
+				      hdb_handle_t parent_object_handle)
+{
+	return CS_OK;
+}
+
+cs_error_t confdb_key_iter_start(confdb_handle_t handle,
+				 hdb_handle_t parent_object_handle)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+
+	if (!o)
+		return CS_ERR_NOT_EXIST;
+	o->key_pos = 0;
+	key_iter_starts++;
+	return CS_OK;
+}
+
+cs_error_t confdb_key_iter(confdb_handle_t handle,
+			   hdb_handle_t parent_object_handle,
+			   void *key_name, size_t *key_name_len,
+			   void *value, size_t *value_len)
+{
+	struct fake_obj *o = get_obj(parent_object_handle);
+	struct fake_key *k;
+
+	if (!o || o->key_pos >= o->key_count)
+		return CS_ERR_NOT_EXIST;
+
+	k = &o->keys[o->key_pos++];
+	*key_name_len = strlen(k->name);
+	memcpy(key_name, k->name, *key_name_len);
+	/* string values are stored with their nul */
+	*value_len = k->value_len;
+	if (*value_len && !((char *)k->value)[*value_len - 1])
+		(*value_len)--;
+	memcpy(value, k->value, *value_len);
+	return CS_OK;
+}
+
+/* The synthetic config */
+
+static hdb_handle_t cluster_handle;
+static int config_version;
+static int element_count;
+
+static hdb_handle_t add_element(hdb_handle_t parent, const char *name)
+{
+	element_count++;
+	return add_obj(parent, name);
+}
+
+static void build_config(int nodes)
+{
+	hdb_handle_t libccs, clusternodes, node, fence, method, device;
+	unsigned int zero = 0;
+	char buf[64];
+	int i;
+
+	libccs = add_obj(OBJECT_PARENT_HANDLE, "libccs");
+	set_key(libccs, "next_handle", &zero, sizeof(zero));
+
+	cluster_handle = add_element(OBJECT_PARENT_HANDLE, "cluster");
+	set_str(cluster_handle, "name", "bench");
+	set_str(cluster_handle, "config_version", "1");
+	config_version = 1;
+
+	clusternodes = add_element(cluster_handle, "clusternodes");
+
+	for (i = 1; i <= nodes; i++) {
+		node = add_element(clusternodes, "clusternode");
+		snprintf(buf, sizeof(buf), "node%d", i);
+		set_str(node, "name", buf);
+		snprintf(buf, sizeof(buf), "%d", i);
+		set_str(node, "nodeid", buf);
+
+		fence = add_element(node, "fence");
+		method = add_element(fence, "method");
+		set_str(method, "name", "1");
+		device = add_element(method, "device");
+		set_str(device, "name", "ipmi");
+		snprintf(buf, sizeof(buf), "10.1.%d.%d", i / 256, i % 256);
+		set_str(device, "ipaddr", buf);
+		/* would not survive being written out as text unescaped */
+		set_str(device, "passwd", "a&b<c\"d");
+	}
+}
+
+static void bump_version(void)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%d", ++config_version);
+	set_str(cluster_handle, "config_version", buf);
+}
+
+/* The benchmark */
+
+static int failed;
+
+static double now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void check(const char *desc, int ok)
+{
+	printf("%-48s %s\n", desc, ok ? "ok" : "FAIL");
+	if (!ok)
+		failed++;
+}
+
+static int query_is(int cd, const char *query, const char *want)
+{
+	char *str = NULL;
+	int ok;
+
+	if (ccs_get(cd, query, &str))
+		return 0;
+	ok = !strcmp(str, want);
+	free(str);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	char query[256], want[32];
+	double t, connect_ms = 0, reload_ms = 0, query_ms = 0, shared_ms = 0;
+	unsigned long before, rebuilt = 0, shared = 0;
+	int nodes = 1250, iterations = 20;
+	int cd1, cd2, i, opt;
+
+	while ((opt = getopt(argc, argv, "n:i:")) != EOF) {
+		switch (opt) {
+		case 'n':
+			nodes = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n nodes] [-i iterations]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	build_config(nodes);
+	fullxpath = 1;
+
+	t = now_ms();
+	cd1 = ccs_connect();
+	cd2 = ccs_connect();
+	connect_ms = now_ms() - t;
+	check("connect", cd1 >= 0 && cd2 >= 0);
+
+	snprintf(query, sizeof(query),
+		 "/cluster/clusternodes/clusternode[@name=\"node%d\"]/@nodeid",
+		 nodes);
+	snprintf(want, sizeof(want), "%d", nodes);
+
+	check("first query", query_is(cd1, query, want));
+	check("attribute with markup characters",
+	      query_is(cd1, "/cluster/clusternodes/clusternode[1]/fence/"
+		       "method/device/@passwd", "a&b<c\"d"));
+
+	for (i = 0; i < iterations; i++) {
+		bump_version();
+
+		/* the first query after the bump rebuilds the document */
+		before = key_iter_starts;
+		t = now_ms();
+		if (!query_is(cd1, query, want))
+			failed++;
+		reload_ms += now_ms() - t;
+		rebuilt += key_iter_starts - before;
+
+		/* the other handle shares it */
+		before = key_iter_starts;
+		t = now_ms();
+		if (!query_is(cd2, query, want))
+			failed++;
+		shared_ms += now_ms() - t;
+		shared += key_iter_starts - before;
+
+		t = now_ms();
+		if (!query_is(cd1, query, want))
+			failed++;
+		query_ms += now_ms() - t;
+	}
+
+	check("queries after reload", !failed);
+	check("document rebuilt once per version",
+	      rebuilt == (unsigned long)iterations * element_count);
+	check("document shared between handles", shared == 0);
+
+	ccs_disconnect(cd1);
+	check("query after other handle disconnected",
+	      query_is(cd2, query, want));
+	ccs_disconnect(cd2);
+
+	printf("%d elements, %d reloads\n", element_count, iterations);
+	printf("connect (2 handles)         %8.3f ms\n", connect_ms);
+	printf("reload + first query        %8.3f ms\n",
+	       reload_ms / iterations);
+	printf("first query, other handle   %8.3f ms\n",
+	       shared_ms / iterations);
+	printf("query, no reload            %8.3f ms\n",
+	       query_ms / iterations);
+
+	if (failed) {
+		printf("%d failed\n", failed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/poll.h>
 
 #include <linux/types.h>
 #include <linux/dlm.h>
@@ -19,12 +20,52 @@
 #include "libaislock.h"
 #include <linux/dlm_device.h>
 
+/* The astaddr of each request is one of these rather than a function;
+   saLckDispatch() uses it to tell what a completion is for.  The astparam
+   is the SaLckLockIdT, or the sa_resource for an anchor. */
+
 enum {
 	SA_LCK_GRANT_CB = 1,
 	SA_LCK_WAITER_CB = 2,
+	SA_LCK_ANCHOR_CB = 3,
+	SA_LCK_SYNC_CB = 4,
+};
+
+/* SaLckLockIdT unlock */
+
+enum {
+	SA_LCK_UNLOCK_ASYNC = 1,
+	SA_LCK_UNLOCK_SYNC = 2,
 };
 
 static struct dlm_ls_info *sa_default_ls = NULL;
+static int sa_fd = -1;
+
+/* Only one thread reads the device at a time, either in saLckDispatch()
+   or waiting for its own synchronous request. */
+
+static pthread_mutex_t reader_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reader_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t reader;
+static int reading;
+
+/* Open resources, by name.  Each holds an NL lock (its anchor) so the
+   dlm keeps the resource, and its master, while it is open; opening a
+   resource that is already open only takes a reference. */
+
+#define RES_HASH_SIZE	256
+
+struct sa_resource {
+	struct sa_resource	*next;
+	unsigned int		refs;
+	int			closing;
+	struct dlm_lksb		lksb;
+	SaUint16T		namelen;
+	unsigned char		name[DLM_RESNAME_MAXLEN];
+};
+
+static pthread_mutex_t res_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct sa_resource *res_hash[RES_HASH_SIZE];
 
 static inline int lkmode_ais2dlm(SaLckLockModeT mode)
 {
@@ -92,6 +133,237 @@ static inline SaErrorT lkerr_dlm2ais(int status)
 	}
 }
 
+static unsigned int res_hashfn(const unsigned char *name, int len)
+{
+	unsigned int h = 0;
+
+	while (len--)
+		h = h * 31 + *name++;
+	return h % RES_HASH_SIZE;
+}
+
+static struct sa_resource *res_find(const unsigned char *name, int len)
+{
+	struct sa_resource *res;
+
+	for (res = res_hash[res_hashfn(name, len)]; res; res = res->next) {
+		if (!res->closing && res->namelen == len &&
+		    !memcmp(res->name, name, len))
+			return res;
+	}
+	return NULL;
+}
+
+static void res_free(struct sa_resource *res)
+{
+	struct sa_resource **rp;
+
+	rp = &res_hash[res_hashfn(res->name, res->namelen)];
+	while (*rp != res)
+		rp = &(*rp)->next;
+	*rp = res->next;
+	free(res);
+}
+
+static void res_unanchor(struct sa_resource *res)
+{
+	if (dlm_ls_unlock(sa_default_ls, res->lksb.sb_lkid, 0, &res->lksb,
+			  res))
+		res_free(res);
+}
+
+/* Completion of an anchor request, called with res_mutex held */
+
+static void anchor_done(struct sa_resource *res)
+{
+	switch (res->lksb.sb_status) {
+	case 0:
+		if (res->closing)
+			res_unanchor(res);
+		break;
+	case EUNLOCK:
+		res_free(res);
+		break;
+	default:
+		/* the resource works without its anchor */
+		if (res->closing)
+			res_free(res);
+		else
+			res->lksb.sb_lkid = 0;
+	}
+}
+
+static void reader_get(void)
+{
+	pthread_mutex_lock(&reader_mutex);
+	while (reading)
+		pthread_cond_wait(&reader_cond, &reader_mutex);
+	reading = 1;
+	reader = pthread_self();
+	pthread_mutex_unlock(&reader_mutex);
+}
+
+static void reader_put(void)
+{
+	pthread_mutex_lock(&reader_mutex);
+	reading = 0;
+	pthread_cond_broadcast(&reader_cond);
+	pthread_mutex_unlock(&reader_mutex);
+}
+
+static int is_reader(void)
+{
+	int rv;
+
+	pthread_mutex_lock(&reader_mutex);
+	rv = reading && pthread_equal(reader, pthread_self());
+	pthread_mutex_unlock(&reader_mutex);
+	return rv;
+}
+
+static void deliver(const SaLckHandleT *lckHandle,
+		    struct dlm_lock_result *result)
+{
+	SaLckLockIdT *lkid = (SaLckLockIdT *)result->user_astparam;
+	long astaddr = (long)result->user_astaddr;
+	SaLckLockModeT lock_mode;
+	int unlock;
+
+	if (SA_LCK_WAITER_CB == astaddr) {
+		/* dispatch waiter ast */
+		if (lckHandle->callback.saLckLockWaiterCallback)
+			lckHandle->callback.
+				saLckLockWaiterCallback(
+					lkid->args, lkid->resource,
+					lkid, lkid->held_mode,
+					lkmode_dlm2ais(result->bast_mode));
+		return;
+	}
+
+	if (lkid->unlock) {
+		unlock = lkid->unlock;
+		lkid->unlock = 0;
+		lkid->held_mode = 0;
+
+		if (SA_LCK_UNLOCK_ASYNC == unlock) {
+			/* dispatch unlock ast */
+			if (lckHandle->callback.saLckResourceUnlockCallback)
+				lckHandle->callback.
+					saLckResourceUnlockCallback(
+						lkid->args, lkid->resource,
+						lkid, SA_LCK_LOCK_RELEASED,
+						SA_OK);
+			return;
+		}
+	} else if (SA_LCK_SYNC_CB == astaddr) {
+		if (0 == lkid->lksb.sb_status)
+			lkid->held_mode = lkid->requested_mode;
+	} else {
+		/* dispatch lock ast */
+		if (0 == lkid->lksb.sb_status) {
+			lkid->held_mode = lkid->requested_mode;
+			lock_mode = lkid->requested_mode;
+		} else {
+			lock_mode = lkid->held_mode;
+		}
+
+		if (lckHandle->callback.saLckLockGrantCallback)
+			lckHandle->callback.
+				saLckLockGrantCallback(
+					lkid->args, lkid->resource,
+					lkid, lock_mode,
+					lkstatus_dlm2ais(
+						lkid->lksb.sb_status),
+					SA_OK);
+		return;
+	}
+
+	/* a synchronous request is done, wake whoever waits for it */
+	pthread_mutex_lock(&reader_mutex);
+	pthread_cond_broadcast(&reader_cond);
+	pthread_mutex_unlock(&reader_mutex);
+}
+
+/* Read one completion from the device and deliver it.  Returns 0 when
+   there are none ready. */
+
+static int dispatch_one(const SaLckHandleT *lckHandle)
+{
+	char resultbuf[sizeof(struct dlm_lock_result) + DLM_USER_LVB_LEN];
+	struct dlm_lock_result *result = (struct dlm_lock_result *)resultbuf;
+	struct sa_resource *res;
+	int status;
+
+	status = read(sa_fd, resultbuf, sizeof(resultbuf));
+	if (status < (int)sizeof(struct dlm_lock_result))
+		return 0;
+
+	if (SA_LCK_ANCHOR_CB == (long)result->user_astaddr) {
+		res = result->user_astparam;
+		pthread_mutex_lock(&res_mutex);
+		res->lksb.sb_lkid = result->lksb.sb_lkid;
+		res->lksb.sb_status = -result->lksb.sb_status;
+		anchor_done(res);
+		pthread_mutex_unlock(&res_mutex);
+		return 1;
+	}
+
+	/* Copy lksb to user's buffer - except the LVB ptr */
+	memcpy(result->user_lksb, &result->lksb,
+	       sizeof(struct dlm_lksb) - sizeof(char*));
+
+	/* Flip the status. Kernel space likes negative return codes,
+	   userspace positive ones */
+	result->user_lksb->sb_status = -result->user_lksb->sb_status;
+
+	/* Need not to care LVB*/
+	deliver(lckHandle, result);
+	return 1;
+}
+
+/* Wait for a synchronous request to complete.  Its completion arrives
+   like any other: the thread reading the device (maybe in saLckDispatch)
+   delivers it and wakes us, or we read the device ourselves when no one
+   else is, delivering any other completions we find on the way. */
+
+static void sync_wait(const SaLckHandleT *lckHandle, SaLckLockIdT *lkid)
+{
+	struct pollfd pfd;
+
+	if (is_reader()) {
+		/* called from a callback */
+		while (lkid->lksb.sb_status == EINPROG) {
+			pfd.fd = sa_fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, -1) > 0)
+				dispatch_one(lckHandle);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&reader_mutex);
+	while (lkid->lksb.sb_status == EINPROG) {
+		if (reading) {
+			pthread_cond_wait(&reader_cond, &reader_mutex);
+			continue;
+		}
+		reading = 1;
+		reader = pthread_self();
+		pthread_mutex_unlock(&reader_mutex);
+
+		pfd.fd = sa_fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) > 0)
+			while (dispatch_one(lckHandle))
+				;
+
+		pthread_mutex_lock(&reader_mutex);
+		reading = 0;
+		pthread_cond_broadcast(&reader_cond);
+	}
+	pthread_mutex_unlock(&reader_mutex);
+}
+
 
 SaErrorT
 saLckInitialize(SaLckHandleT *lckHandle, const SaLckCallbacksT *lckCallbacks,
@@ -123,6 +395,10 @@ saLckInitialize(SaLckHandleT *lckHandle, const SaLckCallbacksT *lckCallbacks,
 		return SA_ERR_LIBRARY;
 
 	sa_default_ls = (struct dlm_ls_info *)ls;
+
+	/* completions are read until there are no more */
+	sa_fd = dlm_ls_get_fd(ls);
+	fcntl(sa_fd, F_SETFL, fcntl(sa_fd, F_GETFL, 0) | O_NONBLOCK);
 	return SA_OK;
 }
 
@@ -130,33 +406,77 @@ saLckInitialize(SaLckHandleT *lckHandle, const SaLckCallbacksT *lckCallbacks,
 SaErrorT
 saLckFinalize(SaLckHandleT *lckHandle)
 {
+	struct sa_resource *res;
+	int i;
+
 	if ( NULL == sa_default_ls ) {
 		return SA_ERR_LIBRARY;
 	}
 
-	if(!dlm_release_lockspace("sa_default", sa_default_ls, 1)) {
-		return SA_OK;
-	} else {
+	if(dlm_release_lockspace("sa_default", sa_default_ls, 1))
 		return SA_ERR_LIBRARY;
+
+	/* the anchors went with the lockspace */
+	pthread_mutex_lock(&res_mutex);
+	for (i = 0; i < RES_HASH_SIZE; i++) {
+		while ((res = res_hash[i])) {
+			res_hash[i] = res->next;
+			free(res);
+		}
 	}
+	pthread_mutex_unlock(&res_mutex);
+
+	sa_default_ls = NULL;
+	sa_fd = -1;
+	return SA_OK;
 }
 
 SaErrorT
 saLckResourceOpen(const SaLckHandleT *lckHandle, const SaNameT *lockName,
 		  SaLckResourceIdT *resourceId)
 {
+	struct sa_resource *res;
+	unsigned int h;
+
 	if ( NULL == sa_default_ls ) {
 		return SA_ERR_LIBRARY;
 	}
 
-	if (lockName->length <= 31 ) /* OpenDLM only support namelen <= 31*/
-	{
-		resourceId->name.length = lockName->length;
-		strncpy((char *)resourceId->name.value, (char *)lockName->value, lockName->length);
-	} else {
+	if (lockName->length > 31 ) /* OpenDLM only support namelen <= 31*/
 		return SA_ERR_NO_MEMORY;
+
+	pthread_mutex_lock(&res_mutex);
+	res = res_find(lockName->value, lockName->length);
+	if (res) {
+		res->refs++;
+		goto out;
 	}
 
+	res = malloc(sizeof(struct sa_resource));
+	if (!res) {
+		pthread_mutex_unlock(&res_mutex);
+		return SA_ERR_NO_MEMORY;
+	}
+	memset(res, 0, sizeof(struct sa_resource));
+	res->refs = 1;
+	res->namelen = lockName->length;
+	memcpy(res->name, lockName->value, lockName->length);
+
+	h = res_hashfn(res->name, res->namelen);
+	res->next = res_hash[h];
+	res_hash[h] = res;
+
+	/* nothing waits for the anchor, its completion is handled in
+	   saLckDispatch like any other */
+	if (dlm_ls_lock(sa_default_ls, DLM_LOCK_NL, &res->lksb, 0,
+			res->name, res->namelen, 0, (void *)SA_LCK_ANCHOR_CB,
+			res, NULL, NULL))
+		res->lksb.sb_lkid = 0;
+ out:
+	pthread_mutex_unlock(&res_mutex);
+
+	resourceId->name.length = lockName->length;
+	memcpy(resourceId->name.value, lockName->value, lockName->length);
 	return SA_OK;
 }
 
@@ -164,10 +484,31 @@ saLckResourceOpen(const SaLckHandleT *lckHandle, const SaNameT *lockName,
 SaErrorT
 saLckResourceClose(SaLckHandleT *lckHandle, SaLckResourceIdT *resourceId)
 {
+	struct sa_resource *res;
+
 	if ( NULL == sa_default_ls ) {
 		return SA_ERR_LIBRARY;
 	}
 
+	pthread_mutex_lock(&res_mutex);
+	res = res_find(resourceId->name.value, resourceId->name.length);
+	if (!res) {
+		pthread_mutex_unlock(&res_mutex);
+		return SA_ERR_NOT_EXIST;
+	}
+
+	if (--res->refs)
+		goto out;
+
+	/* Drop the anchor.  Until it's granted the unlock waits for
+	   anchor_done(); the entry is freed when the unlock completes. */
+	res->closing = 1;
+	if (!res->lksb.sb_lkid)
+		res_free(res);
+	else if (res->lksb.sb_status != EINPROG)
+		res_unanchor(res);
+ out:
+	pthread_mutex_unlock(&res_mutex);
 	return SA_OK;
 }
 
@@ -193,133 +534,46 @@ saLckSelectionObjectGet(const SaLckHandleT *lckHandle,
 }
 
 
+/* SA_DISPATCH_ALL delivers every completion that is ready, so many
+   requests submitted with SaLckResourceLockAsync() and
+   saLckResourceUnlockAsync() are handled with one wakeup.
+   SA_DISPATCH_BLOCKING waits for at least one, then does the same. */
+
 SaErrorT
 saLckDispatch(const SaLckHandleT *lckHandle,
 	      const SaDispatchFlagsT dispatchFlags)
 {
-	int status;
-	int fdflags;
-	char resultbuf[sizeof(struct dlm_lock_result)];
-	struct dlm_lock_result *result = (struct dlm_lock_result *)resultbuf;
-	char *fullresult=NULL;
-	SaLckLockIdT *lkid;
-	SaLckLockModeT lock_mode;
-	int fd = -1;
+	struct pollfd pfd;
 
 	if ( NULL == sa_default_ls ) {
 		return SA_ERR_LIBRARY;
 	}
 
-	fd = dlm_ls_get_fd(sa_default_ls);
-
-	if(!fd)
-		return SA_ERR_LIBRARY;
-
-	fdflags = fcntl(fd, F_GETFL, 0);
-	fcntl(fd, F_SETFL,  fdflags | O_NONBLOCK);
-
-	do
-	{
-
-		/* Just read the header first */
-		status = read(fd, result, sizeof(struct dlm_lock_result));
-		if (status <= 0)
-    			break;
-
-		if (result->length != status)
-		{
-        		int newstat;
-
-        		fullresult = malloc(result->length);
-        		if (!fullresult)
-            			break;
-
-        		newstat = read(fd, fullresult, result->length);
-
-			/* If it read OK then use the new data. otherwise we can
-			   still deliver the AST, it just might not have all the
-			   info in it...hmmm */
-			if (newstat == result->length)
-				result = (struct dlm_lock_result *)fullresult;
-		}
-
-		/* Copy lksb to user's buffer - except the LVB ptr */
-		memcpy(result->user_lksb, &result->lksb,
-		       sizeof(struct dlm_lksb) - sizeof(char*));
-
-		/* Flip the status. Kernel space likes negative return codes,
-		   userspace positive ones */
-		result->user_lksb->sb_status = -result->user_lksb->sb_status;
-
-		/* Need not to care LVB*/
-#ifdef QUERY
-		/* Copy optional items */
-		if (result->qinfo_offset)
-		{
-    			/* Just need the lockcount written out here */
-    			struct dlm_queryinfo *qi = (struct dlm_queryinfo *)
-				(fullresult+result->qinfo_offset);
-    			result->user_qinfo->gqi_lockcount = qi->gqi_lockcount;
-		}
-
-		if (result->qresinfo_offset)
-			memcpy(result->user_qinfo->gqi_resinfo,
-			       fullresult+result->qresinfo_offset,
-			       sizeof(struct dlm_resinfo));
+	switch (dispatchFlags) {
+	case SA_DISPATCH_ONE:
+		reader_get();
+		dispatch_one(lckHandle);
+		break;
 
-		if (result->qlockinfo_offset)
-			memcpy(result->user_qinfo->gqi_lockinfo,
-			       fullresult+result->qlockinfo_offset,
-			       sizeof(struct dlm_lockinfo) *
-			       result->user_qinfo->gqi_lockcount);
-#endif
- 		/* Call AST */
-		lkid = (SaLckLockIdT *)result->user_astparam;
-		if (lkid->unlock) {
-			/* dispatch unlock ast */
-			lkid->unlock = 0;
-			lkid->held_mode = 0;
-			if(lckHandle->callback.saLckResourceUnlockCallback)
-				lckHandle->callback.
-					saLckResourceUnlockCallback(
-						lkid->args, lkid->resource, lkid,
-						SA_LCK_LOCK_RELEASED, SA_OK);
-
-		} else if (SA_LCK_GRANT_CB == (int)result->user_astaddr) {
-			/* dispatch lock ast */
-			if (0 == lkid->lksb.sb_status) {
-				lkid->held_mode = lkid->requested_mode;
-				lock_mode = lkid->requested_mode;
-			} else {
-				lock_mode = lkid->held_mode;
-			}
-
-			if(lckHandle->callback.saLckLockGrantCallback)
-				lckHandle->callback.
-					saLckLockGrantCallback(
-						lkid->args, lkid->resource,
-						lkid, lock_mode,
-						lkstatus_dlm2ais(
-							lkid->lksb.sb_status),
-						SA_OK);
-		} else if (SA_LCK_WAITER_CB == (int)result->user_astaddr) {
-			/* dispatch waiter ast */
-			if(lckHandle->callback.saLckLockWaiterCallback)
-				lckHandle->callback.
-					saLckLockWaiterCallback(
-						lkid->args, lkid->resource,
-						lkid, lkid->held_mode, result->bast_mode);
-		} else {
+	case SA_DISPATCH_BLOCKING:
+		pfd.fd = sa_fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
 			return SA_ERR_LIBRARY;
-		}
-	} while (0 !=status && SA_DISPATCH_ONE != dispatchFlags);
+		/* fall through */
 
-	/* EAGAIN is not an error */
-	if (status < 0 && errno == EAGAIN)
-                status = 0;
+	case SA_DISPATCH_ALL:
+		reader_get();
+		while (dispatch_one(lckHandle))
+			;
+		break;
 
-	fcntl(fd, F_SETFL, fdflags);
-    	return SA_OK;
+	default:
+		return SA_ERR_INVALID_PARAM;
+	}
+
+	reader_put();
+	return SA_OK;
 }
 
 SaErrorT
@@ -338,8 +592,12 @@ SaLckResourceLockAsync(const SaLckHandleT *lckHandle, SaInvocationT invocation,
 	 */
 	lockId->resource = (SaLckResourceIdT *)resourceId;
 	lockId->requested_mode = lockMode;
+	lockId->unlock = 0;
 	lockId->args = invocation;
 
+	/* The request is written to the device and we return; any number
+	   can be outstanding, their completions come through saLckDispatch */
+
 	ret_val = dlm_ls_lock(sa_default_ls, lkmode_ais2dlm(lockMode),
 			      &(lockId->lksb), lkflag_ais2dlm(lockFlags),
 			      (void *)(resourceId->name.value),
@@ -364,18 +622,22 @@ saLckResourceLock(const SaLckHandleT *lckHandle, SaInvocationT invocation,
 
 	lockId->resource = (SaLckResourceIdT *)resourceId;
 	lockId->requested_mode = lockMode;
+	lockId->unlock = 0;
 	lockId->args = invocation;
 
-	ret_val = dlm_ls_lock_wait(sa_default_ls, lkmode_ais2dlm(lockMode),
-				   &(lockId->lksb), lkflag_ais2dlm(lockFlags),
-				   (void *)(resourceId->name.value),
-				   resourceId->name.length, 0, lockId,
-				   (void *)SA_LCK_WAITER_CB, NULL);
+	ret_val = dlm_ls_lock(sa_default_ls, lkmode_ais2dlm(lockMode),
+			      &(lockId->lksb), lkflag_ais2dlm(lockFlags),
+			      (void *)(resourceId->name.value),
+			      resourceId->name.length, 0, (void *)SA_LCK_SYNC_CB,
+			      lockId, (void *)SA_LCK_WAITER_CB, NULL);
+	if (ret_val)
+		return lkerr_dlm2ais(ret_val);
+
+	sync_wait(lckHandle, lockId);
 
 	*lockStatus = lkstatus_dlm2ais(lockId->lksb.sb_status);
-	lockId->held_mode = lockId->requested_mode;
 
-	return lkerr_dlm2ais(ret_val);
+	return SA_OK;
 }
 
 SaErrorT
@@ -388,11 +650,18 @@ saLckResourceUnlock(const SaLckHandleT *lckHandle, SaLckLockIdT *lockId,
 		return SA_ERR_LIBRARY;
 	}
 
-	ret_val = dlm_ls_unlock_wait(sa_default_ls, lockId->lksb.sb_lkid, 0,
-				     &(lockId->lksb));
-	lockId->held_mode = 0;
+	lockId->unlock = SA_LCK_UNLOCK_SYNC;
 
-	return lkerr_dlm2ais(ret_val);
+	ret_val = dlm_ls_unlock(sa_default_ls, lockId->lksb.sb_lkid, 0,
+				&(lockId->lksb), lockId);
+	if (ret_val) {
+		lockId->unlock = 0;
+		return lkerr_dlm2ais(ret_val);
+	}
+
+	sync_wait(lckHandle, lockId);
+
+	return SA_OK;
 }
 
 SaErrorT
@@ -405,12 +674,13 @@ saLckResourceUnlockAsync(const SaLckHandleT *lckHandle,
 		return SA_ERR_LIBRARY;
 	}
 
-	lockId->unlock = 1;
+	lockId->unlock = SA_LCK_UNLOCK_ASYNC;
 	lockId->args = invocation;
 
-
 	ret_val = dlm_ls_unlock(sa_default_ls, lockId->lksb.sb_lkid, 0, &(lockId->lksb),
 				lockId);
+	if (ret_val)
+		lockId->unlock = 0;
 
 	return lkerr_dlm2ais(ret_val);
 }
@@ -1,5 +1,6 @@
 #ifdef _REENTRANT
 #include <pthread.h>
+#include <sys/epoll.h>
 #endif
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -31,6 +32,12 @@
 #define DLM_CONTROL_PATH	MISC_PREFIX DLM_CONTROL_NAME
 #define DEFAULT_LOCKSPACE	"default"
 
+/* Results one read() of the lockspace device can return; one of them
+   may have an lvb */
+#define RESULTS_MAX		32
+#define RESULTS_BUF_LEN		(RESULTS_MAX * sizeof(struct dlm_lock_result) + \
+				 DLM_USER_LVB_LEN)
+
 /*
  * V5 of the dlm_device.h kernel/user interface structs
  */
@@ -82,10 +89,18 @@ struct dlm_lock_result_v5 {
 struct dlm_ls_info {
     int fd;
 #ifdef _REENTRANT
-    pthread_t tid;
+    pthread_t tid;	/* the shared dispatcher's if shared is set */
+    int shared;
+    int read_inline;	/* by a sync call in the shared dispatcher */
+    struct dlm_ls_info *removed_next;
 #else
     int tid;
 #endif
+    /* Results read for dlm_ls_dispatch_results() that didn't fit in the
+       caller's array, returned by its next call */
+    struct dlm_ast_result pending[RESULTS_MAX];
+    int pending_first;
+    int pending_count;
 };
 
 /*
@@ -102,6 +117,9 @@ static int kernel_version_detected = 0;
 
 
 static int release_lockspace(uint32_t minor, uint32_t flags);
+#ifdef _REENTRANT
+static int dispatcher_remove(struct dlm_ls_info *lsinfo);
+#endif
 
 
 static void ls_dev_name(const char *lsname, char *devname, int devlen)
@@ -114,23 +132,73 @@ static void dummy_ast_routine(void *arg)
 }
 
 #ifdef _REENTRANT
-/* Used for the synchronous and "simplified, synchronous" API routines */
+/* Used for the synchronous and "simplified, synchronous" API routines.
+ * Each thread has one, made the first time it waits and kept until it
+ * exits.
+ */
 struct lock_wait
 {
     pthread_cond_t  cond;
     pthread_mutex_t mutex;
+    int             done;
     struct dlm_lksb lksb;
 };
 
+static pthread_key_t lock_wait_key;
+static pthread_once_t lock_wait_once = PTHREAD_ONCE_INIT;
+
+static void free_lock_wait(void *arg)
+{
+    struct lock_wait *lwait = arg;
+
+    pthread_cond_destroy(&lwait->cond);
+    pthread_mutex_destroy(&lwait->mutex);
+    free(lwait);
+}
+
+static void make_lock_wait_key(void)
+{
+    pthread_key_create(&lock_wait_key, free_lock_wait);
+}
+
+static struct lock_wait *get_lock_wait(void)
+{
+    struct lock_wait *lwait;
+
+    pthread_once(&lock_wait_once, make_lock_wait_key);
+
+    lwait = pthread_getspecific(lock_wait_key);
+    if (lwait)
+	return lwait;
+
+    lwait = malloc(sizeof(struct lock_wait));
+    if (!lwait)
+	return NULL;
+
+    pthread_cond_init(&lwait->cond, NULL);
+    pthread_mutex_init(&lwait->mutex, NULL);
+    pthread_setspecific(lock_wait_key, lwait);
+    return lwait;
+}
+
 static void sync_ast_routine(void *arg)
 {
     struct lock_wait *lwait = arg;
 
     pthread_mutex_lock(&lwait->mutex);
+    lwait->done = 1;
     pthread_cond_signal(&lwait->cond);
     pthread_mutex_unlock(&lwait->mutex);
 }
 
+/* Called with lwait->mutex held, returns with it released */
+static void wait_sync_ast(struct lock_wait *lwait)
+{
+    while (!lwait->done)
+	pthread_cond_wait(&lwait->cond, &lwait->mutex);
+    pthread_mutex_unlock(&lwait->mutex);
+}
+
 /* lock_resource & unlock_resource
  * are the simplified, synchronous API.
  * Aways uses the default lockspace.
@@ -138,7 +206,7 @@ static void sync_ast_routine(void *arg)
 int lock_resource(const char *resource, int mode, int flags, int *lockid)
 {
     int status;
-    struct lock_wait lwait;
+    struct lock_wait *lwait;
 
     if (default_ls == NULL)
     {
@@ -154,35 +222,42 @@ int lock_resource(const char *resource, int mode, int flags, int *lockid)
 	return -1;
     }
 
+    lwait = get_lock_wait();
+    if (!lwait)
+	return -1;
+
+    memset(&lwait->lksb, 0, sizeof(lwait->lksb));
+
     /* Conversions need the lockid in the LKSB */
     if (flags & LKF_CONVERT)
-	lwait.lksb.sb_lkid = *lockid;
+	lwait->lksb.sb_lkid = *lockid;
 
-    pthread_cond_init(&lwait.cond, NULL);
-    pthread_mutex_init(&lwait.mutex, NULL);
-    pthread_mutex_lock(&lwait.mutex);
+    pthread_mutex_lock(&lwait->mutex);
+    lwait->done = 0;
 
     status = dlm_lock(mode,
-		      &lwait.lksb,
+		      &lwait->lksb,
 		      flags,
 		      resource,
 		      strlen(resource),
 		      0,
 		      sync_ast_routine,
-		      &lwait,
+		      lwait,
 		      NULL,
 		      NULL);
     if (status)
+    {
+	pthread_mutex_unlock(&lwait->mutex);
 	return status;
+    }
 
     /* Wait for it to complete */
-    pthread_cond_wait(&lwait.cond, &lwait.mutex);
-    pthread_mutex_unlock(&lwait.mutex);
+    wait_sync_ast(lwait);
 
-    *lockid = lwait.lksb.sb_lkid;
+    *lockid = lwait->lksb.sb_lkid;
 
-    errno = lwait.lksb.sb_status;
-    if (lwait.lksb.sb_status)
+    errno = lwait->lksb.sb_status;
+    if (lwait->lksb.sb_status)
 	return -1;
     else
 	return 0;
@@ -192,7 +267,7 @@ int lock_resource(const char *resource, int mode, int flags, int *lockid)
 int unlock_resource(int lockid)
 {
     int status;
-    struct lock_wait lwait;
+    struct lock_wait *lwait;
 
     if (default_ls == NULL)
     {
@@ -200,21 +275,26 @@ int unlock_resource(int lockid)
 	return -1;
     }
 
-    pthread_cond_init(&lwait.cond, NULL);
-    pthread_mutex_init(&lwait.mutex, NULL);
-    pthread_mutex_lock(&lwait.mutex);
+    lwait = get_lock_wait();
+    if (!lwait)
+	return -1;
+
+    pthread_mutex_lock(&lwait->mutex);
+    lwait->done = 0;
 
-    status = dlm_unlock(lockid, 0, &lwait.lksb, &lwait);
+    status = dlm_unlock(lockid, 0, &lwait->lksb, lwait);
 
     if (status)
+    {
+	pthread_mutex_unlock(&lwait->mutex);
 	return status;
+    }
 
     /* Wait for it to complete */
-    pthread_cond_wait(&lwait.cond, &lwait.mutex);
-    pthread_mutex_unlock(&lwait.mutex);
+    wait_sync_ast(lwait);
 
-    errno = lwait.lksb.sb_status;
-    if (lwait.lksb.sb_status != DLM_EUNLOCK)
+    errno = lwait->lksb.sb_status;
+    if (lwait->lksb.sb_status != DLM_EUNLOCK)
 	return -1;
     else
 	return 0;
@@ -226,6 +306,9 @@ static int ls_pthread_cleanup(struct dlm_ls_info *lsinfo)
     int status = 0;
     int fd;
 
+    if (lsinfo->shared)
+	return dispatcher_remove(lsinfo);
+
     /* Must close the fd after the thread has finished */
     fd = lsinfo->fd;
     if (lsinfo->tid)
@@ -519,17 +602,14 @@ static int do_dlm_dispatch_v5(int fd)
 	return 0;
 }
 
-static int do_dlm_dispatch_v6(int fd)
+/* Copy a result to the user's lksb, then call its AST or, if out isn't
+   NULL, return it there instead */
+
+static void deliver_result_v6(struct dlm_lock_result *result,
+			      struct dlm_ast_result *out)
 {
-	char resultbuf[sizeof(struct dlm_lock_result) + DLM_USER_LVB_LEN];
-	struct dlm_lock_result *result = (struct dlm_lock_result *)resultbuf;
-	int status;
 	void (*astaddr)(void *astarg);
 
-	status = read(fd, result, sizeof(resultbuf));
-	if (status <= 0)
-		return -1;
-
 	/* Copy lksb to user's buffer - except the LVB ptr */
 	memcpy(result->user_lksb, &result->lksb,
 	       sizeof(struct dlm_lksb) - sizeof(char*));
@@ -541,11 +621,56 @@ static int do_dlm_dispatch_v6(int fd)
 
 	result->user_lksb->sb_status = -result->user_lksb->sb_status;
 
+	if (out) {
+		out->astaddr = result->user_astaddr;
+		out->astarg = result->user_astparam;
+		out->lksb = result->user_lksb;
+		out->bast_mode = result->bast_mode;
+		return;
+	}
+
 	if (result->user_astaddr) {
 		astaddr = result->user_astaddr;
 		astaddr(result->user_astparam);
 	}
+}
 
+/* One read() of the device.  The dlm device returns a single result per
+   read, but the buffer has room for RESULTS_MAX of them one after another,
+   for devices that return more.  Results are delivered as above; returns
+   how many there were, or -1 if the read failed. */
+
+static int read_results_v6(int fd, struct dlm_ast_result *out)
+{
+	char resultbuf[RESULTS_BUF_LEN];
+	struct dlm_lock_result *result;
+	int status, offset = 0, count = 0;
+
+	status = read(fd, resultbuf, sizeof(resultbuf));
+	if (status <= 0)
+		return -1;
+
+	while (status - offset >= (int)sizeof(struct dlm_lock_result) &&
+	       count < RESULTS_MAX) {
+		result = (struct dlm_lock_result *)(resultbuf + offset);
+
+		/* a length we can't use, take what's left as one result */
+		if (result->length < sizeof(struct dlm_lock_result) ||
+		    result->length > status - offset)
+			result->length = status - offset;
+
+		deliver_result_v6(result, out ? &out[count] : NULL);
+		offset += result->length;
+		count++;
+	}
+
+	return count;
+}
+
+static int do_dlm_dispatch_v6(int fd)
+{
+	if (read_results_v6(fd, NULL) < 0)
+		return -1;
 	return 0;
 }
 
@@ -571,7 +696,7 @@ static int do_dlm_dispatch(int fd)
 static int sync_write_v5(struct dlm_ls_info *lsinfo,
 			 struct dlm_write_request_v5 *req, int len)
 {
-	struct lock_wait lwait;
+	struct lock_wait *lwait;
 	int status;
 
 	if (pthread_self() == lsinfo->tid) {
@@ -586,20 +711,28 @@ static int sync_write_v5(struct dlm_ls_info *lsinfo,
 		while (req->i.lock.lksb->sb_status == EINPROG) {
 			do_dlm_dispatch_v5(lsinfo->fd);
 		}
+
+		/* results the dispatcher was told of may have gone */
+		if (lsinfo->shared)
+			lsinfo->read_inline = 1;
 	} else {
-		pthread_cond_init(&lwait.cond, NULL);
-		pthread_mutex_init(&lwait.mutex, NULL);
-		pthread_mutex_lock(&lwait.mutex);
+		lwait = get_lock_wait();
+		if (!lwait)
+			return -1;
+
+		pthread_mutex_lock(&lwait->mutex);
+		lwait->done = 0;
 
 		req->i.lock.castaddr  = sync_ast_routine;
-		req->i.lock.castparam = &lwait;
+		req->i.lock.castparam = lwait;
 
 		status = write(lsinfo->fd, req, len);
-		if (status < 0)
+		if (status < 0) {
+			pthread_mutex_unlock(&lwait->mutex);
 			return -1;
+		}
 
-		pthread_cond_wait(&lwait.cond, &lwait.mutex);
-		pthread_mutex_unlock(&lwait.mutex);
+		wait_sync_ast(lwait);
 	}
 
 	return status; /* lock status is in the lksb */
@@ -608,7 +741,7 @@ static int sync_write_v5(struct dlm_ls_info *lsinfo,
 static int sync_write_v6(struct dlm_ls_info *lsinfo,
 			 struct dlm_write_request *req, int len)
 {
-	struct lock_wait lwait;
+	struct lock_wait *lwait;
 	int status;
 
 	if (pthread_self() == lsinfo->tid) {
@@ -623,20 +756,28 @@ static int sync_write_v6(struct dlm_ls_info *lsinfo,
 		while (req->i.lock.lksb->sb_status == EINPROG) {
 			do_dlm_dispatch_v6(lsinfo->fd);
 		}
+
+		/* results the dispatcher was told of may have gone */
+		if (lsinfo->shared)
+			lsinfo->read_inline = 1;
 	} else {
-		pthread_cond_init(&lwait.cond, NULL);
-		pthread_mutex_init(&lwait.mutex, NULL);
-		pthread_mutex_lock(&lwait.mutex);
+		lwait = get_lock_wait();
+		if (!lwait)
+			return -1;
+
+		pthread_mutex_lock(&lwait->mutex);
+		lwait->done = 0;
 
 		req->i.lock.castaddr  = sync_ast_routine;
-		req->i.lock.castparam = &lwait;
+		req->i.lock.castparam = lwait;
 
 		status = write(lsinfo->fd, req, len);
-		if (status < 0)
+		if (status < 0) {
+			pthread_mutex_unlock(&lwait->mutex);
 			return -1;
+		}
 
-		pthread_cond_wait(&lwait.cond, &lwait.mutex);
-		pthread_mutex_unlock(&lwait.mutex);
+		wait_sync_ast(lwait);
 	}
 
 	return status; /* lock status is in the lksb */
@@ -762,25 +903,21 @@ static int ls_lock_v5(dlm_lshandle_t ls,
 	return 0;
 }
 
-static int ls_lock_v6(dlm_lshandle_t ls,
-		uint32_t mode,
-		struct dlm_lksb *lksb,
-		uint32_t flags,
-		const void *name,
-		unsigned int namelen,
-		uint32_t parent,
-		void (*astaddr) (void *astarg),
-		void *astarg,
-		void (*bastaddr) (void *astarg),
-		uint64_t *xid,
-		uint64_t *timeout)
+/* Fill in a lock request, returning its length or -1 */
+
+static int build_lock_v6(struct dlm_write_request *req,
+			 uint32_t mode,
+			 struct dlm_lksb *lksb,
+			 uint32_t flags,
+			 const void *name,
+			 unsigned int namelen,
+			 uint32_t parent,
+			 void (*astaddr) (void *astarg),
+			 void *astarg,
+			 void (*bastaddr) (void *astarg),
+			 uint64_t *xid,
+			 uint64_t *timeout)
 {
-	char parambuf[sizeof(struct dlm_write_request) + DLM_RESNAME_MAXLEN];
-	struct dlm_write_request *req = (struct dlm_write_request *)parambuf;
-	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
-	int status;
-	int len;
-
 	memset(req, 0, sizeof(*req));
 	set_version_v6(req);
 
@@ -815,7 +952,34 @@ static int ls_lock_v6(dlm_lshandle_t ls,
 		memcpy(req->i.lock.lvb, lksb->sb_lvbptr, DLM_LVB_LEN);
 	}
 
-	len = sizeof(struct dlm_write_request) + namelen;
+	/* no name follows a convert */
+	return sizeof(struct dlm_write_request) + req->i.lock.namelen;
+}
+
+static int ls_lock_v6(dlm_lshandle_t ls,
+		uint32_t mode,
+		struct dlm_lksb *lksb,
+		uint32_t flags,
+		const void *name,
+		unsigned int namelen,
+		uint32_t parent,
+		void (*astaddr) (void *astarg),
+		void *astarg,
+		void (*bastaddr) (void *astarg),
+		uint64_t *xid,
+		uint64_t *timeout)
+{
+	char parambuf[sizeof(struct dlm_write_request) + DLM_RESNAME_MAXLEN];
+	struct dlm_write_request *req = (struct dlm_write_request *)parambuf;
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+	int status;
+	int len;
+
+	len = build_lock_v6(req, mode, lksb, flags, name, namelen, parent,
+			    astaddr, astarg, bastaddr, xid, timeout);
+	if (len < 0)
+		return -1;
+
 	lksb->sb_status = EINPROG;
 
 	if (flags & LKF_WAIT)
@@ -891,6 +1055,71 @@ int dlm_ls_lockx(dlm_lshandle_t ls,
 			  astaddr, astarg, bastaddr, xid, timeout);
 }
 
+/*
+ * Async locking of many locks in own lockspace.  Each request is as for
+ * dlm_ls_lock().  They're all checked before any is sent, then written
+ * to the device one after another, built in the same buffer.
+ */
+int dlm_ls_lock_batch(dlm_lshandle_t ls,
+		      struct dlm_lock_req *reqs,
+		      int count)
+{
+	char parambuf[sizeof(struct dlm_write_request) + DLM_RESNAME_MAXLEN];
+	struct dlm_write_request *req = (struct dlm_write_request *)parambuf;
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+	struct dlm_lock_req *r;
+	int i, len, status;
+
+	if (kernel_version.version[0] < 6) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	if (ls == NULL) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	if (count <= 0) {
+		if (!count)
+			return 0;
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* check them all before any are sent */
+	for (i = 0; i < count; i++) {
+		r = &reqs[i];
+		if ((r->flags & LKF_WAIT) ||
+		    (r->flags & LKF_VALBLK && !r->lksb->sb_lvbptr) ||
+		    (!(r->flags & LKF_CONVERT) &&
+		     r->namelen > DLM_RESNAME_MAXLEN)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		r = &reqs[i];
+		len = build_lock_v6(req, r->mode, r->lksb, r->flags,
+				    r->name, r->namelen, r->parent,
+				    r->astaddr, r->astarg, r->bastaddr,
+				    NULL, NULL);
+		r->lksb->sb_status = EINPROG;
+
+		status = write(lsinfo->fd, req, len);
+		if (status < 0)
+			break;
+
+		/* the lock id is the return value from the write */
+		if (status > 0)
+			r->lksb->sb_lkid = status;
+	}
+
+	/* the caller finds out which were sent from the count */
+	return i ? i : -1;
+}
+
 /*
  * Async locking in own lockspace
  */
@@ -1149,7 +1378,8 @@ int dlm_dispatch(int fd)
     int fdflags;
 
     fdflags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL,  fdflags | O_NONBLOCK);
+    if (!(fdflags & O_NONBLOCK))
+	fcntl(fd, F_SETFL,  fdflags | O_NONBLOCK);
     do
     {
 	status = do_dlm_dispatch(fd);
@@ -1159,10 +1389,80 @@ int dlm_dispatch(int fd)
     if (status < 0 && errno == EAGAIN)
 	status = 0;
 
-    fcntl(fd, F_SETFL, fdflags);
+    if (!(fdflags & O_NONBLOCK))
+	fcntl(fd, F_SETFL, fdflags);
     return status;
 }
 
+/* Like dlm_dispatch() for a lockspace, but instead of calling the ASTs,
+ * the results (up to max of them) are returned to the caller, who calls
+ * them or not.  Results read beyond max are kept for the next call.
+ * Returns the number of results, 0 if there are none waiting.
+ */
+int dlm_ls_dispatch_results(dlm_lshandle_t ls, struct dlm_ast_result *results,
+			    int max)
+{
+    struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+    struct dlm_ast_result *out;
+    int status = 0;
+    int fdflags;
+    int n = 0;
+
+    if (kernel_version.version[0] < 6)
+    {
+	errno = ENOSYS;
+	return -1;
+    }
+
+    if (max < 0)
+    {
+	errno = EINVAL;
+	return -1;
+    }
+
+    fdflags = fcntl(lsinfo->fd, F_GETFL, 0);
+    if (!(fdflags & O_NONBLOCK))
+	fcntl(lsinfo->fd, F_SETFL,  fdflags | O_NONBLOCK);
+
+    for (;;)
+    {
+	while (lsinfo->pending_count && n < max)
+	{
+	    results[n++] = lsinfo->pending[lsinfo->pending_first++];
+	    lsinfo->pending_count--;
+	}
+	if (n == max)
+	    break;
+
+	/* Read straight into the caller's array when everything a read
+	   can return will fit */
+	if (max - n >= RESULTS_MAX)
+	    out = &results[n];
+	else
+	    out = lsinfo->pending;
+
+	status = read_results_v6(lsinfo->fd, out);
+	if (status < 0)
+	    break;
+
+	if (out == lsinfo->pending)
+	{
+	    lsinfo->pending_first = 0;
+	    lsinfo->pending_count = status;
+	}
+	else
+	    n += status;
+    }
+
+    if (!(fdflags & O_NONBLOCK))
+	fcntl(lsinfo->fd, F_SETFL, fdflags);
+
+    /* EAGAIN is not an error */
+    if (status < 0 && errno != EAGAIN && !n)
+	return -1;
+    return n;
+}
+
 /* Converts a lockspace handle into a file descriptor */
 int dlm_ls_get_fd(dlm_lshandle_t lockspace)
 {
@@ -1219,6 +1519,267 @@ int dlm_ls_pthread_init(dlm_lshandle_t ls)
 
     return pthread_create(&lsinfo->tid, NULL, dlm_recv_thread, (void *)ls);
 }
+
+/*
+ * The thread shared by lockspaces set up with dlm_ls_pthread_init_shared().
+ * It waits for all their fds with epoll, and for a pipe written to wake it
+ * when a lockspace is removed or it's to stop.  It's started for the first
+ * of these lockspaces and stops when the last is closed.
+ */
+
+#define DISPATCH_EVENTS 32
+
+struct dispatcher {
+	pthread_t tid;
+	int epfd;
+	int wake[2];
+	int count;			/* lockspaces */
+	int stop;			/* 1: to be joined, 2: detach */
+	unsigned int rounds;		/* epoll_wait rounds done */
+	pthread_cond_t round_done;
+	struct dlm_ls_info *removed;	/* from asts, freed after the round */
+};
+
+static pthread_mutex_t dispatcher_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct dispatcher *dispatcher;
+
+static void dispatcher_wake(struct dispatcher *d)
+{
+	if (write(d->wake[1], "", 1) < 0 && errno != EAGAIN)
+		return;
+}
+
+static void dispatcher_free(struct dispatcher *d)
+{
+	close(d->epfd);
+	close(d->wake[0]);
+	close(d->wake[1]);
+	pthread_cond_destroy(&d->round_done);
+	free(d);
+}
+
+static void *dispatcher_thread(void *arg)
+{
+	struct dispatcher *d = arg;
+	struct epoll_event events[DISPATCH_EVENTS];
+	struct dlm_ls_info *lsinfo;
+	char buf[32];
+	int i, n, stop;
+
+	do {
+		n = epoll_wait(d->epfd, events, DISPATCH_EVENTS, -1);
+
+		for (i = 0; i < n; i++) {
+			lsinfo = events[i].data.ptr;
+
+			if (!lsinfo) {
+				while (read(d->wake[0], buf, sizeof(buf)) > 0)
+					;
+				continue;
+			}
+
+			/* removed by an ast earlier in this round */
+			if (!lsinfo->shared)
+				continue;
+
+			/* an ast did a sync call on it, so the read could
+			   block; if results are left epoll says so again */
+			if (lsinfo->read_inline) {
+				lsinfo->read_inline = 0;
+				continue;
+			}
+
+			do_dlm_dispatch(lsinfo->fd);
+		}
+
+		pthread_mutex_lock(&dispatcher_mutex);
+		while ((lsinfo = d->removed)) {
+			d->removed = lsinfo->removed_next;
+			close(lsinfo->fd);
+			free(lsinfo);
+		}
+		d->rounds++;
+		pthread_cond_broadcast(&d->round_done);
+		stop = d->stop;
+		pthread_mutex_unlock(&dispatcher_mutex);
+	} while (!stop);
+
+	/* the last lockspace was closed from one of our own asts, so
+	   nobody is waiting to join us */
+	if (stop == 2) {
+		pthread_detach(pthread_self());
+		dispatcher_free(d);
+	}
+	return NULL;
+}
+
+/* Called with dispatcher_mutex held */
+static struct dispatcher *dispatcher_start(void)
+{
+	struct dispatcher *d;
+	struct epoll_event ev;
+	int saved_errno;
+
+	d = malloc(sizeof(struct dispatcher));
+	if (!d)
+		return NULL;
+	memset(d, 0, sizeof(struct dispatcher));
+
+	d->epfd = epoll_create(DISPATCH_EVENTS);
+	if (d->epfd < 0)
+		goto fail_free;
+
+	if (pipe(d->wake))
+		goto fail_epfd;
+	fcntl(d->wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(d->wake[1], F_SETFL, O_NONBLOCK);
+	fcntl(d->epfd, F_SETFD, 1);
+	fcntl(d->wake[0], F_SETFD, 1);
+	fcntl(d->wake[1], F_SETFD, 1);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->wake[0], &ev))
+		goto fail_pipe;
+
+	pthread_cond_init(&d->round_done, NULL);
+
+	errno = pthread_create(&d->tid, NULL, dispatcher_thread, d);
+	if (errno) {
+		pthread_cond_destroy(&d->round_done);
+		goto fail_pipe;
+	}
+	return d;
+
+ fail_pipe:
+	saved_errno = errno;
+	close(d->wake[0]);
+	close(d->wake[1]);
+	errno = saved_errno;
+ fail_epfd:
+	saved_errno = errno;
+	close(d->epfd);
+	errno = saved_errno;
+ fail_free:
+	saved_errno = errno;
+	free(d);
+	errno = saved_errno;
+	return NULL;
+}
+
+/* Called with dispatcher_mutex held, when the last lockspace has gone.
+   Unless self, the caller joins the thread and frees d after unlocking. */
+static void dispatcher_stop(struct dispatcher *d, int self)
+{
+	dispatcher = NULL;
+	d->stop = self ? 2 : 1;
+	dispatcher_wake(d);
+}
+
+static int dispatcher_add(struct dlm_ls_info *lsinfo)
+{
+	struct dispatcher *d;
+	struct epoll_event ev;
+	int saved_errno, rv = -1;
+
+	pthread_mutex_lock(&dispatcher_mutex);
+
+	d = dispatcher;
+	if (!d) {
+		d = dispatcher_start();
+		if (!d)
+			goto out;
+		dispatcher = d;
+	}
+
+	lsinfo->tid = d->tid;
+	lsinfo->shared = 1;
+	lsinfo->read_inline = 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = lsinfo;
+
+	if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, lsinfo->fd, &ev)) {
+		saved_errno = errno;
+		lsinfo->tid = 0;
+		lsinfo->shared = 0;
+		if (!d->count) {
+			dispatcher_stop(d, 0);
+			pthread_mutex_unlock(&dispatcher_mutex);
+			pthread_join(d->tid, NULL);
+			dispatcher_free(d);
+			errno = saved_errno;
+			return -1;
+		}
+		errno = saved_errno;
+		goto out;
+	}
+
+	d->count++;
+	rv = 0;
+ out:
+	pthread_mutex_unlock(&dispatcher_mutex);
+	return rv;
+}
+
+/* Stop delivering a lockspace's asts, then close its fd and free it */
+static int dispatcher_remove(struct dlm_ls_info *lsinfo)
+{
+	struct dispatcher *d;
+	unsigned int rounds;
+
+	pthread_mutex_lock(&dispatcher_mutex);
+
+	d = dispatcher;
+	epoll_ctl(d->epfd, EPOLL_CTL_DEL, lsinfo->fd, NULL);
+	lsinfo->shared = 0;
+	d->count--;
+
+	if (pthread_equal(pthread_self(), d->tid)) {
+		/* from an ast: the rest of this round may have an event for
+		   it, so it's freed once the round is done */
+		lsinfo->removed_next = d->removed;
+		d->removed = lsinfo;
+		if (!d->count)
+			dispatcher_stop(d, 1);
+		pthread_mutex_unlock(&dispatcher_mutex);
+		return 0;
+	}
+
+	if (!d->count) {
+		dispatcher_stop(d, 0);
+		pthread_mutex_unlock(&dispatcher_mutex);
+		pthread_join(d->tid, NULL);
+		dispatcher_free(d);
+	} else {
+		/* a round under way may have an event for it */
+		rounds = d->rounds;
+		dispatcher_wake(d);
+		while (d->rounds == rounds)
+			pthread_cond_wait(&d->round_done, &dispatcher_mutex);
+		pthread_mutex_unlock(&dispatcher_mutex);
+	}
+
+	close(lsinfo->fd);
+	free(lsinfo);
+	return 0;
+}
+
+/* For applications with many lockspaces: the asts of all the lockspaces
+   set up with this are delivered by a single thread */
+int dlm_ls_pthread_init_shared(dlm_lshandle_t ls)
+{
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+
+	if (lsinfo->tid) {
+		errno = EEXIST;
+		return -1;
+	}
+
+	return dispatcher_add(lsinfo);
+}
 #endif
 
 /*
@@ -1324,6 +1885,10 @@ static dlm_lshandle_t create_lockspace(const char *name, mode_t mode,
 	if (mode)
 		fchmod(newls->fd, mode);
 	newls->tid = 0;
+#ifdef _REENTRANT
+	newls->shared = 0;
+#endif
+	newls->pending_count = 0;
 	fcntl(newls->fd, F_SETFD, 1);
 	return (dlm_lshandle_t)newls;
 
@@ -1444,6 +2009,10 @@ dlm_lshandle_t dlm_open_lockspace(const char *name)
 		return NULL;
 
 	newls->tid = 0;
+#ifdef _REENTRANT
+	newls->shared = 0;
+#endif
+	newls->pending_count = 0;
 	ls_dev_name(name, dev_name, sizeof(dev_name));
 
 	newls->fd = open(dev_name, O_RDWR);
@@ -108,6 +108,21 @@ extern int dlm_get_fd(void);
 extern int dlm_dispatch(int fd);
 
 
+/*
+ * A result read from a lockspace by dlm_ls_dispatch_results() instead of
+ * having its ast called.  The lksb has already been filled in.  bast_mode
+ * is zero for a completion ast, or the mode being blocked for a bast
+ * (astaddr is then the bastaddr).
+ */
+
+struct dlm_ast_result {
+	void (*astaddr) (void *astarg);
+	void *astarg;
+	struct dlm_lksb *lksb;
+	int bast_mode;
+};
+
+
 /*
  * Creating your own lockspace
  *
@@ -142,13 +157,39 @@ extern dlm_lshandle_t dlm_new_lockspace(const char *name, mode_t mode,
  *
  * dlm_ls_lock()
  * dlm_ls_lockx()
+ * dlm_ls_lock_batch() - async request or convert of many locks.  They
+ *                       are all checked first (EINVAL and none are sent
+ *                       if one is bad), then written one at a time as
+ *                       dlm_ls_lock() would.  Returns how many of them
+ *                       were sent, the ones after that weren't (their
+ *                       sb_status may have been set to EINPROG, but
+ *                       they'll get no ast)
  * dlm_ls_unlock()
  * dlm_ls_lock_wait()
  * dlm_ls_unlock_wait()
  * dlm_ls_deadlock_cancel()
  * dlm_ls_purge()
+ * dlm_ls_dispatch_results() - like dlm_dispatch() on the lockspace fd, but
+ *                       returns up to max results to the caller instead
+ *                       of calling their asts (EINVAL if max is
+ *                       negative).  Not for use with
+ *                       dlm_ls_pthread_init().
  */
 
+/* One request for dlm_ls_lock_batch(), the arguments of dlm_ls_lock() */
+
+struct dlm_lock_req {
+	uint32_t mode;
+	uint32_t flags;
+	struct dlm_lksb *lksb;
+	const void *name;
+	unsigned int namelen;
+	uint32_t parent;			/* unused */
+	void (*astaddr) (void *astarg);
+	void *astarg;
+	void (*bastaddr) (void *astarg);
+};
+
 extern int dlm_ls_lock(dlm_lshandle_t lockspace,
 		uint32_t mode,
 		struct dlm_lksb *lksb,
@@ -174,6 +215,10 @@ extern int dlm_ls_lockx(dlm_lshandle_t lockspace,
 		uint64_t *xid,
 		uint64_t *timeout);
 
+extern int dlm_ls_lock_batch(dlm_lshandle_t lockspace,
+		struct dlm_lock_req *reqs,
+		int count);
+
 extern int dlm_ls_unlock(dlm_lshandle_t lockspace,
 		uint32_t lkid,
 		uint32_t flags,
@@ -204,6 +249,10 @@ extern int dlm_ls_purge(dlm_lshandle_t lockspace,
 		int nodeid,
 		int pid);
 
+extern int dlm_ls_dispatch_results(dlm_lshandle_t lockspace,
+		struct dlm_ast_result *results,
+		int max);
+
 
 /*
  * For threaded applications
@@ -211,6 +260,11 @@ extern int dlm_ls_purge(dlm_lshandle_t lockspace,
  * dlm_pthread_init()
  * dlm_ls_pthread_init() - call this before any locking operations and the ASTs
  *                         will be delivered in their own thread.
+ * dlm_ls_pthread_init_shared() - instead of dlm_ls_pthread_init(), for
+ *                         applications with many lockspaces: the ASTs of
+ *                         all the lockspaces set up with it are delivered
+ *                         by one thread, started for the first of them and
+ *                         stopped when the last is closed.
  * dlm_pthread_cleanup() - call the cleanup routine at application exit
  *			   (optional) or, if the locking functions are in a
  *			   shared library that is to be unloaded.
@@ -222,6 +276,7 @@ extern int dlm_ls_purge(dlm_lshandle_t lockspace,
 #ifdef _REENTRANT
 extern int dlm_pthread_init(void);
 extern int dlm_ls_pthread_init(dlm_lshandle_t lockspace);
+extern int dlm_ls_pthread_init_shared(dlm_lshandle_t lockspace);
 extern int dlm_pthread_cleanup(void);
 #endif
 
@@ -0,0 +1,214 @@
+/* Lock throughput through libaislock.
+
+   Each op is a SaLckResourceLockAsync() followed, from its grant
+   callback, by saLckResourceUnlockAsync(); the unlock callback starts
+   the next op.  The run is done with one op outstanding at a time and
+   then with <window> of them, dispatching with SA_DISPATCH_ALL, and
+   the two rates are compared.  Resources are opened twice to exercise
+   the resource cache.
+*/
+#include <sys/types.h>
+#include <sys/poll.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "libdlm.h"
+#include "libaislock.h"
+
+static SaLckHandleT handle;
+static SaLckResourceIdT *resources;
+static SaLckLockIdT *lockids;
+static int rescount = 16;
+static int submitted;
+static int completed;
+static int failed;
+static int total;
+
+static void usage(char *prog, FILE *file)
+{
+    fprintf(file, "Usage:\n");
+    fprintf(file, "%s [hnrw]\n", prog);
+    fprintf(file, "\n");
+    fprintf(file, "   -h         Show this help information\n");
+    fprintf(file, "   -n <num>   Number of lock/unlock ops per run (default 100000)\n");
+    fprintf(file, "   -r <num>   Number of resources (default 16)\n");
+    fprintf(file, "   -w <num>   Ops outstanding at once (default 64)\n");
+    fprintf(file, "\n");
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Start the next op in slot <i>, if there are any left */
+static void submit(int i)
+{
+    SaErrorT err;
+
+    if (submitted == total)
+	return;
+
+    err = SaLckResourceLockAsync(&handle, (SaInvocationT)(long)i,
+				 &resources[submitted % rescount],
+				 &lockids[i], SA_LCK_PR_LOCK_MODE, 0, 0);
+    if (err != SA_OK) {
+	fprintf(stderr, "SaLckResourceLockAsync: %d\n", err);
+	failed++;
+	return;
+    }
+    submitted++;
+}
+
+static void grant_cb(SaInvocationT invocation,
+		     const SaLckResourceIdT *resourceId,
+		     const SaLckLockIdT *lockId,
+		     SaLckLockModeT lockMode,
+		     SaLckLockStatusT lockStatus,
+		     SaErrorT error)
+{
+    int i = (long)invocation;
+
+    if (lockStatus != SA_LCK_LOCK_GRANTED ||
+	saLckResourceUnlockAsync(&handle, invocation, &lockids[i]) != SA_OK) {
+	fprintf(stderr, "lock %d failed: %d\n", i, lockStatus);
+	failed++;
+    }
+}
+
+static void unlock_cb(SaInvocationT invocation,
+		      const SaLckResourceIdT *resourceId,
+		      const SaLckLockIdT *lockId,
+		      SaLckLockStatusT lockStatus,
+		      SaErrorT error)
+{
+    completed++;
+    submit((long)invocation);
+}
+
+static double run(int window)
+{
+    struct pollfd pfd;
+    SaSelectionObjectT fd;
+    double start;
+    int i;
+
+    saLckSelectionObjectGet(&handle, &fd);
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    submitted = completed = 0;
+    start = now();
+
+    for (i = 0; i < window; i++)
+	submit(i);
+
+    while (completed < submitted && !failed) {
+	if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+	    perror("poll");
+	    exit(1);
+	}
+	saLckDispatch(&handle, SA_DISPATCH_ALL);
+    }
+
+    return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    SaLckCallbacksT callbacks;
+    SaVersionT version;
+    SaNameT name;
+    double t1, tw;
+    int window = 64;
+    int opt;
+    int i, pass;
+
+    total = 100000;
+
+    while ((opt = getopt(argc, argv, "?hn:r:w:")) != EOF) {
+	switch (opt) {
+	case 'n':
+	    total = atoi(optarg);
+	    break;
+	case 'r':
+	    rescount = atoi(optarg);
+	    break;
+	case 'w':
+	    window = atoi(optarg);
+	    break;
+	case 'h':
+	    usage(argv[0], stdout);
+	    exit(0);
+	default:
+	    usage(argv[0], stderr);
+	    exit(1);
+	}
+    }
+
+    if (total < 1 || rescount < 1 || window < 1) {
+	usage(argv[0], stderr);
+	exit(1);
+    }
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.saLckLockGrantCallback = grant_cb;
+    callbacks.saLckResourceUnlockCallback = unlock_cb;
+    memset(&version, 0, sizeof(version));
+
+    if (saLckInitialize(&handle, &callbacks, &version) != SA_OK) {
+	fprintf(stderr, "saLckInitialize failed\n");
+	return 1;
+    }
+
+    resources = calloc(rescount, sizeof(SaLckResourceIdT));
+    lockids = calloc(window, sizeof(SaLckLockIdT));
+    if (!resources || !lockids) {
+	fprintf(stderr, "out of memory\n");
+	return 1;
+    }
+
+    /* The second open of each name only takes a reference */
+    for (pass = 0; pass < 2; pass++) {
+	t1 = now();
+	for (i = 0; i < rescount; i++) {
+	    name.length = snprintf((char *)name.value, SA_MAX_NAME_LENGTH,
+				   "aislockperf%d", i);
+	    if (saLckResourceOpen(&handle, &name, &resources[i]) != SA_OK) {
+		fprintf(stderr, "saLckResourceOpen %d failed\n", i);
+		return 1;
+	    }
+	}
+	printf("open %d resources: %.1f us each\n", rescount,
+	       (now() - t1) * 1000000 / rescount);
+    }
+
+    t1 = run(1);
+    if (failed)
+	goto out;
+    printf("window 1:  %d ops in %.3fs, %.0f ops/s\n",
+	   total, t1, total / t1);
+
+    tw = run(window);
+    if (failed)
+	goto out;
+    printf("window %d: %d ops in %.3fs, %.0f ops/s (%.1fx)\n",
+	   window, total, tw, total / tw, t1 / tw);
+
+ out:
+    for (pass = 0; pass < 2; pass++)
+	for (i = 0; i < rescount; i++)
+	    saLckResourceClose(&handle, &resources[i]);
+    saLckFinalize(&handle);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,125 @@
+/* A stand-in for a lockspace device, for tests that build libdlm in:
+   include fakedev.h before libdlm.c and this after it.
+
+   The lockspace fd is one end of a socket pair with a thread on the other
+   that grants every request at once.  It takes one request per write
+   and returns one result per read, as the dlm device does.
+*/
+
+static void fakedev_send(struct fakedev *dev, char *buf, int len)
+{
+    if (len && send(dev->fd, buf, len, 0) != len) {
+	perror("stand-in send");
+	exit(1);
+    }
+}
+
+static void fakedev_set_ast(struct fakedev *dev, int lkid, void *castaddr)
+{
+    void **table;
+    int alloc;
+
+    if (lkid >= dev->alloc) {
+	for (alloc = dev->alloc ? dev->alloc : 1024; alloc <= lkid; )
+	    alloc *= 2;
+	table = realloc(dev->castaddr, alloc * sizeof(void *));
+	if (!table) {
+	    perror("stand-in realloc");
+	    exit(1);
+	}
+	dev->castaddr = table;
+	dev->alloc = alloc;
+    }
+    dev->castaddr[lkid] = castaddr;
+}
+
+static void *fakedev_thread(void *arg)
+{
+    struct fakedev *dev = arg;
+    char inbuf[sizeof(struct dlm_write_request) + DLM_RESNAME_MAXLEN];
+    struct dlm_write_request *req = (struct dlm_write_request *)inbuf;
+    struct dlm_lock_result res;
+    int lkid;
+
+    /* the name, which we don't need, follows the request */
+    while (recv(dev->fd, inbuf, sizeof(inbuf), 0) >=
+	   (ssize_t)sizeof(struct dlm_write_request)) {
+	memset(&res, 0, sizeof(res));
+	res.length = sizeof(res);
+	res.user_lksb = req->i.lock.lksb;
+
+	if (req->cmd == DLM_USER_LOCK) {
+	    /* new locks were given their ids by fakedev_write() */
+	    lkid = req->i.lock.lkid;
+	    fakedev_set_ast(dev, lkid, req->i.lock.castaddr);
+	    res.user_astaddr = req->i.lock.castaddr;
+	    res.user_astparam = req->i.lock.castparam;
+	} else {
+	    /* unlock, with the lock's completion ast */
+	    lkid = req->i.lock.lkid;
+	    res.user_astaddr = dev->castaddr[lkid];
+	    res.user_astparam = req->i.lock.castparam;
+	    res.lksb.sb_status = -EUNLOCK;
+	}
+	res.lksb.sb_lkid = lkid;
+	fakedev_send(dev, (char *)&res, sizeof(res));
+    }
+
+    close(dev->fd);
+    return NULL;
+}
+
+/* A lockspace handle on a new stand-in, as dlm_open_lockspace() would
+   give.  Close it with dlm_close_lockspace() then call fakedev_join(). */
+
+static dlm_lshandle_t fakedev_open(struct fakedev *dev)
+{
+    struct dlm_ls_info *lsinfo;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds)) {
+	perror("socketpair");
+	exit(1);
+    }
+
+    memset(dev, 0, sizeof(struct fakedev));
+    dev->fd = fds[1];
+    dev->next_lkid = 1;
+
+    lsinfo = calloc(1, sizeof(struct dlm_ls_info));
+    if (!lsinfo) {
+	perror("calloc");
+	exit(1);
+    }
+    lsinfo->fd = fds[0];
+
+    if (fds[0] >= FAKEDEV_FDS) {
+	fprintf(stderr, "stand-in fd %d too big\n", fds[0]);
+	exit(1);
+    }
+    fakedevs[fds[0]] = dev;
+
+    /* what the control device would have told us; once, as threads
+       for other lockspaces may be looking */
+    if (!kernel_version.version[0]) {
+	kernel_version.version[0] = DLM_DEVICE_VERSION_MAJOR;
+	kernel_version.version[1] = DLM_DEVICE_VERSION_MINOR;
+	kernel_version.version[2] = DLM_DEVICE_VERSION_PATCH;
+    }
+
+    pthread_create(&dev->thread, NULL, fakedev_thread, dev);
+    return (dlm_lshandle_t)lsinfo;
+}
+
+static void fakedev_join(struct fakedev *dev)
+{
+    int i;
+
+    pthread_join(dev->thread, NULL);
+    free(dev->castaddr);
+
+    for (i = 0; i < FAKEDEV_FDS; i++) {
+	if (fakedevs[i] == dev)
+	    fakedevs[i] = NULL;
+    }
+}
@@ -0,0 +1,51 @@
+/* The write() half of the lockspace device stand-in in fakedev.c, which
+   must come before libdlm.c: the device gives each new lock its id when
+   the request is written, and returns it from the write. */
+
+#include <linux/types.h>
+#include <linux/dlm.h>
+#include <linux/dlm_device.h>
+
+#define FAKEDEV_FDS	1024
+
+struct fakedev {
+    int fd;			/* the stand-in's end */
+    pthread_t thread;
+    int next_lkid;
+
+    /* lkid -> completion ast, for unlocks */
+    void **castaddr;
+    int alloc;
+};
+
+/* by the lockspace fds */
+static struct fakedev *fakedevs[FAKEDEV_FDS];
+
+static int fakedev_new_lkid(struct fakedev *dev)
+{
+    return __sync_fetch_and_add(&dev->next_lkid, 1);
+}
+
+static ssize_t fakedev_write(int fd, const void *buf, size_t len)
+{
+    struct dlm_write_request *req = (struct dlm_write_request *)buf;
+    struct fakedev *dev = NULL;
+    int lkid = 0;
+    ssize_t rv;
+
+    if (fd >= 0 && fd < FAKEDEV_FDS)
+	dev = fakedevs[fd];
+
+    if (dev && len >= sizeof(*req) && req->cmd == DLM_USER_LOCK &&
+	!(req->i.lock.flags & DLM_LKF_CONVERT)) {
+	lkid = fakedev_new_lkid(dev);
+	req->i.lock.lkid = lkid;
+    }
+
+    rv = write(fd, buf, len);
+    if (rv < 0 || !lkid)
+	return rv;
+    return lkid;
+}
+
+#define write(fd, buf, len)		fakedev_write(fd, buf, len)
@@ -0,0 +1,322 @@
+/* Lock throughput of dlm_ls_lock_batch() and dlm_ls_dispatch_results()
+   against dlm_ls_lock() and dlm_dispatch().
+
+   No dlm is needed: libdlm is built in, with a stand-in for the lockspace
+   device (fakedev.c) that grants every request at once.
+
+   Locks are taken WINDOW at a time, waiting for all the completions of
+   each window before the next.  The lksbs, asts and lock ids are checked,
+   and the read/write/fcntl calls libdlm makes are counted.
+*/
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/sysmacros.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "fakedev.h"
+
+/* count the calls libdlm makes on the lockspace fd */
+
+static int reads, writes, fcntls;
+
+static ssize_t counted_read(int fd, void *buf, size_t len)
+{
+    reads++;
+    return read(fd, buf, len);
+}
+
+static ssize_t counted_write(int fd, const void *buf, size_t len)
+{
+    writes++;
+    return write(fd, buf, len);
+}
+
+#undef write
+
+#define read(fd, buf, len)		counted_read(fd, buf, len)
+#define write(fd, buf, len)		counted_write(fd, buf, len)
+#define fcntl(fd, cmd, args...)		(fcntls++, fcntl(fd, cmd, ##args))
+
+#include "libdlm.c"
+#include "fakedev.c"
+
+#undef read
+#undef write
+#undef fcntl
+
+#define WINDOW		128
+#define MAX_LOCKS	1000000
+
+struct lock {
+    struct dlm_lksb lksb;
+    int asts;
+};
+
+static struct lock *locks;
+static int completed;
+static int failures;
+
+static void ast_routine(void *arg)
+{
+    struct lock *lk = arg;
+
+    lk->asts++;
+    completed++;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void wait_fd(int fd)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 5000) != 1) {
+	printf("FAIL no results from the stand-in\n");
+	exit(1);
+    }
+}
+
+/* Wait for want asts, calling them from dlm_dispatch() or, with ring,
+   from the results dlm_ls_dispatch_results() returns */
+
+static void wait_asts(struct dlm_ls_info *lsinfo, int want, int ring)
+{
+    struct dlm_ast_result results[50];
+    int i, n;
+
+    while (completed < want) {
+	wait_fd(lsinfo->fd);
+
+	if (!ring) {
+	    if (dlm_dispatch(lsinfo->fd) < 0) {
+		perror("dlm_dispatch");
+		exit(1);
+	    }
+	    continue;
+	}
+
+	/* fewer than RESULTS_MAX, so results get kept between calls */
+	while ((n = dlm_ls_dispatch_results(lsinfo, results, 50)) > 0) {
+	    for (i = 0; i < n; i++) {
+		if (results[i].bast_mode ||
+		    results[i].astaddr != ast_routine ||
+		    results[i].lksb != &((struct lock *)
+					 results[i].astarg)->lksb) {
+		    printf("FAIL bad result\n");
+		    failures++;
+		}
+		results[i].astaddr(results[i].astarg);
+	    }
+	}
+	if (n < 0) {
+	    perror("dlm_ls_dispatch_results");
+	    exit(1);
+	}
+    }
+}
+
+static void run(const char *desc, int nlocks, int batch_api, int ring)
+{
+    struct dlm_lock_req reqs[WINDOW];
+    struct dlm_ls_info *lsinfo;
+    struct fakedev dev;
+    char names[WINDOW][16];
+    double start, elapsed;
+    int i, n, done, rv, bad = 0;
+
+    memset(locks, 0, nlocks * sizeof(struct lock));
+    completed = 0;
+    reads = writes = fcntls = 0;
+
+    lsinfo = fakedev_open(&dev);
+    start = now();
+
+    for (done = 0; done < nlocks; done += n) {
+	n = nlocks - done;
+	if (n > WINDOW)
+	    n = WINDOW;
+
+	for (i = 0; i < n; i++) {
+	    sprintf(names[i], "lock%d", done + i);
+
+	    if (!batch_api) {
+		rv = dlm_ls_lock(lsinfo, LKM_EXMODE, &locks[done + i].lksb,
+				 0, names[i], strlen(names[i]), 0,
+				 ast_routine, &locks[done + i], NULL, NULL);
+		if (rv) {
+		    perror("dlm_ls_lock");
+		    exit(1);
+		}
+		continue;
+	    }
+
+	    reqs[i].mode = LKM_EXMODE;
+	    reqs[i].flags = 0;
+	    reqs[i].lksb = &locks[done + i].lksb;
+	    reqs[i].name = names[i];
+	    reqs[i].namelen = strlen(names[i]);
+	    reqs[i].parent = 0;
+	    reqs[i].astaddr = ast_routine;
+	    reqs[i].astarg = &locks[done + i];
+	    reqs[i].bastaddr = NULL;
+	}
+
+	if (batch_api) {
+	    rv = dlm_ls_lock_batch(lsinfo, reqs, n);
+	    if (rv != n) {
+		perror("dlm_ls_lock_batch");
+		exit(1);
+	    }
+	}
+
+	wait_asts(lsinfo, done + n, ring);
+    }
+
+    elapsed = now() - start;
+
+    /* lock ids are given out in order */
+    for (i = 0; i < nlocks; i++) {
+	if (locks[i].asts != 1 || locks[i].lksb.sb_status ||
+	    locks[i].lksb.sb_lkid != i + 1)
+	    bad++;
+    }
+
+    printf("%-36s %8.0f locks/s  %6d writes %6d reads %5d fcntls\n",
+	   desc, nlocks / elapsed, writes, reads, fcntls);
+
+    /* and unlocking, one at a time */
+    completed = 0;
+    for (i = 0; i < nlocks; i++) {
+	rv = dlm_ls_unlock(lsinfo, locks[i].lksb.sb_lkid, 0,
+			   &locks[i].lksb, &locks[i]);
+	if (rv) {
+	    perror("dlm_ls_unlock");
+	    exit(1);
+	}
+	if ((i + 1) % WINDOW == 0 || i + 1 == nlocks)
+	    wait_asts(lsinfo, i + 1, ring);
+    }
+
+    for (i = 0; i < nlocks; i++) {
+	if (locks[i].asts != 2 || locks[i].lksb.sb_status != EUNLOCK)
+	    bad++;
+    }
+
+    dlm_close_lockspace(lsinfo);
+    fakedev_join(&dev);
+
+    if (bad) {
+	printf("FAIL %s: %d locks with bad asts or lksbs\n", desc, bad);
+	failures++;
+    }
+}
+
+/* Nothing is sent from a batch with a bad request in it, and a negative
+   max is refused */
+
+static void check_bad_args(void)
+{
+    struct dlm_ast_result result;
+    struct dlm_lock_req reqs[2];
+    struct dlm_ls_info *lsinfo;
+    struct fakedev dev;
+
+    lsinfo = fakedev_open(&dev);
+    memset(reqs, 0, sizeof(reqs));
+    memset(locks, 0, 2 * sizeof(struct lock));
+    writes = 0;
+
+    reqs[0].mode = reqs[1].mode = LKM_EXMODE;
+    reqs[0].lksb = &locks[0].lksb;
+    reqs[1].lksb = &locks[1].lksb;
+    reqs[0].name = reqs[1].name = "bad";
+    reqs[0].namelen = 3;
+    reqs[1].namelen = DLM_RESNAME_MAXLEN + 1;
+
+    if (dlm_ls_lock_batch(lsinfo, reqs, 2) != -1 || errno != EINVAL ||
+	writes) {
+	printf("FAIL dlm_ls_lock_batch with a bad request\n");
+	failures++;
+    }
+
+    if (dlm_ls_dispatch_results(lsinfo, &result, -1) != -1 ||
+	errno != EINVAL) {
+	printf("FAIL dlm_ls_dispatch_results with a negative max\n");
+	failures++;
+    }
+
+    dlm_close_lockspace(lsinfo);
+    fakedev_join(&dev);
+}
+
+static void usage(char *prog, FILE *file)
+{
+    fprintf(file, "Usage:\n");
+    fprintf(file, "%s [nh]\n", prog);
+    fprintf(file, "\n");
+    fprintf(file, "   -h         Show this help information\n");
+    fprintf(file, "   -n <num>   Number of locks (default 100000)\n");
+    fprintf(file, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int nlocks = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != EOF) {
+	switch (opt) {
+	case 'n':
+	    nlocks = atoi(optarg);
+	    break;
+	case 'h':
+	    usage(argv[0], stdout);
+	    exit(0);
+	default:
+	    usage(argv[0], stderr);
+	    exit(1);
+	}
+    }
+
+    if (nlocks < 1 || nlocks > MAX_LOCKS) {
+	usage(argv[0], stderr);
+	exit(1);
+    }
+
+    locks = calloc(nlocks, sizeof(struct lock));
+    if (!locks) {
+	perror("calloc");
+	exit(1);
+    }
+
+    printf("%d locks, %d at a time\n", nlocks, WINDOW);
+
+    run("dlm_ls_lock, dlm_dispatch", nlocks, 0, 0);
+    run("dlm_ls_lock_batch, dlm_dispatch", nlocks, 1, 0);
+    run("dlm_ls_lock_batch, dispatch_results", nlocks, 1, 1);
+    check_bad_args();
+
+    if (failures) {
+	printf("%d failed\n", failures);
+	return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,381 @@
+/* Latency of synchronous lock/unlock round trips, dlm_ls_lock_wait() then
+   dlm_ls_unlock_wait(), with a thread per lockspace (dlm_ls_pthread_init)
+   and with one thread for them all (dlm_ls_pthread_init_shared).
+
+   No dlm is needed: libdlm is built in, with a stand-in for each
+   lockspace device (fakedev.c) that grants every request at once.
+
+   Each application thread goes round the lockspaces taking and releasing
+   a lock on each.  Then the shared thread is checked for asts that do
+   sync calls on other lockspaces, and for going away cleanly when the
+   last lockspace is closed, from an ast as well as from the application.
+*/
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/sysmacros.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "fakedev.h"
+#include "libdlm.c"
+#include "fakedev.c"
+
+#define MAX_LOCKSPACES	256
+#define MAX_THREADS	64
+
+static struct fakedev devs[MAX_LOCKSPACES];
+static dlm_lshandle_t lockspaces[MAX_LOCKSPACES];
+static int nls = 32;
+static int rounds = 20000;
+static int failures;
+
+struct app_thread {
+    pthread_t thread;
+    int num;
+    double *samples;
+    int bad;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int count_threads(void)
+{
+    DIR *d;
+    struct dirent *de;
+    int count = 0;
+
+    d = opendir("/proc/self/task");
+    if (!d)
+	return -1;
+    while ((de = readdir(d))) {
+	if (de->d_name[0] != '.')
+	    count++;
+    }
+    closedir(d);
+    return count;
+}
+
+static int dispatcher_running(void)
+{
+    int running;
+
+    pthread_mutex_lock(&dispatcher_mutex);
+    running = (dispatcher != NULL);
+    pthread_mutex_unlock(&dispatcher_mutex);
+    return running;
+}
+
+static void open_lockspaces(int shared)
+{
+    int i, rv;
+
+    for (i = 0; i < nls; i++) {
+	lockspaces[i] = fakedev_open(&devs[i]);
+	if (shared)
+	    rv = dlm_ls_pthread_init_shared(lockspaces[i]);
+	else
+	    rv = dlm_ls_pthread_init(lockspaces[i]);
+	if (rv) {
+	    perror("dlm_ls_pthread_init");
+	    exit(1);
+	}
+    }
+}
+
+static void close_lockspaces(void)
+{
+    int i;
+
+    for (i = 0; i < nls; i++) {
+	dlm_close_lockspace(lockspaces[i]);
+	fakedev_join(&devs[i]);
+    }
+}
+
+static void *app_thread(void *arg)
+{
+    struct app_thread *at = arg;
+    struct dlm_lksb lksb;
+    char name[16];
+    double start;
+    int i, ls, rv;
+
+    sprintf(name, "thread%d", at->num);
+
+    for (i = 0; i < rounds; i++) {
+	ls = (at->num + i) % nls;
+	start = now();
+
+	rv = dlm_ls_lock_wait(lockspaces[ls], LKM_EXMODE, &lksb, 0,
+			      name, strlen(name), 0, NULL, NULL, NULL);
+	if (rv || lksb.sb_status || !lksb.sb_lkid) {
+	    at->bad++;
+	    continue;
+	}
+
+	rv = dlm_ls_unlock_wait(lockspaces[ls], lksb.sb_lkid, 0, &lksb);
+	if (rv || lksb.sb_status != EUNLOCK)
+	    at->bad++;
+
+	at->samples[i] = now() - start;
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void run(const char *desc, int shared, int nthreads)
+{
+    struct app_thread threads[MAX_THREADS];
+    double *all, total = 0;
+    int i, n = nthreads * rounds, bad = 0, tasks;
+
+    open_lockspaces(shared);
+    tasks = count_threads();
+
+    all = calloc(n, sizeof(double));
+    if (!all) {
+	perror("calloc");
+	exit(1);
+    }
+
+    for (i = 0; i < nthreads; i++) {
+	threads[i].num = i;
+	threads[i].samples = all + i * rounds;
+	threads[i].bad = 0;
+	pthread_create(&threads[i].thread, NULL, app_thread, &threads[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+	pthread_join(threads[i].thread, NULL);
+	bad += threads[i].bad;
+    }
+
+    close_lockspaces();
+
+    if (shared && dispatcher_running()) {
+	printf("FAIL %s: shared thread still running\n", desc);
+	failures++;
+    }
+
+    qsort(all, n, sizeof(double), cmp_double);
+    for (i = 0; i < n; i++)
+	total += all[i];
+
+    printf("%-28s %2d app threads %4d threads  mean %6.1f  p50 %6.1f"
+	   "  p99 %7.1f  max %8.1f us\n", desc, nthreads, tasks,
+	   total / n * 1000000, all[n / 2] * 1000000,
+	   all[n - n / 100 - 1] * 1000000, all[n - 1] * 1000000);
+
+    if (bad) {
+	printf("FAIL %s: %d bad round trips\n", desc, bad);
+	failures++;
+    }
+    free(all);
+}
+
+/* An ast in the shared thread doing sync calls on another lockspace,
+   while that lockspace has results of its own waiting to be read */
+
+static pthread_mutex_t ast_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ast_cond = PTHREAD_COND_INITIALIZER;
+static struct dlm_lksb async_lksb[2];
+static int async_asts;
+static int sync_bad;
+
+static void ast_done(int bad)
+{
+    pthread_mutex_lock(&ast_mutex);
+    async_asts++;
+    sync_bad += bad;
+    pthread_cond_signal(&ast_cond);
+    pthread_mutex_unlock(&ast_mutex);
+}
+
+static void sync_from_ast(void *arg)
+{
+    struct dlm_lksb lksb;
+    int bad = 0;
+
+    if (dlm_ls_lock_wait(lockspaces[1], LKM_EXMODE, &lksb, 0, "fromast", 7,
+			 0, NULL, NULL, NULL) || lksb.sb_status)
+	bad = 1;
+    else if (dlm_ls_unlock_wait(lockspaces[1], lksb.sb_lkid, 0, &lksb) ||
+	     lksb.sb_status != EUNLOCK)
+	bad = 1;
+
+    ast_done(bad);
+}
+
+static void count_ast(void *arg)
+{
+    ast_done(0);
+}
+
+static void check_sync_from_ast(void)
+{
+    int i, saved_nls = nls;
+
+    nls = 2;
+    for (i = 0; i < 1000; i++) {
+	open_lockspaces(1);
+	async_asts = 0;
+
+	dlm_ls_lock(lockspaces[1], LKM_EXMODE, &async_lksb[1], 0, "async", 5,
+		    0, count_ast, NULL, NULL, NULL);
+	dlm_ls_lock(lockspaces[0], LKM_EXMODE, &async_lksb[0], 0, "async", 5,
+		    0, sync_from_ast, NULL, NULL, NULL);
+
+	pthread_mutex_lock(&ast_mutex);
+	while (async_asts < 2)
+	    pthread_cond_wait(&ast_cond, &ast_mutex);
+	pthread_mutex_unlock(&ast_mutex);
+
+	close_lockspaces();
+	if (sync_bad || async_lksb[0].sb_status || async_lksb[1].sb_status)
+	    break;
+    }
+    nls = saved_nls;
+
+    if (sync_bad || i < 1000) {
+	printf("FAIL sync calls from an ast\n");
+	failures++;
+    } else {
+	printf("sync calls from an ast on another lockspace ok\n");
+    }
+}
+
+/* Close the last lockspace from its own ast: the shared thread has to
+   go away by itself */
+
+static pthread_mutex_t closed_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t closed_cond = PTHREAD_COND_INITIALIZER;
+static int closed;
+
+static void close_from_ast(void *arg)
+{
+    dlm_close_lockspace(arg);
+
+    pthread_mutex_lock(&closed_mutex);
+    closed = 1;
+    pthread_cond_signal(&closed_cond);
+    pthread_mutex_unlock(&closed_mutex);
+}
+
+static void check_close_from_ast(void)
+{
+    struct dlm_lksb lksb;
+    int i;
+
+    for (i = 0; i < 100; i++) {
+	lockspaces[0] = fakedev_open(&devs[0]);
+	if (dlm_ls_pthread_init_shared(lockspaces[0]) ||
+	    dlm_ls_pthread_init_shared(lockspaces[0]) != -1 ||
+	    errno != EEXIST) {
+	    printf("FAIL dlm_ls_pthread_init_shared\n");
+	    failures++;
+	    return;
+	}
+
+	closed = 0;
+	dlm_ls_lock(lockspaces[0], LKM_EXMODE, &lksb, 0, "close", 5, 0,
+		    close_from_ast, lockspaces[0], NULL, NULL);
+
+	pthread_mutex_lock(&closed_mutex);
+	while (!closed)
+	    pthread_cond_wait(&closed_cond, &closed_mutex);
+	pthread_mutex_unlock(&closed_mutex);
+
+	/* the stand-in sees the close once the shared thread's round
+	   is done */
+	fakedev_join(&devs[0]);
+
+	if (dispatcher_running()) {
+	    printf("FAIL shared thread still running after the last"
+		   " lockspace was closed from an ast\n");
+	    failures++;
+	    return;
+	}
+    }
+    printf("last lockspace closed from an ast ok\n");
+}
+
+static void usage(char *prog, FILE *file)
+{
+    fprintf(file, "Usage:\n");
+    fprintf(file, "%s [lnth]\n", prog);
+    fprintf(file, "\n");
+    fprintf(file, "   -h         Show this help information\n");
+    fprintf(file, "   -l <num>   Number of lockspaces (default 32)\n");
+    fprintf(file, "   -n <num>   Round trips per thread (default 20000)\n");
+    fprintf(file, "   -t <num>   Most application threads (default 4)\n");
+    fprintf(file, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int maxthreads = 4;
+    int opt, t;
+
+    while ((opt = getopt(argc, argv, "l:n:t:h")) != EOF) {
+	switch (opt) {
+	case 'l':
+	    nls = atoi(optarg);
+	    break;
+	case 'n':
+	    rounds = atoi(optarg);
+	    break;
+	case 't':
+	    maxthreads = atoi(optarg);
+	    break;
+	case 'h':
+	    usage(argv[0], stdout);
+	    exit(0);
+	default:
+	    usage(argv[0], stderr);
+	    exit(1);
+	}
+    }
+
+    if (nls < 2 || nls > MAX_LOCKSPACES || rounds < 1 ||
+	maxthreads < 1 || maxthreads > MAX_THREADS) {
+	usage(argv[0], stderr);
+	exit(1);
+    }
+
+    printf("%d lockspaces, %d round trips per thread\n", nls, rounds);
+
+    for (t = 1; t <= maxthreads; t *= 2) {
+	run("thread per lockspace", 0, t);
+	run("shared thread", 1, t);
+    }
+
+    check_sync_from_ast();
+    check_close_from_ast();
+
+    if (failures) {
+	printf("%d failed\n", failures);
+	return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
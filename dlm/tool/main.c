@@ -10,6 +10,7 @@
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
+#include <ctype.h>
 #include <netinet/in.h>
 
 #include <linux/dlmconstants.h>
@@ -29,6 +30,7 @@
 #define OP_LOCKDUMP			8
 #define OP_LOCKDEBUG			9
 #define OP_LOG_PLOCK			10
+#define OP_CONTENTION			11
 
 static char *prog_name;
 static char *lsname;
@@ -43,6 +45,11 @@ static mode_t create_mode = 0600;
 static int verbose;
 static int wide;
 static int summarize;
+static int sample_interval = 1;
+static int sample_count = 10;
+static int top_count = 10;
+static char **dump_files;
+static int dump_file_count;
 
 #define MAX_LS 128
 #define MAX_NODES 128
@@ -172,8 +179,8 @@ static void print_usage(void)
 	printf("Usage:\n");
 	printf("\n");
 	printf("dlm_tool [options] [join | leave | lockdump | lockdebug |\n"
-	       "                    ls | dump | log_plock | plocks |\n"
-	       "                    deadlock_check]\n");
+	       "                    contention | ls | dump | log_plock |\n"
+	       "                    plocks | deadlock_check]\n");
 	printf("\n");
 	printf("Options:\n");
 	printf("  -n               Show all node information in ls\n");
@@ -187,12 +194,20 @@ static void print_usage(void)
 	printf("                   (experimental, format not fixed)\n");
 	printf("  -v               Verbose lockdebug output\n");
 	printf("  -w               Wide lockdebug output\n");
+	printf("  -i <sec>         Seconds between contention samples, default 1\n");
+	printf("  -c <num>         Number of contention samples, default 10\n");
+	printf("  -t <num>         Resources in contention report, default 10\n");
 	printf("  -h               Print this help, then exit\n");
 	printf("  -V               Print program version information, then exit\n");
 	printf("\n");
+	printf("contention <name> [file ...] samples the lockspace's _locks and\n"
+	       "_waiters debugfs files and reports the most contended resources\n"
+	       "and the nodes involved.  Given files, each is taken as a sample\n"
+	       "saved with: cat <name>_locks <name>_waiters > file\n");
+	printf("\n");
 }
 
-#define OPTION_STRING "MhVnd:m:e:f:vws"
+#define OPTION_STRING "MhVnd:m:e:f:vwsi:c:t:"
 
 static void decode_arguments(int argc, char **argv)
 {
@@ -243,6 +258,18 @@ static void decode_arguments(int argc, char **argv)
 			wide = 1;
 			break;
 
+		case 'i':
+			sample_interval = atoi(optarg);
+			break;
+
+		case 'c':
+			sample_count = atoi(optarg);
+			break;
+
+		case 't':
+			top_count = atoi(optarg);
+			break;
+
 		case 'h':
 			print_usage();
 			exit(EXIT_SUCCESS);
@@ -345,6 +372,11 @@ static void decode_arguments(int argc, char **argv)
 			operation = OP_LOCKDEBUG;
 			opt_ind = optind + 1;
 			break;
+		} else if (!strncmp(argv[optind], "contention", 10) &&
+			   (strlen(argv[optind]) == 10)) {
+			operation = OP_CONTENTION;
+			opt_ind = optind + 1;
+			break;
 		}
 		optind++;
 	}
@@ -360,6 +392,16 @@ static void decode_arguments(int argc, char **argv)
 		fprintf(stderr, "lockspace name required\n");
 		exit(EXIT_FAILURE);
 	}
+
+	if (operation == OP_CONTENTION) {
+		dump_files = &argv[opt_ind + 1];
+		dump_file_count = argc - opt_ind - 1;
+
+		if (sample_interval < 0 || sample_count < 1 || top_count < 1) {
+			fprintf(stderr, "bad contention sample options\n");
+			exit(EXIT_FAILURE);
+		}
+	}
 }
 
 static int do_write(int fd, void *buf, size_t count)
@@ -1010,6 +1052,473 @@ static void do_lockdump(char *name)
 	fclose(file);
 }
 
+/*
+ * contention: sample the _locks and _waiters files and add up, for each
+ * resource, the locks waiting to be granted or converted, how long they
+ * have been waiting, the replies expected from other nodes and where the
+ * resource is mastered.  A node sees the locks of other nodes only on the
+ * resources it masters, so the report is of contention as seen from here.
+ */
+
+#define CRES_HASH 4096
+
+struct cres {
+	struct cres *next;
+	char name[65];
+	int master;			/* r_nodeid as last seen, -2 none */
+	int master_changes;
+	int seq;			/* the last sample seen in */
+	unsigned int samples;
+	unsigned int contended;		/* samples with locks waiting */
+	unsigned int waiters;		/* summed over samples */
+	unsigned int max_waiters;
+	unsigned int max_convert;
+	unsigned int replies;		/* summed over samples */
+	unsigned int wait_count;	/* waiting locks, summed */
+	unsigned long long wait_total;	/* their wait times, usec */
+	unsigned long long wait_max;
+	unsigned int cur_waiting;
+	unsigned int cur_convert;
+};
+
+/* nodeid 0 is this node */
+
+struct cnode {
+	int nodeid;
+	unsigned int contended;		/* contended resources mastered */
+	unsigned int waiters;		/* waiting locks on those */
+	unsigned int blocked;		/* waiting locks held by the node */
+	unsigned int replies;		/* replies expected from the node */
+	unsigned long long wait_max;
+};
+
+static struct cres *cres_hash[CRES_HASH];
+static int cres_count;
+static struct cnode cnodes[MAX_NODES];
+static int cnode_count;
+
+static struct cres *get_cres(char *name, int seq)
+{
+	struct cres *r;
+	unsigned int h = 0;
+	char *p;
+
+	for (p = name; *p; p++)
+		h = h * 31 + (unsigned char)*p;
+	h %= CRES_HASH;
+
+	for (r = cres_hash[h]; r; r = r->next) {
+		if (!strcmp(r->name, name))
+			goto found;
+	}
+
+	r = malloc(sizeof(struct cres));
+	if (!r) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(r, 0, sizeof(struct cres));
+	strncpy(r->name, name, sizeof(r->name) - 1);
+	r->master = -2;
+	r->next = cres_hash[h];
+	cres_hash[h] = r;
+	cres_count++;
+ found:
+	if (r->seq != seq) {
+		r->seq = seq;
+		r->samples++;
+		r->cur_waiting = 0;
+		r->cur_convert = 0;
+	}
+	return r;
+}
+
+static struct cnode *get_cnode(int nodeid)
+{
+	int i;
+
+	for (i = 0; i < cnode_count; i++) {
+		if (cnodes[i].nodeid == nodeid)
+			return &cnodes[i];
+	}
+
+	/* more nodes than we keep, leave them out */
+	if (cnode_count == MAX_NODES)
+		return NULL;
+
+	memset(&cnodes[cnode_count], 0, sizeof(struct cnode));
+	cnodes[cnode_count].nodeid = nodeid;
+	return &cnodes[cnode_count++];
+}
+
+/* the resource name between the first and last quotes of a _locks line */
+
+static int parse_quoted_name(char *line, char *name)
+{
+	char *begin, *end;
+	int len;
+
+	begin = strchr(line, '"');
+	end = strrchr(line, '"');
+	if (!begin || end == begin)
+		return -1;
+
+	len = end - begin - 1;
+	if (len > 64)
+		len = 64;
+	memcpy(name, begin + 1, len);
+	name[len] = '\0';
+	return 0;
+}
+
+static void sample_lock(char *line, int seq)
+{
+	struct cres *r;
+	struct cnode *n;
+	char r_name[65];
+	unsigned long long xid, time;
+	uint32_t id, remid, exflags, flags;
+	int nodeid, ownpid, status, grmode, rqmode, r_nodeid, r_len, owner;
+
+	sscanf(line, "%x %d %x %u %llu %x %x %d %d %d %llu %d %d",
+	       &id, &nodeid, &remid, &ownpid, &xid, &exflags, &flags,
+	       &status, &grmode, &rqmode, &time, &r_nodeid, &r_len);
+
+	if (parse_quoted_name(line, r_name) < 0) {
+		fprintf(stderr, "no resource name: %s", line);
+		return;
+	}
+
+	r = get_cres(r_name, seq);
+
+	if (r->master != r_nodeid) {
+		if (r->master != -2)
+			r->master_changes++;
+		r->master = r_nodeid;
+	}
+
+	if (status == DLM_LKSTS_WAITING)
+		r->cur_waiting++;
+	else if (status == DLM_LKSTS_CONVERT)
+		r->cur_convert++;
+	else
+		return;
+
+	/* time is usecs since the lock went on its current queue */
+	r->wait_count++;
+	r->wait_total += time;
+	if (time > r->wait_max)
+		r->wait_max = time;
+
+	/* on a resource we master, a lock with a nodeid is another node's;
+	   otherwise it's our own with the master's nodeid */
+	owner = r_nodeid ? 0 : nodeid;
+
+	n = get_cnode(owner);
+	if (n) {
+		n->blocked++;
+		if (time > n->wait_max)
+			n->wait_max = time;
+	}
+}
+
+static void sample_waiter(char *line, int seq)
+{
+	struct cres *r;
+	struct cnode *n;
+	char *p;
+	uint32_t id;
+	int wait_type, nodeid, off = 0;
+
+	/* one space before the name, which may begin with spaces */
+	sscanf(line, "%x %d %d%n", &id, &wait_type, &nodeid, &off);
+	if (line[off] == ' ')
+		off++;
+
+	p = strchr(line + off, '\n');
+	if (p)
+		*p = '\0';
+	if (strlen(line + off) > 64)
+		line[off + 64] = '\0';
+
+	r = get_cres(line + off, seq);
+	r->replies++;
+
+	n = get_cnode(nodeid);
+	if (n)
+		n->replies++;
+}
+
+/* A sample is the lines of the _locks file (after its header) and those
+   of the _waiters file, in one or more files; they're told apart by the
+   number of fields. */
+
+static void sample_file(FILE *file, int seq)
+{
+	char line[LOCK_LINE_MAX];
+	char rest[LOCK_LINE_MAX];
+	unsigned long long xid, time;
+	uint32_t id, remid, exflags, flags;
+	int nodeid, ownpid, status, grmode, rqmode, r_nodeid, r_len;
+	int rv;
+
+	while (fgets(line, LOCK_LINE_MAX, file)) {
+		if (!strncmp(line, "id ", 3))
+			continue;
+
+		rv = sscanf(line, "%x %d %x %u %llu %x %x %d %d %d %llu %d %d %s",
+			    &id, &nodeid, &remid, &ownpid, &xid, &exflags,
+			    &flags, &status, &grmode, &rqmode, &time,
+			    &r_nodeid, &r_len, rest);
+		if (rv == 14) {
+			sample_lock(line, seq);
+			continue;
+		}
+
+		rv = sscanf(line, "%x %d %d %s", &id, &status, &nodeid, rest);
+		if (rv == 4) {
+			sample_waiter(line, seq);
+			continue;
+		}
+
+		if (line[0] != '\n')
+			fprintf(stderr, "invalid debugfs line: %s", line);
+	}
+}
+
+/* fold the counts of a sample into the totals */
+
+static void end_sample(int seq)
+{
+	struct cres *r;
+	struct cnode *n;
+	unsigned int waiting;
+	int i;
+
+	for (i = 0; i < CRES_HASH; i++) {
+		for (r = cres_hash[i]; r; r = r->next) {
+			if (r->seq != seq)
+				continue;
+
+			waiting = r->cur_waiting + r->cur_convert;
+			if (!waiting)
+				continue;
+
+			r->contended++;
+			r->waiters += waiting;
+			if (waiting > r->max_waiters)
+				r->max_waiters = waiting;
+			if (r->cur_convert > r->max_convert)
+				r->max_convert = r->cur_convert;
+
+			if (r->master < 0)
+				continue;
+			n = get_cnode(r->master);
+			if (n) {
+				n->contended++;
+				n->waiters += waiting;
+			}
+		}
+	}
+}
+
+static int cres_compare(const void *va, const void *vb)
+{
+	const struct cres *a = *(const struct cres **)va;
+	const struct cres *b = *(const struct cres **)vb;
+
+	if (a->waiters != b->waiters)
+		return a->waiters > b->waiters ? -1 : 1;
+	if (a->replies != b->replies)
+		return a->replies > b->replies ? -1 : 1;
+	if (a->wait_max != b->wait_max)
+		return a->wait_max > b->wait_max ? -1 : 1;
+	return strcmp(a->name, b->name);
+}
+
+static int cnode_compare(const void *va, const void *vb)
+{
+	const struct cnode *a = va;
+	const struct cnode *b = vb;
+
+	if (a->waiters + a->blocked != b->waiters + b->blocked)
+		return a->waiters + a->blocked > b->waiters + b->blocked ? -1 : 1;
+	if (a->replies != b->replies)
+		return a->replies > b->replies ? -1 : 1;
+	return a->nodeid - b->nodeid;
+}
+
+static const char *pr_cnode(int nodeid)
+{
+	static char buf[16];
+
+	if (!nodeid)
+		return "local";
+	if (nodeid == -1)
+		return "lookup";
+	if (nodeid == -2)
+		return "-";	/* only seen in _waiters */
+	snprintf(buf, sizeof(buf), "%d", nodeid);
+	return buf;
+}
+
+static char *pr_cres_name(char *name)
+{
+	static char buf[140];
+	char *p;
+	int i;
+
+	for (p = name; *p; p++) {
+		if (!isprint((unsigned char)*p))
+			break;
+	}
+	if (!*p) {
+		snprintf(buf, sizeof(buf), "\"%s\"", name);
+		return buf;
+	}
+
+	strcpy(buf, "hex ");
+	for (i = 0; name[i]; i++)
+		sprintf(buf + 4 + i * 2, "%02x", (unsigned char)name[i]);
+	return buf;
+}
+
+static void print_contention(char *name, int samples)
+{
+	struct cres **list, *r;
+	struct cnode *n;
+	int i, count = 0;
+
+	printf("lockspace \"%s\" %d samples %d resources\n",
+	       name, samples, cres_count);
+
+	list = malloc((cres_count + 1) * sizeof(struct cres *));
+	if (!list) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < CRES_HASH; i++) {
+		for (r = cres_hash[i]; r; r = r->next) {
+			if (r->contended || r->replies)
+				list[count++] = r;
+		}
+	}
+	qsort(list, count, sizeof(struct cres *), cres_compare);
+
+	printf("\n");
+	printf("Contended resources: %d, top %d\n", count,
+	       count < top_count ? count : top_count);
+	printf("samples  waiters    max convert  wait avg ms  wait max ms"
+	       " replies master  resource\n");
+
+	for (i = 0; i < count && i < top_count; i++) {
+		r = list[i];
+		printf("%3u/%-3u %8.1f %6u %7u %12.1f %12.1f %7u %-6s%s %s\n",
+		       r->contended, samples,
+		       (double)r->waiters / samples,
+		       r->max_waiters, r->max_convert,
+		       r->wait_count ?
+		       (double)r->wait_total / r->wait_count / 1000 : 0.0,
+		       (double)r->wait_max / 1000,
+		       r->replies, pr_cnode(r->master),
+		       r->master_changes ? "*" : " ",
+		       pr_cres_name(r->name));
+	}
+	free(list);
+
+	qsort(cnodes, cnode_count, sizeof(struct cnode), cnode_compare);
+
+	printf("\n");
+	printf("Nodes\n");
+	printf("node    contended  waiters  blocked  wait max ms  replies\n");
+
+	for (i = 0; i < cnode_count; i++) {
+		n = &cnodes[i];
+		printf("%-6s %10u %8u %8u %12.1f %8u\n",
+		       pr_cnode(n->nodeid), n->contended, n->waiters,
+		       n->blocked, (double)n->wait_max / 1000, n->replies);
+	}
+
+	printf("\n");
+	printf("waiters: locks waiting or converting, per sample\n");
+	printf("master: * if it moved between samples\n");
+	printf("contended, waiters: on resources mastered by the node\n");
+	printf("blocked: the node's own locks waiting or converting\n");
+	printf("replies: replies expected, per resource or from the node\n");
+}
+
+static void free_contention(void)
+{
+	struct cres *r;
+	int i;
+
+	for (i = 0; i < CRES_HASH; i++) {
+		while ((r = cres_hash[i])) {
+			cres_hash[i] = r->next;
+			free(r);
+		}
+	}
+}
+
+static int sample_debugfs(char *name, int seq)
+{
+	FILE *file;
+	char path[PATH_MAX];
+
+	snprintf(path, PATH_MAX, "/sys/kernel/debug/dlm/%s_locks", name);
+
+	file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	sample_file(file, seq);
+	fclose(file);
+
+	snprintf(path, PATH_MAX, "/sys/kernel/debug/dlm/%s_waiters", name);
+
+	file = fopen(path, "r");
+	if (file) {
+		sample_file(file, seq);
+		fclose(file);
+	}
+	return 0;
+}
+
+static void do_contention(char *name)
+{
+	FILE *file;
+	int seq;
+
+	if (dump_file_count) {
+		for (seq = 1; seq <= dump_file_count; seq++) {
+			file = fopen(dump_files[seq - 1], "r");
+			if (!file) {
+				fprintf(stderr, "can't open %s: %s\n",
+					dump_files[seq - 1], strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			sample_file(file, seq);
+			fclose(file);
+			end_sample(seq);
+		}
+		print_contention(name, dump_file_count);
+		free_contention();
+		return;
+	}
+
+	for (seq = 1; seq <= sample_count; seq++) {
+		if (seq > 1)
+			sleep(sample_interval);
+		if (sample_debugfs(name, seq) < 0)
+			exit(EXIT_FAILURE);
+		end_sample(seq);
+	}
+	print_contention(name, sample_count);
+	free_contention();
+}
+
 static char *dlmc_lf_str(uint32_t flags)
 {
 	static char str[128];
@@ -1318,6 +1827,10 @@ int main(int argc, char **argv)
 	case OP_LOCKDEBUG:
 		do_lockdebug(lsname);
 		break;
+
+	case OP_CONTENTION:
+		do_contention(lsname);
+		break;
 	}
 	return 0;
 }
@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# Runs dlm_tool contention over saved _locks/_waiters samples and compares
+# the reports with the hand checked ones in <test>.expected.  Each test's
+# samples are <test>.1, <test>.2, ...
+#
+
+LANG=C
+LC_ALL=C
+export LANG LC_ALL
+
+TESTS="gfs idle"
+
+for t in $TESTS; do
+	echo -n "  Checking contention $t..."
+	../dlm_tool -t 5 contention $t $t.[0-9]* > $t.out 2>&1
+	if ! diff -u $t.expected $t.out; then
+		echo "FAILED"
+		exit 1
+	fi
+	rm -f $t.out
+	echo OK
+done
@@ -43,6 +43,9 @@
 static int running = 1;
 static int reload_key;
 
+/* Rewrite all checkpoint sections this often even if nothing changed */
+#define CKPT_RESYNC_INTERVAL 300
+
 #define LOG_DAEMON_NAME  "xvmd"
 #define LOG_MODE_DEFAULT LOG_MODE_OUTPUT_SYSLOG|LOG_MODE_OUTPUT_FILE
 static int log_mode_default = LOG_MODE_DEFAULT;
@@ -345,23 +348,6 @@ out:
 }
 
 
-static int
-virt_list_update(virConnectPtr vp, virt_list_t **vl, int my_id)
-{
-	virt_list_t *list = NULL;
-
-	list = vl_get(vp, my_id);
-	if (!list)
-		return -1;
-
-	if (*vl)
-		vl_free(*vl);
-	*vl = list;
-
-	return 0;
-}
-
-
 static int
 get_cman_ids(cman_handle_t ch, int *my_id, int *high_id)
 {
@@ -435,41 +421,64 @@ get_domain_state_ckpt(void *hp, unsigned char *domain, vm_state_t *state)
 }
 
 
-static void
-store_domains_by_name(void *hp, virt_list_t *vl)
+/*
+ * Refresh our list of local domains, (re)connecting to the hypervisor if
+ * needed.  The connection is kept open between calls; if it has gone bad
+ * it is closed and reopened once.  Only checkpoint sections for domains
+ * which have changed since the last call are rewritten, except after a
+ * reconnect or every CKPT_RESYNC_INTERVAL seconds, when all of them are.
+ */
+static int
+update_domains(void *h, virConnectPtr *vpp, virt_list_t **vl,
+	       fence_xvm_args_t *args, int my_id)
 {
-	int x;
+	static time_t last_resync = 0;
+	virt_list_t *new_vl = NULL;
+	int resync = 0, stored = 0, tries;
+	time_t now;
+
+	for (tries = 0; tries < 2; tries++) {
+		if (!*vpp) {
+			*vpp = virConnectOpen(args->uri);
+			if (!*vpp) {
+				logt_print(LOG_NOTICE, "NOTICE: virConnectOpen(): "
+					   "%s; cannot fence!\n", strerror(errno));
+				return -1;
+			}
+			resync = 1;
+		}
 
-	if (!vl)
-		return;
+		new_vl = vl_get(*vpp, my_id);
+		/* NULL with errno clear means no domains are running */
+		if (new_vl || !errno)
+			break;
 
-	for (x = 0; x < vl->vm_count; x++) {
-		if (!strcmp(DOMAIN0NAME, vl->vm_states[x].v_name))
-			continue;
-		dbg_printf(2, "Storing %s\n", vl->vm_states[x].v_name);
-		ckpt_write(hp, vl->vm_states[x].v_name, 
-			   &vl->vm_states[x].v_state,
-			   sizeof(vm_state_t));
+		logt_print(LOG_NOTICE, "NOTICE: Failed to list domains: %s; "
+			   "reconnecting\n", strerror(errno));
+		virConnectClose(*vpp);
+		*vpp = NULL;
 	}
-}
 
+	if (!*vpp)
+		return -1;
 
-static void
-store_domains_by_uuid(void *hp, virt_list_t *vl)
-{
-	int x;
+	now = time(NULL);
+	if (now - last_resync >= CKPT_RESYNC_INTERVAL)
+		resync = 1;
+	if (resync)
+		last_resync = now;
 
-	if (!vl)
-		return;
+	if (!(args->flags & F_NOCLUSTER))
+		stored = vl_store_changed(h, resync ? NULL : *vl, new_vl,
+					  args->flags & F_USE_UUID);
+	if (stored || resync)
+		vl_print(new_vl);
 
-	for (x = 0; x < vl->vm_count; x++) {
-		if (!strcmp(DOMAIN0UUID, vl->vm_states[x].v_uuid))
-			continue;
-		dbg_printf(2, "Storing %s\n", vl->vm_states[x].v_uuid);
-		ckpt_write(hp, vl->vm_states[x].v_uuid, 
-			   &vl->vm_states[x].v_state,
-			   sizeof(vm_state_t));
-	}
+	if (*vl)
+		vl_free(*vl);
+	*vl = new_vl;
+
+	return 0;
 }
 
 
@@ -571,25 +580,12 @@ xvmd_loop(cman_handle_t ch, void *h, int fd, fence_xvm_args_t *args,
 	virt_list_t *vl = NULL;
 	virt_state_t *dom = NULL;
 
-	vp = virConnectOpen(args->uri);
-  	if (!vp)
-		logt_print(LOG_ERR, "virConnectOpen failed: %s\n",
-			   strerror(errno));
-  
   	if (!(args->flags & F_NOCLUSTER))
   		get_cman_ids(ch, &my_id, NULL);
   
 	dbg_printf(1, "My Node ID = %d\n", my_id);
-	
-	if (vp) {
-		vl = vl_get(vp, my_id);
-		vl_print(vl);
-		virt_list_update(vp, &vl, my_id);
-		if (args->flags & F_USE_UUID) 
-			store_domains_by_uuid(h, vl);
-		else
-			store_domains_by_name(h, vl);
-	}
+
+	update_domains(h, &vp, &vl, args, my_id);
 
 	while (running) {
 		FD_ZERO(&rfds);
@@ -597,12 +593,6 @@ xvmd_loop(cman_handle_t ch, void *h, int fd, fence_xvm_args_t *args,
 		tv.tv_sec = 10;
 		tv.tv_usec = 0;
 
-		/* Close the connection */
-		if (vp) {
-			virConnectClose(vp);
-			vp = NULL;
-		}
-
 		if (reload_key) {
 			char temp_key[MAX_KEY_LEN];
 			int ret;
@@ -629,26 +619,11 @@ xvmd_loop(cman_handle_t ch, void *h, int fd, fence_xvm_args_t *args,
 		if (n < 0)
 			continue;
 	
-		/* Request and/or timeout: open connection */
-		vp = virConnectOpen(args->uri);
-		if (!vp) {
-			logt_print(LOG_NOTICE, "NOTICE: virConnectOpen(): "
-				   "%s; cannot fence!\n", strerror(errno));
+		/* Request and/or timeout: update list of VMs from
+		   libvirt and store any changes */
+		if (update_domains(h, &vp, &vl, args, my_id) < 0)
 			continue;
-		}
-			
-		/* Update list of VMs from libvirt. */
-		virt_list_update(vp, &vl, my_id);
-		vl_print(vl);
-
-		/* Store information here */
-		if (!(args->flags & F_NOCLUSTER)) {
-			if (args->flags & F_USE_UUID) 
-				store_domains_by_uuid(h, vl);
-			else
-				store_domains_by_name(h, vl);
-		}
-		
+
 		/* 
 		 * If no requests, we're done 
 		 */
@@ -714,6 +689,8 @@ xvmd_loop(cman_handle_t ch, void *h, int fd, fence_xvm_args_t *args,
 
 	cman_finish(ch);
 	
+	if (vl)
+		vl_free(vl);
 	if (vp) {
 		virConnectClose(vp);
 		vp = NULL;
@@ -0,0 +1,219 @@
+/*
+ * Exercise vl_get() and vl_store_changed() against a fake libvirt
+ * connection and a fake checkpoint, checking that only the sections of
+ * domains whose state or owner changed are rewritten.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libvirt/libvirt.h>
+
+#include "virt.h"
+#include "debug.h"
+
+#define MAX_FAKE_DOMAINS 512
+
+/* The fake hypervisor */
+struct fake_dom {
+	int id;
+	int running;
+	int state;
+	char name[MAX_DOMAINNAME_LENGTH];
+	char uuid[MAX_DOMAINNAME_LENGTH];
+};
+
+struct _virConnect {
+	int broken;
+	int ndoms;
+	struct fake_dom doms[MAX_FAKE_DOMAINS];
+};
+
+struct _virDomain {
+	struct fake_dom *dom;
+};
+
+static struct _virConnect hv;
+
+int
+virConnectNumOfDomains(virConnectPtr conn)
+{
+	int x, n = 0;
+
+	if (conn->broken)
+		return -1;
+	for (x = 0; x < conn->ndoms; x++)
+		if (conn->doms[x].running)
+			n++;
+	return n;
+}
+
+int
+virConnectListDomains(virConnectPtr conn, int *ids, int maxids)
+{
+	int x, n = 0;
+
+	for (x = 0; x < conn->ndoms && n < maxids; x++)
+		if (conn->doms[x].running)
+			ids[n++] = conn->doms[x].id;
+	return n;
+}
+
+virDomainPtr
+virDomainLookupByID(virConnectPtr conn, int id)
+{
+	virDomainPtr dp;
+	int x;
+
+	for (x = 0; x < conn->ndoms; x++) {
+		if (conn->doms[x].id != id || !conn->doms[x].running)
+			continue;
+		dp = malloc(sizeof(*dp));
+		dp->dom = &conn->doms[x];
+		return dp;
+	}
+	return NULL;
+}
+
+const char *
+virDomainGetName(virDomainPtr domain)
+{
+	return domain->dom->name;
+}
+
+int
+virDomainGetUUIDString(virDomainPtr domain, char *buf)
+{
+	strcpy(buf, domain->dom->uuid);
+	return 0;
+}
+
+int
+virDomainGetInfo(virDomainPtr domain, virDomainInfoPtr info)
+{
+	memset(info, 0, sizeof(*info));
+	info->state = domain->dom->state;
+	return 0;
+}
+
+int
+virDomainFree(virDomainPtr domain)
+{
+	free(domain);
+	return 0;
+}
+
+/* The fake checkpoint just counts writes */
+static int writes;
+static char last_section[MAX_DOMAINNAME_LENGTH];
+
+int
+ckpt_write(void *hp, char *secid, void *buf, size_t maxlen)
+{
+	writes++;
+	strncpy(last_section, secid, sizeof(last_section) - 1);
+	return 0;
+}
+
+
+static int failed;
+
+static void
+check(const char *desc, int got, int want)
+{
+	printf("%-40s %5d (want %5d) %s\n", desc, got, want,
+	       got == want ? "ok" : "FAIL");
+	if (got != want)
+		failed++;
+}
+
+static void
+add_domain(int n, int state)
+{
+	struct fake_dom *d = &hv.doms[hv.ndoms++];
+
+	d->id = n;
+	d->running = 1;
+	d->state = state;
+	snprintf(d->name, sizeof(d->name), "guest%04d", n);
+	snprintf(d->uuid, sizeof(d->uuid),
+		 "%08x-0000-0000-0000-000000000000", n + 1);
+}
+
+/* One pass of what fence_xvmd does in its main loop */
+static int
+pass(virt_list_t **vl, int use_uuid, int resync)
+{
+	virt_list_t *new_vl;
+	int before = writes;
+
+	new_vl = vl_get(&hv, 1);
+	vl_store_changed(NULL, resync ? NULL : *vl, new_vl, use_uuid);
+	if (*vl)
+		vl_free(*vl);
+	*vl = new_vl;
+
+	return writes - before;
+}
+
+static void
+run(int use_uuid)
+{
+	virt_list_t *vl = NULL;
+	int x;
+
+	printf("== sections by %s ==\n", use_uuid ? "uuid" : "name");
+
+	memset(&hv, 0, sizeof(hv));
+
+	/* Domain-0 is never stored */
+	add_domain(0, VIR_DOMAIN_RUNNING);
+	strcpy(hv.doms[0].name, DOMAIN0NAME);
+	strcpy(hv.doms[0].uuid, DOMAIN0UUID);
+
+	for (x = 1; x <= 300; x++)
+		add_domain(x, VIR_DOMAIN_RUNNING);
+
+	check("initial store", pass(&vl, use_uuid, 1), 300);
+	check("nothing changed", pass(&vl, use_uuid, 0), 0);
+	check("nothing changed again", pass(&vl, use_uuid, 0), 0);
+
+	hv.doms[10].state = VIR_DOMAIN_PAUSED;
+	hv.doms[200].state = VIR_DOMAIN_SHUTOFF;
+	check("two state changes", pass(&vl, use_uuid, 0), 2);
+	check("last section written",
+	      !strcmp(last_section, use_uuid ? hv.doms[200].uuid :
+				    hv.doms[200].name), 1);
+
+	hv.doms[50].running = 0;
+	hv.doms[51].running = 0;
+	check("two domains gone", pass(&vl, use_uuid, 0), 0);
+
+	add_domain(301, VIR_DOMAIN_RUNNING);
+	hv.doms[50].running = 1;
+	check("one new, one back", pass(&vl, use_uuid, 0), 2);
+
+	/* 301 guests, one still stopped */
+	check("resync", pass(&vl, use_uuid, 1), 300);
+
+	/* A dead connection is reported, not mistaken for no domains */
+	hv.broken = 1;
+	errno = 0;
+	check("broken connection", vl_get(&hv, 1) == NULL && errno != 0, 1);
+
+	vl_free(vl);
+}
+
+int
+main(int argc, char **argv)
+{
+	run(0);
+	run(1);
+
+	if (failed) {
+		printf("%d failed\n", failed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
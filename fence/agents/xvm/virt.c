@@ -195,6 +195,67 @@ vl_find_uuid(virt_list_t *vl, char *uuid)
 }
 
 
+/*
+   Write the checkpoint section of each domain in new_vl whose owner or
+   state differs from its entry in old_vl, or which has no entry there.
+   With no old_vl, every domain is written.  Domains which have gone away
+   are left alone so that their last owner is still known to the other
+   hosts.  Both lists are sorted by name, as returned by vl_get().
+
+   Returns the number of sections written.
+ */
+int
+vl_store_changed(void *hp, virt_list_t *old_vl, virt_list_t *new_vl,
+		 int use_uuid)
+{
+	virt_state_t *vs, *old_vs;
+	char *secid;
+	int x, o = 0, cmp, stored = 0;
+
+	if (!new_vl)
+		return 0;
+
+	for (x = 0; x < new_vl->vm_count; x++) {
+		vs = &new_vl->vm_states[x];
+
+		if (use_uuid) {
+			secid = vs->v_uuid;
+			if (!strcmp(DOMAIN0UUID, secid))
+				continue;
+		} else {
+			secid = vs->v_name;
+			if (!strcmp(DOMAIN0NAME, secid))
+				continue;
+		}
+
+		/* Walk the old list alongside the new one */
+		old_vs = NULL;
+		while (old_vl && o < old_vl->vm_count) {
+			cmp = _compare_virt(&old_vl->vm_states[o], vs);
+			if (cmp > 0)
+				break;
+			o++;
+			if (cmp == 0) {
+				old_vs = &old_vl->vm_states[o - 1];
+				break;
+			}
+		}
+
+		if (old_vs &&
+		    !strcmp(old_vs->v_uuid, vs->v_uuid) &&
+		    old_vs->v_state.s_owner == vs->v_state.s_owner &&
+		    old_vs->v_state.s_state == vs->v_state.s_state)
+			continue;
+
+		dbg_printf(2, "Storing %s\n", secid);
+		ckpt_write(hp, secid, &vs->v_state, sizeof(vm_state_t));
+		stored++;
+	}
+
+	return stored;
+}
+
+
 void
 vl_free(virt_list_t *old)
 {
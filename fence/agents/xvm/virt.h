@@ -47,6 +47,8 @@ int vl_cmp(virt_list_t *left, virt_list_t *right);
 
 void vl_print(virt_list_t *vl);
 void vl_free(virt_list_t *old);
+int vl_store_changed(void *hp, virt_list_t *old_vl, virt_list_t *new_vl,
+		     int use_uuid);
 virt_state_t * vl_find_uuid(virt_list_t *vl, char *name);
 virt_state_t * vl_find_name(virt_list_t *vl, char *name);
 
@@ -104,6 +104,8 @@ static const char *fe_str(int r)
 		return "error config method";
 	case FE_READ_DEVICE:
 		return "error config device";
+	case FE_AGENT_TIMEOUT:
+		return "error agent timeout";
 	default:
 		return "error unknown";
 	}
@@ -192,10 +194,16 @@ int main(int argc, char *argv[])
 	}
 
 	for (i = 0; i < flog_count; i++) {
-		fprintf(stderr, "%s %s dev %d.%d agent %s result: %s\n",
+		fprintf(stderr, "%s %s dev %d.%d agent %s result: %s time %ums\n",
 			action, victim, flog[i].method_num, flog[i].device_num,
 			flog[i].agent_name[0] ? flog[i].agent_name : "none",
-			fe_str(flog[i].error));
+			fe_str(flog[i].error), flog[i].duration);
+
+		if (flog[i].error != FE_AGENT_SUCCESS &&
+		    flog[i].agent_output[0])
+			fprintf(stderr, "agent output: %s%s", flog[i].agent_output,
+				flog[i].agent_output[strlen(flog[i].agent_output) - 1]
+				== '\n' ? "" : "\n");
 
 		if (verbose < 2)
 			continue;
@@ -19,6 +19,7 @@
 #include "ccs.h"
 #include "copyright.cf"
 #include "libcman.h"
+#include "libfence.h"
 #include "libfenced.h"
 
 #define OP_JOIN  			1
@@ -523,6 +524,56 @@ static const char *how_str(int how)
 	return "unknown";
 }
 
+static const char *result_str(int result)
+{
+	switch (result) {
+	case FE_AGENT_SUCCESS:
+		return "success";
+	case FE_AGENT_TIMEOUT:
+		return "timeout";
+	}
+	return "error";
+}
+
+static void print_attempts(void)
+{
+	struct fenced_attempt *attempts, *ap;
+	int count = 0;
+	int rv, i, c;
+
+	attempts = malloc(FENCED_ATTEMPTS_MAX * sizeof(struct fenced_attempt));
+	if (!attempts)
+		return;
+	memset(attempts, 0, FENCED_ATTEMPTS_MAX * sizeof(struct fenced_attempt));
+
+	rv = fenced_fence_attempts(FENCED_ATTEMPTS_MAX, &count, attempts);
+	if (rv < 0 || count <= 0)
+		goto out;
+
+	printf("fence attempts\n");
+
+	ap = attempts;
+	for (i = 0; i < count; i++) {
+		printf("nodeid %d dev %d.%d agent %s result %s time %ums at %llu\n",
+		       ap->nodeid, ap->method_num, ap->device_num,
+		       ap->agent_name[0] ? ap->agent_name : "none",
+		       result_str(ap->result), ap->duration,
+		       (unsigned long long)ap->time);
+
+		if (ap->result != FE_AGENT_SUCCESS && ap->agent_output[0]) {
+			for (c = 0; ap->agent_output[c]; c++) {
+				if (ap->agent_output[c] == '\n')
+					ap->agent_output[c] = ' ';
+			}
+			printf("  output: %s\n", ap->agent_output);
+		}
+		ap++;
+	}
+	printf("\n");
+ out:
+	free(attempts);
+}
+
 static int do_list(void)
 {
 	struct fenced_domain d;
@@ -589,6 +640,8 @@ static int do_list(void)
 		np++;
 	}
 	printf("\n");
+
+	print_attempts();
 	exit(EXIT_SUCCESS);
  fail:
 	fprintf(stderr, "fenced query error %d\n", rv);
@@ -609,7 +662,8 @@ static void print_usage(void)
 	printf("  dump		   Dump debug buffer from fenced\n");
 	printf("\n");
 	printf("Options:\n");
-	printf("  -n               Show all node information in ls\n");
+	printf("  -n               Show all node information and recent fence\n");
+	printf("                   agent attempts in ls\n");
 
 	printf("  -t <seconds>     Retry cman connection for <seconds>.\n");
 	printf("                   Default %d.  0 no retry, -1 indefinite retry.\n",
@@ -25,6 +25,9 @@ int cfgd_post_join_delay = DEFAULT_POST_JOIN_DELAY;
 int cfgd_post_fail_delay = DEFAULT_POST_FAIL_DELAY;
 int cfgd_override_time   = DEFAULT_OVERRIDE_TIME;
 const char *cfgd_override_path = DEFAULT_OVERRIDE_PATH;
+int cfgd_retry_min       = DEFAULT_RETRY_MIN;
+int cfgd_retry_max       = DEFAULT_RETRY_MAX;
+int cfgd_retry_jitter    = DEFAULT_RETRY_JITTER;
 
 void read_ccs_name(const char *path, char *name)
 {
@@ -89,6 +92,9 @@ void read_ccs_int(const char *path, int *config_val)
 #define POST_FAIL_DELAY_PATH "/cluster/fence_daemon/@post_fail_delay"
 #define OVERRIDE_PATH_PATH "/cluster/fence_daemon/@override_path"
 #define OVERRIDE_TIME_PATH "/cluster/fence_daemon/@override_time"
+#define RETRY_MIN_PATH "/cluster/fence_daemon/@retry_min"
+#define RETRY_MAX_PATH "/cluster/fence_daemon/@retry_max"
+#define RETRY_JITTER_PATH "/cluster/fence_daemon/@retry_jitter"
 #define METHOD_NAME_PATH "/cluster/clusternodes/clusternode[@name=\"%s\"]/fence/method[%d]/@name"
 
 static int count_methods(char *victim)
@@ -118,6 +124,12 @@ void reread_ccs(void)
 		read_ccs_int(POST_FAIL_DELAY_PATH, &cfgd_post_fail_delay);
 	if (!optd_override_time)
 		read_ccs_int(OVERRIDE_TIME_PATH, &cfgd_override_time);
+
+	read_ccs_int(RETRY_MIN_PATH, &cfgd_retry_min);
+	read_ccs_int(RETRY_MAX_PATH, &cfgd_retry_max);
+	read_ccs_int(RETRY_JITTER_PATH, &cfgd_retry_jitter);
+	if (cfgd_retry_jitter > 100)
+		cfgd_retry_jitter = 100;
 }
 
 /* called when the domain is joined, not when the daemon starts */
@@ -9,6 +9,9 @@
 #define DEFAULT_POST_FAIL_DELAY 0
 #define DEFAULT_OVERRIDE_TIME 3
 #define DEFAULT_OVERRIDE_PATH "/var/run/cluster/fenced_override"
+#define DEFAULT_RETRY_MIN 5
+#define DEFAULT_RETRY_MAX 60
+#define DEFAULT_RETRY_JITTER 20
 
 extern int optd_groupd_compat;
 extern int optd_debug_logfile;
@@ -27,6 +30,9 @@ extern int cfgd_post_join_delay;
 extern int cfgd_post_fail_delay;
 extern int cfgd_override_time;
 extern const char *cfgd_override_path;
+extern int cfgd_retry_min;
+extern int cfgd_retry_max;
+extern int cfgd_retry_jitter;
 
 #endif
 
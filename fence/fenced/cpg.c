@@ -425,7 +425,7 @@ void node_history_fence(struct fd *fd, int victim, int master, int how,
    libfenced:fence_external(victim) to tell fenced what it's done, so fenced
    can avoid fencing the node a second time.  This will result in a message
    being sent to all domain members which will update their node_history entry
-   for the victim.  The recover.c:fence_victims() code can check whether
+   for the victim.  The recover.c:fence_victim() code can check whether
    a victim has been externally fenced since the last add_time, and if so
    skip the fencing.  This won't always work perfectly; a node might in some
    circumstances be fenced a second time by fenced. */
@@ -514,7 +514,7 @@ void send_external(struct fd *fd, int victim)
 }
 
 /* now, if the victim dies and the fence domain sees it fail,
-   it will be added as an fd victim, but fence_victims() will
+   it will be added as an fd victim, but fence_victim() will
    call is_fenced_external() which will see that it's already
    fenced and bypass fencing it again */
 
@@ -630,8 +630,8 @@ static void receive_victim_done(struct fd *fd, struct fd_header *hd, int len)
 		nodeh->fence_time_local = time(NULL);
 
 	if (hd->nodeid == our_nodeid) {
-		/* sanity check, I don't think this should happen;
-		   see comment in fence_victims() */
+		/* sanity check, we set local_victim_done when we
+		   sent this; see fencing_done() */
 		if (!node->local_victim_done)
 			log_error("expect local_victim_done");
 		node->local_victim_done = 0;
@@ -644,6 +644,8 @@ static void receive_victim_done(struct fd *fd, struct fd_header *hd, int len)
 
 	list_del(&node->list);
 	free(node);
+
+	notify_subscribers(id->nodeid);
 }
 
 static int check_quorum_done(struct fd *fd)
@@ -1049,6 +1051,8 @@ static void receive_complete(struct fd *fd, struct fd_header *hd, int len)
 		list_del(&node->list);
 		free(node);
 	}
+
+	notify_subscribers(0);
 }
 
 static int count_ids(struct fd *fd)
@@ -1210,10 +1214,13 @@ static void add_victims(struct fd *fd, struct change *cg)
    init_victims from startup init, and it sets init_complete so it will
    volunteer to be master in the next round by setting COMPLETE flag.
 
-   once the master begins fencing victims, it won't process any new changes
-   until it's done.  the non-master members will process changes while the
-   master is fencing, but will wait for the master to catch up in
-   WAIT_MESSAGES.  if the master fails, the others will no longer wait for it.*/
+   the master fences victims from the main loop (WAIT_FENCING), so it goes
+   on processing changes while it waits out a delay or a retry.  a new
+   change replaces the one being fenced for, and fencing continues, with
+   the victims and their retry state kept on fd->victims, once that change
+   reaches WAIT_FENCING in its turn (possibly on a new master).  the
+   non-master members will wait for the master to catch up in WAIT_MESSAGES.
+   if the master fails, the others will no longer wait for it.*/
 
 static void apply_changes(struct fd *fd)
 {
@@ -1233,23 +1240,31 @@ static void apply_changes(struct fd *fd)
 		break;
 
 	case CGST_WAIT_MESSAGES:
-		if (wait_messages_done(fd)) {
-			our_protocol.dr_ver.flags |= PV_STATEFUL;
-			set_master(fd);
-			cg->state = CGST_WAIT_FENCING;  /* for queries */
-
-			if (fd->master == our_nodeid) {
-				delay_fencing(fd, nodes_added(fd));
-				fence_victims(fd);
-				send_complete(fd);
-				fd->local_init_complete = 1;
-			} else {
-				defer_fencing(fd);
-			}
+		if (!wait_messages_done(fd))
+			break;
 
+		our_protocol.dr_ver.flags |= PV_STATEFUL;
+		set_master(fd);
+		cg->state = CGST_WAIT_FENCING;
+
+		if (fd->master != our_nodeid) {
+			defer_fencing(fd);
 			cleanup_changes(fd);
 			fd->joining_group = 0;
+			break;
 		}
+
+		start_fencing(fd, nodes_added(fd));
+		/* fall through */
+
+	case CGST_WAIT_FENCING:
+		if (!fencing_done(fd))
+			break;
+
+		send_complete(fd);
+		fd->local_init_complete = 1;
+		cleanup_changes(fd);
+		fd->joining_group = 0;
 		break;
 
 	default:
@@ -1267,6 +1282,23 @@ void process_fd_changes(void)
 	}
 }
 
+/* called from the main loop each time it wakes up: a victim may have
+   rejoined the cluster, or a delay or retry may be due */
+
+void process_fd_fencing(void)
+{
+	struct fd *fd, *safe;
+	struct change *cg;
+
+	list_for_each_entry_safe(fd, safe, &domains, list) {
+		if (!fd->fencing || list_empty(&fd->changes))
+			continue;
+		cg = list_first_entry(&fd->changes, struct change, list);
+		if (cg->state == CGST_WAIT_FENCING)
+			apply_changes(fd);
+	}
+}
+
 static int add_change(struct fd *fd,
 		      const struct cpg_address *member_list,
 		      size_t member_list_entries,
@@ -1432,6 +1464,7 @@ static void confchg_cb_domain(cpg_handle_t handle,
 		client_dead(fd->cpg_client);
 		list_del(&fd->list);
 		free_fd(fd);
+		notify_subscribers(0);
 		return;
 	}
 
@@ -1441,6 +1474,10 @@ static void confchg_cb_domain(cpg_handle_t handle,
 	if (rv)
 		return;
 
+	/* fencing for the previous change stops until this one is started */
+
+	fd->fencing = 0;
+
 	/* failed nodes in this change become victims */
 
 	add_victims(fd, cg);
@@ -1453,6 +1490,8 @@ static void confchg_cb_domain(cpg_handle_t handle,
 	if (cg->we_joined)
 		add_victims_init(fd, cg);
 
+	notify_subscribers(0);
+
 	apply_changes(fd);
 }
 
@@ -2110,8 +2149,8 @@ int is_clean_daemon_member(int nodeid)
 	struct node_daemon *node;
 
 	/* process confchg's and protocol messages for daemon cpg,
-	   need to dispatch here because this is called from fence_victims()
-	   outside the poll() loop */
+	   need to dispatch here because this is called while fencing,
+	   before poll() may have reported them */
 
 	cpg_dispatch(cpg_handle_daemon, CPG_DISPATCH_ALL);
 
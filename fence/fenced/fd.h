@@ -110,7 +110,7 @@ struct fd_header {
 
 #define CGST_WAIT_CONDITIONS	1
 #define CGST_WAIT_MESSAGES	2
-#define CGST_WAIT_FENCING	3	/* for queries */
+#define CGST_WAIT_FENCING	3	/* master fencing victims */
 
 struct change {
 	struct list_head list;
@@ -153,9 +153,17 @@ struct node {
 	int			nodeid;
 	int			init_victim;
 	int			local_victim_done;
+	int			retries;	/* failed fencing attempts */
+	uint64_t		next_try;	/* now_ms() of next attempt */
+	uint32_t		fail_sig;	/* how the last attempt failed */
 	char 			name[MAX_NODENAME_LEN+1];
 };
 
+/* fd fencing */
+
+#define FENCING_DELAY		1	/* post_join/fail_delay */
+#define FENCING_VICTIMS		2
+
 struct fd {
 	struct list_head	list;
 	char 			name[MAX_GROUPNAME_LEN+1];
@@ -182,6 +190,15 @@ struct fd {
 	struct list_head 	victims;
 	struct list_head	complete;
 
+	/* master fencing victims */
+
+	int			fencing;	/* FENCING_ */
+	int			delay;		/* secs, -1 for no limit */
+	const char		*delay_type;
+	int			delay_victims;
+	uint64_t		delay_first;	/* now_ms() */
+	uint64_t		delay_start;	/* restarted as victims rejoin */
+
 	/* libgroup domain membership */
 
 	int 			last_stop;
@@ -217,6 +234,7 @@ void send_external(struct fd *fd, int victim);
 int is_fenced_external(struct fd *fd, int nodeid);
 void send_victim_done(struct fd *fd, int victim);
 void process_fd_changes(void);
+void process_fd_fencing(void);
 int fd_join(struct fd *fd);
 int fd_leave(struct fd *fd);
 int set_node_info(struct fd *fd, int nodeid, struct fenced_node *node);
@@ -249,6 +267,8 @@ struct fd *find_fd(char *name);
 void query_lock(void);
 void query_unlock(void);
 void cluster_dead(int ci);
+uint64_t now_ms(void);
+void notify_subscribers(int nodeid);
 
 /* member_cman.c */
 
@@ -268,9 +288,13 @@ void free_node_list(struct list_head *head);
 void add_complete_node(struct fd *fd, int nodeid);
 int list_count(struct list_head *head);
 int is_victim(struct fd *fd, int nodeid);
-void delay_fencing(struct fd *fd, int node_join);
+void start_fencing(struct fd *fd, int node_join);
+int fencing_done(struct fd *fd);
+int fencing_timeout(struct fd *fd);
+int fence_poll_timeout(void);
+void fence_victims_wait(struct fd *fd, int node_join);
 void defer_fencing(struct fd *fd);
-void fence_victims(struct fd *fd);
+int set_fence_attempts(int *attempt_count, struct fenced_attempt **attempts);
 
 /* logging.c */
 
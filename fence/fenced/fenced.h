@@ -20,6 +20,8 @@
 #define FENCED_CMD_NODE_INFO		5
 #define FENCED_CMD_DOMAIN_INFO		6
 #define FENCED_CMD_DOMAIN_NODES		7
+#define FENCED_CMD_FENCE_ATTEMPTS	8
+#define FENCED_CMD_NOTIFY		9
 
 struct fenced_header {
 	unsigned int magic;
@@ -310,8 +310,7 @@ void process_groupd(int ci)
 		add_victims(fd, cb_type, cb_member_count, cb_members);
 		set_master(fd);
 		if (fd->master == our_nodeid) {
-			delay_fencing(fd, cb_type == GROUP_NODE_JOIN);
-			fence_victims(fd);
+			fence_victims_wait(fd, cb_type == GROUP_NODE_JOIN);
 		} else {
 			defer_fencing(fd);
 		}
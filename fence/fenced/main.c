@@ -419,6 +419,138 @@ static void query_domain_nodes(int f, int option, int max)
 		free(nodes);
 }
 
+static void query_fence_attempts(int f, int max)
+{
+	int attempt_count = 0;
+	struct fenced_attempt *attempts = NULL;
+	int rv, result;
+
+	rv = set_fence_attempts(&attempt_count, &attempts);
+	if (rv < 0) {
+		result = rv;
+		attempt_count = 0;
+		goto out;
+	}
+
+	/* the most recent attempts are at the end */
+
+	if (attempt_count > max) {
+		result = -E2BIG;
+		memmove(attempts, attempts + (attempt_count - max),
+			max * sizeof(struct fenced_attempt));
+		attempt_count = max;
+	} else {
+		result = attempt_count;
+	}
+ out:
+	do_reply(f, FENCED_CMD_FENCE_ATTEMPTS, result, (char *)attempts,
+		 attempt_count * sizeof(struct fenced_attempt));
+
+	if (attempts)
+		free(attempts);
+}
+
+/* Daemons that wait for fencing (dlm_controld) subscribe for notifications
+   (fenced_notify_connect) instead of querying node and domain info until a
+   victim is done.  Each one is the domain info and the info for one node,
+   nodeid 0 if it's not about a particular node.  A subscriber that doesn't
+   keep up is dropped, and goes back to querying. */
+
+static void process_subscriber(int ci)
+{
+	char buf[64];
+	int rv;
+
+	/* nothing is sent after FENCED_CMD_NOTIFY, so this is a close */
+
+	rv = read(client[ci].fd, buf, sizeof(buf));
+	if (rv > 0 || (rv < 0 && (errno == EINTR || errno == EAGAIN)))
+		return;
+
+	log_debug("subscriber %d closed", ci);
+	client_dead(ci);
+}
+
+static void send_notify(int ci, int nodeid)
+{
+	char msg[sizeof(struct fenced_header) + sizeof(struct fenced_domain) +
+		 sizeof(struct fenced_node)];
+	struct fenced_header *h = (struct fenced_header *)msg;
+	struct fenced_domain *domain;
+	struct fenced_node *node;
+	struct fd *fd;
+	int rv;
+
+	/* dropped while being sent the initial state */
+	if (client[ci].fd < 0)
+		return;
+
+	memset(msg, 0, sizeof(msg));
+	domain = (struct fenced_domain *)(msg + sizeof(struct fenced_header));
+	node = (struct fenced_node *)((char *)domain + sizeof(*domain));
+
+	fd = find_fd(default_name);
+	if (!fd) {
+		rv = -ENOENT;
+		goto out;
+	}
+
+	domain->group_mode = group_mode;
+	rv = set_domain_info(fd, domain);
+	if (!rv && nodeid)
+		rv = set_node_info(fd, nodeid, node);
+ out:
+	init_header(h, FENCED_CMD_NOTIFY, rv,
+		    sizeof(msg) - sizeof(struct fenced_header));
+	h->option = nodeid;
+
+	if (do_write(client[ci].fd, msg, sizeof(msg)) < 0) {
+		log_error("subscriber %d dropped", ci);
+		client_dead(ci);
+	}
+}
+
+static int do_subscribe(int ci)
+{
+	struct fd *fd;
+	struct node_history *node;
+	int flags;
+
+	if (group_mode == GROUP_LIBGROUP) {
+		do_reply(client[ci].fd, FENCED_CMD_NOTIFY, -ENOSYS, NULL,
+			 sizeof(struct fenced_domain) +
+			 sizeof(struct fenced_node));
+		return -ENOSYS;
+	}
+
+	flags = fcntl(client[ci].fd, F_GETFL, 0);
+	fcntl(client[ci].fd, F_SETFL, flags | O_NONBLOCK);
+	client[ci].workfn = process_subscriber;
+
+	log_debug("subscriber %d fd %d", ci, client[ci].fd);
+
+	/* start the subscriber off with everything we know */
+
+	fd = find_fd(default_name);
+	if (fd) {
+		list_for_each_entry(node, &fd->node_history, list)
+			send_notify(ci, node->nodeid);
+	}
+	send_notify(ci, 0);
+	return 0;
+}
+
+void notify_subscribers(int nodeid)
+{
+	int i;
+
+	for (i = 0; i <= client_maxi; i++) {
+		if (client[i].fd >= 0 &&
+		    client[i].workfn == (void *)process_subscriber)
+			send_notify(i, nodeid);
+	}
+}
+
 static void process_connection(int ci)
 {
 	struct fenced_header h;
@@ -468,10 +600,16 @@ static void process_connection(int ci)
 	case FENCED_CMD_EXTERNAL:
 		do_external(default_name, extra, extra_len);
 		break;
+	case FENCED_CMD_NOTIFY:
+		/* the connection stays open */
+		if (!do_subscribe(ci))
+			goto out_keep;
+		break;
 	case FENCED_CMD_DUMP_DEBUG:
 	case FENCED_CMD_NODE_INFO:
 	case FENCED_CMD_DOMAIN_INFO:
 	case FENCED_CMD_DOMAIN_NODES:
+	case FENCED_CMD_FENCE_ATTEMPTS:
 		log_error("process_connection query on wrong socket");
 		break;
 	default:
@@ -479,9 +617,10 @@ static void process_connection(int ci)
 			  ci, h.command);
 	}
  out:
+	client_dead(ci);
+ out_keep:
 	if (extra)
 		free(extra);
-	client_dead(ci);
 }
 
 static void process_listener(int ci)
@@ -592,6 +731,9 @@ static void *process_queries(void *arg)
 		case FENCED_CMD_DOMAIN_NODES:
 			query_domain_nodes(f, h.option, h.data);
 			break;
+		case FENCED_CMD_FENCE_ATTEMPTS:
+			query_fence_attempts(f, h.data);
+			break;
 		default:
 			break;
 		}
@@ -687,7 +829,8 @@ static int check_controlled_dir(char *path)
    to notify others that we have no uncontrolled gfs/dlm objects.
    (Conceptually, we could use the fence domain cpg for this purpose instead,
    but that would require processing domain membership changes during
-   fence_victims(), which would be a major change in the way the daemon works.)
+   fencing without starting a new cycle for each, which would be a major
+   change in the way the daemon works.)
 
    So, if we (the local node) are *not* in a clean state, we don't join the
    daemon cpg and we exit; we still need to be fenced.  If we are starting
@@ -718,6 +861,16 @@ static int check_uncontrolled_entries(void)
 	return 0;
 }
 
+/* for fencing delays and retries, unaffected by changes to the clock */
+
+uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void cluster_dead(int ci)
 {
 	if (!cluster_down)
@@ -794,7 +947,7 @@ static void loop(void)
 	}
 
 	for (;;) {
-		rv = poll(pollfd, client_maxi + 1, -1);
+		rv = poll(pollfd, client_maxi + 1, fence_poll_timeout());
 		if (rv == -1 && errno == EINTR) {
 			if (daemon_quit && list_empty(&domains))
 				goto out;
@@ -820,6 +973,9 @@ static void loop(void)
 				deadfn(i);
 			}
 		}
+
+		if (group_mode == GROUP_LIBCPG)
+			process_fd_fencing();
 		query_unlock();
 
 		if (daemon_quit)
@@ -1041,6 +1197,7 @@ int main(int argc, char **argv)
 	log_level(LOG_INFO, "fenced %s started", RELEASE_VERSION);
 	signal(SIGTERM, sigterm_handler);
 	set_oom_adj(-16);
+	srandom(time(NULL) ^ getpid());	/* fencing retry jitter */
 
 	loop();
 
@@ -62,18 +62,22 @@ static void victim_done(struct fd *fd, int victim, int how)
 static int reduce_victims(struct fd *fd)
 {
 	struct node *node, *safe;
-	int num_victims;
+	int num_victims, nodeid;
 
 	num_victims = list_count(&fd->victims);
 
 	list_for_each_entry_safe(node, safe, &fd->victims, list) {
+		if (node->local_victim_done)
+			continue;
 		if (is_cluster_member_reread(node->nodeid) &&
 		    is_clean_daemon_member(node->nodeid)) {
 			log_debug("reduce victim %s", node->name);
-			victim_done(fd, node->nodeid, VIC_DONE_MEMBER);
+			nodeid = node->nodeid;
+			victim_done(fd, nodeid, VIC_DONE_MEMBER);
 			list_del(&node->list);
 			free(node);
 			num_victims--;
+			notify_subscribers(nodeid);
 		}
 	}
 
@@ -165,74 +169,89 @@ static int check_override(int ofd, char *nodename, int timeout)
 	return rv;
 }
 
-/* If there are victims after a node has joined, it's a good indication that
-   they may be joining the cluster shortly.  If we delay a bit they might
-   become members and we can avoid fencing them.  This is only really an issue
-   when the fencing method reboots the victims.  Otherwise, the nodes should
-   unfence themselves when they start up. */
+/* The master fences victims from the main loop (libcpg mode).
+   start_fencing() is called when the master is picked for a change, and
+   fencing_done() each time the daemon wakes up after that until it returns
+   1.  Nothing here sleeps between checks: fence_poll_timeout() tells the
+   main loop when the next delay ends or retry is due, and cman and daemon
+   cpg membership changes wake it up sooner, so a delay ends as soon as the
+   last victim rejoins. */
 
-void delay_fencing(struct fd *fd, int node_join)
+static void end_delay(struct fd *fd, int victim_count)
 {
-	struct timeval first, last, start, now;
-	int victim_count, last_count = 0, delay = 0;
 	struct node *node;
-	const char *delay_type;
 
-	if (list_empty(&fd->victims))
-		return;
+	if (fd->delay)
+		log_debug("delay of %ds leaves %d victims",
+			  (int) ((now_ms() - fd->delay_first) / 1000),
+			  victim_count);
 
-	if (node_join) {
-		delay = cfgd_post_join_delay;
-		delay_type = "post_join_delay";
-	} else {
-		delay = cfgd_post_fail_delay;
-		delay_type = "post_fail_delay";
+	list_for_each_entry(node, &fd->victims, list) {
+		log_debug("%s not a cluster member after %d sec %s",
+		          node->name, fd->delay, fd->delay_type);
 	}
 
-	if (delay == 0)
-		goto out;
+	fd->fencing = FENCING_VICTIMS;
+}
 
-	gettimeofday(&first, NULL);
-	gettimeofday(&start, NULL);
+/* If there are victims after a node has joined, it's a good indication that
+   they may be joining the cluster shortly.  If we delay a bit they might
+   become members and we can avoid fencing them.  This is only really an issue
+   when the fencing method reboots the victims.  Otherwise, the nodes should
+   unfence themselves when they start up. */
 
-	for (;;) {
-		query_unlock();
-		sleep(1);
-		query_lock();
+static int delay_done(struct fd *fd)
+{
+	uint64_t now = now_ms();
+	int victim_count;
 
-		victim_count = reduce_victims(fd);
+	victim_count = reduce_victims(fd);
 
-		if (victim_count == 0)
-			break;
+	if (victim_count == 0) {
+		end_delay(fd, 0);
+		return 1;
+	}
 
-		if (victim_count < last_count) {
-			gettimeofday(&start, NULL);
-			if (delay > 0 && cfgd_post_join_delay > delay) {
-				delay = cfgd_post_join_delay;
-				delay_type = "post_join_delay (modified)";
-			}
+	if (victim_count < fd->delay_victims) {
+		fd->delay_start = now;
+		if (fd->delay > 0 && cfgd_post_join_delay > fd->delay) {
+			fd->delay = cfgd_post_join_delay;
+			fd->delay_type = "post_join_delay (modified)";
 		}
+	}
 
-		last_count = victim_count;
+	fd->delay_victims = victim_count;
 
-		/* negative delay means wait forever */
-		if (delay == -1)
-			continue;
+	/* negative delay means wait forever */
+	if (fd->delay == -1)
+		return 0;
 
-		gettimeofday(&now, NULL);
-		if (now.tv_sec - start.tv_sec >= delay)
-			break;
-	}
+	if (now - fd->delay_start < (uint64_t)fd->delay * 1000)
+		return 0;
 
-	gettimeofday(&last, NULL);
+	end_delay(fd, victim_count);
+	return 1;
+}
 
-	log_debug("delay of %ds leaves %d victims",
-		  (int) (last.tv_sec - first.tv_sec), victim_count);
- out:
-	list_for_each_entry(node, &fd->victims, list) {
-		log_debug("%s not a cluster member after %d sec %s",
-		          node->name, delay, delay_type);
+void start_fencing(struct fd *fd, int node_join)
+{
+	if (node_join) {
+		fd->delay = cfgd_post_join_delay;
+		fd->delay_type = "post_join_delay";
+	} else {
+		fd->delay = cfgd_post_fail_delay;
+		fd->delay_type = "post_fail_delay";
 	}
+
+	fd->delay_victims = 0;
+	fd->delay_first = now_ms();
+	fd->delay_start = fd->delay_first;
+	fd->fencing = FENCING_DELAY;
+
+	if (list_empty(&fd->victims))
+		fd->fencing = FENCING_VICTIMS;
+	else if (fd->delay == 0)
+		end_delay(fd, list_count(&fd->victims));
 }
 
 void defer_fencing(struct fd *fd)
@@ -271,6 +290,8 @@ static const char *fe_str(int r)
 		return "error config method"; 
 	case FE_READ_DEVICE:
 		return "error config device"; 
+	case FE_AGENT_TIMEOUT:
+		return "error agent timeout";
 	default:
 		return "error unknown";
 	}
@@ -278,125 +299,261 @@ static const char *fe_str(int r)
 
 #define FL_SIZE 32
 static struct fence_log flog[FL_SIZE];
-static struct fence_log prev_flog[FL_SIZE];
 
-void fence_victims(struct fd *fd)
+/* recent agent runs for all victims, for queries */
+static struct fenced_attempt attempts[FENCED_ATTEMPTS_MAX];
+static int attempts_next;
+static int attempts_count;
+
+static void save_attempts(struct node *node, struct fence_log *log, int count)
 {
-	struct node *node;
-	int error, i, ll, flog_count, prev_flog_count;
-	int override = -1;
-	int cluster_member, cpg_member, ext;
-	unsigned int limit, retries;
+	struct fenced_attempt *at;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		at = &attempts[attempts_next];
+		memset(at, 0, sizeof(struct fenced_attempt));
+
+		at->nodeid = node->nodeid;
+		at->method_num = log[i].method_num;
+		at->device_num = log[i].device_num;
+		at->result = log[i].error;
+		at->agent_timeout = log[i].agent_timeout;
+		at->duration = log[i].duration;
+		at->time = time(NULL);
+		strncpy(at->agent_name, log[i].agent_name,
+			FENCED_ATTEMPT_NAME_MAX - 1);
+		strncpy(at->agent_output, log[i].agent_output,
+			FENCED_ATTEMPT_OUTPUT_MAX - 1);
+
+		attempts_next = (attempts_next + 1) % FENCED_ATTEMPTS_MAX;
+		if (attempts_count < FENCED_ATTEMPTS_MAX)
+			attempts_count++;
+	}
+}
 
-	list_for_each_entry(node, &fd->victims, list) {
-		if (node->local_victim_done) {
-			/* local_victim_done means we've successfully fenced
-			   this node and will remove it from victims list
-			   upon receipt of the victim_done message we sent */
-
-			/* I don't believe fence_victims() can come across
-			   a node with local_victim_done set.  That would
-			   mean: pass 1 through fence_victims() fences node A,
-			   send victim_done(A), return, process confchgs
-			   adding and removing A again, receive msgs for start
-			   cycle, but *not* receive victim_done(A) msg before
-			   coming through fence_victims() again. */
-
-			log_error("skip local_victim_done node %d",
-				  node->nodeid);
-			continue;
-		}
+/* copy out saved attempts, oldest first */
 
-		/* limit repeated logging of the same failure messages
-		   when retrying fencing */
+int set_fence_attempts(int *attempt_count, struct fenced_attempt **attempts_out)
+{
+	struct fenced_attempt *at;
+	int i, first;
 
-		limit = 0;
-		retries = 0;
-		memset(&prev_flog, 0, sizeof(flog));
-		prev_flog_count = 0;
+	*attempt_count = 0;
+	*attempts_out = NULL;
 
- retry:
-		if (retries > 2)
-			limit = 1;
-		if (limit && !(retries % 600))
-			log_level(LOG_INFO, "fencing node %s still retrying",
-				  node->name);
+	if (!attempts_count)
+		return 0;
 
-		/* for queries */
-		fd->current_victim = node->nodeid;
+	at = malloc(attempts_count * sizeof(struct fenced_attempt));
+	if (!at)
+		return -ENOMEM;
 
-		cluster_member = is_cluster_member_reread(node->nodeid);
-		cpg_member = is_clean_daemon_member(node->nodeid);
-		if (group_mode == GROUP_LIBCPG)
-			ext = is_fenced_external(fd, node->nodeid);
-		else
-			ext = 0;
+	first = (attempts_next + FENCED_ATTEMPTS_MAX - attempts_count) %
+		FENCED_ATTEMPTS_MAX;
 
-		if ((cluster_member && cpg_member) || ext) {
-			log_debug("averting fence of node %s "
-				  "cluster member %d cpg member %d external %d",
-				  node->name, cluster_member, cpg_member, ext);
+	for (i = 0; i < attempts_count; i++)
+		memcpy(&at[i], &attempts[(first + i) % FENCED_ATTEMPTS_MAX],
+		       sizeof(struct fenced_attempt));
 
-			node->local_victim_done = 1;
-			victim_done(fd, node->nodeid,
-				    ext ? VIC_DONE_EXTERNAL : VIC_DONE_MEMBER);
-			continue;
-		}
+	*attempt_count = attempts_count;
+	*attempts_out = at;
+	return 0;
+}
 
-		memset(&flog, 0, sizeof(flog));
-		flog_count = 0;
+/* how an attempt failed, ignoring timing and agent output, to tell when a
+   retry fails the same way as the attempt before it */
 
-		if (!limit)
-			log_level(LOG_INFO, "fencing node %s", node->name);
+static uint32_t fail_sig(struct fence_log *log, int count)
+{
+	uint32_t sig = 2166136261U;
+	char *p;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		sig = (sig ^ log[i].error) * 16777619;
+		sig = (sig ^ log[i].method_num) * 16777619;
+		sig = (sig ^ log[i].device_num) * 16777619;
+		for (p = log[i].agent_name; *p; p++)
+			sig = (sig ^ (unsigned char)*p) * 16777619;
+	}
+	return sig;
+}
 
-		query_unlock();
-		error = fence_node(node->name, flog, FL_SIZE, &flog_count);
-		query_lock();
+static void log_agent_output(struct node *node, struct fence_log *lp)
+{
+	char line[MAXLINE];
+	int i;
 
-		if (flog_count > FL_SIZE) {
-			log_error("fence_node log overflow %d", flog_count);
-			flog_count = FL_SIZE;
-		}
+	if (!lp->agent_output[0])
+		return;
 
-		if (limit && error &&
-		    flog_count == prev_flog_count &&
-		    !memcmp(&flog, &prev_flog, sizeof(flog))) {
-			goto skip_log_message;
-		}
+	/* one line in the log per device */
+	strncpy(line, lp->agent_output, MAXLINE - 1);
+	line[MAXLINE - 1] = '\0';
+	for (i = 0; line[i]; i++) {
+		if (line[i] == '\n' || line[i] == '\r')
+			line[i] = ' ';
+	}
 
-		memcpy(&prev_flog, &flog, sizeof(flog));
-		prev_flog_count = flog_count;
-
-		for (i = 0; i < flog_count; i++) {
-			ll = (flog[i].error == FE_AGENT_SUCCESS) ? LOG_DEBUG:
-								  LOG_ERR;
-			log_level(ll, "fence %s dev %d.%d agent %s result: %s",
-				  node->name,
-				  flog[i].method_num, flog[i].device_num,
-				  flog[i].agent_name[0] ?
-				  	flog[i].agent_name : "none",
-				  fe_str(flog[i].error));
-		}
+	log_debug("fence %s dev %d.%d agent output: %s", node->name,
+		  lp->method_num, lp->device_num, line);
+}
 
-		log_error("fence %s %s", node->name,
-			  error ? "failed" : "success");
+static uint64_t backoff_ms(int min, int max, int retries)
+{
+	uint64_t ms, max_ms;
 
- skip_log_message:
-		if (!error) {
-			node->local_victim_done = 1;
-			victim_done(fd, node->nodeid, VIC_DONE_AGENT);
+	if (min < 1)
+		min = 1;
+	if (max < min)
+		max = min;
+
+	ms = (uint64_t)min * 1000;
+	max_ms = (uint64_t)max * 1000;
+
+	while (--retries > 0 && ms < max_ms)
+		ms *= 2;
+
+	return ms < max_ms ? ms : max_ms;
+}
+
+/* The wait before the next attempt doubles with each failure, from
+   retry_min up to retry_max seconds.  A fencedevice can set its own
+   retry_min and retry_max; since each attempt runs the whole chain again,
+   the device that failed and wants the longest wait decides it.  The wait
+   is spread by up to retry_jitter percent either way so the masters of
+   several domains don't keep retrying a shared device at the same moment. */
+
+static void schedule_retry(struct node *node, struct fence_log *log,
+			   int count)
+{
+	uint64_t wait, dev_wait, spread;
+	int i, min, max;
+
+	node->retries++;
+	wait = 0;
+
+	for (i = 0; i < count; i++) {
+		if (log[i].error == FE_AGENT_SUCCESS)
 			continue;
-		}
 
-		if (!cfgd_override_path) {
-			query_unlock();
-			sleep(5);
-			query_lock();
-			retries++;
-			goto retry;
-		}
+		min = log[i].retry_min ? log[i].retry_min : cfgd_retry_min;
+		max = log[i].retry_max ? log[i].retry_max : cfgd_retry_max;
+
+		dev_wait = backoff_ms(min, max, node->retries);
+		if (dev_wait > wait)
+			wait = dev_wait;
+	}
+
+	if (!wait)
+		wait = backoff_ms(cfgd_retry_min, cfgd_retry_max,
+				  node->retries);
+
+	if (cfgd_retry_jitter > 0) {
+		spread = wait * cfgd_retry_jitter / 100;
+		wait = wait - spread + random() % (2 * spread + 1);
+	}
+
+	node->next_try = now_ms() + wait;
+
+	log_debug("fence %s retry %d in %llums", node->name, node->retries,
+		  (unsigned long long)wait);
+}
+
+static void fence_victim(struct fd *fd, struct node *node)
+{
+	int error, i, ll, flog_count, limit;
+	int override = -1;
+	int cluster_member, cpg_member, ext;
+	uint32_t sig;
+
+	/* limit repeated logging of the same failure messages
+	   when retrying fencing */
+
+	limit = node->retries > 2;
+	if (limit && !(node->retries % 10))
+		log_level(LOG_INFO, "fencing node %s still retrying",
+			  node->name);
+
+	/* for queries */
+	fd->current_victim = node->nodeid;
+
+	cluster_member = is_cluster_member_reread(node->nodeid);
+	cpg_member = is_clean_daemon_member(node->nodeid);
+	if (group_mode == GROUP_LIBCPG)
+		ext = is_fenced_external(fd, node->nodeid);
+	else
+		ext = 0;
+
+	if ((cluster_member && cpg_member) || ext) {
+		log_debug("averting fence of node %s "
+			  "cluster member %d cpg member %d external %d",
+			  node->name, cluster_member, cpg_member, ext);
+
+		node->local_victim_done = 1;
+		victim_done(fd, node->nodeid,
+			    ext ? VIC_DONE_EXTERNAL : VIC_DONE_MEMBER);
+		return;
+	}
+
+	memset(&flog, 0, sizeof(flog));
+	flog_count = 0;
+
+	if (!limit)
+		log_level(LOG_INFO, "fencing node %s", node->name);
+
+	query_unlock();
+	error = fence_node(node->name, flog, FL_SIZE, &flog_count);
+	query_lock();
+
+	if (flog_count > FL_SIZE) {
+		log_error("fence_node log overflow %d", flog_count);
+		flog_count = FL_SIZE;
+	}
+
+	save_attempts(node, flog, flog_count);
+
+	sig = fail_sig(flog, flog_count);
+	if (limit && error && sig == node->fail_sig)
+		goto skip_log_message;
+	node->fail_sig = sig;
+
+	for (i = 0; i < flog_count; i++) {
+		ll = (flog[i].error == FE_AGENT_SUCCESS) ? LOG_DEBUG:
+							  LOG_ERR;
+		log_level(ll, "fence %s dev %d.%d agent %s result: %s "
+			  "time %ums",
+			  node->name,
+			  flog[i].method_num, flog[i].device_num,
+			  flog[i].agent_name[0] ?
+			  	flog[i].agent_name : "none",
+			  fe_str(flog[i].error), flog[i].duration);
+
+		if (flog[i].error == FE_AGENT_TIMEOUT)
+			log_error("fence %s dev %d.%d agent %s killed "
+				  "after agent_timeout %ds", node->name,
+				  flog[i].method_num,
+				  flog[i].device_num,
+				  flog[i].agent_name,
+				  flog[i].agent_timeout);
+
+		if (flog[i].error != FE_AGENT_SUCCESS)
+			log_agent_output(node, &flog[i]);
+	}
+
+	log_error("fence %s %s", node->name,
+		  error ? "failed" : "success");
 
-		/* Check for manual intervention */
+ skip_log_message:
+	if (!error) {
+		node->local_victim_done = 1;
+		victim_done(fd, node->nodeid, VIC_DONE_AGENT);
+		return;
+	}
+
+	/* Check for manual intervention */
+	if (cfgd_override_path) {
 		override = open_override(cfgd_override_path);
 		if (check_override(override, node->name,
 				   cfgd_override_time) > 0) {
@@ -405,14 +562,125 @@ void fence_victims(struct fd *fd)
 			node->local_victim_done = 1;
 			victim_done(fd, node->nodeid, VIC_DONE_OVERRIDE);
 			close_override(&override, cfgd_override_path);
+			return;
+		}
+		close_override(&override, cfgd_override_path);
+	}
+
+	schedule_retry(node, flog, flog_count);
+}
+
+/* Returns 1 when every victim has been fenced (or has rejoined); each
+   call makes one attempt at each victim whose retry is due. */
+
+int fencing_done(struct fd *fd)
+{
+	struct node *node, *safe;
+	int pending = 0;
+
+	if (fd->fencing == FENCING_DELAY) {
+		if (!delay_done(fd))
+			return 0;
+	} else {
+		/* a victim waiting for a retry may have rejoined */
+		reduce_victims(fd);
+	}
+
+	list_for_each_entry_safe(node, safe, &fd->victims, list) {
+		/* local_victim_done means we've successfully fenced
+		   this node and will remove it from victims list
+		   upon receipt of the victim_done message we sent */
+
+		if (node->local_victim_done)
+			continue;
+
+		if (node->next_try > now_ms()) {
+			pending++;
 			continue;
-		} else {
-			close_override(&override, cfgd_override_path);
-			retries++;
-			goto retry;
 		}
+
+		fence_victim(fd, node);
+
+		if (!node->local_victim_done)
+			pending++;
 	}
 
 	fd->current_victim = 0;
+
+	if (pending)
+		return 0;
+
+	fd->fencing = 0;
+	return 1;
+}
+
+/* milliseconds until fencing_done() has something new to do, apart
+   from membership changes, or -1 */
+
+int fencing_timeout(struct fd *fd)
+{
+	struct node *node;
+	uint64_t now = now_ms(), due = 0;
+	int pending = 0;
+
+	switch (fd->fencing) {
+	case FENCING_DELAY:
+		if (fd->delay == -1)
+			return -1;
+		due = fd->delay_start + (uint64_t)fd->delay * 1000;
+		break;
+
+	case FENCING_VICTIMS:
+		list_for_each_entry(node, &fd->victims, list) {
+			if (node->local_victim_done)
+				continue;
+			if (!pending++ || node->next_try < due)
+				due = node->next_try;
+		}
+		if (!pending)
+			return -1;
+		break;
+
+	default:
+		return -1;
+	}
+
+	if (due <= now)
+		return 0;
+	if (due - now > INT_MAX)
+		return INT_MAX;
+	return due - now;
+}
+
+int fence_poll_timeout(void)
+{
+	struct fd *fd;
+	int timeout = -1, rv;
+
+	list_for_each_entry(fd, &domains, list) {
+		rv = fencing_timeout(fd);
+		if (rv >= 0 && (timeout < 0 || rv < timeout))
+			timeout = rv;
+	}
+	return timeout;
 }
 
+/* libgroup mode doesn't return to the main loop until fencing is done, so
+   it waits here, looking at membership once a second as it always has */
+
+void fence_victims_wait(struct fd *fd, int node_join)
+{
+	int timeout;
+
+	start_fencing(fd, node_join);
+
+	while (!fencing_done(fd)) {
+		timeout = fencing_timeout(fd);
+		if (timeout < 0 || timeout > 1000)
+			timeout = 1000;
+
+		query_unlock();
+		poll(NULL, 0, timeout);
+		query_lock();
+	}
+}
@@ -2,8 +2,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/poll.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
@@ -20,10 +23,115 @@
 #define NODE_FENCE_ARGS_PATH	"/cluster/clusternodes/clusternode[@name=\"%s\"]/fence/method[@name=\"%s\"]/device[%d]/@*"
 #define AGENT_NAME_PATH			"/cluster/fencedevices/fencedevice[@name=\"%s\"]/@agent"
 #define FENCE_DEVICE_ARGS_PATH	"/cluster/fencedevices/fencedevice[@name=\"%s\"]/@*"
+#define AGENT_TIMEOUT_PATH		"/cluster/fencedevices/fencedevice[@name=\"%s\"]/@agent_timeout"
+#define DEFAULT_AGENT_TIMEOUT_PATH	"/cluster/fence_daemon/@agent_timeout"
+#define RETRY_MIN_PATH			"/cluster/fencedevices/fencedevice[@name=\"%s\"]/@retry_min"
+#define RETRY_MAX_PATH			"/cluster/fencedevices/fencedevice[@name=\"%s\"]/@retry_max"
 
 
 
-static int run_agent(char *agent, char *args, int *agent_result)
+/* How long a timed out agent gets to exit after SIGTERM before SIGKILL */
+#define AGENT_KILL_GRACE	5
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Read whatever the agent has written.  Output beyond what fits in lp
+   is read and thrown away so the agent never blocks on a full pipe.
+   Returns 0 at eof. */
+
+static int read_output(int fd, struct fence_log *lp, int *out_len)
+{
+	char junk[256];
+	int room, rv;
+
+	room = FENCE_AGENT_OUTPUT_MAX - 1 - *out_len;
+
+	if (room > 0)
+		rv = read(fd, lp->agent_output + *out_len, room);
+	else
+		rv = read(fd, junk, sizeof(junk));
+
+	if (rv > 0 && room > 0)
+		*out_len += rv;
+
+	if (rv < 0 && (errno == EINTR || errno == EAGAIN))
+		return 1;
+
+	return rv;
+}
+
+/* Collect the agent's output and exit status.  If it runs for longer than
+   timeout seconds, SIGTERM its process group, then SIGKILL it if it still
+   hasn't gone after AGENT_KILL_GRACE. */
+
+static int wait_agent(int pid, int pr_fd, int timeout, struct fence_log *lp,
+		      int *status)
+{
+	struct pollfd pfd;
+	uint64_t start, now, deadline = 0;
+	int out_len = 0, eof = 0, killed = 0;
+	int wait_ms, rv;
+
+	*status = -1;
+	start = now_ms();
+	if (timeout > 0)
+		deadline = start + (uint64_t)timeout * 1000;
+
+	for (;;) {
+		rv = waitpid(pid, status, WNOHANG);
+		if (rv == pid || (rv < 0 && errno != EINTR))
+			break;
+
+		now = now_ms();
+
+		if (deadline && now >= deadline) {
+			if (!killed) {
+				kill(-pid, SIGTERM);
+				deadline = now + AGENT_KILL_GRACE * 1000;
+			} else {
+				kill(-pid, SIGKILL);
+				deadline = 0;
+			}
+			killed++;
+			continue;
+		}
+
+		/* the pipe tells us when there's output or the agent is
+		   done; poll in short steps in case something else is
+		   holding the pipe open, shorter still once it's closed
+		   and we're just waiting for the agent to exit */
+
+		wait_ms = eof ? 10 : 100;
+		if (deadline && deadline - now < wait_ms)
+			wait_ms = deadline - now;
+
+		pfd.fd = pr_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		rv = poll(&pfd, eof ? 0 : 1, wait_ms);
+		if (rv > 0 && read_output(pr_fd, lp, &out_len) <= 0)
+			eof = 1;
+	}
+
+	/* pick up anything written just before exiting */
+	while (!eof && read_output(pr_fd, lp, &out_len) > 0)
+		;
+
+	lp->agent_output[out_len] = '\0';
+	lp->duration = now_ms() - start;
+
+	return killed;
+}
+
+static int run_agent(char *agent, char *args, int timeout,
+		     struct fence_log *lp)
 {
 	int pid, status, len;
 	int pr_fd, pw_fd;  /* parent read/write file descriptors */
@@ -49,7 +157,7 @@ static int run_agent(char *agent, char *args, int *agent_result)
 
 	pid = fork();
 	if (pid < 0) {
-		*agent_result = FE_AGENT_FORK;
+		lp->error = FE_AGENT_FORK;
 		goto fail;
 	}
 
@@ -57,27 +165,47 @@ static int run_agent(char *agent, char *args, int *agent_result)
 		/* parent */
 		int ret;
 
+		/* also done by the child, whichever runs first */
+		setpgid(pid, pid);
+
+		/* our copy of the write end would keep the pipe from
+		   reaching eof when the agent exits */
+		close(cw_fd);
+		cw_fd = -1;
+
 		fcntl(pr_fd, F_SETFL, fcntl(pr_fd, F_GETFL, 0) | O_NONBLOCK);
 
 		do {
 			ret = write(pw_fd, args, len);
 		} while (ret < 0 && errno == EINTR);
 
-		if (ret != len)
+		if (ret != len) {
+			kill(-pid, SIGKILL);
+			waitpid(pid, &status, 0);
 			goto fail;
+		}
 
 		close(pw_fd);
-		waitpid(pid, &status, 0);
+		pw_fd = -1;
+
+		if (wait_agent(pid, pr_fd, timeout, lp, &status)) {
+			lp->error = FE_AGENT_TIMEOUT;
+			goto fail;
+		}
 
 		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
-			*agent_result = FE_AGENT_ERROR;
+			lp->error = FE_AGENT_ERROR;
 			goto fail;
 		} else {
-			*agent_result = FE_AGENT_SUCCESS;
+			lp->error = FE_AGENT_SUCCESS;
 		}
 	} else {
 		/* child */
 
+		/* own process group so a timeout can kill anything the
+		   agent has started as well */
+		setpgid(0, 0);
+
 		close(1);
 		if (dup(cw_fd) < 0)
 			goto fail;
@@ -97,9 +225,7 @@ static int run_agent(char *agent, char *args, int *agent_result)
 	}
 
 	close(pr_fd);
-	close(cw_fd);
 	close(cr_fd);
-	close(pw_fd);
 	return 0;
 
  fail:
@@ -110,6 +236,68 @@ static int run_agent(char *agent, char *args, int *agent_result)
 	return -1;
 }
 
+/* agent_timeout may be set for a device, or for all devices in
+   fence_daemon; it is used by us and never passed to the agent */
+
+static int get_agent_timeout(int cd, char *device)
+{
+	char path[PATH_MAX], *str = NULL;
+	int timeout = 0;
+
+	memset(path, 0, PATH_MAX);
+	sprintf(path, AGENT_TIMEOUT_PATH, device);
+
+	if (ccs_get(cd, path, &str) || !str) {
+		if (ccs_get(cd, DEFAULT_AGENT_TIMEOUT_PATH, &str) || !str)
+			return 0;
+	}
+
+	timeout = atoi(str);
+	free(str);
+
+	if (timeout < 0)
+		timeout = 0;
+	return timeout;
+}
+
+/* retry_min and retry_max may be set for a device to change how long
+   fenced waits between attempts after the device fails; 0 when not set,
+   and fenced uses its own settings */
+
+static int get_retry(int cd, int max, char *device)
+{
+	char path[PATH_MAX], *str = NULL;
+	int val;
+
+	memset(path, 0, PATH_MAX);
+	if (max)
+		snprintf(path, sizeof(path), RETRY_MAX_PATH, device);
+	else
+		snprintf(path, sizeof(path), RETRY_MIN_PATH, device);
+
+	if (ccs_get(cd, path, &str) || !str)
+		return 0;
+
+	val = atoi(str);
+	free(str);
+
+	if (val < 0)
+		val = 0;
+	return val;
+}
+
+/* attributes that are for us or fenced, not the agent */
+
+static int agent_arg(const char *str)
+{
+	if (!strncmp(str, "name=", 5) ||
+	    !strncmp(str, "agent_timeout=", 14) ||
+	    !strncmp(str, "retry_min=", 10) ||
+	    !strncmp(str, "retry_max=", 10))
+		return 0;
+	return 1;
+}
+
 static int make_args(int cd, char *victim, char *method, int d,
 		     char *device, char **args_out)
 {
@@ -137,7 +325,7 @@ static int make_args(int cd, char *victim, char *method, int d,
 			break;
 		++cnt;
 
-		if (!strncmp(str, "name=", 5)) {
+		if (!agent_arg(str)) {
 			free(str);
 			continue;
 		}
@@ -175,7 +363,7 @@ static int make_args(int cd, char *victim, char *method, int d,
 			break;
 		++cnt;
 
-		if (!strncmp(str, "name=", 5)) {
+		if (!agent_arg(str)) {
 			free(str);
 			continue;
 		}
@@ -292,7 +480,11 @@ static int use_device(int cd, char *victim, char *method, int d,
 
 	strncpy(lp->agent_args, args, FENCE_AGENT_ARGS_MAX-1);
 
-	error = run_agent(agent, args, &lp->error);
+	lp->agent_timeout = get_agent_timeout(cd, device);
+	lp->retry_min = get_retry(cd, 0, device);
+	lp->retry_max = get_retry(cd, 1, device);
+
+	error = run_agent(agent, args, lp->agent_timeout, lp);
 
 	free(args);
  out_agent:
@@ -456,7 +648,7 @@ static int make_args_unfence(int cd, char *victim, int d,
 			break;
 		++cnt;
 
-		if (!strncmp(str, "name=", 5)) {
+		if (!agent_arg(str)) {
 			free(str);
 			continue;
 		}
@@ -494,7 +686,7 @@ static int make_args_unfence(int cd, char *victim, int d,
 			break;
 		++cnt;
 
-		if (!strncmp(str, "name=", 5)) {
+		if (!agent_arg(str)) {
 			free(str);
 			continue;
 		}
@@ -579,7 +771,9 @@ static int use_device_unfence(int cd, char *victim, int d,
 
 	strncpy(lp->agent_args, args, FENCE_AGENT_ARGS_MAX);
 
-	error = run_agent(agent, args, &lp->error);
+	lp->agent_timeout = get_agent_timeout(cd, device);
+
+	error = run_agent(agent, args, lp->agent_timeout, lp);
 
 	free(args);
  out_agent:
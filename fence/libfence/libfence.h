@@ -15,16 +15,23 @@ extern "C" {
 #define FE_READ_ARGS		8	/* read (ccs) error on node/dev args */
 #define FE_READ_METHOD		9	/* read (ccs) error on method */
 #define FE_READ_DEVICE		10	/* read (ccs) error on method/device */
+#define FE_AGENT_TIMEOUT	11	/* agent killed after agent_timeout */
 
 #define FENCE_AGENT_NAME_MAX 256	/* including terminating \0 */
 #define FENCE_AGENT_ARGS_MAX 4096	/* including terminating \0 */
+#define FENCE_AGENT_OUTPUT_MAX 1024	/* including terminating \0 */
 
 struct fence_log {
 	int error;
 	int method_num;
 	int device_num;
+	int agent_timeout;		/* seconds, 0 for none */
+	int retry_min;			/* seconds, 0 if not set for device */
+	int retry_max;			/* seconds, 0 if not set for device */
+	unsigned int duration;		/* milliseconds the agent ran */
 	char agent_name[FENCE_AGENT_NAME_MAX];
 	char agent_args[FENCE_AGENT_ARGS_MAX];
+	char agent_output[FENCE_AGENT_OUTPUT_MAX]; /* stdout+stderr, truncated */
 };
 
 int fence_node(char *name, struct fence_log *log, int log_size, int *log_count);
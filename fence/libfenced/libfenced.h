@@ -37,6 +37,24 @@ struct fenced_domain {
 	int state;
 };
 
+/* result of running one fence device, most recent attempts are kept */
+
+#define FENCED_ATTEMPTS_MAX		64
+#define FENCED_ATTEMPT_NAME_MAX		64
+#define FENCED_ATTEMPT_OUTPUT_MAX	256
+
+struct fenced_attempt {
+	int nodeid;
+	int method_num;
+	int device_num;
+	int result;		/* FE_ from libfence.h */
+	int agent_timeout;	/* seconds, 0 for none */
+	unsigned int duration;	/* milliseconds */
+	uint64_t time;		/* when the agent finished */
+	char agent_name[FENCED_ATTEMPT_NAME_MAX];
+	char agent_output[FENCED_ATTEMPT_OUTPUT_MAX];
+};
+
 /* fenced_domain_nodes() types */
 #define FENCED_NODES_ALL	1
 #define FENCED_NODES_MEMBERS	2
@@ -49,5 +67,19 @@ int fenced_external(char *name);
 int fenced_node_info(int nodeid, struct fenced_node *node);
 int fenced_domain_info(struct fenced_domain *domain);
 int fenced_domain_nodes(int type, int max, int *count, struct fenced_node *nodes);
+int fenced_fence_attempts(int max, int *count, struct fenced_attempt *attempts);
+
+/* A persistent connection on which fenced sends the domain info, and the
+   info for one node, whenever a victim is added or done.  The first
+   notifications describe every node fenced knows of, ending with one for
+   nodeid 0.  fenced_notify_read() returns the result fenced would give
+   fenced_domain_info() (-ENOENT if the domain hasn't been joined), or
+   -ENOSYS if fenced can't send notifications; fenced_node_info() and
+   fenced_domain_info() still work then. */
+
+int fenced_notify_connect(void);
+void fenced_notify_disconnect(int fd);
+int fenced_notify_read(int fd, struct fenced_node *node,
+		       struct fenced_domain *domain);
 
 #endif
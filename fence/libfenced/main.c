@@ -147,6 +147,52 @@ int fenced_external(char *name)
 	return rv;
 }
 
+int fenced_notify_connect(void)
+{
+	struct fenced_header h;
+	int fd, rv;
+
+	init_header(&h, FENCED_CMD_NOTIFY, 0);
+
+	fd = do_connect(FENCED_SOCK_PATH);
+	if (fd < 0)
+		return fd;
+
+	rv = do_write(fd, &h, sizeof(h));
+	if (rv < 0) {
+		close(fd);
+		return rv;
+	}
+	return fd;
+}
+
+void fenced_notify_disconnect(int fd)
+{
+	close(fd);
+}
+
+int fenced_notify_read(int fd, struct fenced_node *node,
+		       struct fenced_domain *domain)
+{
+	char msg[sizeof(struct fenced_header) + sizeof(struct fenced_domain) +
+		 sizeof(struct fenced_node)];
+	struct fenced_header *h = (struct fenced_header *)msg;
+	int rv;
+
+	rv = do_read(fd, msg, sizeof(msg));
+	if (rv < 0)
+		return rv;
+
+	if (h->magic != FENCED_MAGIC || h->command != FENCED_CMD_NOTIFY)
+		return -EINVAL;
+
+	memcpy(domain, msg + sizeof(struct fenced_header),
+	       sizeof(struct fenced_domain));
+	memcpy(node, msg + sizeof(struct fenced_header) +
+	       sizeof(struct fenced_domain), sizeof(struct fenced_node));
+	return h->data;
+}
+
 int fenced_dump_debug(char *buf)
 {
 	struct fenced_header h, *rh;
@@ -321,3 +367,61 @@ int fenced_domain_nodes(int type, int max, int *count, struct fenced_node *nodes
 	return rv;
 }
 
+
+int fenced_fence_attempts(int max, int *count, struct fenced_attempt *attempts)
+{
+	struct fenced_header h, *rh;
+	char *reply = NULL;
+	int reply_len;
+	int fd, rv, result, attempt_count;
+
+	init_header(&h, FENCED_CMD_FENCE_ATTEMPTS, 0);
+	h.data = max;
+
+	reply_len = sizeof(struct fenced_header) +
+		    (max * sizeof(struct fenced_attempt));
+	reply = malloc(reply_len);
+	if (!reply) {
+		rv = -1;
+		goto out;
+	}
+	memset(reply, 0, reply_len);
+
+	fd = do_connect(FENCED_QUERY_SOCK_PATH);
+	if (fd < 0) {
+		rv = fd;
+		goto out;
+	}
+
+	rv = do_write(fd, &h, sizeof(h));
+	if (rv < 0)
+		goto out_close;
+
+	/* won't usually get back the full reply_len */
+	do_read(fd, reply, reply_len);
+
+	rh = (struct fenced_header *)reply;
+	result = rh->data;
+	if (result < 0 && result != -E2BIG) {
+		rv = result;
+		goto out_close;
+	}
+
+	if (result == -E2BIG) {
+		*count = -E2BIG;
+		attempt_count = max;
+	} else {
+		*count = result;
+		attempt_count = result;
+	}
+	rv = 0;
+
+	memcpy(attempts, (char *)reply + sizeof(struct fenced_header),
+	       attempt_count * sizeof(struct fenced_attempt));
+ out_close:
+	close(fd);
+ out:
+	if (reply)
+		free(reply);
+	return rv;
+}
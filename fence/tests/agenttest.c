@@ -0,0 +1,76 @@
+/* Exercise libfence agent execution with a fake agent (fence_sleep):
+   timeouts and SIGTERM/SIGKILL escalation, output capture and exit
+   status.  The config lookups are stubbed, only run_agent is used. */
+
+#include "agent.c"
+
+int ccs_connect(void) { return -1; }
+int ccs_disconnect(int desc) { return 0; }
+int ccs_get(int desc, const char *query, char **rtn) { return -1; }
+int ccs_get_list(int desc, const char *query, char **rtn) { return -1; }
+int ccs_lookup_nodename(int desc, const char *nodename, char **rtn)
+{
+	return -1;
+}
+
+static const char *agent = "./fence_sleep";
+static int failed;
+
+static void run(const char *desc, const char *args, int timeout,
+		int want_error, unsigned int min_ms, unsigned int max_ms,
+		const char *want_output)
+{
+	struct fence_log log;
+	int rv;
+
+	memset(&log, 0, sizeof(log));
+
+	/* run_agent only reads them */
+	rv = run_agent((char *)agent, (char *)args, timeout, &log);
+
+	printf("%-32s rv %d result %d time %ums output %zu bytes: ",
+	       desc, rv, log.error, log.duration, strlen(log.agent_output));
+
+	if (log.error != want_error ||
+	    (want_error == FE_AGENT_SUCCESS) != (rv == 0) ||
+	    log.duration < min_ms || log.duration > max_ms ||
+	    (want_output && !strstr(log.agent_output, want_output))) {
+		printf("FAIL\n");
+		failed++;
+		return;
+	}
+	printf("ok\n");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		agent = argv[1];
+
+	run("success", "sleep=0\n", 10, FE_AGENT_SUCCESS,
+	    0, 5000, "fence_sleep: sleeping 0");
+
+	run("agent error", "exit=1\n", 10, FE_AGENT_ERROR,
+	    0, 5000, "fence_sleep");
+
+	run("no timeout", "sleep=2\n", 0, FE_AGENT_SUCCESS,
+	    2000, 7000, NULL);
+
+	run("timeout, SIGTERM", "sleep=60\n", 2, FE_AGENT_TIMEOUT,
+	    2000, 4000, "fence_sleep: sleeping 60");
+
+	run("timeout, SIGKILL", "sleep=60\nignore_term=1\n", 1,
+	    FE_AGENT_TIMEOUT, 1000 + AGENT_KILL_GRACE * 1000,
+	    3000 + AGENT_KILL_GRACE * 1000, NULL);
+
+	/* more than a pipe's worth, output is truncated to fit */
+	run("large output", "output=200000\n", 10, FE_AGENT_SUCCESS,
+	    0, 5000, "xxxx");
+
+	if (failed) {
+		printf("%d failed\n", failed);
+		return EXIT_FAILURE;
+	}
+	printf("all passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,476 @@
+/* Drive fenced's fencing of victims (recover.c) the way the main loop
+   does: fencing_done() after each wakeup, with the clock advanced to the
+   next fencing_timeout() in between.  cman and daemon cpg membership is
+   simulated, time is virtual, and fence_node() from libfence runs a real
+   fake agent (fence_sleep) that fails a given number of times, configured
+   through stubbed ccs lookups. */
+
+#include <stdarg.h>
+
+#include "recover.c"
+#include "ccs.h"
+
+#define MAX_CONF	64
+#define COUNT_FILE	"recovertest.count"
+
+int group_mode = GROUP_LIBCPG;
+int our_nodeid = 1;
+int daemon_debug_opt;
+char daemon_debug_buf[256];
+struct list_head domains;
+
+int cfgd_post_join_delay;
+int cfgd_post_fail_delay;
+int cfgd_override_time;
+const char *cfgd_override_path;
+int cfgd_retry_min;
+int cfgd_retry_max;
+int cfgd_retry_jitter;
+
+static const char *agent = "./fence_sleep";
+static int verbose;
+static int failed;
+
+static uint64_t vtime;			/* virtual now_ms() */
+static int member[MAX_NODES];		/* cman member, clean daemon member */
+static int victims_done[MAX_NODES];	/* victim_done messages sent */
+
+static struct {
+	char path[PATH_MAX];
+	char val[256];
+} conf[MAX_CONF];
+static int conf_count;
+static int list_next;
+
+uint64_t now_ms(void)
+{
+	return vtime;
+}
+
+void logt_print(int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+	printf("  %6llu ", (unsigned long long)vtime);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
+void daemon_dump_save(void) { }
+void notify_subscribers(int nodeid) { }
+void query_lock(void) { }
+void query_unlock(void) { }
+void node_history_init(struct fd *fd, int nodeid) { }
+void node_history_fence(struct fd *fd, int victim, int master, int how,
+			uint64_t mastertime) { }
+int is_fenced_external(struct fd *fd, int nodeid) { return 0; }
+char *nodeid_to_name(int nodeid) { return NULL; }
+
+int is_cluster_member_reread(int nodeid)
+{
+	return member[nodeid];
+}
+
+int is_clean_daemon_member(int nodeid)
+{
+	return member[nodeid];
+}
+
+struct node *get_new_node(struct fd *fd, int nodeid)
+{
+	struct node *node;
+
+	node = malloc(sizeof(*node));
+	if (!node)
+		return NULL;
+	memset(node, 0, sizeof(struct node));
+	node->nodeid = nodeid;
+	sprintf(node->name, "node%d", nodeid);
+	return node;
+}
+
+/* the message goes to everyone, and is delivered back to us later by
+   deliver_victim_done() */
+
+void send_victim_done(struct fd *fd, int victim)
+{
+	victims_done[victim]++;
+}
+
+static void deliver_victim_done(struct fd *fd)
+{
+	struct node *node, *safe;
+
+	list_for_each_entry_safe(node, safe, &fd->victims, list) {
+		if (!node->local_victim_done)
+			continue;
+		list_del(&node->list);
+		free(node);
+	}
+}
+
+/* libfence config */
+
+static void __attribute__((format (printf, 2, 3)))
+conf_add(const char *val, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(conf[conf_count].path, PATH_MAX, fmt, ap);
+	va_end(ap);
+	strncpy(conf[conf_count].val, val, sizeof(conf[0].val) - 1);
+	conf_count++;
+}
+
+int ccs_connect(void) { return 1; }
+int ccs_disconnect(int desc) { return 0; }
+int ccs_lookup_nodename(int desc, const char *nodename, char **rtn)
+{
+	return -1;
+}
+
+int ccs_get(int desc, const char *query, char **rtn)
+{
+	int i;
+
+	for (i = 0; i < conf_count; i++) {
+		if (!strcmp(conf[i].path, query)) {
+			*rtn = strdup(conf[i].val);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* successive calls return each value configured for query, then fail
+   once and start over */
+
+int ccs_get_list(int desc, const char *query, char **rtn)
+{
+	for (; list_next < conf_count; list_next++) {
+		if (!strcmp(conf[list_next].path, query)) {
+			*rtn = strdup(conf[list_next++].val);
+			return 0;
+		}
+	}
+	list_next = 0;
+	return -1;
+}
+
+/* a fence method for node<nodeid> with one device running the fake agent,
+   which fails the first <fail> times it's run for the method; retry_min
+   and retry_max for the device when non-zero */
+
+static void conf_method(int nodeid, int m, int fail, int retry_min,
+			int retry_max)
+{
+	char victim[16], method[16], device[16], val[256];
+
+	sprintf(victim, "node%d", nodeid);
+	sprintf(method, "m%d", m);
+	sprintf(device, "dev%d.%d", nodeid, m);
+
+	conf_add(method, "/cluster/clusternodes/clusternode[@name=\"%s\"]"
+		 "/fence/method[%d]/@name", victim, m);
+	conf_add(device, "/cluster/clusternodes/clusternode[@name=\"%s\"]"
+		 "/fence/method[@name=\"%s\"]/device[1]/@name", victim, method);
+	conf_add(agent, "/cluster/fencedevices/fencedevice[@name=\"%s\"]"
+		 "/@agent", device);
+
+	sprintf(val, "name=%s", device);
+	conf_add(val, "/cluster/fencedevices/fencedevice[@name=\"%s\"]/@*",
+		 device);
+	sprintf(val, "count_file=%s.%s", COUNT_FILE, device);
+	conf_add(val, "/cluster/fencedevices/fencedevice[@name=\"%s\"]/@*",
+		 device);
+	sprintf(val, "fail=%d", fail);
+	conf_add(val, "/cluster/fencedevices/fencedevice[@name=\"%s\"]/@*",
+		 device);
+
+	if (retry_min) {
+		sprintf(val, "%d", retry_min);
+		conf_add(val, "/cluster/fencedevices/fencedevice[@name=\"%s\"]"
+			 "/@retry_min", device);
+		sprintf(val, "retry_min=%d", retry_min);
+		conf_add(val, "/cluster/fencedevices/fencedevice"
+			 "[@name=\"%s\"]/@*", device);
+	}
+	if (retry_max) {
+		sprintf(val, "%d", retry_max);
+		conf_add(val, "/cluster/fencedevices/fencedevice[@name=\"%s\"]"
+			 "/@retry_max", device);
+		sprintf(val, "retry_max=%d", retry_max);
+		conf_add(val, "/cluster/fencedevices/fencedevice"
+			 "[@name=\"%s\"]/@*", device);
+	}
+
+	sprintf(val, "%s.%s", COUNT_FILE, device);
+	unlink(val);
+}
+
+static int agent_runs(int nodeid, int m)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int runs = 0;
+
+	sprintf(path, "%s.dev%d.%d", COUNT_FILE, nodeid, m);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%d", &runs) != 1)
+		runs = 0;
+	fclose(f);
+	unlink(path);
+	return runs;
+}
+
+static struct fd *setup(int post_fail_delay, int retry_min, int retry_max,
+			int retry_jitter)
+{
+	struct fd *fd;
+
+	fd = malloc(sizeof(struct fd));
+	memset(fd, 0, sizeof(struct fd));
+	INIT_LIST_HEAD(&fd->victims);
+	INIT_LIST_HEAD(&fd->complete);
+	INIT_LIST_HEAD(&domains);
+	list_add(&fd->list, &domains);
+
+	cfgd_post_join_delay = 6;
+	cfgd_post_fail_delay = post_fail_delay;
+	cfgd_retry_min = retry_min;
+	cfgd_retry_max = retry_max;
+	cfgd_retry_jitter = retry_jitter;
+
+	vtime = 1000000;
+	conf_count = 0;
+	list_next = 0;
+	memset(member, 0, sizeof(member));
+	memset(victims_done, 0, sizeof(victims_done));
+	return fd;
+}
+
+static void add_victim(struct fd *fd, int nodeid)
+{
+	struct node *node = get_new_node(fd, nodeid);
+
+	list_add_tail(&node->list, &fd->victims);
+}
+
+static struct node *find_victim(struct fd *fd, int nodeid)
+{
+	struct node *node;
+
+	list_for_each_entry(node, &fd->victims, list) {
+		if (node->nodeid == nodeid)
+			return node;
+	}
+	return NULL;
+}
+
+/* one pass of the main loop: sleep until the next deadline, or until
+   <until> when that comes first (a membership change, say), then let
+   fencing make progress.  Returns fencing_done(). */
+
+static int wakeup(struct fd *fd, uint64_t until)
+{
+	int timeout, done;
+
+	timeout = fence_poll_timeout();
+	if (timeout >= 0 && (!until || vtime + timeout < until))
+		vtime += timeout;
+	else if (until)
+		vtime = until;
+
+	done = fencing_done(fd);
+	deliver_victim_done(fd);
+	return done;
+}
+
+static void finish(struct fd *fd)
+{
+	free_node_list(&fd->victims);
+	list_del(&fd->list);
+	free(fd);
+}
+
+static void check(const char *desc, int ok)
+{
+	printf("%-56s %s\n", desc, ok ? "ok" : "FAIL");
+	if (!ok)
+		failed++;
+}
+
+/* A victim rejoins during an unlimited post_fail_delay: fencing is done
+   at the wakeup for the membership change, not at a later poll. */
+
+static void test_rejoin_ends_delay(void)
+{
+	struct fd *fd = setup(-1, 1, 1, 0);
+	uint64_t start = vtime;
+	int done;
+
+	conf_method(2, 1, 0, 0, 0);
+	add_victim(fd, 2);
+	start_fencing(fd, 0);
+
+	done = wakeup(fd, start + 2000);
+	check("unlimited delay waits", !done && fence_poll_timeout() == -1);
+
+	member[2] = 1;
+	done = wakeup(fd, start + 7000);
+	check("rejoined victim ends the delay at once",
+	      done && vtime == start + 7000 && list_empty(&fd->victims));
+	check("rejoined victim not fenced",
+	      victims_done[2] == 1 && !agent_runs(2, 1));
+	finish(fd);
+}
+
+/* The delay ends on time, then the agent fails four times and the
+   retries back off 2, 4, 8 and 10 seconds (retry_min and retry_max of
+   the device, no jitter) before the fifth attempt succeeds. */
+
+static void test_backoff(void)
+{
+	struct fd *fd = setup(30, 5, 60, 0);
+	uint64_t start = vtime, expect[] = { 30000, 32000, 36000, 44000,
+					      54000 };
+	uint64_t seen[8];
+	int tries = 0, done = 0, ok = 1;
+
+	conf_method(2, 1, 4, 2, 10);
+	add_victim(fd, 2);
+	start_fencing(fd, 0);
+
+	check("delay reported to the main loop",
+	      fence_poll_timeout() == 30000);
+
+	while (!done && tries < 8) {
+		done = wakeup(fd, 0);
+		seen[tries++] = vtime - start;
+	}
+
+	if (tries != 5)
+		ok = 0;
+	while (ok && tries--) {
+		if (seen[tries] != expect[tries])
+			ok = 0;
+	}
+	check("retries back off 2, 4, 8, 10s from the device", ok);
+	check("fenced by the agent on the fifth run",
+	      done && agent_runs(2, 1) == 5 && victims_done[2] == 1 &&
+	      list_empty(&fd->victims));
+	finish(fd);
+}
+
+/* With retry_jitter each wait is spread around the backoff, here
+   retry_min = retry_max = 4s from fence_daemon, 50% either way. */
+
+static void test_jitter(void)
+{
+	struct fd *fd = setup(0, 4, 4, 50);
+	uint64_t last, wait, lo = UINT64_MAX, hi = 0;
+	int i, done, ok = 1;
+
+	conf_method(2, 1, 12, 0, 0);
+	add_victim(fd, 2);
+	start_fencing(fd, 0);
+
+	done = wakeup(fd, 0);
+	last = vtime;
+	for (i = 0; i < 12 && !done; i++) {
+		done = wakeup(fd, 0);
+		wait = vtime - last;
+		last = vtime;
+		if (wait < 2000 || wait > 6000)
+			ok = 0;
+		if (wait < lo)
+			lo = wait;
+		if (wait > hi)
+			hi = wait;
+	}
+	check("jittered waits within 2-6s", ok && done);
+	check("jittered waits vary", lo != hi);
+	agent_runs(2, 1);
+	finish(fd);
+}
+
+/* Two methods that both fail: the device wanting the longer wait decides
+   it.  While the victim waits for a retry it rejoins the cluster, and is
+   let go at that wakeup; another victim keeps its backoff when a new
+   change starts fencing over. */
+
+static void test_devices_and_rejoin(void)
+{
+	struct fd *fd = setup(0, 1, 4, 0);
+	struct node *node;
+	uint64_t start = vtime, next;
+	int done;
+
+	conf_method(2, 1, 100, 1, 1);
+	conf_method(2, 2, 100, 8, 8);
+	conf_method(3, 1, 100, 0, 0);
+	add_victim(fd, 2);
+	add_victim(fd, 3);
+	start_fencing(fd, 0);
+
+	wakeup(fd, 0);
+	node = find_victim(fd, 2);
+	check("longest device backoff wins",
+	      node && node->next_try == start + 8000);
+
+	wakeup(fd, 0);
+	wakeup(fd, 0);
+	node = find_victim(fd, 3);
+	check("global backoff for devices without their own",
+	      node && node->retries == 3 && node->next_try == start + 7000);
+
+	member[2] = 1;
+	done = wakeup(fd, start + 3500);
+	check("victim rejoining while waiting for a retry is dropped",
+	      !done && !find_victim(fd, 2) && victims_done[2] == 1 && vtime == start + 3500);
+
+	/* a new change replaces the one being fenced for */
+	next = node->next_try;
+	start_fencing(fd, 0);
+	wakeup(fd, start + 3600);
+	check("retry state survives a new change",
+	      node->retries == 3 && node->next_try == next);
+
+	member[3] = 1;
+	done = wakeup(fd, 0);
+	check("done when the last victim rejoins", done);
+	check("agent runs", agent_runs(2, 1) == 1 && agent_runs(2, 2) == 1 &&
+	      agent_runs(3, 1) == 3);
+	finish(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "-v")) {
+		verbose = 1;
+		argc--;
+		argv++;
+	}
+	if (argc > 1)
+		agent = argv[1];
+
+	srandom(1);
+
+	test_rejoin_ends_delay();
+	test_backoff();
+	test_jitter();
+	test_devices_and_rejoin();
+
+	if (failed) {
+		printf("%d failed\n", failed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
@@ -1,7 +1,446 @@
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "util.h"
 #include "fsck.h"
 #include "bio.h"
 
+/*
+ * The block cache
+ *
+ * Every block read through read_buf() is kept in a bounded cache, so the
+ * dinodes, indirect blocks and bitmaps that each pass walks again are
+ * only read from disk once.  A miss reads ahead sequentially: the window
+ * starts small, doubles while the misses follow on from each other, and
+ * stops at the end of the resource group (an rgrp header miss reads all
+ * of its bitmaps with it).  write_buf() only updates the cache; dirty
+ * blocks are written back in block order at the end of each pass, when
+ * they are evicted, or at exit.  Callers still get their own buffer_head
+ * and data, so nothing outside bio.c changes.
+ */
+
+#define BC_MAX_BYTES	(256 << 20)	/* at most, or 1/16 of memory */
+#define BC_MIN_BYTES	(4 << 20)
+#define RA_MIN		16		/* blocks */
+#define RA_MAX		1024
+
+struct bcache_buf {
+	osi_list_t	b_hash;
+	osi_list_t	b_lru;		/* most recently used first */
+	uint64		b_blkno;
+	int		b_dirty;
+	char		b_data[0];
+};
+
+struct bcache_rgrp {
+	uint64		start;		/* ri_addr */
+	uint64		end;		/* ri_data1 + ri_data */
+	uint32		length;		/* ri_length */
+};
+
+struct bcache {
+	uint32		bc_bsize;
+	unsigned int	bc_count;
+	unsigned int	bc_max;
+	unsigned int	bc_dirty;
+	unsigned int	bc_hash_size;
+	osi_list_t	*bc_hash;
+	osi_list_t	bc_lru;
+	char		*bc_iobuf;	/* RA_MAX blocks for read-ahead */
+	char		*bc_wbuf;	/* and for write-back */
+	struct bcache_rgrp *bc_rgrps;	/* sorted by start */
+	unsigned int	bc_rgcount;
+	uint64		bc_ra_next;	/* block after the last read-ahead */
+	unsigned int	bc_ra_size;
+
+	uint64		bc_hits;
+	uint64		bc_misses;
+	uint64		bc_reads;
+	uint64		bc_read_blocks;
+	uint64		bc_writes;
+	uint64		bc_written_blocks;
+};
+
+static struct fsck_sb *bcache_sdp;
+
+static void bcache_free(struct fsck_sb *sdp)
+{
+	struct bcache *bc = sdp->bcache;
+	struct bcache_buf *bb;
+
+	if(!bc)
+		return;
+	while(!osi_list_empty(&bc->bc_lru)) {
+		bb = osi_list_entry(bc->bc_lru.next, struct bcache_buf, b_lru);
+		osi_list_del(&bb->b_lru);
+		free(bb);
+	}
+	free(bc->bc_hash);
+	free(bc->bc_iobuf);
+	free(bc->bc_wbuf);
+	free(bc->bc_rgrps);
+	free(bc);
+	sdp->bcache = NULL;
+}
+
+static void bcache_atexit(void)
+{
+	if(bcache_sdp)
+		bcache_sync(bcache_sdp);
+}
+
+/*
+ * bcache_get - get the block cache for the current block size
+ * @sdp: the super block
+ *
+ * The superblock is read with 512 byte blocks before the real block
+ * size is known; the cache is rebuilt when the block size changes.
+ *
+ * Returns: the cache, or NULL if there's no memory for one
+ */
+static struct bcache *bcache_get(struct fsck_sb *sdp)
+{
+	struct bcache *bc = sdp->bcache;
+	uint32 bsize = sdp->sb.sb_bsize;
+	uint64 bytes;
+	unsigned int x;
+
+	if(bc && bc->bc_bsize == bsize)
+		return bc;
+	if(bc) {
+		bcache_sync(sdp);
+		bcache_free(sdp);
+	}
+
+	bytes = (uint64)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 16;
+	if(bytes > BC_MAX_BYTES)
+		bytes = BC_MAX_BYTES;
+	if(bytes < BC_MIN_BYTES)
+		bytes = BC_MIN_BYTES;
+
+	if(!(bc = malloc(sizeof(struct bcache))))
+		return NULL;
+	memset(bc, 0, sizeof(struct bcache));
+	bc->bc_bsize = bsize;
+	bc->bc_max = bytes / (bsize + sizeof(struct bcache_buf));
+	if(bc->bc_max < 2 * RA_MAX)
+		bc->bc_max = 2 * RA_MAX;
+	for(bc->bc_hash_size = 1; bc->bc_hash_size < bc->bc_max / 2;
+	    bc->bc_hash_size <<= 1);
+	bc->bc_hash = malloc(bc->bc_hash_size * sizeof(osi_list_t));
+	bc->bc_iobuf = malloc(RA_MAX * bsize);
+	bc->bc_wbuf = malloc(RA_MAX * bsize);
+	if(!bc->bc_hash || !bc->bc_iobuf || !bc->bc_wbuf) {
+		free(bc->bc_hash);
+		free(bc->bc_iobuf);
+		free(bc->bc_wbuf);
+		free(bc);
+		return NULL;
+	}
+	for(x = 0; x < bc->bc_hash_size; x++)
+		osi_list_init(&bc->bc_hash[x]);
+	osi_list_init(&bc->bc_lru);
+	bc->bc_ra_size = RA_MIN;
+
+	log_debug("Block cache: %u blocks of %u bytes\n", bc->bc_max, bsize);
+	sdp->bcache = bc;
+	if(!bcache_sdp)
+		atexit(bcache_atexit);
+	bcache_sdp = sdp;
+	return bc;
+}
+
+static struct bcache_buf *bcache_lookup(struct bcache *bc, uint64 blkno)
+{
+	osi_list_t *head = &bc->bc_hash[blkno & (bc->bc_hash_size - 1)];
+	osi_list_t *tmp;
+	struct bcache_buf *bb;
+
+	osi_list_foreach(tmp, head) {
+		bb = osi_list_entry(tmp, struct bcache_buf, b_hash);
+		if(bb->b_blkno == blkno)
+			return bb;
+	}
+	return NULL;
+}
+
+static int bcache_cmp(const void *a, const void *b)
+{
+	uint64 x = (*(struct bcache_buf **)a)->b_blkno;
+	uint64 y = (*(struct bcache_buf **)b)->b_blkno;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * bcache_writeback - write all dirty blocks
+ * @sdp: the super block
+ * @bc: the cache
+ *
+ * The blocks are sorted, and runs of consecutive blocks are written
+ * with one write.
+ *
+ * Returns: 0 on success, -1 if any block couldn't be written
+ */
+static int bcache_writeback(struct fsck_sb *sdp, struct bcache *bc)
+{
+	struct bcache_buf **dirty, *bb;
+	osi_list_t *tmp;
+	unsigned int x, n = 0, run;
+	uint32 bsize = bc->bc_bsize;
+	ssize_t len;
+	int error = 0;
+
+	if(!bc->bc_dirty)
+		return 0;
+
+	if(!(dirty = malloc(bc->bc_dirty * sizeof(struct bcache_buf *)))) {
+		log_err("Unable to allocate memory to write back %u blocks\n",
+			bc->bc_dirty);
+		return -1;
+	}
+	osi_list_foreach(tmp, &bc->bc_lru) {
+		bb = osi_list_entry(tmp, struct bcache_buf, b_lru);
+		if(bb->b_dirty)
+			dirty[n++] = bb;
+	}
+	qsort(dirty, n, sizeof(struct bcache_buf *), bcache_cmp);
+
+	for(x = 0; x < n; x += run) {
+		for(run = 0; x + run < n && run < RA_MAX &&
+			    dirty[x + run]->b_blkno == dirty[x]->b_blkno + run;
+		    run++)
+			memcpy(bc->bc_wbuf + run * bsize,
+			       dirty[x + run]->b_data, bsize);
+
+		log_debug("Writing to %"PRIu64" - %"PRIu64" %u x %u\n",
+			  (uint64)(dirty[x]->b_blkno * bsize),
+			  dirty[x]->b_blkno, run, bsize);
+		len = pwrite(sdp->diskfd, bc->bc_wbuf, run * bsize,
+			     dirty[x]->b_blkno * bsize);
+		bc->bc_writes++;
+		if(len != run * bsize) {
+			log_err("Unable to write %u bytes to position "
+				"%"PRIu64"\n", run * bsize,
+				(uint64)(dirty[x]->b_blkno * bsize));
+			error = -1;
+			continue;
+		}
+		bc->bc_written_blocks += run;
+		for(len = 0; len < run; len++)
+			dirty[x + len]->b_dirty = 0;
+		bc->bc_dirty -= run;
+	}
+
+	free(dirty);
+	return error;
+}
+
+/*
+ * bcache_add - make a cache entry for a block that isn't cached
+ *
+ * When the cache is full the least recently used block is reused.
+ * If that is dirty, all dirty blocks are written first, so that
+ * writes still go out in order and in runs.
+ *
+ * Returns: the entry, or NULL on error
+ */
+static struct bcache_buf *bcache_add(struct fsck_sb *sdp, struct bcache *bc,
+				     uint64 blkno)
+{
+	struct bcache_buf *bb;
+
+	if(bc->bc_count < bc->bc_max) {
+		bb = malloc(sizeof(struct bcache_buf) + bc->bc_bsize);
+		if(!bb) {
+			log_err("Unable to allocate memory for block cache\n");
+			return NULL;
+		}
+		bc->bc_count++;
+	} else {
+		bb = osi_list_entry(bc->bc_lru.prev, struct bcache_buf, b_lru);
+		if(bb->b_dirty && bcache_writeback(sdp, bc))
+			return NULL;
+		osi_list_del(&bb->b_hash);
+		osi_list_del(&bb->b_lru);
+	}
+
+	bb->b_blkno = blkno;
+	bb->b_dirty = 0;
+	osi_list_add(&bb->b_hash,
+		     &bc->bc_hash[blkno & (bc->bc_hash_size - 1)]);
+	osi_list_add(&bb->b_lru, &bc->bc_lru);
+	return bb;
+}
+
+static int bcache_rgrp_cmp(const void *a, const void *b)
+{
+	uint64 x = ((struct bcache_rgrp *)a)->start;
+	uint64 y = ((struct bcache_rgrp *)b)->start;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * bcache_rgrp - find the resource group holding a block
+ *
+ * The rgrp list is copied into a sorted table the first time, and
+ * again whenever the number of rgrps changes (they can be rebuilt
+ * before pass1).
+ *
+ * Returns: the rgrp's extent, or NULL if blkno isn't in one
+ */
+static struct bcache_rgrp *bcache_rgrp(struct fsck_sb *sdp, struct bcache *bc,
+				       uint64 blkno)
+{
+	struct fsck_rgrp *rgd;
+	struct bcache_rgrp *r;
+	osi_list_t *tmp;
+	unsigned int lo, hi, mid, n = 0;
+
+	if(!sdp->rgcount || !sdp->rglist.next)
+		return NULL;
+
+	if(bc->bc_rgcount != sdp->rgcount) {
+		free(bc->bc_rgrps);
+		bc->bc_rgcount = 0;
+		bc->bc_rgrps = malloc(sdp->rgcount * sizeof(struct bcache_rgrp));
+		if(!bc->bc_rgrps)
+			return NULL;
+		osi_list_foreach(tmp, &sdp->rglist) {
+			if(n == sdp->rgcount)
+				break;
+			rgd = osi_list_entry(tmp, struct fsck_rgrp, rd_list);
+			bc->bc_rgrps[n].start = rgd->rd_ri.ri_addr;
+			bc->bc_rgrps[n].end = rgd->rd_ri.ri_data1 +
+				rgd->rd_ri.ri_data;
+			bc->bc_rgrps[n].length = rgd->rd_ri.ri_length;
+			n++;
+		}
+		qsort(bc->bc_rgrps, n, sizeof(struct bcache_rgrp),
+		      bcache_rgrp_cmp);
+		bc->bc_rgcount = n;
+	}
+
+	lo = 0;
+	hi = bc->bc_rgcount;
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		r = &bc->bc_rgrps[mid];
+		if(blkno < r->start)
+			hi = mid;
+		else if(blkno >= r->end)
+			lo = mid + 1;
+		else
+			return r;
+	}
+	return NULL;
+}
+
+/*
+ * bcache_read - read a block that isn't cached, and some after it
+ * @sdp: the super block
+ * @bc: the cache
+ * @blkno: the block wanted
+ *
+ * Returns: the cache entry for blkno, or NULL on error
+ */
+static struct bcache_buf *bcache_read(struct fsck_sb *sdp, struct bcache *bc,
+				      uint64 blkno)
+{
+	struct bcache_rgrp *r;
+	struct bcache_buf *bb, *want = NULL;
+	uint64 end = blkno + 1;
+	uint32 bsize = bc->bc_bsize;
+	unsigned int count, x;
+	ssize_t len;
+
+	if(blkno == bc->bc_ra_next) {
+		bc->bc_ra_size *= 2;
+		if(bc->bc_ra_size > RA_MAX)
+			bc->bc_ra_size = RA_MAX;
+	} else
+		bc->bc_ra_size = RA_MIN;
+
+	/* Read ahead only within the file system, and within the rgrp */
+	if(sdp->last_fs_block) {
+		end = blkno + bc->bc_ra_size;
+		if(end > sdp->last_fs_block + 1)
+			end = sdp->last_fs_block + 1;
+	}
+	if((r = bcache_rgrp(sdp, bc, blkno))) {
+		if(blkno == r->start && end < blkno + r->length)
+			end = blkno + r->length;
+		if(end > r->end)
+			end = r->end;
+	}
+	if(end > blkno + RA_MAX)
+		end = blkno + RA_MAX;
+
+	/* Don't read over blocks we have, they may be dirty */
+	for(count = 1; blkno + count < end; count++)
+		if(bcache_lookup(bc, blkno + count))
+			break;
+
+	len = pread(sdp->diskfd, bc->bc_iobuf, count * bsize, blkno * bsize);
+	bc->bc_reads++;
+	if(len < (ssize_t)bsize) {
+		log_err("Unable to read %u bytes from position %"PRIu64"\n",
+			bsize, (uint64)(blkno * bsize));
+		return NULL;
+	}
+	count = len / bsize;
+	bc->bc_read_blocks += count;
+	bc->bc_ra_next = blkno + count;
+
+	/* Add the read-ahead blocks first so the wanted one is the most
+	   recently used */
+	for(x = count; x-- > 0;) {
+		if(!(bb = bcache_add(sdp, bc, blkno + x)))
+			return NULL;
+		memcpy(bb->b_data, bc->bc_iobuf + x * bsize, bsize);
+		want = bb;
+	}
+	return want;
+}
+
+/*
+ * bcache_sync - write back the block cache
+ * @sdp: the super block
+ *
+ * Called at the end of each pass.  The cache statistics so far are
+ * logged in verbose mode.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int bcache_sync(struct fsck_sb *sdp)
+{
+	struct bcache *bc = sdp->bcache;
+	int error;
+
+	if(!bc)
+		return 0;
+
+	error = bcache_writeback(sdp, bc);
+	log_info("Block cache: %"PRIu64" hits, %"PRIu64" misses "
+		 "(%"PRIu64" blocks in %"PRIu64" reads), %"PRIu64
+		 " blocks written in %"PRIu64" writes\n",
+		 bc->bc_hits, bc->bc_misses, bc->bc_read_blocks,
+		 bc->bc_reads, bc->bc_written_blocks, bc->bc_writes);
+	return error;
+}
+
+/*
+ * bcache_destroy - write back and free the block cache
+ * @sdp: the super block
+ */
+void bcache_destroy(struct fsck_sb *sdp)
+{
+	bcache_sync(sdp);
+	bcache_free(sdp);
+	bcache_sdp = NULL;
+}
+
 /*
  * get_buf - get a buffer
  * @sdp: the super block
@@ -80,11 +519,31 @@ void relse_buf(struct fsck_sb *sdp, osi_buf_t *bh){
  * @bhp: place where buffer is returned
  * @flags:
  *
+ * The data comes from the block cache, which reads it (and the
+ * blocks after it) from disk on a miss.
+ *
  * Returns 0 on success, -1 on error
  */
 int read_buf(struct fsck_sb *sdp, osi_buf_t *bh, int flags){
+	struct bcache *bc = bcache_get(sdp);
+	struct bcache_buf *bb;
 	int disk_fd = sdp->diskfd;
 
+	if(bc && BH_SIZE(bh) == bc->bc_bsize) {
+		bb = bcache_lookup(bc, BH_BLKNO(bh));
+		if(bb) {
+			bc->bc_hits++;
+			osi_list_del(&bb->b_lru);
+			osi_list_add(&bb->b_lru, &bc->bc_lru);
+		} else {
+			bc->bc_misses++;
+			if(!(bb = bcache_read(sdp, bc, BH_BLKNO(bh))))
+				return -1;
+		}
+		memcpy(BH_DATA(bh), bb->b_data, BH_SIZE(bh));
+		return 0;
+	}
+
 	if(do_lseek(disk_fd, (uint64)(BH_BLKNO(bh)*BH_SIZE(bh)))){
 		log_err("Unable to seek to position %"PRIu64" "
 			"(%"PRIu64" * %u) on storage device.\n",
@@ -109,11 +568,37 @@ int read_buf(struct fsck_sb *sdp, osi_buf_t *bh, int flags){
  * @bh: buffer head that describes buffer to write
  * @flags: flags that determine usage
  *
+ * The block cache is updated and the block written back later, unless
+ * BW_WAIT is given; then it is written and synced now.
+ *
  * Returns: 0 on success, -1 on failure
  */
 int write_buf(struct fsck_sb *sdp, osi_buf_t *bh, int flags){
+	struct bcache *bc = NULL;
+	struct bcache_buf *bb = NULL;
 	int disk_fd = sdp->diskfd;
 
+	/* With -n the device is read-only; let the write fail as ever */
+	if(!sdp->opts->no)
+		bc = bcache_get(sdp);
+
+	if(bc && BH_SIZE(bh) == bc->bc_bsize) {
+		bb = bcache_lookup(bc, BH_BLKNO(bh));
+		if(bb) {
+			osi_list_del(&bb->b_lru);
+			osi_list_add(&bb->b_lru, &bc->bc_lru);
+		} else if(!(bb = bcache_add(sdp, bc, BH_BLKNO(bh))))
+			return -1;
+		memcpy(bb->b_data, BH_DATA(bh), BH_SIZE(bh));
+		if(!(flags & BW_WAIT)) {
+			if(!bb->b_dirty) {
+				bb->b_dirty = 1;
+				bc->bc_dirty++;
+			}
+			return 0;
+		}
+	}
+
 	if(do_lseek(disk_fd, (uint64)(BH_BLKNO(bh) * BH_SIZE(bh)))) {
 		log_err("Unable to seek to position %"PRIu64
 			"(%"PRIu64" * %u) on storage device.\n",
@@ -130,6 +615,10 @@ int write_buf(struct fsck_sb *sdp, osi_buf_t *bh, int flags){
 			BH_SIZE(bh), (uint64)(BH_BLKNO(bh) * BH_SIZE(bh)));
 		return -1;
 	}
+	if(bb && bb->b_dirty) {
+		bb->b_dirty = 0;
+		bc->bc_dirty--;
+	}
 
 	if(flags & BW_WAIT){
 		fsync(disk_fd);
@@ -17,6 +17,8 @@ void relse_buf(struct fsck_sb *sdp, osi_buf_t *bh);
 int read_buf(struct fsck_sb *sdp, osi_buf_t *bh, int flags);
 int write_buf(struct fsck_sb *sdp, osi_buf_t *bh, int flags);
 int get_and_read_buf(struct fsck_sb *sdp, uint64 blkno, osi_buf_t **bhp, int flags);
+int bcache_sync(struct fsck_sb *sdp);
+void bcache_destroy(struct fsck_sb *sdp);
 
 #endif  /*  __BIO_H  */
 
@@ -19,6 +19,8 @@ static int reconstruct_single_journal(struct fsck_sb *sdp, int jnum){
   struct gfs_jindex    	*jdesc = &(sdp->jindex[jnum]);
   uint32		seg, sequence;
   char			buf[sdp->sb.sb_bsize];
+  osi_buf_t		*bh;
+  int			error;
 
   srandom(time(NULL));
   sequence = jdesc->ji_nsegment / (RAND_MAX + 1.0) * random();
@@ -41,8 +43,15 @@ static int reconstruct_single_journal(struct fsck_sb *sdp, int jnum){
     gfs_log_header_out(&lh,
 		       buf + GFS_BASIC_BLOCK - sizeof(struct gfs_log_header));
 
-    if(do_lseek(sdp->diskfd, lh.lh_first * sdp->sb.sb_bsize) ||
-       do_write(sdp->diskfd, buf, sdp->sb.sb_bsize)){
+    /* through the block cache, which may hold these blocks */
+    if(get_buf(sdp, lh.lh_first, &bh)){
+      log_err("Unable to reconstruct journal %d.\n", jnum);
+      return -1;
+    }
+    memcpy(BH_DATA(bh), buf, sdp->sb.sb_bsize);
+    error = write_buf(sdp, bh, 0);
+    relse_buf(sdp, bh);
+    if(error){
       log_err("Unable to reconstruct journal %d.\n", jnum);
       return -1;
     }
@@ -129,6 +129,9 @@ struct fsck_sb {
 	/* fsck_opts is used to pass command line params around */
 	struct options *opts;
 
+	/* block cache, see bio.c */
+	struct bcache *bcache;
+
 };
 
 
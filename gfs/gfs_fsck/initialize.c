@@ -403,13 +403,20 @@ int initialize(struct fsck_sb *sbp)
 static void destroy_sbp(struct fsck_sb *sbp)
 {
 	if(!sbp->opts->no) {
-		if(block_mounters(sbp, 0)) {
+		/* The repairs have to be on disk before the lock protocol
+		 * is put back and the fs can be mounted again */
+		log_info("Syncing the device.\n");
+		if(bcache_sync(sbp) || fsync(sbp->diskfd)) {
+			log_warn("Unable to write changes to disk - leaving other mounters blocked\n");
+			log_warn("Run fsck again, or use 'gfs_tool sb <device> proto' to unblock\n");
+		} else if(block_mounters(sbp, 0)) {
 			log_warn("Unable to unblock other mounters - manual intevention required\n");
 			log_warn("Use 'gfs_tool sb <device> proto' to fix\n");
 		}
-		log_info("Syncing the device.\n");
-		fsync(sbp->diskfd);
 	}
+	bcache_destroy(sbp);
+	if(!sbp->opts->no)
+		fsync(sbp->diskfd);
 	empty_super_block(sbp);
 	close(sbp->diskfd);
 }
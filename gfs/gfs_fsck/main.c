@@ -9,6 +9,7 @@
 #include "fsck_incore.h"
 #include "fsck.h"
 #include "log.h"
+#include "bio.h"
 
 uint64_t last_fs_block, last_reported_block = -1;
 int skip_this_pass = FALSE, fsck_abort = FALSE, fsck_query = FALSE;
@@ -191,6 +192,7 @@ int main(int argc, char **argv)
 	}
 	else
 		log_notice("Pass1 complete      \n");
+	bcache_sync(sbp);
 
 	if (!fsck_abort) {
 		last_reported_block = 0;
@@ -204,6 +206,7 @@ int main(int argc, char **argv)
 		}
 		else
 			log_notice("Pass1b complete      \n");
+		bcache_sync(sbp);
 	}
 	if (!fsck_abort) {
 		last_reported_block = 0;
@@ -217,6 +220,7 @@ int main(int argc, char **argv)
 		}
 		else
 			log_notice("Pass1c complete      \n");
+		bcache_sync(sbp);
 	}
 	if (!fsck_abort) {
 		last_reported_block = 0;
@@ -230,6 +234,7 @@ int main(int argc, char **argv)
 		}
 		else
 			log_notice("Pass2 complete      \n");
+		bcache_sync(sbp);
 	}
 	if (!fsck_abort) {
 		last_reported_block = 0;
@@ -243,6 +248,7 @@ int main(int argc, char **argv)
 		}
 		else
 			log_notice("Pass3 complete      \n");
+		bcache_sync(sbp);
 	}
 	if (!fsck_abort) {
 		last_reported_block = 0;
@@ -256,6 +262,7 @@ int main(int argc, char **argv)
 		}
 		else
 			log_notice("Pass4 complete      \n");
+		bcache_sync(sbp);
 	}
 	if (!fsck_abort) {
 		last_reported_block = 0;
@@ -270,6 +277,7 @@ int main(int argc, char **argv)
 		else
 			log_notice("Pass5 complete      \n");
 		log_notice("Writing changes to disk\n");
+		bcache_sync(sbp);
 	} else {
 		error = FSCK_CANCELED;
 	}
@@ -20,6 +20,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <linux/types.h>
 #include <linux/gfs2_ondisk.h>
@@ -62,6 +63,9 @@
 
 #define DIV_RU(x, y) (((x) + (y) - 1) / (y))
 
+#define MAX_CONVERT_THREADS 8
+#define RENUMBER_WINDOW (4 << 20) /* bytes of metadata read at a time */
+
 struct gfs1_rgrp {
 	struct gfs2_meta_header rg_header; /* hasn't changed from gfs1 to 2 */
 	uint32_t rg_flags;
@@ -132,6 +136,36 @@ struct blocklist {
 	char *ptrbuf;
 };
 
+/* One resource group's share of inode_renumber */
+struct rgrp_work {
+	struct rgrp_list *rgd;
+	uint64_t *dinodes;      /* dinodes to renumber, in block order */
+	uint32_t ndinodes;
+	uint32_t *rebuild;      /* indexes into dinodes of the inodes whose */
+	uint32_t nrebuild;      /* metadata trees have to be rebuilt        */
+	uint64_t first_inum;    /* number given to dinodes[0] */
+	int counted;            /* the dinodes have all been found */
+	int root;               /* index of the root dinode, or -1 */
+	osi_list_t dirs;        /* directories to fix, in block order */
+	osi_list_t cdpns;       /* cdpn symlinks to fix, in block order */
+	int error;
+};
+
+struct renumber {
+	struct gfs2_sbd *sbp;
+	uint64_t root_addr;
+	struct rgrp_work *work;
+	unsigned int rgrps;
+	unsigned int next;      /* next rgrp for a thread to take */
+	unsigned int numbered;  /* rgrps whose first_inum is known */
+	unsigned int converted; /* rgrps finished */
+	unsigned int running;   /* threads still running */
+	uint64_t inodes;        /* inodes converted so far */
+	int error;              /* an rgrp couldn't be scanned */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
 struct gfs1_sb  raw_gfs1_ondisk_sb;
 struct gfs2_sbd sb2;
 char device[256];
@@ -149,6 +183,7 @@ uint64_t gfs2_jheightsize[GFS2_MAX_META_HEIGHT];
 uint32_t gfs2_max_height;
 uint32_t gfs2_max_jheight;
 uint64_t jindex_addr = 0, rindex_addr = 0;
+int convert_threads = -1; /* -1: one per cpu, 0: serial walk */
 
 /* ------------------------------------------------------------------------- */
 /* This function is for libgfs's sake.                                       */
@@ -915,7 +950,8 @@ static int has_cdpn(const char *str)
 	return 0;
 }
 
-static int fix_cdpn_symlink(struct gfs2_sbd *sbp, struct gfs2_buffer_head *bh, struct gfs2_inode *ip)
+static int fix_cdpn_symlink(struct gfs2_sbd *sbp, struct gfs2_buffer_head *bh,
+			    struct gfs2_inode *ip, osi_list_t *cdpn_to_fix)
 {
 	int ret = 0;
 	char *linkptr = NULL;
@@ -934,8 +970,7 @@ static int fix_cdpn_symlink(struct gfs2_sbd *sbp, struct gfs2_buffer_head *bh, s
 		}
 		memset(fix, 0, sizeof(struct inode_dir_block));
 		fix->di_addr = ip->i_di.di_num.no_addr;
-		osi_list_add_prev((osi_list_t *)&fix->list,
-				  (osi_list_t *)&cdpns_to_fix);
+		osi_list_add_prev((osi_list_t *)&fix->list, cdpn_to_fix);
 	}
 
 	return ret;
@@ -979,15 +1014,42 @@ static int fix_xattr(struct gfs2_sbd *sbp, struct gfs2_buffer_head *bh, struct g
 	return ret;
 }
 
+/* ------------------------------------------------------------------------- */
+/* gfs1_type_to_mode - the gfs2 di_mode type bits for a gfs1 di_type         */
+/* ------------------------------------------------------------------------- */
+static unsigned int gfs1_type_to_mode(unsigned int di_type)
+{
+	switch (di_type) {
+	case GFS_FILE_DIR:           /* directory        */
+		return S_IFDIR;
+	case GFS_FILE_REG:           /* regular file     */
+		return S_IFREG;
+	case GFS_FILE_LNK:           /* symlink          */
+		return S_IFLNK;
+	case GFS_FILE_BLK:           /* block device     */
+		return S_IFBLK;
+	case GFS_FILE_CHR:           /* character device */
+		return S_IFCHR;
+	case GFS_FILE_FIFO:          /* fifo / pipe      */
+		return S_IFIFO;
+	case GFS_FILE_SOCK:          /* socket           */
+		return S_IFSOCK;
+	}
+	return 0;
+}
+
 /* ------------------------------------------------------------------------- */
 /* adjust_inode - change an inode from gfs1 to gfs2                          */
 /*                                                                           */
+/* @inum: the new inode number                                               */
+/* @cdpn_to_fix: list to add the inode to if it's a cdpn symlink             */
+/*                                                                           */
 /* Returns: 0 on success, -1 on failure                                      */
 /* ------------------------------------------------------------------------- */
-static int adjust_inode(struct gfs2_sbd *sbp, struct gfs2_buffer_head *bh)
+static int adjust_inode(struct gfs2_sbd *sbp, struct gfs2_buffer_head *bh,
+			uint64_t inum, osi_list_t *cdpn_to_fix)
 {
 	struct gfs2_inode *inode;
-	struct inode_block *fixdir;
 	int inode_was_gfs1;
 
 	inode = gfs_inode_get(sbp, bh);
@@ -995,42 +1057,10 @@ static int adjust_inode(struct gfs2_sbd *sbp, struct gfs2_buffer_head *bh)
 	inode_was_gfs1 = (inode->i_di.di_num.no_formal_ino ==
 					  inode->i_di.di_num.no_addr);
 	/* Fix the inode number: */
-	inode->i_di.di_num.no_formal_ino = sbp->md.next_inum;           ;
+	inode->i_di.di_num.no_formal_ino = inum;
 	
 	/* Fix the inode type: gfs1 uses di_type, gfs2 uses di_mode. */
-	switch (inode->i_di.__pad1) { /* formerly di_type */
-	case GFS_FILE_DIR:           /* directory        */
-		inode->i_di.di_mode |= S_IFDIR;
-		/* Add this directory to the list of dirs to fix later. */
-		fixdir = malloc(sizeof(struct inode_block));
-		if (!fixdir) {
-			log_crit("Error: out of memory.\n");
-			return -1;
-		}
-		memset(fixdir, 0, sizeof(struct inode_block));
-		fixdir->di_addr = inode->i_di.di_num.no_addr;
-		osi_list_add_prev((osi_list_t *)&fixdir->list,
-						  (osi_list_t *)&dirs_to_fix);
-		break;
-	case GFS_FILE_REG:           /* regular file     */
-		inode->i_di.di_mode |= S_IFREG;
-		break;
-	case GFS_FILE_LNK:           /* symlink          */
-		inode->i_di.di_mode |= S_IFLNK;
-		break;
-	case GFS_FILE_BLK:           /* block device     */
-		inode->i_di.di_mode |= S_IFBLK;
-		break;
-	case GFS_FILE_CHR:           /* character device */
-		inode->i_di.di_mode |= S_IFCHR;
-		break;
-	case GFS_FILE_FIFO:          /* fifo / pipe      */
-		inode->i_di.di_mode |= S_IFIFO;
-		break;
-	case GFS_FILE_SOCK:          /* socket           */
-		inode->i_di.di_mode |= S_IFSOCK;
-		break;
-	}
+	inode->i_di.di_mode |= gfs1_type_to_mode(inode->i_di.__pad1);
 			
 	/* ----------------------------------------------------------- */
 	/* gfs2 inodes are slightly different from gfs1 inodes in that */
@@ -1066,7 +1096,7 @@ static int adjust_inode(struct gfs2_sbd *sbp, struct gfs2_buffer_head *bh)
 			return -1;
 		/* Check for cdpns */
 		if (inode->i_di.di_mode & S_IFLNK) {
-			ret = fix_cdpn_symlink(sbp, bh, inode);
+			ret = fix_cdpn_symlink(sbp, bh, inode, cdpn_to_fix);
 			if (ret)
 				return -1;
 		}
@@ -1080,32 +1110,305 @@ static int adjust_inode(struct gfs2_sbd *sbp, struct gfs2_buffer_head *bh)
 	
 	bmodified(inode->i_bh);
 	inode_put(&inode); /* does gfs2_dinode_out if modified */
-	sbp->md.next_inum++; /* update inode count */
 	return 0;
 } /* adjust_inode */
 
 /* ------------------------------------------------------------------------- */
-/* inode_renumber - renumber the inodes                                      */
+/* inode_needs_rebuild - will adjust_inode rebuild the inode's metadata tree */
 /*                                                                           */
-/* In gfs1, the inode number WAS the inode address.  In gfs2, the inodes are */
-/* numbered sequentially.                                                    */
+/* Rebuilding frees and allocates blocks, so those inodes can't be converted */
+/* alongside the others.                                                     */
+/* ------------------------------------------------------------------------- */
+static int inode_needs_rebuild(struct gfs2_inode *ip)
+{
+	unsigned int mode;
+
+	/* Renumbered by an earlier, interrupted run: nothing to rebuild */
+	if (ip->i_di.di_num.no_formal_ino != ip->i_di.di_num.no_addr)
+		return 0;
+	mode = ip->i_di.di_mode | gfs1_type_to_mode(ip->i_di.__pad1);
+	if (!(mode & S_IFDIR) && ip->i_di.di_flags & GFS2_DIF_JDATA)
+		return ip->i_di.di_height > 0;
+	return ip->i_di.di_height > 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* fix_meta_bitmap - mark a metadata block that isn't a dinode as data.      */
 /*                                                                           */
-/* Returns: 0 on success, -1 on failure                                      */
+/* gfs1 marks all metadata "used meta" (11) but gfs2 only uses that state    */
+/* for dinodes; indirect blocks and the like are marked as data (01).        */
 /* ------------------------------------------------------------------------- */
-static int inode_renumber(struct gfs2_sbd *sbp, uint64_t root_inode_addr, osi_list_t *cdpn_to_fix)
+static void fix_meta_bitmap(struct rgrp_list *rgd, uint64_t block)
+{
+	uint32_t rblock = block - rgd->ri.ri_data0;
+	uint32_t byte = rblock / GFS2_NBBY;
+	int bit = (rblock % GFS2_NBBY) * GFS2_BIT_SIZE;
+	struct gfs2_bitmap *bits;
+	unsigned char *bitbyte;
+	int i = 0;
+
+	/* All bitmaps but the first are the same size (or the last is
+	   shorter), so the one the byte is on can be worked out directly */
+	if (byte >= rgd->bits[0].bi_len && rgd->ri.ri_length > 1)
+		i = 1 + (byte - rgd->bits[0].bi_len) / rgd->bits[1].bi_len;
+	bits = &rgd->bits[i];
+	bitbyte = (unsigned char *)rgd->bh[i]->b_data + bits->bi_offset +
+		byte - bits->bi_start;
+	*bitbyte &= ~(GFS2_BIT_MASK << bit);
+	*bitbyte |= GFS2_BLKST_USED << bit;
+	bmodified(rgd->bh[i]);
+}
+
+/* ------------------------------------------------------------------------- */
+/* read_blocks - read a run of blocks into a buffer                          */
+/* ------------------------------------------------------------------------- */
+static int read_blocks(struct gfs2_sbd *sbp, uint64_t block, uint64_t count,
+		       char *buf)
+{
+	size_t len = count * sbp->bsize, done = 0;
+	ssize_t rv;
+
+	while (done < len) {
+		rv = pread(sbp->device_fd, buf + done, len - done,
+			   (off_t)block * sbp->bsize + done);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv <= 0) {
+			log_crit("Error reading block %" PRIu64 ": %s\n",
+				 block, rv < 0 ? strerror(errno) : "end of device");
+			return -1;
+		}
+		done += rv;
+	}
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* scan_rgrp - find the dinodes in a resource group                          */
+/*                                                                           */
+/* Reads all the rgrp's metadata, a window at a time, fixes the bitmap for   */
+/* the metadata that isn't dinodes, and lists the dinodes to be renumbered,  */
+/* the directories among them and the ones that need their metadata trees   */
+/* rebuilt.  Nothing but the rgrp's own bitmaps is changed.                  */
+/* ------------------------------------------------------------------------- */
+static void scan_rgrp(struct renumber *rn, struct rgrp_work *w, char *window,
+		      uint64_t **meta, uint32_t *meta_size)
+{
+	struct gfs2_sbd *sbp = rn->sbp;
+	struct gfs2_buffer_head bh;
+	struct gfs2_inode *ip;
+	struct inode_block *fixdir;
+	uint64_t block, *grown, wblocks = RENUMBER_WINDOW / sbp->bsize;
+	uint32_t n = 0, i, j, k;
+	int first = 1;
+
+	/* Get all the "used meta" blocks.  Both inodes and indirect blocks
+	   are marked that way, so all of them have to be looked at. */
+	while (!gfs2_next_rg_meta(w->rgd, &block, first)) {
+		if (n == *meta_size) {
+			*meta_size = *meta_size ? *meta_size * 2 : 1024;
+			grown = realloc(*meta, *meta_size * sizeof(uint64_t));
+			if (!grown) {
+				log_crit("Error: out of memory.\n");
+				w->error = -1;
+				return;
+			}
+			*meta = grown;
+		}
+		(*meta)[n++] = block;
+		first = 0;
+	}
+	w->dinodes = malloc((n ? n : 1) * sizeof(uint64_t));
+	w->rebuild = malloc((n ? n : 1) * sizeof(uint32_t));
+	if (!w->dinodes || !w->rebuild) {
+		log_crit("Error: out of memory.\n");
+		w->error = -1;
+		return;
+	}
+
+	memset(&bh, 0, sizeof(bh));
+	bh.sdp = sbp;
+	for (i = 0; i < n; i = j) {
+		/* One read for as many of them as fit in the window */
+		for (j = i + 1; j < n && (*meta)[j] - (*meta)[i] < wblocks; j++)
+			;
+		if (read_blocks(sbp, (*meta)[i], (*meta)[j - 1] - (*meta)[i] + 1,
+				window)) {
+			w->error = -1;
+			return;
+		}
+		for (k = i; k < j; k++) {
+			block = (*meta)[k];
+			bh.b_blocknr = block;
+			bh.b_data = window + (block - (*meta)[i]) * sbp->bsize;
+			if (gfs2_check_meta(&bh, 0))
+				continue;
+			if (gfs2_check_meta(&bh, GFS_METATYPE_DI)) {
+				fix_meta_bitmap(w->rgd, block);
+				continue;
+			}
+			/* Skip the rindex and jindex inodes for now. */
+			if (block == rindex_addr || block == jindex_addr)
+				continue;
+			if (block == rn->root_addr)
+				w->root = w->ndinodes;
+			ip = gfs_inode_get(sbp, &bh);
+			if (ip->i_di.__pad1 == GFS_FILE_DIR) {
+				/* Add it to the list of dirs to fix later. */
+				fixdir = malloc(sizeof(struct inode_block));
+				if (!fixdir) {
+					log_crit("Error: out of memory.\n");
+					w->error = -1;
+					inode_put(&ip);
+					return;
+				}
+				memset(fixdir, 0, sizeof(struct inode_block));
+				fixdir->di_addr = block;
+				osi_list_add_prev(&fixdir->list, &w->dirs);
+			}
+			if (inode_needs_rebuild(ip))
+				w->rebuild[w->nrebuild++] = w->ndinodes;
+			inode_put(&ip);
+			w->dinodes[w->ndinodes++] = block;
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* convert_rgrp - convert the dinodes scan_rgrp found                        */
+/*                                                                           */
+/* All but the ones that need their metadata trees rebuilt; those are done   */
+/* later, one at a time.                                                     */
+/* ------------------------------------------------------------------------- */
+static void convert_rgrp(struct renumber *rn, struct rgrp_work *w)
+{
+	struct gfs2_sbd *sbp = rn->sbp;
+	struct gfs2_buffer_head *bh;
+	uint32_t i, r = 0;
+
+	if (!w->ndinodes)
+		return;
+	/* They were just read by scan_rgrp, but may have been evicted */
+	posix_fadvise(sbp->device_fd, (off_t)w->dinodes[0] * sbp->bsize,
+		      (off_t)(w->dinodes[w->ndinodes - 1] - w->dinodes[0] + 1) *
+		      sbp->bsize, POSIX_FADV_WILLNEED);
+	for (i = 0; i < w->ndinodes; i++) {
+		if (r < w->nrebuild && w->rebuild[r] == i) {
+			r++;
+			continue;
+		}
+		bh = bread(sbp, w->dinodes[i]);
+		if (adjust_inode(sbp, bh, w->first_inum + i, &w->cdpns))
+			w->error = -1;
+		brelse(bh);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* renumber_thread - scan and convert resource groups until there are none   */
+/*                   left                                                    */
+/*                                                                           */
+/* An rgrp's inodes are numbered after those of all the rgrps before it, so  */
+/* they get the same numbers they would in a serial conversion.  A thread    */
+/* scans its rgrp, then waits until every rgrp before it has been scanned    */
+/* (and so the number of its first inode is known) before converting it.     */
+/* ------------------------------------------------------------------------- */
+static void *renumber_thread(void *arg)
+{
+	struct renumber *rn = arg;
+	struct rgrp_work *w, *prev;
+	uint64_t *meta = NULL;
+	uint32_t meta_size = 0;
+	unsigned int rgnum;
+	int convert;
+	char *window;
+
+	window = malloc(RENUMBER_WINDOW);
+	if (!window)
+		log_crit("Error: out of memory.\n");
+
+	pthread_mutex_lock(&rn->lock);
+	while (window && rn->next < rn->rgrps) {
+		rgnum = rn->next++;
+		w = &rn->work[rgnum];
+		pthread_mutex_unlock(&rn->lock);
+
+		scan_rgrp(rn, w, window, &meta, &meta_size);
+
+		pthread_mutex_lock(&rn->lock);
+		w->counted = 1;
+		if (w->error)
+			rn->error = 1;
+		while (rn->numbered < rn->rgrps &&
+		       rn->work[rn->numbered].counted) {
+			if (rn->numbered) {
+				prev = &rn->work[rn->numbered - 1];
+				rn->work[rn->numbered].first_inum =
+					prev->first_inum + prev->ndinodes;
+			} else
+				rn->work[0].first_inum = 1;
+			rn->numbered++;
+		}
+		pthread_cond_broadcast(&rn->cond);
+		while (rn->numbered <= rgnum)
+			pthread_cond_wait(&rn->cond, &rn->lock);
+		/* If an rgrp before this one couldn't be scanned, the
+		   numbers are wrong: give up */
+		convert = !rn->error;
+		pthread_mutex_unlock(&rn->lock);
+
+		if (convert)
+			convert_rgrp(rn, w);
+
+		pthread_mutex_lock(&rn->lock);
+		rn->converted++;
+		rn->inodes += w->ndinodes - w->nrebuild;
+	}
+	rn->running--;
+	pthread_cond_broadcast(&rn->cond);
+	pthread_mutex_unlock(&rn->lock);
+
+	free(meta);
+	free(window);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* renumber_progress - put out a warm, fuzzy message every second so the    */
+/*                     customer doesn't think we hung.  (This may take a     */
+/*                     long time).                                           */
+/* ------------------------------------------------------------------------- */
+static void renumber_progress(struct renumber *rn)
+{
+	gettimeofday(&tv, NULL);
+	if (tv.tv_sec - seconds) {
+		seconds = tv.tv_sec;
+		log_notice("\r%" PRIu64" inodes from %u rgs converted.",
+			   rn->inodes, rn->converted);
+		fflush(stdout);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* inode_renumber_serial - renumber the inodes one block at a time           */
+/*                                                                           */
+/* The walk inode_renumber did before it had worker threads, kept (-T 0) so  */
+/* their results can be checked against it.                                  */
+/* ------------------------------------------------------------------------- */
+static int inode_renumber_serial(struct gfs2_sbd *sbp, uint64_t root_inode_addr,
+				 osi_list_t *cdpn_to_fix)
 {
 	struct rgrp_list *rgd;
+	struct inode_block *fixdir;
+	struct gfs2_buffer_head *bh;
+	struct gfs2_inode *ip;
 	osi_list_t *tmp;
 	uint64_t block;
-	struct gfs2_buffer_head *bh;
 	int first;
 	int error = 0;
 	int rgs_processed = 0;
 
-	log_notice("Converting inodes.\n");
 	sbp->md.next_inum = 1; /* starting inode numbering */
-	gettimeofday(&tv, NULL);
-	seconds = tv.tv_sec;
 
 	/* ---------------------------------------------------------------- */
 	/* Traverse the resource groups to figure out where the inodes are. */
@@ -1114,7 +1417,7 @@ static int inode_renumber(struct gfs2_sbd *sbp, uint64_t root_inode_addr, osi_li
 		rgs_processed++;
 		rgd = osi_list_entry(tmp, struct rgrp_list, list);
 		first = 1;
-		while (1) {    /* for all inodes in the resource group */
+		while (!error) {    /* for all inodes in the resource group */
 			gettimeofday(&tv, NULL);
 			/* Put out a warm, fuzzy message every second so the customer */
 			/* doesn't think we hung.  (This may take a long time).       */
@@ -1128,54 +1431,187 @@ static int inode_renumber(struct gfs2_sbd *sbp, uint64_t root_inode_addr, osi_li
 			/* Get the next metadata block.  Break out if we reach the end. */
 			/* We have to check all metadata blocks because the bitmap may  */
 			/* be "11" (used meta) for both inodes and indirect blocks.     */
-			/* We need to process the inodes and change the indirect blocks */
-			/* to have a bitmap type of "01" (data).                        */
 			if (gfs2_next_rg_metatype(sbp, rgd, &block, 0, first))
 				break;
+			first = 0;
+			bh = bread(sbp, block);
+			if (gfs2_check_meta(bh, GFS_METATYPE_DI)) {
+				/* It's metadata, but not an inode */
+				fix_meta_bitmap(rgd, block);
+				brelse(bh);
+				continue;
+			}
+			/* Skip the rindex and jindex inodes for now. */
+			if (block == rindex_addr || block == jindex_addr) {
+				brelse(bh);
+				continue;
+			}
 			/* If this is the root inode block, remember it for later: */
 			if (block == root_inode_addr) {
 				sbp->sd_sb.sb_root_dir.no_addr = block;
-				sbp->sd_sb.sb_root_dir.no_formal_ino = sbp->md.next_inum;
+				sbp->sd_sb.sb_root_dir.no_formal_ino =
+					sbp->md.next_inum;
 			}
-			bh = bread(sbp, block);
-			if (!gfs2_check_meta(bh, GFS_METATYPE_DI)) {/* if it is an dinode */
-				/* Skip the rindex and jindex inodes for now. */
-				if (block != rindex_addr && block != jindex_addr)
-					error = adjust_inode(sbp, bh);
-			} else { /* It's metadata, but not an inode, so fix the bitmap. */
-				int blk, buf_offset;
-				int bitmap_byte; /* byte within the bitmap to fix */
-				int byte_bit; /* bit within the byte */
-
-				/* Figure out the absolute bitmap byte we need to fix.   */
-				/* ignoring structure offsets and bitmap blocks for now. */
-				bitmap_byte = (block - rgd->ri.ri_data0) / GFS2_NBBY;
-				byte_bit = (block - rgd->ri.ri_data0) % GFS2_NBBY;
-				/* Now figure out which bitmap block the byte is on */
-				for (blk = 0; blk < rgd->ri.ri_length; blk++) {
-					/* figure out offset of first bitmap byte for this map: */
-					buf_offset = (blk) ? sizeof(struct gfs2_meta_header) :
-						sizeof(struct gfs2_rgrp);
-					/* if it's on this page */
-					if (buf_offset + bitmap_byte < sbp->bsize) {
-						rgd->bh[blk]->b_data[buf_offset + bitmap_byte] &=
-							~(0x03 << (GFS2_BIT_SIZE * byte_bit));
-						rgd->bh[blk]->b_data[buf_offset + bitmap_byte] |=
-							(0x01 << (GFS2_BIT_SIZE * byte_bit));
-						break;
-					}
-					bitmap_byte -= (sbp->bsize - buf_offset);
-					bmodified(rgd->bh[blk]);
+			ip = gfs_inode_get(sbp, bh);
+			if (ip->i_di.__pad1 == GFS_FILE_DIR) {
+				/* Add it to the list of dirs to fix later. */
+				fixdir = malloc(sizeof(struct inode_block));
+				if (!fixdir) {
+					log_crit("Error: out of memory.\n");
+					inode_put(&ip);
+					brelse(bh);
+					return -1;
 				}
+				memset(fixdir, 0, sizeof(struct inode_block));
+				fixdir->di_addr = block;
+				osi_list_add_prev((osi_list_t *)&fixdir->list,
+						  (osi_list_t *)&dirs_to_fix);
 			}
+			inode_put(&ip);
+			error = adjust_inode(sbp, bh, sbp->md.next_inum++,
+					     cdpn_to_fix);
 			brelse(bh);
-			first = 0;
 		} /* while 1 */
 	} /* for all rgs */
 	log_notice("\r%" PRIu64" inodes from %d rgs converted.",
 		   sbp->md.next_inum, rgs_processed);
 	fflush(stdout);
-	return 0;
+	return error;
+}/* inode_renumber_serial */
+
+/* ------------------------------------------------------------------------- */
+/* inode_renumber - renumber the inodes                                      */
+/*                                                                           */
+/* In gfs1, the inode number WAS the inode address.  In gfs2, the inodes are */
+/* numbered sequentially.                                                    */
+/*                                                                           */
+/* The resource groups are converted in parallel, but the result is the same */
+/* as converting them one at a time: see renumber_thread.                    */
+/*                                                                           */
+/* Returns: 0 on success, -1 on failure                                      */
+/* ------------------------------------------------------------------------- */
+static int inode_renumber(struct gfs2_sbd *sbp, uint64_t root_inode_addr, osi_list_t *cdpn_to_fix)
+{
+	struct renumber rn;
+	struct rgrp_work *w;
+	pthread_t threads[MAX_CONVERT_THREADS];
+	struct gfs2_buffer_head *bh;
+	struct timeval now;
+	struct timespec ts;
+	osi_list_t *tmp, *x;
+	unsigned int i, r, nthreads;
+	int error = 0;
+
+	log_notice("Converting inodes.\n");
+	gettimeofday(&tv, NULL);
+	seconds = tv.tv_sec;
+
+	if (!convert_threads)
+		return inode_renumber_serial(sbp, root_inode_addr, cdpn_to_fix);
+
+	memset(&rn, 0, sizeof(rn));
+	rn.sbp = sbp;
+	rn.root_addr = root_inode_addr;
+	osi_list_foreach(tmp, &sbp->rglist)
+		rn.rgrps++;
+	rn.work = calloc(rn.rgrps ? rn.rgrps : 1, sizeof(struct rgrp_work));
+	if (!rn.work) {
+		log_crit("Error: out of memory.\n");
+		return -1;
+	}
+	i = 0;
+	osi_list_foreach(tmp, &sbp->rglist) {
+		w = &rn.work[i++];
+		w->rgd = osi_list_entry(tmp, struct rgrp_list, list);
+		w->root = -1;
+		osi_list_init(&w->dirs);
+		osi_list_init(&w->cdpns);
+	}
+
+	nthreads = convert_threads;
+	if (convert_threads < 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > MAX_CONVERT_THREADS)
+		nthreads = MAX_CONVERT_THREADS;
+	if (nthreads > rn.rgrps)
+		nthreads = rn.rgrps;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	pthread_mutex_init(&rn.lock, NULL);
+	pthread_cond_init(&rn.cond, NULL);
+	pthread_mutex_lock(&rn.lock);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, renumber_thread, &rn))
+			break;
+		rn.running++;
+	}
+	nthreads = i;
+	while (rn.running) {
+		gettimeofday(&now, NULL);
+		ts.tv_sec = now.tv_sec + 1;
+		ts.tv_nsec = now.tv_usec * 1000;
+		pthread_cond_timedwait(&rn.cond, &rn.lock, &ts);
+		renumber_progress(&rn);
+	}
+	pthread_mutex_unlock(&rn.lock);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_cond_destroy(&rn.cond);
+	pthread_mutex_destroy(&rn.lock);
+
+	if (rn.converted < rn.rgrps) {
+		log_crit("Error: unable to start inode conversion.\n");
+		error = -1;
+	}
+	if (rn.error)
+		error = -1;
+	for (i = 0; i < rn.converted; i++)
+		if (rn.work[i].error)
+			error = -1;
+
+	/* Rebuilding metadata trees frees and allocates blocks, so the
+	   blocks an inode gets depend on the ones before it.  Do those
+	   inodes last, in block order, as a serial conversion would. */
+	for (i = 0; !error && i < rn.rgrps; i++) {
+		w = &rn.work[i];
+		for (r = 0; r < w->nrebuild; r++) {
+			bh = bread(sbp, w->dinodes[w->rebuild[r]]);
+			if (adjust_inode(sbp, bh, w->first_inum + w->rebuild[r],
+					 &w->cdpns))
+				error = -1;
+			brelse(bh);
+			rn.inodes++;
+			renumber_progress(&rn);
+		}
+	}
+
+	sbp->md.next_inum = 1;
+	for (i = 0; i < rn.rgrps; i++) {
+		w = &rn.work[i];
+		if (w->root >= 0) {
+			sbp->sd_sb.sb_root_dir.no_addr = root_inode_addr;
+			sbp->sd_sb.sb_root_dir.no_formal_ino =
+				w->first_inum + w->root;
+		}
+		sbp->md.next_inum += w->ndinodes;
+		osi_list_foreach_safe(tmp, &w->dirs, x) {
+			osi_list_del(tmp);
+			osi_list_add_prev(tmp, (osi_list_t *)&dirs_to_fix);
+		}
+		osi_list_foreach_safe(tmp, &w->cdpns, x) {
+			osi_list_del(tmp);
+			osi_list_add_prev(tmp, cdpn_to_fix);
+		}
+		free(w->dinodes);
+		free(w->rebuild);
+	}
+	free(rn.work);
+
+	log_notice("\r%" PRIu64" inodes from %u rgs converted.",
+		   sbp->md.next_inum, rn.rgrps);
+	fflush(stdout);
+	return error;
 }/* inode_renumber */
 
 /* ------------------------------------------------------------------------- */
@@ -1726,11 +2162,14 @@ static void usage(const char *name)
 {
 	give_warning();
 	printf("\nUsage:\n");
-	printf("%s [-hnqvVy] <device>\n\n", name);
+	printf("%s [-hnqvVy] [-T threads] <device>\n\n", name);
 	printf("Flags:\n");
 	printf("\th - print this help message\n");
 	printf("\tn - assume 'no' to all questions\n");
 	printf("\tq - quieter output\n");
+	printf("\tT - number of threads converting inodes "
+	       "(default: one per cpu, up to %d;\n"
+	       "\t    0 walks the blocks one at a time)\n", MAX_CONVERT_THREADS);
 	printf("\tv - more verbose output\n");
 	printf("\tV - print version information\n");
 	printf("\ty - assume 'yes' to all questions\n");
@@ -1751,7 +2190,7 @@ static void process_parameters(int argc, char **argv, struct gfs2_options *opts)
 		exit(0);
 	}
 	memset(device, 0, sizeof(device));
-	while((c = getopt(argc, argv, "hnqvyV")) != -1) {
+	while((c = getopt(argc, argv, "hnqvyVT:")) != -1) {
 		switch(c) {
 
 		case 'h':
@@ -1767,6 +2206,16 @@ static void process_parameters(int argc, char **argv, struct gfs2_options *opts)
 		case 'v':
 			increase_verbosity();
 			break;
+		case 'T':
+			convert_threads = atoi(optarg);
+			if (convert_threads < 0 ||
+			    convert_threads > MAX_CONVERT_THREADS) {
+				fprintf(stderr, "Number of threads must be "
+					"between 0 and %d\n",
+					MAX_CONVERT_THREADS);
+				exit(1);
+			}
+			break;
 		case 'V':
 			exit(0);
 		case 'y':
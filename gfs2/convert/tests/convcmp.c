@@ -0,0 +1,131 @@
+/*
+ * Compare two converted gfs2 images block by block.  Dinode timestamps
+ * are set from the clock while converting, so they are masked out; every
+ * other byte must match.  Used to check that a parallel gfs2_convert
+ * produces the same file system as a serial one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+
+#include "libgfs2.h"
+
+#define MAX_REPORT	20
+
+/* For libgfs2's sake */
+void print_it(const char *label, const char *fmt, const char *fmt2, ...)
+{
+	va_list args;
+
+	va_start(args, fmt2);
+	printf("%s: ", label);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+static int open_image(const char *path, off_t *size)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die("can't open %s: %s\n", path, strerror(errno));
+	if (fstat(fd, &st))
+		die("can't stat %s: %s\n", path, strerror(errno));
+	*size = st.st_size;
+	return fd;
+}
+
+static void read_block(int fd, const char *path, char *buf,
+		       unsigned int bsize, uint64_t blk)
+{
+	ssize_t n;
+
+	n = pread(fd, buf, bsize, (off_t)blk * bsize);
+	if (n != bsize)
+		die("short read of block %"PRIu64" from %s\n", blk, path);
+}
+
+static int is_dinode(char *buf)
+{
+	struct gfs2_meta_header *mh = (struct gfs2_meta_header *)buf;
+
+	return be32_to_cpu(mh->mh_magic) == GFS2_MAGIC &&
+		be32_to_cpu(mh->mh_type) == GFS2_METATYPE_DI;
+}
+
+static void mask_times(char *buf)
+{
+	size_t start = offsetof(struct gfs2_dinode, di_atime);
+	size_t end = offsetof(struct gfs2_dinode, di_ctime) + sizeof(uint64_t);
+
+	memset(buf + start, 0, end - start);
+}
+
+int main(int argc, char **argv)
+{
+	struct gfs2_sb *sb;
+	char sbbuf[GFS2_BASIC_BLOCK], *a, *b;
+	unsigned int bsize;
+	uint64_t blk, blocks, dinodes = 0;
+	off_t size_a, size_b;
+	int fd_a, fd_b, diffs = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: convcmp <image> <image>\n");
+		return 2;
+	}
+	fd_a = open_image(argv[1], &size_a);
+	fd_b = open_image(argv[2], &size_b);
+	if (size_a != size_b) {
+		printf("%s and %s differ in size\n", argv[1], argv[2]);
+		return 1;
+	}
+
+	if (pread(fd_a, sbbuf, sizeof(sbbuf),
+		  GFS2_SB_ADDR * GFS2_BASIC_BLOCK) != sizeof(sbbuf))
+		die("can't read the superblock of %s\n", argv[1]);
+	sb = (struct gfs2_sb *)sbbuf;
+	if (be32_to_cpu(sb->sb_header.mh_magic) != GFS2_MAGIC ||
+	    be32_to_cpu(sb->sb_header.mh_type) != GFS2_METATYPE_SB)
+		die("%s is not a gfs2 file system\n", argv[1]);
+	bsize = be32_to_cpu(sb->sb_bsize);
+
+	a = malloc(bsize);
+	b = malloc(bsize);
+	if (!a || !b)
+		die("out of memory\n");
+
+	blocks = size_a / bsize;
+	for (blk = 0; blk < blocks; blk++) {
+		read_block(fd_a, argv[1], a, bsize, blk);
+		read_block(fd_b, argv[2], b, bsize, blk);
+		if (is_dinode(a) && is_dinode(b)) {
+			mask_times(a);
+			mask_times(b);
+			dinodes++;
+		}
+		if (!memcmp(a, b, bsize))
+			continue;
+		if (++diffs <= MAX_REPORT)
+			printf("block %"PRIu64" (0x%"PRIx64") differs\n",
+			       blk, blk);
+	}
+
+	printf("%"PRIu64" blocks, %"PRIu64" dinodes compared, "
+	       "%d differ\n", blocks, dinodes, diffs);
+	free(a);
+	free(b);
+	close(fd_a);
+	close(fd_b);
+	return diffs ? 1 : 0;
+}
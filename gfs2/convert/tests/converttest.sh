@@ -0,0 +1,147 @@
+#!/bin/sh
+#
+# Convert the same GFS1 image with the serial walk (-T 0), with one worker
+# thread and with several, and check that the threaded results match the
+# serial one block for block (apart from dinode timestamps) and pass
+# fsck.gfs2.
+#
+# The image is populated with directories, small, large and journaled
+# files and symlinks first, so it needs root, loop devices, mkfs.gfs and
+# the gfs kernel module; it is skipped (exit 0 with a message) when any of
+# them is missing.
+#
+# Usage: converttest.sh [threads [image MB]]
+#
+
+THREADS=${1:-8}
+IMGSIZE=${2:-1024}
+
+MKFS=../../../gfs/gfs_mkfs/mkfs.gfs
+GFS_TOOL=../../../gfs/gfs_tool/gfs_tool
+CONVERT=../gfs2_convert
+FSCK=../../fsck/fsck.gfs2
+CONVCMP=./convcmp
+
+IMG=$(pwd)/converttest.img
+SERIAL=$(pwd)/converttest.serial
+SINGLE=$(pwd)/converttest.single
+PARALLEL=$(pwd)/converttest.parallel
+MNT=$(pwd)/converttest.mnt
+
+LANG=C
+LC_ALL=C
+export LANG LC_ALL
+
+skip()
+{
+	echo "converttest skipped: $*"
+	exit 0
+}
+
+fail()
+{
+	echo "FAILED: $*"
+	cleanup
+	exit 1
+}
+
+cleanup()
+{
+	umount $MNT 2>/dev/null
+	[ -n "$LOOP" ] && losetup -d $LOOP 2>/dev/null
+	LOOP=
+	rmdir $MNT 2>/dev/null
+	rm -f $IMG $SERIAL $SINGLE $PARALLEL
+}
+
+populate()
+{
+	i=0
+	while [ $i -lt 50 ]; do
+		mkdir -p $MNT/d$i/sub || return 1
+		j=0
+		while [ $j -lt 40 ]; do
+			echo "file $i/$j" > $MNT/d$i/f$j || return 1
+			j=$((j + 1))
+		done
+		ln -s f0 $MNT/d$i/link || return 1
+		i=$((i + 1))
+	done
+	# Tall enough to need rebuilding with 512 byte blocks
+	dd if=/dev/urandom of=$MNT/d0/big bs=1M count=8 2>/dev/null || return 1
+	dd if=/dev/urandom of=$MNT/d1/sub/big bs=1M count=2 2>/dev/null ||
+		return 1
+	dd if=/dev/zero of=$MNT/sparse bs=1M count=1 seek=64 2>/dev/null ||
+		return 1
+	ln -s @hostname $MNT/cdpn || return 1
+	if [ -x $GFS_TOOL ]; then
+		touch $MNT/jdata $MNT/d2/jdata
+		$GFS_TOOL setflag jdata $MNT/jdata || return 1
+		$GFS_TOOL setflag jdata $MNT/d2/jdata || return 1
+		dd if=/dev/urandom of=$MNT/jdata bs=64k count=16 2>/dev/null
+		echo "journaled" > $MNT/d2/jdata
+	fi
+	return 0
+}
+
+convert()
+{
+	name=$1
+	image=$2
+	threads=$3
+
+	start=$(date +%s.%N)
+	$CONVERT -y -T $threads $image > converttest.$name.log 2>&1 ||
+		fail "gfs2_convert -T $threads, see converttest.$name.log"
+	end=$(date +%s.%N)
+	echo "gfs2_convert -T $threads: $(echo "$end - $start" | bc) seconds"
+	rm -f converttest.$name.log
+}
+
+[ "$(id -u)" = 0 ] || skip "not root"
+[ -x $MKFS ] || skip "$MKFS not built"
+[ -x $CONVERT ] || skip "$CONVERT not built"
+[ -x $CONVCMP ] || skip "$CONVCMP not built"
+modprobe gfs 2>/dev/null
+grep -qw gfs /proc/filesystems || skip "no gfs kernel module"
+
+trap cleanup INT TERM
+
+rm -f $IMG
+dd if=/dev/zero of=$IMG bs=1M count=0 seek=$IMGSIZE 2>/dev/null ||
+	fail "can't create $IMG"
+LOOP=$(losetup -f --show $IMG) || skip "no loop devices"
+
+$MKFS -O -b 512 -r 32 -p lock_nolock -j 2 $LOOP > /dev/null ||
+	fail "mkfs.gfs"
+
+mkdir -p $MNT
+mount -t gfs $LOOP $MNT || fail "can't mount $LOOP"
+populate || fail "can't populate $MNT"
+umount $MNT || fail "can't unmount $MNT"
+losetup -d $LOOP
+LOOP=
+echo "Converting a populated ${IMGSIZE}MB file system..."
+
+for f in $SERIAL $SINGLE $PARALLEL; do
+	cp --sparse=always $IMG $f || fail "can't copy $IMG"
+done
+
+convert serial $SERIAL 0
+convert single $SINGLE 1
+convert parallel $PARALLEL $THREADS
+
+$CONVCMP $SERIAL $SINGLE ||
+	fail "-T 1 result differs from the serial walk"
+$CONVCMP $SERIAL $PARALLEL ||
+	fail "-T $THREADS result differs from the serial walk"
+
+if [ -x $FSCK ]; then
+	$FSCK -n $PARALLEL > converttest.fsck 2>&1 ||
+		fail "fsck.gfs2 found problems, see converttest.fsck"
+	rm -f converttest.fsck
+fi
+
+cleanup
+echo "all passed"
+exit 0
@@ -0,0 +1,612 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <curses.h>
+#include <linux/gfs2_ondisk.h>
+
+#include "osi_list.h"
+#include "hexedit.h"
+#include "libgfs2.h"
+
+/*
+ * Block type index
+ *
+ * Searching for the next block of a given metadata type used to mean
+ * reading every block from the starting point onward, or walking the
+ * bitmaps of each rgrp again on every search.  Instead, one pass over the
+ * file system records where every metadata block is, grouped by type, and
+ * searches become binary searches of those lists.
+ *
+ * The pass is driven by the bitmaps: the rgrp headers and bitmaps are
+ * read with one read per rgrp, free blocks are never read, and allocated
+ * blocks are read a window at a time with one read per window.  Blocks
+ * outside every rgrp (the superblock area, and the journals in gfs1) are
+ * read in full.
+ *
+ * The index can be saved to a file and is reused from there as long as
+ * the layout of the file system and the free and dinode counts of every
+ * rgrp are still the same.  The file is in host byte order; it's a cache
+ * for the machine that made it, not an interchange format.
+ */
+
+#define BLKIDX_MAGIC	"GFS2BIDX"
+#define BLKIDX_VERSION	1
+#define BLKIDX_TYPES	(GFS2_METATYPE_QC + 1)
+#define BLKIDX_WINDOW	(4 << 20)	/* bytes read at a time */
+
+struct blkidx_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t bsize;
+	uint64_t fs_blocks;
+	uint64_t rgrps;
+	uint64_t counts[BLKIDX_TYPES];
+};
+
+struct blkidx_rg {
+	uint64_t addr;
+	uint64_t data0;
+	uint32_t length;
+	uint32_t data;
+	uint32_t free;
+	uint32_t dinodes;
+	uint32_t bits0;		/* data blocks covered by the first bitmap */
+	uint32_t bits;		/* and by each of the others */
+};
+
+struct blkidx {
+	uint64_t fs_blocks;
+	uint64_t rgrps;
+	struct blkidx_rg *rg;		/* sorted by addr */
+	uint64_t *blocks[BLKIDX_TYPES];	/* each sorted */
+	uint64_t counts[BLKIDX_TYPES];
+	uint64_t sizes[BLKIDX_TYPES];
+};
+
+static struct blkidx *idx;
+static char idx_fn[PATH_MAX];
+static int idx_fn_stale;	/* blocks were written since it was saved */
+static char *window;
+
+void blkidx_set_file(const char *fn)
+{
+	strncpy(idx_fn, fn, sizeof(idx_fn) - 1);
+}
+
+int blkidx_enabled(void)
+{
+	return idx_fn[0] != '\0';
+}
+
+static void idx_add(int type, uint64_t blk)
+{
+	if (idx->counts[type] == idx->sizes[type]) {
+		idx->sizes[type] = idx->sizes[type] ? idx->sizes[type] * 2 : 64;
+		idx->blocks[type] = realloc(idx->blocks[type],
+					    idx->sizes[type] *
+					    sizeof(uint64_t));
+		if (!idx->blocks[type])
+			die("Out of memory building the block type index.\n");
+	}
+	idx->blocks[type][idx->counts[type]++] = blk;
+}
+
+/* Same test as get_block_type() in hexedit.c */
+static int buf_type(const unsigned char *buf)
+{
+	if (buf[0] == 0x01 && buf[1] == 0x16 && buf[2] == 0x19 &&
+	    buf[3] == 0x70 && buf[4] == 0x00 && buf[5] == 0x00 &&
+	    buf[6] == 0x00 && buf[7] < BLKIDX_TYPES)
+		return buf[7];
+	return 0;
+}
+
+static void read_blocks(uint64_t blk, uint64_t count, char *buf)
+{
+	size_t len = count * sbd.bsize;
+	off_t off = (off_t)blk * sbd.bsize;
+	ssize_t rv;
+	size_t done = 0;
+
+	while (done < len) {
+		rv = pread(sbd.device_fd, buf + done, len - done, off + done);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv <= 0) {
+			/* Past the end of the device reads as nothing */
+			memset(buf + done, 0, len - done);
+			return;
+		}
+		done += rv;
+	}
+}
+
+/* Index every block in [start, end) by reading all of it */
+static void index_all(uint64_t start, uint64_t end)
+{
+	uint64_t chunk = BLKIDX_WINDOW / sbd.bsize, n, x;
+	int type;
+
+	for (; start < end; start += n) {
+		n = end - start;
+		if (n > chunk)
+			n = chunk;
+		read_blocks(start, n, window);
+		for (x = 0; x < n; x++) {
+			type = buf_type((unsigned char *)window +
+					x * sbd.bsize);
+			if (type)
+				idx_add(type, start + x);
+		}
+	}
+}
+
+/* Bitmap state of every data block in the rgrp, one byte per block */
+static unsigned char *rg_states(struct rgrp_list *rgd, const char *bitbuf)
+{
+	struct gfs2_bitmap *bits;
+	const unsigned char *byte;
+	unsigned char *states;
+	uint32_t b = 0, i, x;
+	int y;
+
+	states = malloc(rgd->ri.ri_data);
+	if (!states)
+		die("Out of memory building the block type index.\n");
+
+	for (i = 0; i < rgd->ri.ri_length; i++) {
+		bits = &rgd->bits[i];
+		byte = (const unsigned char *)bitbuf + i * sbd.bsize +
+			bits->bi_offset;
+		for (x = 0; x < bits->bi_len; x++, byte++)
+			for (y = 0; y < GFS2_NBBY && b < rgd->ri.ri_data;
+			     y++, b++)
+				states[b] = (*byte >> (y * GFS2_BIT_SIZE)) &
+					GFS2_BIT_MASK;
+	}
+	for (; b < rgd->ri.ri_data; b++)
+		states[b] = GFS2_BLKST_FREE;
+	return states;
+}
+
+/* Index the rgrp header, its bitmaps, and its allocated blocks */
+static void index_rgrp(struct rgrp_list *rgd, struct blkidx_rg *irg)
+{
+	uint64_t chunk = BLKIDX_WINDOW / sbd.bsize;
+	uint32_t start, end, first, last, x;
+	unsigned char *states;
+	struct gfs2_rgrp rg;
+	struct gfs2_buffer_head hbh;
+	char *bitbuf;
+	int type;
+
+	bitbuf = malloc((size_t)rgd->ri.ri_length * sbd.bsize);
+	if (!bitbuf)
+		die("Out of memory building the block type index.\n");
+	read_blocks(rgd->ri.ri_addr, rgd->ri.ri_length, bitbuf);
+	for (x = 0; x < rgd->ri.ri_length; x++) {
+		type = buf_type((unsigned char *)bitbuf + x * sbd.bsize);
+		if (type)
+			idx_add(type, rgd->ri.ri_addr + x);
+	}
+
+	hbh.b_data = bitbuf;
+	gfs2_rgrp_in(&rg, &hbh);
+	irg->addr = rgd->ri.ri_addr;
+	irg->length = rgd->ri.ri_length;
+	irg->data0 = rgd->ri.ri_data0;
+	irg->data = rgd->ri.ri_data;
+	irg->free = rg.rg_free;
+	irg->dinodes = rg.rg_dinodes;
+	irg->bits0 = rgd->bits[0].bi_len * GFS2_NBBY;
+	if (rgd->ri.ri_length > 1)
+		irg->bits = rgd->bits[1].bi_len * GFS2_NBBY;
+
+	states = rg_states(rgd, bitbuf);
+	free(bitbuf);
+
+	for (start = 0; start < rgd->ri.ri_data; start = end) {
+		end = start + chunk;
+		if (end > rgd->ri.ri_data)
+			end = rgd->ri.ri_data;
+
+		/* Only read the part of the window that's in use */
+		for (first = start; first < end; first++)
+			if (states[first] != GFS2_BLKST_FREE)
+				break;
+		if (first == end)
+			continue;
+		for (last = end - 1; last > first; last--)
+			if (states[last] != GFS2_BLKST_FREE)
+				break;
+
+		read_blocks(rgd->ri.ri_data0 + first, last - first + 1,
+			    window);
+		for (x = first; x <= last; x++) {
+			if (states[x] == GFS2_BLKST_FREE)
+				continue;
+			type = buf_type((unsigned char *)window +
+					(uint64_t)(x - first) * sbd.bsize);
+			if (type)
+				idx_add(type, rgd->ri.ri_data0 + x);
+		}
+	}
+	free(states);
+}
+
+static int rg_compare(const void *a, const void *b)
+{
+	const struct rgrp_list *ra = *(struct rgrp_list * const *)a;
+	const struct rgrp_list *rb = *(struct rgrp_list * const *)b;
+
+	if (ra->ri.ri_addr < rb->ri.ri_addr)
+		return -1;
+	return ra->ri.ri_addr > rb->ri.ri_addr;
+}
+
+/* rglist in address order; the caller frees the array */
+static struct rgrp_list **sorted_rgrps(uint64_t *count)
+{
+	struct rgrp_list **rgs;
+	osi_list_t *tmp;
+	uint64_t n = 0;
+
+	osi_list_foreach(tmp, &sbd.rglist)
+		n++;
+	rgs = calloc(n ? n : 1, sizeof(struct rgrp_list *));
+	if (!rgs)
+		die("Out of memory building the block type index.\n");
+	n = 0;
+	osi_list_foreach(tmp, &sbd.rglist)
+		rgs[n++] = osi_list_entry(tmp, struct rgrp_list, list);
+	qsort(rgs, n, sizeof(struct rgrp_list *), rg_compare);
+	*count = n;
+	return rgs;
+}
+
+static void free_index(struct blkidx *bi)
+{
+	int t;
+
+	if (!bi)
+		return;
+	for (t = 0; t < BLKIDX_TYPES; t++)
+		free(bi->blocks[t]);
+	free(bi->rg);
+	free(bi);
+}
+
+static struct blkidx *new_index(void)
+{
+	struct blkidx *bi;
+
+	bi = calloc(1, sizeof(struct blkidx));
+	if (!bi)
+		die("Out of memory building the block type index.\n");
+	return bi;
+}
+
+static void build_index(void)
+{
+	struct rgrp_list **rgs;
+	uint64_t n, r, next = sbd.sb_addr;
+
+	if (!termlines)
+		fprintf(stderr, "Building the block type index...\n");
+
+	idx = new_index();
+	idx->fs_blocks = max_block;
+	rgs = sorted_rgrps(&n);
+	idx->rgrps = n;
+	idx->rg = calloc(n ? n : 1, sizeof(struct blkidx_rg));
+	if (!idx->rg)
+		die("Out of memory building the block type index.\n");
+
+	for (r = 0; r < n; r++) {
+		if (rgs[r]->ri.ri_addr > next)
+			index_all(next, rgs[r]->ri.ri_addr);
+		index_rgrp(rgs[r], &idx->rg[r]);
+		next = rgs[r]->ri.ri_data0 + rgs[r]->ri.ri_data;
+	}
+	if (next < max_block)
+		index_all(next, max_block);
+	free(rgs);
+}
+
+/* Does the saved index still describe this file system? */
+static int index_current(struct blkidx *bi)
+{
+	struct rgrp_list **rgs;
+	struct blkidx_rg *irg;
+	struct gfs2_rgrp rg;
+	struct gfs2_buffer_head hbh;
+	char *buf;
+	uint64_t n, r;
+	int ok = 1;
+
+	if (bi->fs_blocks != max_block)
+		return 0;
+	rgs = sorted_rgrps(&n);
+	if (n != bi->rgrps) {
+		free(rgs);
+		return 0;
+	}
+	buf = malloc(sbd.bsize);
+	if (!buf)
+		die("Out of memory reading the block type index.\n");
+	hbh.b_data = buf;
+	for (r = 0; ok && r < n; r++) {
+		irg = &bi->rg[r];
+		if (irg->addr != rgs[r]->ri.ri_addr ||
+		    irg->length != rgs[r]->ri.ri_length ||
+		    irg->data0 != rgs[r]->ri.ri_data0 ||
+		    irg->data != rgs[r]->ri.ri_data) {
+			ok = 0;
+			break;
+		}
+		read_blocks(irg->addr, 1, buf);
+		gfs2_rgrp_in(&rg, &hbh);
+		if (rg.rg_free != irg->free || rg.rg_dinodes != irg->dinodes)
+			ok = 0;
+	}
+	free(buf);
+	free(rgs);
+	return ok;
+}
+
+static struct blkidx *load_index(const char *fn)
+{
+	struct blkidx_header h;
+	struct blkidx *bi;
+	FILE *f;
+	int t;
+
+	f = fopen(fn, "r");
+	if (!f)
+		return NULL;
+	if (fread(&h, sizeof(h), 1, f) != 1 ||
+	    memcmp(h.magic, BLKIDX_MAGIC, sizeof(h.magic)) ||
+	    h.version != BLKIDX_VERSION || h.bsize != sbd.bsize) {
+		fclose(f);
+		return NULL;
+	}
+
+	bi = new_index();
+	bi->fs_blocks = h.fs_blocks;
+	bi->rgrps = h.rgrps;
+	bi->rg = calloc(h.rgrps ? h.rgrps : 1, sizeof(struct blkidx_rg));
+	if (!bi->rg)
+		die("Out of memory reading the block type index.\n");
+	if (fread(bi->rg, sizeof(struct blkidx_rg), h.rgrps, f) != h.rgrps)
+		goto fail;
+	for (t = 0; t < BLKIDX_TYPES; t++) {
+		bi->counts[t] = bi->sizes[t] = h.counts[t];
+		if (!h.counts[t])
+			continue;
+		bi->blocks[t] = malloc(h.counts[t] * sizeof(uint64_t));
+		if (!bi->blocks[t])
+			die("Out of memory reading the block type index.\n");
+		if (fread(bi->blocks[t], sizeof(uint64_t), h.counts[t], f) !=
+		    h.counts[t])
+			goto fail;
+	}
+	fclose(f);
+	return bi;
+ fail:
+	fclose(f);
+	free_index(bi);
+	return NULL;
+}
+
+static void save_index(const char *fn)
+{
+	struct blkidx_header h;
+	char tmp_fn[PATH_MAX + 8];
+	FILE *f;
+	int t, err = 0;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, BLKIDX_MAGIC, sizeof(h.magic));
+	h.version = BLKIDX_VERSION;
+	h.bsize = sbd.bsize;
+	h.fs_blocks = idx->fs_blocks;
+	h.rgrps = idx->rgrps;
+	memcpy(h.counts, idx->counts, sizeof(h.counts));
+
+	/* Write a new file and rename it over the old, so an interrupted
+	   save never leaves a truncated index behind */
+	snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", fn);
+	f = fopen(tmp_fn, "w");
+	if (!f) {
+		fprintf(stderr, "Can't save the block type index to %s: %s\n",
+			fn, strerror(errno));
+		return;
+	}
+	if (fwrite(&h, sizeof(h), 1, f) != 1 ||
+	    fwrite(idx->rg, sizeof(struct blkidx_rg), idx->rgrps, f) !=
+	    idx->rgrps)
+		err = 1;
+	for (t = 0; !err && t < BLKIDX_TYPES; t++)
+		if (idx->counts[t] &&
+		    fwrite(idx->blocks[t], sizeof(uint64_t), idx->counts[t],
+			   f) != idx->counts[t])
+			err = 1;
+	if (fclose(f))
+		err = 1;
+	if (err || rename(tmp_fn, fn)) {
+		fprintf(stderr, "Can't save the block type index to %s: %s\n",
+			fn, strerror(errno));
+		unlink(tmp_fn);
+	}
+}
+
+/**
+ * blkidx_get - make sure the block type index is ready
+ *
+ * Uses the saved index if there is one and it's current, otherwise builds
+ * it (and saves it, if a file was given with -i).
+ */
+static void blkidx_get(void)
+{
+	if (idx)
+		return;
+	if (idx_fn[0] && !idx_fn_stale) {
+		idx = load_index(idx_fn);
+		if (idx && !index_current(idx)) {
+			free_index(idx);
+			idx = NULL;
+		}
+		if (idx)
+			return;
+	}
+
+	window = malloc(BLKIDX_WINDOW);
+	if (!window)
+		die("Out of memory building the block type index.\n");
+	build_index();
+	free(window);
+	window = NULL;
+
+	if (idx_fn[0])
+		save_index(idx_fn);
+}
+
+/**
+ * blkidx_free - drop the block type index
+ *
+ * Called after a block is written, so the next search rebuilds the index
+ * from the device.  The saved copy isn't trusted either: only the rgrp
+ * counts are checked against it, and a write can change a block's type
+ * without changing those.
+ */
+void blkidx_free(void)
+{
+	free_index(idx);
+	idx = NULL;
+	idx_fn_stale = 1;
+}
+
+/**
+ * blkidx_next - find the next block of a type after a given block
+ * @type: the metadata type
+ * @blk: the block to search after
+ *
+ * Returns: the block, or 0 if there are no more of that type
+ */
+uint64_t blkidx_next(int type, uint64_t blk)
+{
+	uint64_t lo = 0, hi, mid;
+
+	if (type <= 0 || type >= BLKIDX_TYPES)
+		return 0;
+	blkidx_get();
+	hi = idx->counts[type];
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->blocks[type][mid] <= blk)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < idx->counts[type] ? idx->blocks[type][lo] : 0;
+}
+
+/**
+ * blkidx_prev - find the last block of a type before a given block
+ * @type: the metadata type
+ * @blk: the block to search before
+ *
+ * Returns: the block, or 0 if there are none of that type before it
+ */
+uint64_t blkidx_prev(int type, uint64_t blk)
+{
+	uint64_t lo = 0, hi, mid;
+
+	if (type <= 0 || type >= BLKIDX_TYPES)
+		return 0;
+	blkidx_get();
+	hi = idx->counts[type];
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->blocks[type][mid] < blk)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? idx->blocks[type][lo - 1] : 0;
+}
+
+/**
+ * blkidx_type - look up the metadata type of a block
+ *
+ * Returns: the type, or 0 if the block isn't in the index: it's free,
+ *          or not metadata
+ */
+int blkidx_type(uint64_t blk)
+{
+	uint64_t lo, hi, mid;
+	int t;
+
+	blkidx_get();
+	for (t = 1; t < BLKIDX_TYPES; t++) {
+		lo = 0;
+		hi = idx->counts[t];
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (idx->blocks[t][mid] < blk)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < idx->counts[t] && idx->blocks[t][lo] == blk)
+			return t;
+	}
+	return 0;
+}
+
+/**
+ * blkidx_rgrp - find the rgrp, or the bitmap block, for a block
+ * @blk: the block
+ * @bitmap: if set, return the bitmap block that covers blk rather than
+ *          the rgrp header
+ *
+ * Returns: the block number, or -1 if blk isn't in any rgrp
+ */
+uint64_t blkidx_rgrp(uint64_t blk, int bitmap)
+{
+	struct blkidx_rg *irg;
+	uint64_t lo = 0, hi, mid, rblk;
+
+	blkidx_get();
+	hi = idx->rgrps;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->rg[mid].addr <= blk)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo)
+		return (uint64_t)-1;
+	irg = &idx->rg[lo - 1];
+	if (blk >= irg->data0 + irg->data)
+		return (uint64_t)-1;
+	if (!bitmap || blk < irg->data0)
+		return irg->addr;
+
+	rblk = blk - irg->data0;
+	if (rblk < irg->bits0 || !irg->bits)
+		return irg->addr;
+	rblk = 1 + (rblk - irg->bits0) / irg->bits;
+	if (rblk >= irg->length)
+		rblk = irg->length - 1;
+	return irg->addr + rblk;
+}
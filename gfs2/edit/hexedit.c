@@ -845,6 +845,7 @@ static void rgcount(void)
 	       (unsigned long long)sbd.md.riinode->i_di.di_size / risize());
 	inode_put(&sbd.md.riinode);
 	gfs2_rgrp_free(&sbd.rglist);
+	blkidx_free();
 	exit(EXIT_SUCCESS);
 }
 
@@ -992,8 +993,10 @@ static void set_rgrp_flags(int rgnum, uint32_t new_flags, int modify, int full)
 			       (unsigned long long)rgblk, rg.rg2.rg_flags);
 		brelse(rbh);
 	}
-	if (modify)
+	if (modify) {
 		fsync(sbd.device_fd);
+		blkidx_free();
+	}
 }
 
 /* ------------------------------------------------------------------------ */
@@ -2080,8 +2083,10 @@ static uint64_t find_metablockoftype_slow(uint64_t startblk, int metatype, int p
 			printf("%llu\n", (unsigned long long)blk);
 	}
 	gfs2_rgrp_free(&sbd.rglist);
-	if (print)
+	if (print) {
+		blkidx_free();
 		exit(0);
+	}
 	return blk;
 }
 
@@ -2119,12 +2124,15 @@ static uint64_t find_metablockoftype_rg(uint64_t startblk, int metatype, int pri
 		if (print)
 			printf("0\n");
 		gfs2_rgrp_free(&sbd.rglist);
-		if (print)
+		if (print) {
+			blkidx_free();
 			exit(-1);
+		}
 	}
 	for(; !found && tmp != &sbd.rglist; tmp = tmp->next){
 		rgd = osi_list_entry(tmp, struct rgrp_list, list);	
 		first = 1;
+		gfs2_rgrp_read(&sbd, rgd);
 		do {
 			if (gfs2_next_rg_metatype(&sbd, rgd, &blk, metatype,
 						  first))
@@ -2135,6 +2143,7 @@ static uint64_t find_metablockoftype_rg(uint64_t startblk, int metatype, int pri
 			}
 			first = 0;
 		} while (blk <= startblk);
+		gfs2_rgrp_relse(rgd);
 	}
 	if (!found)
 		blk = 0;
@@ -2145,15 +2154,45 @@ static uint64_t find_metablockoftype_rg(uint64_t startblk, int metatype, int pri
 			printf("%llu\n", (unsigned long long)blk);
 	}
 	gfs2_rgrp_free(&sbd.rglist);
-	if (print)
+	if (print) {
+		blkidx_free();
+		exit(0);
+	}
+	return blk;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Find next (or previous) metadata block of a given type using the block   */
+/* type index.  The index covers every block that's allocated in the        */
+/* bitmaps, plus the rgrps and everything outside them.                     */
+/* ------------------------------------------------------------------------ */
+static uint64_t find_metablockoftype_idx(uint64_t startblk, int metatype,
+					 int backward, int print)
+{
+	uint64_t blk;
+
+	if (backward)
+		blk = blkidx_prev(metatype, startblk);
+	else
+		blk = blkidx_next(metatype, startblk);
+	if (print) {
+		if (dmode == HEX_MODE)
+			printf("0x%llx\n", (unsigned long long)blk);
+		else
+			printf("%llu\n", (unsigned long long)blk);
+		gfs2_rgrp_free(&sbd.rglist);
+		blkidx_free();
 		exit(0);
+	}
 	return blk;
 }
 
 /* ------------------------------------------------------------------------ */
 /* Find next metadata block AFTER a given point in the fs                   */
+/* (or BEFORE it, if backward is set)                                       */
 /* ------------------------------------------------------------------------ */
-static uint64_t find_metablockoftype(const char *strtype, int print)
+static uint64_t find_metablockoftype(const char *strtype, int backward,
+				     int print)
 {
 	int mtype = 0;
 	uint64_t startblk, blk = 0;
@@ -2169,7 +2208,14 @@ static uint64_t find_metablockoftype(const char *strtype, int print)
 			break;
 	if (!strcmp(strtype, "dinode"))
 		mtype = GFS2_METATYPE_DI;
-	if (mtype >= GFS2_METATYPE_NONE && mtype <= GFS2_METATYPE_RB)
+	/* Searching backward always uses the index; there's no other
+	   way to do it that isn't block by block */
+	if (mtype >= GFS2_METATYPE_SB && mtype <= GFS2_METATYPE_QC &&
+	    (blkidx_enabled() || backward))
+		blk = find_metablockoftype_idx(startblk, mtype, backward,
+					       print);
+	else if (mtype >= GFS2_METATYPE_NONE && mtype <= GFS2_METATYPE_RB &&
+		 !backward)
 		blk = find_metablockoftype_slow(startblk, mtype, print);
 	else if (mtype >= GFS2_METATYPE_DI && mtype <= GFS2_METATYPE_QC)
 		blk = find_metablockoftype_rg(startblk, mtype, print);
@@ -2179,6 +2225,7 @@ static uint64_t find_metablockoftype(const char *strtype, int print)
 		fprintf(stderr, "sb rg rb di in lf jd lh ld"
 			" ea ed lb 13 qc\n");
 		gfs2_rgrp_free(&sbd.rglist);
+		blkidx_free();
 		exit(-1);
 	}
 	return blk;
@@ -2240,7 +2287,9 @@ uint64_t check_keywords(const char *kword)
 
 		blk = find_journal_block(kword, &j_size);
 	} else if (kword[0]=='/') /* search */
-		blk = find_metablockoftype(&kword[1], 0);
+		blk = find_metablockoftype(&kword[1], 0, 0);
+	else if (kword[0]=='?') /* search backward */
+		blk = find_metablockoftype(&kword[1], 1, 0);
 	else if (kword[0]=='0' && kword[1]=='x') /* hex addr */
 		sscanf(kword, "%"SCNx64, &blk);/* retrieve in hex */
 	else
@@ -2364,6 +2413,8 @@ static void hex_edit(int *exitch)
 				exit(-1);
 			}
 			fsync(sbd.device_fd);
+			/* The block may not be the type it was indexed as */
+			blkidx_free();
 		}
 	}
 }
@@ -2484,11 +2535,18 @@ static void find_print_block_type(void)
 	int type;
 
 	tblock = blockstack[blockhist % BLOCK_STACK_SIZE].block;
-	lbh = bread(&sbd, tblock);
-	type = get_block_type(lbh);
-	print_block_type(tblock, type, "");
-	brelse(lbh);
+	/* Blocks that aren't in the index (free ones, or ones that aren't
+	   metadata) are still read, since they may have a stale header */
+	if (blkidx_enabled() && (type = blkidx_type(tblock)))
+		print_block_type(tblock, type, "");
+	else {
+		lbh = bread(&sbd, tblock);
+		type = get_block_type(lbh);
+		print_block_type(tblock, type, "");
+		brelse(lbh);
+	}
 	gfs2_rgrp_free(&sbd.rglist);
+	blkidx_free();
 	exit(0);
 }
 
@@ -2504,7 +2562,15 @@ static void find_print_block_rg(int bitmap)
 	rblock = blockstack[blockhist % BLOCK_STACK_SIZE].block;
 	if (rblock == sbd.sb_addr)
 		printf("0 (the superblock is not in the bitmap)\n");
-	else {
+	else if (blkidx_enabled()) {
+		rgblock = blkidx_rgrp(rblock, bitmap);
+		if (rgblock == (uint64_t)-1)
+			printf("-1 (block invalid or part of an rgrp).\n");
+		else if (dmode == HEX_MODE)
+			printf("0x%llx\n",(unsigned long long)rgblock);
+		else
+			printf("%llu\n", (unsigned long long)rgblock);
+	} else {
 		rgd = gfs2_blk2rgrpd(&sbd, rblock);
 		if (rgd) {
 			rgblock = rgd->ri.ri_addr;
@@ -2532,6 +2598,7 @@ static void find_print_block_rg(int bitmap)
 		}
 	}
 	gfs2_rgrp_free(&sbd.rglist);
+	blkidx_free();
 	exit(0);
 }
 
@@ -2553,6 +2620,7 @@ static void find_change_block_alloc(int *newval)
 		for (i = GFS2_BLKST_FREE; i <= GFS2_BLKST_DINODE; i++)
 			printf("%d - %s\n", i, allocdesc[gfs1][i]);
 		gfs2_rgrp_free(&sbd.rglist);
+		blkidx_free();
 		exit(-1);
 	}
 	ablock = blockstack[blockhist % BLOCK_STACK_SIZE].block;
@@ -2573,12 +2641,14 @@ static void find_change_block_alloc(int *newval)
 				printf("%d (%s)\n", type, allocdesc[gfs1][type]);
 			} else {
 				gfs2_rgrp_free(&sbd.rglist);
+				blkidx_free();
 				printf("-1 (block invalid or part of an rgrp).\n");
 				exit(-1);
 			}
 		}
 	}
 	gfs2_rgrp_free(&sbd.rglist);
+	blkidx_free();
 	if (newval)
 		fsync(sbd.device_fd);
 	exit(0);
@@ -2649,6 +2719,8 @@ static void process_field(const char *field, uint64_t *newval, int print_field)
 	}
 	brelse(rbh);
 	fsync(sbd.device_fd);
+	if (newval)
+		blkidx_free();
 }
 
 /* ------------------------------------------------------------------------ */
@@ -3199,7 +3271,7 @@ static void dump_journal(const char *journal)
 /* ------------------------------------------------------------------------ */
 static void usage(void)
 {
-	fprintf(stderr,"\nFormat is: gfs2_edit [-c 1] [-V] [-x] [-h] [identify] [-p structures|blocks][blocktype][blockalloc [val]][blockbits][blockrg][find sb|rg|rb|di|in|lf|jd|lh|ld|ea|ed|lb|13|qc][field <f>[val]] /dev/device\n\n");
+	fprintf(stderr,"\nFormat is: gfs2_edit [-c 1] [-V] [-x] [-h] [identify] [-p structures|blocks][blocktype][blockalloc [val]][blockbits][blockrg][find sb|rg|rb|di|in|lf|jd|lh|ld|ea|ed|lb|13|qc][findprev <type>][field <f>[val]] [-i indexfile] /dev/device\n\n");
 	fprintf(stderr,"If only the device is specified, it enters into hexedit mode.\n");
 	fprintf(stderr,"identify - prints out only the block type, not the details.\n");
 	fprintf(stderr,"printsavedmeta - prints out the saved metadata blocks from a savemeta file.\n");
@@ -3239,6 +3311,14 @@ static void usage(void)
 	fprintf(stderr,"-p   <b> find sb|rg|rb|di|in|lf|jd|lh|ld|ea|ed|lb|"
 		"13|qc - find block of given type after block <b>\n");
 	fprintf(stderr,"     <b> specifies the starting block for search\n");
+	fprintf(stderr,"-p   <b> findprev <type> - find block of given type "
+		"before block <b>\n");
+	fprintf(stderr,"-i   <file> keeps an index of block types in <file> "
+		"and uses it for\n");
+	fprintf(stderr,"     find, findprev, blocktype, blockrg and blockbits. "
+		"It's built on first\n");
+	fprintf(stderr,"     use and rebuilt when the file system has "
+		"changed.\n");
 	fprintf(stderr,"-s   specifies a starting block such as root, rindex, quota, inum.\n");
 	fprintf(stderr,"-x   print in hexmode.\n");
 	fprintf(stderr,"-h   prints this help.\n\n");
@@ -3263,6 +3343,8 @@ static void usage(void)
 	fprintf(stderr,"     gfs2_edit -p 0x118 field di_size /dev/roth_vg/roth_lb\n");
 	fprintf(stderr,"   To find any dinode higher than the quota file dinode:\n");
 	fprintf(stderr,"     gfs2_edit -p quota find di /dev/x/y\n");
+	fprintf(stderr,"   The same, keeping a block type index for next time:\n");
+	fprintf(stderr,"     gfs2_edit -i /tmp/y.idx -p quota find di /dev/x/y\n");
 	fprintf(stderr,"   To set the Resource Group flags for rg #7 to 3.\n");
 	fprintf(stderr,"     gfs2_edit rgflags 7 3 /dev/sdc2\n");
 	fprintf(stderr,"   To save off all metadata for /dev/vg/lv:\n");
@@ -3272,7 +3354,7 @@ static void usage(void)
 /* ------------------------------------------------------------------------ */
 /* parameterpass1 - pre-processing for command-line parameters              */
 /* ------------------------------------------------------------------------ */
-static void parameterpass1(int argc, char *argv[], int i)
+static int parameterpass1(int argc, char *argv[], int i)
 {
 	if (!strcasecmp(argv[i], "-V")) {
 		printf("%s version %s (built %s %s)\n",
@@ -3290,6 +3372,12 @@ static void parameterpass1(int argc, char *argv[], int i)
 		i++;
 		color_scheme = atoi(argv[i]);
 	}
+	else if (!strcmp(argv[i], "-i")) {
+		i++;
+		if (i >= argc - 1)
+			die("no index file specified with -i\n");
+		blkidx_set_file(argv[i]);
+	}
 	else if (!strcasecmp(argv[i], "-p") ||
 		 !strcasecmp(argv[i], "-print")) {
 		termlines = 0; /* initial value--we'll figure
@@ -3320,6 +3408,7 @@ static void parameterpass1(int argc, char *argv[], int i)
 		dmode = HEX_MODE;
 	else if (!device[0] && strchr(argv[i],'/'))
 		strcpy(device, argv[i]);
+	return i;
 }
 
 /* ------------------------------------------------------------------------ */
@@ -3339,10 +3428,14 @@ static void process_parameters(int argc, char *argv[], int pass)
 	}
 	for (i = 1; i < argc; i++) {
 		if (!pass) { /* first pass */
-			parameterpass1(argc, argv, i);
+			i = parameterpass1(argc, argv, i);
 			continue;
 		}
 		/* second pass */
+		if (!strcmp(argv[i], "-i")) {
+			i++;
+			continue;
+		}
 		if (!strcasecmp(argv[i], "-s")) {
 			i++;
 			if (i >= argc - 1) {
@@ -3389,6 +3482,7 @@ static void process_parameters(int argc, char *argv[], int pass)
 				printf("Format is: %s -p <block> field "
 				       "<field> [newvalue]\n", argv[0]);
 				gfs2_rgrp_free(&sbd.rglist);
+				blkidx_free();
 				exit(EXIT_FAILURE);
 			}
 			if (isdigit(argv[i + 1][0])) {
@@ -3399,10 +3493,12 @@ static void process_parameters(int argc, char *argv[], int pass)
 					newval = (uint64_t)atoll(argv[i + 1]);
 				process_field(argv[i], &newval, 1);
 				gfs2_rgrp_free(&sbd.rglist);
+				blkidx_free();
 				exit(0);
 			} else {
 				process_field(argv[i], NULL, 1);
 				gfs2_rgrp_free(&sbd.rglist);
+				blkidx_free();
 				exit(0);
 			}
 		} else if (!strcmp(argv[i], "blocktype")) {
@@ -3424,7 +3520,9 @@ static void process_parameters(int argc, char *argv[], int pass)
 				find_change_block_alloc(NULL);
 			}
 		} else if (!strcmp(argv[i], "find")) {
-			find_metablockoftype(argv[i + 1], 1);
+			find_metablockoftype(argv[i + 1], 0, 1);
+		} else if (!strcmp(argv[i], "findprev")) {
+			find_metablockoftype(argv[i + 1], 1, 1);
 		} else if (!strcmp(argv[i], "rgflags")) {
 			int rg, set = FALSE;
 			uint32_t new_flags = 0;
@@ -3435,6 +3533,7 @@ static void process_parameters(int argc, char *argv[], int pass)
 				printf("Format is: %s rgflags rgnum"
 				       "[newvalue]\n", argv[0]);
 				gfs2_rgrp_free(&sbd.rglist);
+				blkidx_free();
 				exit(EXIT_FAILURE);
 			}
 			if (argv[i][0]=='0' && argv[i][1]=='x')
@@ -3452,6 +3551,7 @@ static void process_parameters(int argc, char *argv[], int pass)
 			}
 			set_rgrp_flags(rg, new_flags, set, FALSE);
 			gfs2_rgrp_free(&sbd.rglist);
+			blkidx_free();
 			exit(EXIT_SUCCESS);
 		} else if (!strcmp(argv[i], "rg")) {
 			int rg;
@@ -3461,6 +3561,7 @@ static void process_parameters(int argc, char *argv[], int pass)
 				printf("Error: rg # not specified.\n");
 				printf("Format is: %s rg rgnum\n", argv[0]);
 				gfs2_rgrp_free(&sbd.rglist);
+				blkidx_free();
 				exit(EXIT_FAILURE);
 			}
 			rg = atoi(argv[i]);
@@ -3470,6 +3571,7 @@ static void process_parameters(int argc, char *argv[], int pass)
 			} else {
 				set_rgrp_flags(rg, 0, FALSE, TRUE);
 				gfs2_rgrp_free(&sbd.rglist);
+				blkidx_free();
 				exit(EXIT_SUCCESS);
 			}
 		}
@@ -3577,5 +3679,6 @@ int main(int argc, char *argv[])
 	if (indirect)
 		free(indirect);
 	gfs2_rgrp_free(&sbd.rglist);
+	blkidx_free();
  	exit(EXIT_SUCCESS);
 }
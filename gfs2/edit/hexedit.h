@@ -163,6 +163,13 @@ extern void gfs_dinode_in(struct gfs_dinode *di, struct gfs2_buffer_head *bh);
 extern void savemeta(char *out_fn, int saveoption);
 extern void restoremeta(const char *in_fn, const char *out_device,
 			uint64_t printblocksonly);
+extern void blkidx_set_file(const char *fn);
+extern int blkidx_enabled(void);
+extern void blkidx_free(void);
+extern uint64_t blkidx_next(int type, uint64_t blk);
+extern uint64_t blkidx_prev(int type, uint64_t blk);
+extern int blkidx_type(uint64_t blk);
+extern uint64_t blkidx_rgrp(uint64_t blk, int bitmap);
 extern int display(int identify_only);
 extern uint64_t check_keywords(const char *kword);
 extern uint64_t masterblock(const char *fn);
@@ -126,6 +126,7 @@ extern int skip_this_pass, fsck_abort;
 extern int errors_found, errors_corrected;
 extern uint64_t last_data_block;
 extern uint64_t first_data_block;
+extern uint64_t bmap_budget; /* Memory limit for the block map, 0 for auto */
 extern struct osi_root dup_blocks;
 extern struct osi_root dirtree;
 extern struct osi_root inodetree;
@@ -517,7 +517,8 @@ static int init_system_inodes(struct gfs2_sbd *sdp)
 		goto fail;
 	}
 
-	bl = gfs2_bmap_create(sdp, last_fs_block+1, &addl_mem_needed);
+	bl = gfs2_bmap_create(sdp, last_fs_block+1, bmap_budget,
+			      &addl_mem_needed);
 	if (!bl) {
 		log_crit( _("This system doesn't have enough memory + swap space to fsck this file system.\n"));
 		log_crit( _("Additional memory needed is approximately: %lluMB\n"),
@@ -525,6 +526,11 @@ static int init_system_inodes(struct gfs2_sbd *sdp)
 		log_crit( _("Please increase your swap space by that amount and run gfs2_fsck again.\n"));
 		goto fail;
 	}
+	if (!bl->map)
+		log_notice( _("The block map needs %lluMB; keeping at most "
+			      "%lluMB of it in memory.\n"),
+			    (unsigned long long)(bl->mapsize / 1048576ULL),
+			    (unsigned long long)(bl->budget / 1048576ULL));
 	return 0;
  fail:
 	empty_super_block(sdp);
@@ -29,6 +29,7 @@ const char *pass = "";
 uint64_t last_data_block;
 uint64_t first_data_block;
 int preen = 0, force_check = 0;
+uint64_t bmap_budget = 0;
 struct osi_root dup_blocks = (struct osi_root) { NULL, };
 struct osi_root dirtree = (struct osi_root) { NULL, };
 struct osi_root inodetree = (struct osi_root) { NULL, };
@@ -47,7 +48,7 @@ void print_it(const char *label, const char *fmt, const char *fmt2, ...)
 
 static void usage(char *name)
 {
-	printf("Usage: %s [-afhnpqvVy] <device> \n", basename(name));
+	printf("Usage: %s [-afhnpqvVy] [-m <MB>] <device> \n", basename(name));
 }
 
 static void version(void)
@@ -61,7 +62,7 @@ static int read_cmdline(int argc, char **argv, struct gfs2_options *gopts)
 {
 	int c;
 
-	while((c = getopt(argc, argv, "afhnpqvyV")) != -1) {
+	while((c = getopt(argc, argv, "afhm:npqvyV")) != -1) {
 		switch(c) {
 
 		case 'a':
@@ -75,6 +76,14 @@ static int read_cmdline(int argc, char **argv, struct gfs2_options *gopts)
 			usage(argv[0]);
 			exit(FSCK_OK);
 			break;
+		case 'm':
+			bmap_budget = strtoull(optarg, NULL, 10) << 20;
+			if (!bmap_budget) {
+				fprintf(stderr, _("Bad block map memory limit: "
+						  "%s\n"), optarg);
+				return FSCK_USAGE;
+			}
+			break;
 		case 'n':
 			gopts->no = 1;
 			break;
@@ -310,6 +310,8 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 	char *filename;
 	int first = 1;
 
+	/* Entries get repaired in place below, behind libgfs2's back */
+	gfs2_dindex_free(ip);
 	bh_end = bh->b_data + ip->i_sbd->bsize;
 
 	if(type == DIR_LINEAR) {
@@ -19,14 +19,7 @@ extern const char *reftypes[3];
 
 static inline uint8_t block_type(uint64_t bblock)
 {
-	static unsigned char *byte;
-	static uint64_t b;
-	static uint8_t btype;
-
-	byte = bl->map + BLOCKMAP_SIZE4(bblock);
-	b = BLOCKMAP_BYTE_OFFSET4(bblock);
-	btype = (*byte & (BLOCKMAP_MASK4 << b )) >> b;
-	return btype;
+	return gfs2_blockmap_get(bl, bblock);
 }
 
 #endif /* __UTIL_H__ */
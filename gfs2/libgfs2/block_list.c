@@ -5,9 +5,51 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "libgfs2.h"
 
+/*
+ * When the flat 4-bit-per-block map doesn't fit in the memory budget the
+ * map is split into chunks of BMAP_CHUNK_BLOCKS blocks, each kept in the
+ * cheapest form that still describes it:
+ *
+ *  uniform - every block has the same mark; no memory at all.  All chunks
+ *            start out this way (free).
+ *  flat    - a slice of the flat map, read and written in place.
+ *  rle     - a cold flat chunk that compressed well: (count, byte) pairs.
+ *  spilled - a cold flat chunk that didn't, written to an unlinked
+ *            temporary file at a fixed slot per chunk.
+ *
+ * Flat and rle chunks count against the budget.  When a chunk has to be
+ * made flat and the budget is used up, a clock sweep over the flat chunks
+ * evicts those that haven't been touched since the hand last passed them.
+ */
+#define BMAP_CHUNK_SHIFT	(12)
+#define BMAP_CHUNK_BLOCKS	(1ULL << BMAP_CHUNK_SHIFT)
+#define BMAP_CHUNK_BYTES	(BLOCKMAP_SIZE4(BMAP_CHUNK_BLOCKS))
+#define BMAP_MIN_CHUNKS		(16)
+#define BMAP_RLE_MAX		(BMAP_CHUNK_BYTES / 4)
+
+enum bmap_chunk_state {
+	BMAP_UNIFORM = 0,
+	BMAP_FLAT,
+	BMAP_RLE,
+	BMAP_SPILLED,
+};
+
+struct gfs2_bmap_chunk {
+	unsigned char *map;	/* flat or rle data */
+	uint16_t rlelen;
+	uint8_t state;
+	uint8_t value;		/* mark of a uniform chunk */
+	uint8_t ref;		/* touched since the clock hand passed */
+	uint8_t dirty;		/* flat copy differs from the spill slot */
+	uint8_t on_disk;	/* spill slot holds a copy */
+};
+
+static unsigned char bmap_scratch[BMAP_CHUNK_BYTES];
+
 static int gfs2_blockmap_create(struct gfs2_bmap *bmap, uint64_t size)
 {
 	bmap->size = size;
@@ -16,11 +58,32 @@ static int gfs2_blockmap_create(struct gfs2_bmap *bmap, uint64_t size)
 	 * must be 1-based */
 	bmap->mapsize = BLOCKMAP_SIZE4(size);
 
-	if(!(bmap->map = malloc(sizeof(char) * bmap->mapsize)))
+	if(!(bmap->map = calloc(bmap->mapsize + 1, sizeof(char))))
 		return -ENOMEM;
-	if(!memset(bmap->map, 0, sizeof(char) * bmap->mapsize)) {
-		free(bmap->map);
-		bmap->map = NULL;
+	return 0;
+}
+
+static int gfs2_blockmap_create_tiered(struct gfs2_bmap *bmap, uint64_t size,
+				       uint64_t budget)
+{
+	bmap->size = size;
+	bmap->mapsize = BLOCKMAP_SIZE4(size);
+	bmap->map = NULL;
+	bmap->nchunks = (size >> BMAP_CHUNK_SHIFT) + 1;
+	bmap->budget = budget;
+	if (bmap->budget < BMAP_MIN_CHUNKS * BMAP_CHUNK_BYTES)
+		bmap->budget = BMAP_MIN_CHUNKS * BMAP_CHUNK_BYTES;
+	bmap->spill_fd = -1;
+
+	bmap->nframes = bmap->budget / BMAP_CHUNK_BYTES;
+
+	bmap->chunks = calloc(bmap->nchunks, sizeof(struct gfs2_bmap_chunk));
+	bmap->frames = calloc(bmap->nframes, sizeof(uint64_t));
+	if (!bmap->chunks || !bmap->frames) {
+		free(bmap->chunks);
+		free(bmap->frames);
+		bmap->chunks = NULL;
+		bmap->frames = NULL;
 		return -ENOMEM;
 	}
 	return 0;
@@ -28,14 +91,51 @@ static int gfs2_blockmap_create(struct gfs2_bmap *bmap, uint64_t size)
 
 static void gfs2_blockmap_destroy(struct gfs2_bmap *bmap)
 {
+	uint64_t i;
+
 	if(bmap->map)
 		free(bmap->map);
+	if (bmap->chunks) {
+		for (i = 0; i < bmap->nchunks; i++)
+			if (bmap->chunks[i].map)
+				free(bmap->chunks[i].map);
+		free(bmap->chunks);
+		free(bmap->frames);
+	}
+	if (bmap->spill_fd >= 0)
+		close(bmap->spill_fd);
+	bmap->map = NULL;
+	bmap->chunks = NULL;
+	bmap->frames = NULL;
+	bmap->nflat = 0;
+	bmap->spill_fd = -1;
 	bmap->size = 0;
 	bmap->mapsize = 0;
 }
 
+/* Returns the memory budget to use when none was given: half of RAM */
+static uint64_t bmap_default_budget(void)
+{
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	if (pages <= 0 || pagesize <= 0)
+		return 0;
+	return (uint64_t)pages * pagesize / 2;
+}
+
+/**
+ * gfs2_bmap_create - create the block map
+ * @size: number of blocks to track
+ * @budget: bytes of memory the map may use, 0 for half of RAM
+ * @addl_mem_needed: set to the memory that was missing on failure
+ *
+ * The map is flat when it fits in @budget, otherwise it is tiered and
+ * keeps at most @budget bytes in memory, spilling the rest to a temporary
+ * file under $TMPDIR.
+ */
 struct gfs2_bmap *gfs2_bmap_create(struct gfs2_sbd *sdp, uint64_t size,
-				   uint64_t *addl_mem_needed)
+				   uint64_t budget, uint64_t *addl_mem_needed)
 {
 	struct gfs2_bmap *il;
 
@@ -43,16 +143,270 @@ struct gfs2_bmap *gfs2_bmap_create(struct gfs2_sbd *sdp, uint64_t size,
 	il = malloc(sizeof(*il));
 	if (!il || !memset(il, 0, sizeof(*il)))
 		return NULL;
+	il->spill_fd = -1;
 
-	if(gfs2_blockmap_create(il, size)) {
-		*addl_mem_needed = il->mapsize;
+	if (!budget)
+		budget = bmap_default_budget();
+	if ((!budget || BLOCKMAP_SIZE4(size) <= budget) &&
+	    !gfs2_blockmap_create(il, size))
+		goto out;
+	if(gfs2_blockmap_create_tiered(il, size, budget)) {
+		*addl_mem_needed = il->nchunks *
+			sizeof(struct gfs2_bmap_chunk) +
+			il->nframes * sizeof(uint64_t);
 		free(il);
 		il = NULL;
 	}
+ out:
 	osi_list_init(&sdp->eattr_blocks.list);
 	return il;
 }
 
+static int bmap_spill_open(struct gfs2_bmap *bmap)
+{
+	char path[PATH_MAX];
+	const char *dir = getenv("TMPDIR");
+
+	if (!dir || !*dir)
+		dir = "/tmp";
+	snprintf(path, sizeof(path), "%s/gfs2_bmap.XXXXXX", dir);
+	bmap->spill_fd = mkstemp(path);
+	if (bmap->spill_fd < 0)
+		return -1;
+	unlink(path);
+	return 0;
+}
+
+static void bmap_chunk_io(struct gfs2_bmap *bmap, uint64_t idx,
+			  unsigned char *buf, int write)
+{
+	off_t off = (off_t)idx * BMAP_CHUNK_BYTES;
+	ssize_t n;
+
+	if (write)
+		n = pwrite(bmap->spill_fd, buf, BMAP_CHUNK_BYTES, off);
+	else
+		n = pread(bmap->spill_fd, buf, BMAP_CHUNK_BYTES, off);
+	if (n != BMAP_CHUNK_BYTES)
+		die("block map spill file %s failed: %s\n",
+		    write ? "write" : "read", n < 0 ? strerror(errno) :
+		    "short transfer");
+}
+
+static void bmap_spill(struct gfs2_bmap *bmap, uint64_t idx,
+		       unsigned char *buf)
+{
+	if (bmap->spill_fd < 0 && bmap_spill_open(bmap))
+		die("can't create a block map spill file: %s\n",
+		    strerror(errno));
+	bmap_chunk_io(bmap, idx, buf, 1);
+	bmap->spills++;
+}
+
+/* Returns the rle length of buf, or 0 if it doesn't fit in BMAP_RLE_MAX */
+static uint32_t bmap_rle_encode(const unsigned char *buf, unsigned char *out)
+{
+	uint32_t i = 0, len = 0, run;
+
+	while (i < BMAP_CHUNK_BYTES) {
+		for (run = 1; run < 255 && i + run < BMAP_CHUNK_BYTES &&
+			     buf[i + run] == buf[i]; run++)
+			;
+		if (len + 2 > BMAP_RLE_MAX)
+			return 0;
+		out[len++] = run;
+		out[len++] = buf[i];
+		i += run;
+	}
+	return len;
+}
+
+static void bmap_rle_decode(const unsigned char *rle, uint32_t len,
+			    unsigned char *out)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i += 2) {
+		memset(out, rle[i + 1], rle[i]);
+		out += rle[i];
+	}
+}
+
+static int bmap_chunk_uniform(const unsigned char *buf, uint8_t *value)
+{
+	if ((buf[0] >> 4) != (buf[0] & BLOCKMAP_MASK4) ||
+	    memcmp(buf, buf + 1, BMAP_CHUNK_BYTES - 1))
+		return 0;
+	*value = buf[0] & BLOCKMAP_MASK4;
+	return 1;
+}
+
+static void bmap_evict(struct gfs2_bmap *bmap, uint64_t idx)
+{
+	struct gfs2_bmap_chunk *c = &bmap->chunks[idx];
+	unsigned char *rle;
+	uint32_t len;
+
+	if (c->state == BMAP_RLE) {
+		bmap_rle_decode(c->map, c->rlelen, bmap_scratch);
+		bmap_spill(bmap, idx, bmap_scratch);
+		bmap->resident -= c->rlelen;
+		c->on_disk = 1;
+		goto spilled;
+	}
+
+	bmap->resident -= BMAP_CHUNK_BYTES;
+	if (bmap_chunk_uniform(c->map, &c->value)) {
+		c->state = BMAP_UNIFORM;
+		c->on_disk = 0;
+		goto out;
+	}
+	if (c->on_disk && !c->dirty)
+		goto spilled;
+	len = bmap_rle_encode(c->map, bmap_scratch);
+	if (len && (rle = malloc(len))) {
+		memcpy(rle, bmap_scratch, len);
+		free(c->map);
+		c->map = rle;
+		c->rlelen = len;
+		c->state = BMAP_RLE;
+		c->on_disk = 0;
+		c->dirty = 0;
+		bmap->resident += len;
+		return;
+	}
+	bmap_spill(bmap, idx, c->map);
+	c->on_disk = 1;
+ spilled:
+	c->state = BMAP_SPILLED;
+ out:
+	free(c->map);
+	c->map = NULL;
+	c->dirty = 0;
+	if (bmap->last == c)
+		bmap->last = NULL;
+}
+
+/*
+ * Evict cold chunks until another flat chunk fits in the budget.  Flat
+ * chunks go first, picked by a clock over the frames table: compressing
+ * them frees most of their memory without any I/O.  Rle chunks are only
+ * written out when that isn't enough.
+ */
+static void bmap_make_room(struct gfs2_bmap *bmap)
+{
+	struct gfs2_bmap_chunk *c;
+	uint64_t idx, scanned = 0;
+
+	while (bmap->nflat &&
+	       (bmap->nflat == bmap->nframes ||
+		bmap->resident + BMAP_CHUNK_BYTES > bmap->budget)) {
+		if (bmap->fhand >= bmap->nflat)
+			bmap->fhand = 0;
+		idx = bmap->frames[bmap->fhand];
+		c = &bmap->chunks[idx];
+		if (c->ref) {
+			c->ref = 0;
+			bmap->fhand++;
+			continue;
+		}
+		bmap_evict(bmap, idx);
+		bmap->frames[bmap->fhand] = bmap->frames[--bmap->nflat];
+	}
+	while (bmap->resident + BMAP_CHUNK_BYTES > bmap->budget &&
+	       scanned++ < bmap->nchunks) {
+		if (bmap->chunks[bmap->hand].state == BMAP_RLE)
+			bmap_evict(bmap, bmap->hand);
+		if (++bmap->hand == bmap->nchunks)
+			bmap->hand = 0;
+	}
+}
+
+/* Make chunk idx flat and return it */
+static struct gfs2_bmap_chunk *bmap_chunk_load(struct gfs2_bmap *bmap,
+					       uint64_t idx)
+{
+	struct gfs2_bmap_chunk *c = &bmap->chunks[idx];
+	unsigned char *map;
+
+	if (c->state != BMAP_FLAT) {
+		bmap_make_room(bmap);
+		map = malloc(BMAP_CHUNK_BYTES);
+		if (!map)
+			die("out of memory for the block map\n");
+		switch (c->state) {
+		case BMAP_UNIFORM:
+			memset(map, c->value | (c->value << 4),
+			       BMAP_CHUNK_BYTES);
+			c->dirty = 1;
+			break;
+		case BMAP_RLE:
+			bmap_rle_decode(c->map, c->rlelen, map);
+			bmap->resident -= c->rlelen;
+			free(c->map);
+			c->dirty = 1;
+			break;
+		case BMAP_SPILLED:
+			bmap_chunk_io(bmap, idx, map, 0);
+			bmap->reloads++;
+			c->dirty = 0;
+			break;
+		}
+		c->map = map;
+		c->state = BMAP_FLAT;
+		bmap->resident += BMAP_CHUNK_BYTES;
+		bmap->frames[bmap->nflat++] = idx;
+	}
+	c->ref = 1;
+	bmap->last = c;
+	bmap->last_idx = idx;
+	return c;
+}
+
+uint8_t gfs2_blockmap_get_tiered(struct gfs2_bmap *bmap, uint64_t bblock)
+{
+	struct gfs2_bmap_chunk *c;
+	uint64_t idx = bblock >> BMAP_CHUNK_SHIFT;
+	uint64_t off = bblock & (BMAP_CHUNK_BLOCKS - 1);
+
+	if (bblock > bmap->size)
+		return gfs2_block_free;
+	c = bmap->last;
+	if (!c || bmap->last_idx != idx) {
+		c = &bmap->chunks[idx];
+		if (c->state == BMAP_UNIFORM)
+			return c->value;
+		c = bmap_chunk_load(bmap, idx);
+	}
+	return (c->map[BLOCKMAP_SIZE4(off)] >> BLOCKMAP_BYTE_OFFSET4(off)) &
+		BLOCKMAP_MASK4;
+}
+
+static int gfs2_blockmap_set_tiered(struct gfs2_bmap *bmap, uint64_t bblock,
+				    enum gfs2_mark_block mark)
+{
+	struct gfs2_bmap_chunk *c;
+	uint64_t idx = bblock >> BMAP_CHUNK_SHIFT;
+	uint64_t off = bblock & (BMAP_CHUNK_BLOCKS - 1);
+	unsigned char *byte;
+	uint64_t b;
+
+	c = bmap->last;
+	if (!c || bmap->last_idx != idx) {
+		c = &bmap->chunks[idx];
+		if (c->state == BMAP_UNIFORM &&
+		    c->value == (mark & BLOCKMAP_MASK4))
+			return 0;
+		c = bmap_chunk_load(bmap, idx);
+	}
+	byte = c->map + BLOCKMAP_SIZE4(off);
+	b = BLOCKMAP_BYTE_OFFSET4(off);
+	*byte &= ~(BLOCKMAP_MASK4 << b);
+	*byte |= (mark & BLOCKMAP_MASK4) << b;
+	c->dirty = 1;
+	return 0;
+}
+
 void gfs2_special_free(struct special_blocks *blist)
 {
 	struct special_blocks *f;
@@ -117,6 +471,8 @@ int gfs2_blockmap_set(struct gfs2_bmap *bmap, uint64_t bblock,
 
 	if(bblock > bmap->size)
 		return -1;
+	if (!bmap->map)
+		return gfs2_blockmap_set_tiered(bmap, bblock, mark);
 
 	byte = bmap->map + BLOCKMAP_SIZE4(bblock);
 	b = BLOCKMAP_BYTE_OFFSET4(bblock);
@@ -26,15 +26,8 @@ struct gfs2_buffer_head *__bget_generic(struct gfs2_sbd *sdp, uint64_t num,
 	bh->sdp = sdp;
 	bh->b_data = (char *)bh + sizeof(struct gfs2_buffer_head);
 	if (read_disk) {
-		if (lseek(sdp->device_fd, num * sdp->bsize, SEEK_SET) !=
-		    num * sdp->bsize) {
-			fprintf(stderr, "bad seek: %s from %s:%d: block "
-				"%llu (0x%llx)\n", strerror(errno),
-				caller, line, (unsigned long long)num,
-				(unsigned long long)num);
-			exit(-1);
-		}
-		if (read(sdp->device_fd, bh->b_data, sdp->bsize) < 0) {
+		if (pread(sdp->device_fd, bh->b_data, sdp->bsize,
+			  (off_t)num * sdp->bsize) < 0) {
 			fprintf(stderr, "bad read: %s from %s:%d: block "
 				"%llu (0x%llx)\n", strerror(errno),
 				caller, line, (unsigned long long)num,
@@ -62,13 +55,11 @@ int bwrite(struct gfs2_buffer_head *bh)
 {
 	struct gfs2_sbd *sdp = bh->sdp;
 
-	if (lseek(sdp->device_fd, bh->b_blocknr * sdp->bsize, SEEK_SET) !=
-	    bh->b_blocknr * sdp->bsize) {
-		return -1;
-	}
-	if (write(sdp->device_fd, bh->b_data, sdp->bsize) != sdp->bsize)
+	if (pwrite(sdp->device_fd, bh->b_data, sdp->bsize,
+		   (off_t)bh->b_blocknr * sdp->bsize) != sdp->bsize)
 		return -1;
-	sdp->writes++;
+	/* gfs2_convert's worker threads write through the same sbd */
+	__sync_fetch_and_add(&sdp->writes, 1);
 	bh->b_modified = 0;
 	return 0;
 }
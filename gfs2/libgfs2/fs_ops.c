@@ -105,6 +105,7 @@ void inode_put(struct gfs2_inode **ip_in)
 		   It can also point out a coding problem, but we don't
 		   want to raise alarm in the users either. */
 	}
+	gfs2_dindex_free(ip);
 	if (ip->bh_owned)
 		brelse(ip->i_bh);
 	ip->i_bh = NULL;
@@ -112,47 +113,378 @@ void inode_put(struct gfs2_inode **ip_in)
 	*ip_in = NULL; /* make sure the memory isn't accessed again */
 }
 
-static uint64_t blk_alloc_i(struct gfs2_sbd *sdp, unsigned int type)
+/*
+ * In-core directory index
+ *
+ * Exhash directories that are searched repeatedly (lost+found in fsck,
+ * the master directory in mkfs and gfs2_convert) keep a copy of their hash
+ * table and a hash of their entry names hanging off the inode, so a lookup
+ * doesn't have to read the hash table and walk a leaf chain every time.
+ * Both halves are built lazily: the leaf table by gfs2_get_leaf_nr() and
+ * the names by dir_search().  dir_add(), dirent2_del() and gfs2_dirent_del()
+ * keep the names current; writes to the hash table through gfs2_writei()
+ * are applied to the leaf table or drop it.  Anything that edits dirents
+ * in place must call gfs2_dindex_free().
+ */
+
+#define DINDEX_MIN_BUCKETS	(256)
+
+struct dindex_ent {
+	struct dindex_ent *next;
+	uint32_t hash;
+	uint16_t type;
+	uint16_t len;
+	struct gfs2_inum inum;
+	char name[0];
+};
+
+struct gfs2_dir_index {
+	uint64_t *leaves;		/* hash table, host endian; NULL if stale */
+	uint32_t nleaves;
+	struct dindex_ent **buckets;	/* NULL until the names are read */
+	uint32_t nbuckets;
+	uint32_t count;
+};
+
+static void dindex_free_names(struct gfs2_dir_index *di)
 {
-	osi_list_t *tmp, *head;
-	struct rgrp_list *rl = NULL;
-	struct gfs2_rindex *ri;
-	struct gfs2_rgrp *rg;
-	unsigned int block, bn = 0, x = 0, y = 0;
-	unsigned int state;
-	struct gfs2_buffer_head *bh;
+	struct dindex_ent *de, *next;
+	uint32_t x;
 
-	memset(&rg, 0, sizeof(rg));
-	for (head = &sdp->rglist, tmp = head->next; tmp != head;
-	     tmp = tmp->next) {
-		rl = osi_list_entry(tmp, struct rgrp_list, list);
-		if (rl->rg.rg_free)
+	if (!di->buckets)
+		return;
+	for (x = 0; x < di->nbuckets; x++) {
+		for (de = di->buckets[x]; de; de = next) {
+			next = de->next;
+			free(de);
+		}
+	}
+	free(di->buckets);
+	di->buckets = NULL;
+	di->nbuckets = 0;
+	di->count = 0;
+}
+
+void gfs2_dindex_free(struct gfs2_inode *dip)
+{
+	struct gfs2_dir_index *di = dip->i_dindex;
+
+	if (!di)
+		return;
+	dindex_free_names(di);
+	free(di->leaves);
+	free(di);
+	dip->i_dindex = NULL;
+}
+
+static struct gfs2_dir_index *dindex_get(struct gfs2_inode *dip)
+{
+	if (!dip->i_dindex) {
+		dip->i_dindex = calloc(1, sizeof(struct gfs2_dir_index));
+		if (dip->i_dindex == NULL) {
+			fprintf(stderr, "Out of memory in %s\n", __FUNCTION__);
+			exit(-1);
+		}
+	}
+	return dip->i_dindex;
+}
+
+/* The hash table is only cached while it is the size its depth says */
+static int dindex_table_ok(struct gfs2_inode *dip)
+{
+	return (dip->i_di.di_flags & GFS2_DIF_EXHASH) &&
+		dip->i_di.di_depth <= GFS2_DIR_MAX_DEPTH &&
+		dip->i_di.di_size == sizeof(uint64_t) << dip->i_di.di_depth;
+}
+
+static uint64_t *dindex_leaves(struct gfs2_inode *dip)
+{
+	struct gfs2_dir_index *di;
+	uint32_t x, n;
+
+	if (!dindex_table_ok(dip))
+		return NULL;
+	n = 1 << dip->i_di.di_depth;
+	di = dindex_get(dip);
+	if (di->leaves && di->nleaves == n)
+		return di->leaves;
+
+	free(di->leaves);
+	di->leaves = malloc(n * sizeof(uint64_t));
+	if (di->leaves == NULL) {
+		fprintf(stderr, "Out of memory in %s\n", __FUNCTION__);
+		exit(-1);
+	}
+	if (gfs2_readi(dip, (char *)di->leaves, 0, n * sizeof(uint64_t)) !=
+	    n * sizeof(uint64_t)) {
+		free(di->leaves);
+		di->leaves = NULL;
+		return NULL;
+	}
+	for (x = 0; x < n; x++)
+		di->leaves[x] = be64_to_cpu(di->leaves[x]);
+	di->nleaves = n;
+	return di->leaves;
+}
+
+/* Called by gfs2_writei() before it writes <size> bytes at <offset> */
+static void dindex_write(struct gfs2_inode *dip, void *buf, uint64_t offset,
+			 unsigned int size)
+{
+	struct gfs2_dir_index *di = dip->i_dindex;
+	uint64_t *from = buf;
+	uint32_t x, n;
+
+	if (!di->leaves)
+		return;
+	if (offset % sizeof(uint64_t) || size % sizeof(uint64_t) ||
+	    offset + size > di->nleaves * sizeof(uint64_t)) {
+		free(di->leaves);
+		di->leaves = NULL;
+		return;
+	}
+	x = offset / sizeof(uint64_t);
+	for (n = size / sizeof(uint64_t); n--; x++, from++)
+		di->leaves[x] = be64_to_cpu(*from);
+}
+
+static struct dindex_ent **dindex_slot(struct gfs2_dir_index *di,
+				       uint32_t hash, const char *filename,
+				       int len)
+{
+	struct dindex_ent **dep;
+
+	for (dep = &di->buckets[hash & (di->nbuckets - 1)]; *dep;
+	     dep = &(*dep)->next) {
+		if ((*dep)->hash == hash && (*dep)->len == len &&
+		    !memcmp((*dep)->name, filename, len))
 			break;
 	}
+	return dep;
+}
 
-	if (tmp == head)
-		die("out of space\n");
+static void dindex_grow(struct gfs2_dir_index *di)
+{
+	struct dindex_ent **old = di->buckets, *de, *next;
+	uint32_t x, oldn = di->nbuckets;
 
-	ri = &rl->ri;
-	rg = &rl->rg;
+	di->nbuckets = oldn ? oldn * 2 : DINDEX_MIN_BUCKETS;
+	di->buckets = calloc(di->nbuckets, sizeof(struct dindex_ent *));
+	if (di->buckets == NULL) {
+		fprintf(stderr, "Out of memory in %s\n", __FUNCTION__);
+		exit(-1);
+	}
+	for (x = 0; x < oldn; x++) {
+		for (de = old[x]; de; de = next) {
+			next = de->next;
+			de->next = di->buckets[de->hash & (di->nbuckets - 1)];
+			di->buckets[de->hash & (di->nbuckets - 1)] = de;
+		}
+	}
+	free(old);
+}
+
+static void dindex_insert(struct gfs2_dir_index *di, struct gfs2_dirent *dent)
+{
+	struct dindex_ent *de;
+	uint16_t len = be16_to_cpu(dent->de_name_len);
+
+	if (di->count >= di->nbuckets * 2)
+		dindex_grow(di);
+
+	de = malloc(sizeof(struct dindex_ent) + len);
+	if (de == NULL) {
+		fprintf(stderr, "Out of memory in %s\n", __FUNCTION__);
+		exit(-1);
+	}
+	de->hash = be32_to_cpu(dent->de_hash);
+	de->type = be16_to_cpu(dent->de_type);
+	de->len = len;
+	gfs2_inum_in(&de->inum, (char *)&dent->de_inum);
+	memcpy(de->name, (char *)(dent + 1), len);
+
+	de->next = di->buckets[de->hash & (di->nbuckets - 1)];
+	di->buckets[de->hash & (di->nbuckets - 1)] = de;
+	di->count++;
+}
+
+static void dindex_remove(struct gfs2_dir_index *di, struct gfs2_dirent *dent)
+{
+	struct dindex_ent **dep, *de;
+
+	dep = dindex_slot(di, be32_to_cpu(dent->de_hash), (char *)(dent + 1),
+			  be16_to_cpu(dent->de_name_len));
+	if (!*dep)
+		return;
+	de = *dep;
+	*dep = de->next;
+	free(de);
+	di->count--;
+}
+
+/*
+ * Read every entry of an exhash directory into the name hash.  Slots that
+ * share a leaf are adjacent in the hash table, so each leaf chain is read
+ * once.  Returns NULL if the directory doesn't look sane enough to index;
+ * the caller falls back to searching the leaves.
+ */
+static struct gfs2_dir_index *dindex_names(struct gfs2_inode *dip)
+{
+	struct gfs2_sbd *sdp = dip->i_sbd;
+	struct gfs2_dir_index *di;
+	struct gfs2_buffer_head *bh;
+	struct gfs2_dirent *dent;
+	struct gfs2_leaf *leaf;
+	uint64_t *leaves, leaf_no;
+	uint64_t chain;
+	uint32_t x;
 
-	for (block = 0; block < ri->ri_length; block++) {
-		bh = rl->bh[block];
-		x = (block) ? sizeof(struct gfs2_meta_header) : sizeof(struct gfs2_rgrp);
+	if (dip->i_dindex && dip->i_dindex->buckets)
+		return dip->i_dindex;
+	leaves = dindex_leaves(dip);
+	if (!leaves)
+		return NULL;
+	di = dip->i_dindex;
+	dindex_grow(di);
 
-		for (; x < sdp->bsize; x++)
-			for (y = 0; y < GFS2_NBBY; y++) {
-				state = (bh->b_data[x] >> (GFS2_BIT_SIZE * y)) & 0x03;
-				if (state == GFS2_BLKST_FREE)
-					goto found;
-				bn++;
+	for (x = 0; x < di->nleaves; x++) {
+		if (x && leaves[x] == leaves[x - 1])
+			continue;
+		leaf_no = leaves[x];
+		for (chain = 0; leaf_no; chain++) {
+			if (chain > dip->i_di.di_blocks)
+				goto bad;
+			bh = bread(sdp, leaf_no);
+			if (gfs2_dirent_first(dip, bh, &dent) != IS_LEAF) {
+				brelse(bh);
+				goto bad;
 			}
+			do {
+				if (dent->de_inum.no_formal_ino)
+					dindex_insert(di, dent);
+			} while (gfs2_dirent_next(dip, bh, &dent) == 0);
+			leaf = (struct gfs2_leaf *)bh->b_data;
+			leaf_no = be64_to_cpu(leaf->lf_next);
+			brelse(bh);
+		}
+	}
+	return di;
+bad:
+	dindex_free_names(di);
+	return NULL;
+}
+
+/**
+ * rgrp_bitfit - find a free block in a resource group
+ * @rl: the resource group
+ * @goal: the rgrp relative block to start searching from
+ * @bitblk: returns the index of the bitmap block holding the result
+ *
+ * Returns: the rgrp relative block number, or BFITNOENT
+ */
+static uint32_t rgrp_bitfit(struct rgrp_list *rl, uint32_t goal,
+			    unsigned int *bitblk)
+{
+	struct gfs2_bitmap *bits;
+	unsigned long blk;
+	uint32_t start, len;
+	unsigned int x;
+
+	for (x = 0; x < rl->ri.ri_length; x++) {
+		bits = &rl->bits[x];
+		start = bits->bi_start * GFS2_NBBY;
+		len = bits->bi_len * GFS2_NBBY;
+		if (goal >= start + len)
+			continue;
+
+		blk = gfs2_bitfit((unsigned char *)rl->bh[x]->b_data +
+				  bits->bi_offset, bits->bi_len,
+				  goal > start ? goal - start : 0,
+				  GFS2_BLKST_FREE);
+		if (blk != BFITNOENT) {
+			*bitblk = x;
+			return start + blk;
+		}
+	}
+	return BFITNOENT;
+}
+
+static __inline__ struct rgrp_list *next_rgrp(struct gfs2_sbd *sdp,
+					      struct rgrp_list *rl)
+{
+	osi_list_t *tmp = rl->list.next;
+
+	if (tmp == &sdp->rglist)
+		tmp = tmp->next;
+	return osi_list_entry(tmp, struct rgrp_list, list);
+}
+
+/**
+ * blk_alloc_i - allocate a run of blocks
+ * @sdp: the superblock
+ * @type: DATA, META or DINODE
+ * @count: the number of blocks wanted; returns the number allocated
+ *
+ * The search starts at sdp->alloc_goal, just past the previous allocation,
+ * rather than at the first resource group, and wraps around the rglist
+ * once before giving up.  Bitmaps are searched a word at a time with
+ * gfs2_bitfit().  The run is cut short at the first block that isn't free
+ * or at the end of the resource group, so at least one block is always
+ * returned.  Dinodes are only ever allocated one at a time.
+ *
+ * Returns: the first block of the run
+ */
+static uint64_t blk_alloc_i(struct gfs2_sbd *sdp, unsigned int type,
+			    unsigned int *count)
+{
+	struct rgrp_list *rl, *first;
+	struct gfs2_rindex *ri;
+	struct gfs2_rgrp *rg;
+	struct gfs2_bitmap *bits;
+	struct gfs2_buffer_head *bh;
+	uint32_t goal, bn = BFITNOENT;
+	unsigned int bitblk = 0, n, x, y;
+	unsigned char *byte;
+	unsigned int state;
+
+	if (osi_list_empty(&sdp->rglist))
+		die("out of space\n");
+	if (*count == 0)
+		*count = 1;
+
+	first = gfs2_blk2rgrpd(sdp, sdp->alloc_goal);
+	if (!first) {
+		first = osi_list_entry(sdp->rglist.next, struct rgrp_list,
+				       list);
+		goal = 0;
+	} else if (sdp->alloc_goal < first->ri.ri_data0)
+		goal = 0;
+	else
+		goal = sdp->alloc_goal - first->ri.ri_data0;
+
+	rl = first;
+	for (;;) {
+		if (rl->rg.rg_free) {
+			bn = rgrp_bitfit(rl, goal, &bitblk);
+			if (bn != BFITNOENT)
+				goto found;
+		}
+		rl = next_rgrp(sdp, rl);
+		goal = 0;
+		if (rl == first)
+			break;
 	}
 
-	die("allocation is broken (1): %"PRIu64" %u\n",
-	    (uint64_t)rl->ri.ri_addr, rl->rg.rg_free);
+	/* Lastly, the part of the first rgrp that was behind the goal */
+	if (rl->rg.rg_free)
+		bn = rgrp_bitfit(rl, 0, &bitblk);
+	if (bn == BFITNOENT)
+		die("out of space\n");
 
 found:
+	ri = &rl->ri;
+	rg = &rl->rg;
+
 	if (bn >= ri->ri_bitbytes * GFS2_NBBY)
 		die("allocation is broken (2): bn: %u %u rgrp: %"PRIu64
 		    " (0x%" PRIx64 ") Free:%u\n",
@@ -166,45 +498,102 @@ found:
 		break;
 	case DINODE:
 		state = GFS2_BLKST_DINODE;
-		rg->rg_dinodes++;
+		*count = 1;
 		break;
 	default:
 		die("bad state\n");
 	}
 
-	bh->b_data[x] &= ~(0x03 << (GFS2_BIT_SIZE * y));
-	bh->b_data[x] |= state << (GFS2_BIT_SIZE * y);
-	rg->rg_free--;
+	for (n = 0; n < *count && n < rg->rg_free; n++) {
+		bits = &rl->bits[bitblk];
+		x = (bn + n) / GFS2_NBBY - bits->bi_start;
+		if (x >= bits->bi_len) {
+			bmodified(rl->bh[bitblk]);
+			if (++bitblk == ri->ri_length)
+				break;
+			bits = &rl->bits[bitblk];
+			x = 0;
+		}
+		y = (bn + n) % GFS2_NBBY;
+		bh = rl->bh[bitblk];
+		byte = (unsigned char *)bh->b_data + bits->bi_offset + x;
 
-	bmodified(bh);
+		if (n && ((*byte >> (GFS2_BIT_SIZE * y)) & 0x03) !=
+		    GFS2_BLKST_FREE)
+			break;
+		*byte &= ~(0x03 << (GFS2_BIT_SIZE * y));
+		*byte |= state << (GFS2_BIT_SIZE * y);
+	}
+	if (bitblk < ri->ri_length)
+		bmodified(rl->bh[bitblk]);
+
+	if (type == DINODE)
+		rg->rg_dinodes++;
+	rg->rg_free -= n;
 	gfs2_rgrp_out(rg, rl->bh[0]);
 
-	sdp->blks_alloced++;
+	sdp->blks_alloced += n;
+	/* There can be a gap between one rgrp's data and the next rgrp */
+	if (bn + n < ri->ri_data)
+		sdp->alloc_goal = ri->ri_data0 + bn + n;
+	else
+		sdp->alloc_goal = next_rgrp(sdp, rl)->ri.ri_data0;
+	*count = n;
 	return ri->ri_data0 + bn;
 }
 
 uint64_t data_alloc(struct gfs2_inode *ip)
+{
+	unsigned int n = 1;
+
+	return data_alloc_extent(ip, &n);
+}
+
+uint64_t meta_alloc(struct gfs2_inode *ip)
+{
+	unsigned int n = 1;
+
+	return meta_alloc_extent(ip, &n);
+}
+
+/**
+ * data_alloc_extent - allocate up to *count contiguous data blocks
+ * @ip: the inode the blocks are for
+ * @count: the number of blocks wanted; returns the number allocated
+ *
+ * Returns: the first block allocated
+ */
+uint64_t data_alloc_extent(struct gfs2_inode *ip, unsigned int *count)
 {
 	uint64_t x;
-	x = blk_alloc_i(ip->i_sbd, DATA);
-	ip->i_di.di_goal_data = x;
+	x = blk_alloc_i(ip->i_sbd, DATA, count);
+	ip->i_di.di_goal_data = x + *count - 1;
 	bmodified(ip->i_bh);
 	return x;
 }
 
-uint64_t meta_alloc(struct gfs2_inode *ip)
+/**
+ * meta_alloc_extent - allocate up to *count contiguous metadata blocks
+ * @ip: the inode the blocks are for
+ * @count: the number of blocks wanted; returns the number allocated
+ *
+ * Returns: the first block allocated
+ */
+uint64_t meta_alloc_extent(struct gfs2_inode *ip, unsigned int *count)
 {
 	uint64_t x;
-	x = blk_alloc_i(ip->i_sbd, META);
-	ip->i_di.di_goal_meta = x;
+	x = blk_alloc_i(ip->i_sbd, META, count);
+	ip->i_di.di_goal_meta = x + *count - 1;
 	bmodified(ip->i_bh);
 	return x;
 }
 
 uint64_t dinode_alloc(struct gfs2_sbd *sdp)
 {
+	unsigned int n = 1;
+
 	sdp->dinodes_alloced++;
-	return blk_alloc_i(sdp, DINODE);
+	return blk_alloc_i(sdp, DINODE, &n);
 }
 
 static __inline__ void buffer_clear_tail(struct gfs2_sbd *sdp,
@@ -592,6 +981,9 @@ int gfs2_writei(struct gfs2_inode *ip, void *buf,
 	if (!size)
 		return 0;
 
+	if (ip->i_dindex)
+		dindex_write(ip, buf, offset, size);
+
 	if (inode_is_stuffed(ip) &&
 	    ((start + size) > (sdp->bsize - sizeof(struct gfs2_dinode))))
 		unstuff_dinode(ip);
@@ -784,8 +1176,8 @@ static int dirent_alloc(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
 	return -ENOSPC;
 }
 
-void dirent2_del(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
-		 struct gfs2_dirent *prev, struct gfs2_dirent *cur)
+static void dirent_unlink(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
+			  struct gfs2_dirent *prev, struct gfs2_dirent *cur)
 {
 	uint16_t cur_rec_len, prev_rec_len;
 
@@ -813,12 +1205,26 @@ void dirent2_del(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
 	prev->de_rec_len = cpu_to_be16(prev_rec_len);
 }
 
+void dirent2_del(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
+		 struct gfs2_dirent *prev, struct gfs2_dirent *cur)
+{
+	if (dip->i_dindex && dip->i_dindex->buckets)
+		dindex_remove(dip->i_dindex, cur);
+	dirent_unlink(dip, bh, prev, cur);
+}
+
 void gfs2_get_leaf_nr(struct gfs2_inode *dip, uint32_t lindex,
 		      uint64_t *leaf_out)
 {
-	uint64_t leaf_no;
+	uint64_t leaf_no, *leaves;
 	int count;
 
+	leaves = dindex_leaves(dip);
+	if (leaves && lindex < dip->i_dindex->nleaves) {
+		*leaf_out = leaves[lindex];
+		return;
+	}
+
 	count = gfs2_readi(dip, (char *)&leaf_no, lindex * sizeof(uint64_t),
 			   sizeof(uint64_t));
 	if (count != sizeof(uint64_t))
@@ -913,7 +1319,8 @@ static void dir_split_leaf(struct gfs2_inode *dip, uint32_t lindex,
 			nleaf->lf_entries = be16_to_cpu(nleaf->lf_entries) + 1;
 			nleaf->lf_entries = cpu_to_be16(nleaf->lf_entries);
 
-			dirent2_del(dip, obh, prev, dent);
+			/* The entry only moves, so the name index stays */
+			dirent_unlink(dip, obh, prev, dent);
 
 			if (!prev)
 				prev = dent;
@@ -1123,6 +1530,8 @@ restart:
 		dent->de_hash = cpu_to_be32(hash);
 		dent->de_type = cpu_to_be16(type);
 		memcpy((char *)(dent + 1), filename, len);
+		if (dip->i_dindex && dip->i_dindex->buckets)
+			dindex_insert(dip->i_dindex, dent);
 
 		leaf->lf_entries = be16_to_cpu(leaf->lf_entries) + 1;
 		leaf->lf_entries = cpu_to_be16(leaf->lf_entries);
@@ -1470,8 +1879,22 @@ static int dir_e_search(struct gfs2_inode *dip, const char *filename,
 {
 	struct gfs2_buffer_head *bh = NULL;
 	struct gfs2_dirent *dent;
+	struct gfs2_dir_index *di;
+	struct dindex_ent *de;
 	int error;
 
+	di = dindex_names(dip);
+	if (di) {
+		de = *dindex_slot(di, gfs2_disk_hash(filename, len),
+				  filename, len);
+		if (!de)
+			return -ENOENT;
+		*inum = de->inum;
+		if (type)
+			*type = de->type;
+		return 0;
+	}
+
 	error = linked_leaf_search(dip, filename, len, &dent, &bh);
 	if (error)
 		return error;
@@ -1541,42 +1964,73 @@ int dir_search(struct gfs2_inode *dip, const char *filename, int len,
 	return error;
 }
 
+/* Search the leaf chain starting at <leaf_no>; on success the leaf
+   holding the entry is returned in <bh_out> */
+static int chain_search(struct gfs2_inode *dip, uint64_t leaf_no,
+			const char *filename, int len,
+			struct gfs2_buffer_head **bh_out,
+			struct gfs2_dirent **cur, struct gfs2_dirent **prev)
+{
+	struct gfs2_buffer_head *bh;
+	int error;
+
+	while (leaf_no) {
+		bh = bread(dip->i_sbd, leaf_no);
+		error = leaf_search(dip, bh, filename, len, cur, prev);
+		if (!error) {
+			*bh_out = bh;
+			return 0;
+		}
+		if (error != -ENOENT) {
+			brelse(bh);
+			return -1;
+		}
+		leaf_no = be64_to_cpu(((struct gfs2_leaf *)bh->b_data)->lf_next);
+		brelse(bh);
+	}
+	return -ENOENT;
+}
+
 static int dir_e_del(struct gfs2_inode *dip, const char *filename, int len)
 {
 	int lindex;
 	int error;
-	int found = 0;
-	uint64_t leaf_no;
+	uint64_t leaf_no, prev_leaf = 0;
 	struct gfs2_buffer_head *bh = NULL;
 	struct gfs2_dirent *cur, *prev;
+	struct gfs2_dir_index *di = dip->i_dindex;
+
+	if (di && di->buckets &&
+	    !*dindex_slot(di, gfs2_disk_hash(filename, len), filename, len))
+		return 1;
 
-	lindex = (1 << (dip->i_di.di_depth))-1;
+	/* The entry should be in the leaf chain its hash points at */
+	lindex = 0;
+	if (dip->i_di.di_depth)
+		lindex = gfs2_disk_hash(filename, len) >>
+			(32 - dip->i_di.di_depth);
+	gfs2_get_leaf_nr(dip, lindex, &leaf_no);
+	error = chain_search(dip, leaf_no, filename, len, &bh, &cur, &prev);
 
-	for(; (lindex >= 0) && !found; lindex--){
+	/* but fsck may be deleting from a directory with a damaged hash
+	   table, so look in every leaf before giving up */
+	for (lindex = (1 << (dip->i_di.di_depth)) - 1;
+	     error == -ENOENT && lindex >= 0; lindex--) {
 		gfs2_get_leaf_nr(dip, lindex, &leaf_no);
-
-		while(leaf_no && !found){
-			bh = bread(dip->i_sbd, leaf_no);
-			error = leaf_search(dip, bh, filename, len, &cur, &prev);
-			if (error) {
-				if(error != -ENOENT){
-					brelse(bh);
-					return -1;
-				}
-				leaf_no = be64_to_cpu(((struct gfs2_leaf *)bh->b_data)->lf_next);
-				brelse(bh);
-			} else
-				found = 1;
-		}
+		if (leaf_no == prev_leaf)
+			continue;
+		prev_leaf = leaf_no;
+		error = chain_search(dip, leaf_no, filename, len, &bh, &cur,
+				     &prev);
 	}
 
-	if(!found)
+	if (error == -ENOENT)
 		return 1;
+	if (error)
+		return -1;
 
-	if (bh) {
-		dirent2_del(dip, bh, prev, cur);
-		brelse(bh);
-	}
+	dirent2_del(dip, bh, prev, cur);
+	brelse(bh);
 	return 0;
 }
 
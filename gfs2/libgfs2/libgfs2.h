@@ -127,6 +127,7 @@ struct gfs2_inode {
 	struct gfs2_dinode i_di;
 	struct gfs2_buffer_head *i_bh;
 	struct gfs2_sbd *i_sbd;
+	struct gfs2_dir_index *i_dindex; /* in-core lookup index, dirs only */
 };
 
 #define BUF_HASH_SHIFT       (13)    /* # hash buckets = 8K */
@@ -225,6 +226,8 @@ struct gfs2_sbd {
 	uint64_t rgrps;
 	uint64_t new_rgrps;
 	osi_list_t rglist;
+	uint64_t alloc_goal;	/* where the next block allocation search
+				   starts: just past the last one */
 
 	unsigned int orig_journals;
 
@@ -265,10 +268,28 @@ struct metapath {
 #define DINODE (3)
 
 /* bitmap.c */
+struct gfs2_bmap_chunk;
+
 struct gfs2_bmap {
 	uint64_t size;
 	uint64_t mapsize;
-	unsigned char *map;
+	unsigned char *map;		/* flat map, NULL when tiered */
+
+	/* Tiered map, used when the flat one won't fit in the budget */
+	uint64_t budget;		/* bytes the chunks may keep in memory */
+	uint64_t resident;		/* bytes they keep now */
+	uint64_t nchunks;
+	struct gfs2_bmap_chunk *chunks;
+	struct gfs2_bmap_chunk *last;	/* chunk of the last get or set */
+	uint64_t last_idx;
+	uint64_t *frames;		/* indices of the flat chunks */
+	uint64_t nframes;
+	uint64_t nflat;
+	uint64_t fhand;			/* clock hand over the frames */
+	uint64_t hand;			/* and over the rle chunks */
+	int spill_fd;
+	uint64_t spills;		/* chunks written to the spill file */
+	uint64_t reloads;		/* and read back */
 };
 
 /* block_list.c */
@@ -351,6 +372,7 @@ static inline int blockmap_to_bitmap(enum gfs2_mark_block m)
 }
 
 extern struct gfs2_bmap *gfs2_bmap_create(struct gfs2_sbd *sdp, uint64_t size,
+					  uint64_t budget,
 					  uint64_t *addl_mem_needed);
 extern struct special_blocks *blockfind(struct special_blocks *blist, uint64_t num);
 extern void gfs2_special_add(struct special_blocks *blocklist, uint64_t block);
@@ -361,6 +383,15 @@ extern int gfs2_blockmap_set(struct gfs2_bmap *il, uint64_t block,
 extern void gfs2_special_clear(struct special_blocks *blocklist,
 			       uint64_t block);
 extern void *gfs2_bmap_destroy(struct gfs2_sbd *sdp, struct gfs2_bmap *il);
+extern uint8_t gfs2_blockmap_get_tiered(struct gfs2_bmap *il, uint64_t block);
+
+static inline uint8_t gfs2_blockmap_get(struct gfs2_bmap *il, uint64_t block)
+{
+	if (!il->map)
+		return gfs2_blockmap_get_tiered(il, block);
+	return (il->map[BLOCKMAP_SIZE4(block)] >>
+		BLOCKMAP_BYTE_OFFSET4(block)) & BLOCKMAP_MASK4;
+}
 
 /* buf.c */
 extern struct gfs2_buffer_head *__bget_generic(struct gfs2_sbd *sdp,
@@ -432,6 +463,8 @@ extern struct gfs2_inode *is_system_inode(struct gfs2_sbd *sdp,
 extern void inode_put(struct gfs2_inode **ip);
 extern uint64_t data_alloc(struct gfs2_inode *ip);
 extern uint64_t meta_alloc(struct gfs2_inode *ip);
+extern uint64_t data_alloc_extent(struct gfs2_inode *ip, unsigned int *count);
+extern uint64_t meta_alloc_extent(struct gfs2_inode *ip, unsigned int *count);
 extern uint64_t dinode_alloc(struct gfs2_sbd *sdp);
 extern int gfs2_readi(struct gfs2_inode *ip, void *buf, uint64_t offset,
 		      unsigned int size);
@@ -455,6 +488,7 @@ extern void dir_add(struct gfs2_inode *dip, const char *filename, int len,
 		    struct gfs2_inum *inum, unsigned int type);
 extern int gfs2_dirent_del(struct gfs2_inode *dip, const char *filename,
 			   int filename_len);
+extern void gfs2_dindex_free(struct gfs2_inode *dip);
 extern void block_map(struct gfs2_inode *ip, uint64_t lblock, int *new,
 		      uint64_t *dblock, uint32_t *extlen, int prealloc);
 extern void gfs2_get_leaf_nr(struct gfs2_inode *dip, uint32_t index,
@@ -203,7 +203,7 @@ void gfs2_rindex_out(struct gfs2_rindex *ri, char *buf)
 
 	CPOUT_64(ri, str, ri_addr);
 	CPOUT_32(ri, str, ri_length);
-	ri->__pad = 0;
+	str->__pad = 0;
 
 	CPOUT_64(ri, str, ri_data0);
 	CPOUT_32(ri, str, ri_data);
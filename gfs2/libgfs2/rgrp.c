@@ -46,7 +46,7 @@ int gfs2_compute_bitstructs(struct gfs2_sbd *sdp, struct rgrp_list *rgd)
 			bits->bi_len = bytes;
 		}
 		else if (x == 0){
-			bytes = sdp->sd_sb.sb_bsize - sizeof(struct gfs2_rgrp);
+			bytes = sdp->bsize - sizeof(struct gfs2_rgrp);
 			bits->bi_offset = sizeof(struct gfs2_rgrp);
 			bits->bi_start = 0;
 			bits->bi_len = bytes;
@@ -58,7 +58,7 @@ int gfs2_compute_bitstructs(struct gfs2_sbd *sdp, struct rgrp_list *rgd)
 			bits->bi_len = bytes;
 		}
 		else{
-			bytes = sdp->sd_sb.sb_bsize - sizeof(struct gfs2_meta_header);
+			bytes = sdp->bsize - sizeof(struct gfs2_meta_header);
 			bits->bi_offset = sizeof(struct gfs2_meta_header);
 			bits->bi_start = rgd->ri.ri_bitbytes - bytes_left;
 			bits->bi_len = bytes;
@@ -0,0 +1,201 @@
+/*
+ * Build resource groups on a sparse image file the way mkfs.gfs2 does and
+ * time a million single block allocations, then a million more made as
+ * contiguous runs.  Checks that the allocator hands out each free block
+ * once, in order, and wraps around to reuse freed blocks when it reaches
+ * the end of the file system.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/time.h>
+
+#include "libgfs2.h"
+
+#define IMAGE_BLOCKS	(4 * 1024 * 1024)	/* 16GB of 4k blocks */
+#define ALLOC_COUNT	(1000 * 1000)
+#define RUN_LENGTH	256
+#define HOLES		500
+
+static int failed;
+
+/* For libgfs2's sake */
+void print_it(const char *label, const char *fmt, const char *fmt2, ...)
+{
+	va_list args;
+
+	va_start(args, fmt2);
+	printf("%s: ", label);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+static void check(const char *desc, uint64_t got, uint64_t want)
+{
+	printf("%-40s %10"PRIu64" (want %10"PRIu64") %s\n", desc, got, want,
+	       got == want ? "ok" : "FAIL");
+	if (got != want)
+		failed++;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static uint64_t free_blocks(struct gfs2_sbd *sdp)
+{
+	osi_list_t *tmp;
+	struct rgrp_list *rl;
+	uint64_t count = 0;
+
+	osi_list_foreach(tmp, &sdp->rglist) {
+		rl = osi_list_entry(tmp, struct rgrp_list, list);
+		count += rl->rg.rg_free;
+	}
+	return count;
+}
+
+static void free_block(struct gfs2_sbd *sdp, uint64_t blk)
+{
+	struct rgrp_list *rl = gfs2_blk2rgrpd(sdp, blk);
+
+	gfs2_set_bitmap(sdp, blk, GFS2_BLKST_FREE);
+	rl->rg.rg_free++;
+	sdp->blks_alloced--;
+}
+
+static void make_fs(struct gfs2_sbd *sdp, const char *path)
+{
+	memset(sdp, 0, sizeof(struct gfs2_sbd));
+	sdp->bsize = GFS2_DEFAULT_BSIZE;
+	sdp->rgsize = GFS2_DEFAULT_RGSIZE;
+	osi_list_init(&sdp->rglist);
+
+	sdp->device_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (sdp->device_fd < 0)
+		die("can't create %s: %s\n", path, strerror(errno));
+	if (ftruncate(sdp->device_fd, (off_t)IMAGE_BLOCKS * sdp->bsize))
+		die("can't size %s: %s\n", path, strerror(errno));
+
+	if (compute_constants(sdp))
+		die("bad constants\n");
+	if (device_geometry(sdp) || fix_device_geometry(sdp))
+		die("bad geometry\n");
+	compute_rgrp_layout(sdp, TRUE);
+	build_rgrps(sdp, TRUE);
+}
+
+int main(int argc, char **argv)
+{
+	struct gfs2_sbd sbd, *sdp = &sbd;
+	struct gfs2_inode ip;
+	const char *path = argc > 1 ? argv[1] : "allocbench.img";
+	uint64_t blk, prev, first = 0, total, holes[HOLES];
+	unsigned int n, runs = 0, short_runs = 0;
+	int x, bad;
+	double start, single, runtime;
+
+	make_fs(sdp, path);
+	total = free_blocks(sdp);
+	printf("%"PRIu64" rgrps, %"PRIu64" free blocks\n", sdp->rgrps, total);
+
+	memset(&ip, 0, sizeof(ip));
+	ip.i_sbd = sdp;
+	ip.i_bh = bget(sdp, sdp->sb_addr);
+
+	/* One block at a time */
+	bad = 0;
+	prev = 0;
+	start = now();
+	for (x = 0; x < ALLOC_COUNT; x++) {
+		blk = data_alloc(&ip);
+		if (blk <= prev)
+			bad++;
+		if (!x)
+			first = blk;
+		else if (x <= HOLES * 2 && !(x & 1))
+			holes[x / 2 - 1] = blk;
+		prev = blk;
+	}
+	single = now() - start;
+
+	check("single allocations out of order", bad, 0);
+	check("free after single allocations", free_blocks(sdp),
+	      total - ALLOC_COUNT);
+	check("first block is used",
+	      gfs2_get_bitmap(sdp, first, NULL), GFS2_BLKST_USED);
+	check("goal updated", ip.i_di.di_goal_data, prev);
+
+	/* The same number again, in runs */
+	bad = 0;
+	start = now();
+	for (x = 0; x < ALLOC_COUNT; x += n) {
+		n = RUN_LENGTH;
+		if (n > ALLOC_COUNT - x)
+			n = ALLOC_COUNT - x;
+		blk = data_alloc_extent(&ip, &n);
+		if (blk <= prev)
+			bad++;
+		if (n < RUN_LENGTH && x + n < ALLOC_COUNT)
+			short_runs++;
+		runs++;
+		prev = blk + n - 1;
+	}
+	runtime = now() - start;
+
+	check("runs out of order", bad, 0);
+	check("free after runs", free_blocks(sdp), total - 2 * ALLOC_COUNT);
+	check("blocks accounted", sdp->blks_alloced, 2 * ALLOC_COUNT);
+	check("runs cut short only at rgrp ends",
+	      short_runs < sdp->rgrps, 1);
+	check("last block of last run is used",
+	      gfs2_get_bitmap(sdp, prev, NULL), GFS2_BLKST_USED);
+	check("block after last run is free",
+	      gfs2_get_bitmap(sdp, prev + 1, NULL), GFS2_BLKST_FREE);
+
+	/* Punch holes behind the cursor, fill the rest of the file system,
+	   and the next allocations must wrap around to the holes */
+	for (x = 0; x < HOLES; x++)
+		free_block(sdp, holes[x]);
+	while (free_blocks(sdp) > HOLES) {
+		n = 65536;
+		if (n > free_blocks(sdp) - HOLES)
+			n = free_blocks(sdp) - HOLES;
+		data_alloc_extent(&ip, &n);
+	}
+	bad = 0;
+	for (x = 0; x < HOLES; x++) {
+		n = RUN_LENGTH;
+		blk = data_alloc_extent(&ip, &n);
+		if (blk != holes[x] || n != 1)
+			bad++;
+	}
+	check("holes reused in order", bad, 0);
+	check("file system full", free_blocks(sdp), 0);
+
+	printf("%d single allocations: %.3fs (%.0f/s)\n", ALLOC_COUNT,
+	       single, ALLOC_COUNT / single);
+	printf("%d blocks in %u runs:     %.3fs (%.0f/s)\n", ALLOC_COUNT,
+	       runs, runtime, ALLOC_COUNT / runtime);
+
+	free(ip.i_bh);
+	close(sdp->device_fd);
+	unlink(path);
+
+	if (failed) {
+		printf("%d failed\n", failed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
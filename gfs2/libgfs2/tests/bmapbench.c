@@ -0,0 +1,183 @@
+/*
+ * Time the block map the way fsck.gfs2 uses it: pass1 marks every block of
+ * a synthetic file system, mostly in order with some scattered updates,
+ * and pass5 reads every mark back in order.  Runs once with the flat map
+ * and once with a tiered map held to an eighth of its size (or 1/divisor),
+ * and checks that both return exactly the marks that were set.
+ *
+ * Usage: bmapbench [blocks [divisor]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <sys/time.h>
+
+#include "libgfs2.h"
+
+#define DEFAULT_BLOCKS	(256ULL * 1024 * 1024)	/* 1TB of 4k blocks */
+#define REGION_BLOCKS	(1024 * 1024)
+#define SCATTER_EVERY	97
+
+static int failed;
+
+/* For libgfs2's sake */
+void print_it(const char *label, const char *fmt, const char *fmt2, ...)
+{
+	va_list args;
+
+	va_start(args, fmt2);
+	printf("%s: ", label);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static uint64_t hash64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb3f99ebc1ba3ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/*
+ * The mark pass1 would give each block.  Each region starts with an rgrp
+ * header and is filled to a different level; most are dinodes and data in
+ * long runs, every eighth one is badly fragmented.
+ */
+static uint8_t layout(uint64_t blk)
+{
+	uint64_t region = blk / REGION_BLOCKS;
+	uint64_t off = blk % REGION_BLOCKS;
+	uint64_t fill = hash64(region) % (REGION_BLOCKS + 1);
+
+	if (off < 4)
+		return gfs2_meta_rgrp;
+	if (off >= fill)
+		return gfs2_block_free;
+	if (region % 8 == 7)
+		return hash64(blk) % 13;
+	if (off % 1024 == 4)
+		return gfs2_inode_dir;
+	if (off % 64 == 4)
+		return gfs2_inode_file;
+	if (off % 512 == 5)
+		return gfs2_indir_blk;
+	return gfs2_block_used;
+}
+
+static double pass1(struct gfs2_bmap *bmap, uint64_t blocks)
+{
+	uint64_t blk, far;
+	double start = now();
+
+	/* Mark everything in order, and every so often go back and mark a
+	   block somewhere else first as data, the way pass1 meets indirect
+	   blocks that point far away */
+	for (blk = 0; blk < blocks; blk++) {
+		if (blk % SCATTER_EVERY == 0) {
+			far = hash64(blk) % blocks;
+			if (far > blk)
+				gfs2_blockmap_set(bmap, far, gfs2_block_used);
+		}
+		gfs2_blockmap_set(bmap, blk, layout(blk));
+	}
+	return now() - start;
+}
+
+static double pass5(struct gfs2_bmap *bmap, uint64_t blocks)
+{
+	uint64_t blk, bad = 0, free = 0;
+	double start = now();
+
+	for (blk = 0; blk < blocks; blk++) {
+		uint8_t q = gfs2_blockmap_get(bmap, blk);
+
+		if (q != layout(blk))
+			bad++;
+		if (blockmap_to_bitmap(q) == GFS2_BLKST_FREE)
+			free++;
+	}
+	if (bad) {
+		printf("  %"PRIu64" blocks read back wrong\n", bad);
+		failed++;
+	}
+	printf("  %"PRIu64" free blocks\n", free);
+	return now() - start;
+}
+
+static void run(struct gfs2_sbd *sdp, const char *desc, uint64_t blocks,
+		uint64_t budget)
+{
+	struct gfs2_bmap *bmap;
+	uint64_t addl;
+	double t1, t5;
+
+	bmap = gfs2_bmap_create(sdp, blocks, budget, &addl);
+	if (!bmap)
+		die("can't create the %s map, %"PRIu64" more bytes needed\n",
+		    desc, addl);
+	printf("%s map (%s):\n", desc, bmap->map ? "flat" : "tiered");
+	if (budget && !bmap->map == (budget >= BLOCKMAP_SIZE4(blocks))) {
+		printf("  wrong kind of map for a %"PRIu64"MB budget\n",
+		       budget >> 20);
+		failed++;
+	}
+
+	t1 = pass1(bmap, blocks);
+	t5 = pass5(bmap, blocks);
+	printf("  pass1: %.3fs (%.1fM blocks/s)\n", t1, blocks / t1 / 1e6);
+	printf("  pass5: %.3fs (%.1fM blocks/s)\n", t5, blocks / t5 / 1e6);
+	if (!bmap->map) {
+		printf("  resident %"PRIu64"MB of %"PRIu64"MB, %"PRIu64
+		       " chunks spilled, %"PRIu64" reloaded\n",
+		       bmap->resident >> 20, bmap->mapsize >> 20,
+		       bmap->spills, bmap->reloads);
+		if (bmap->resident > bmap->budget) {
+			printf("  over budget\n");
+			failed++;
+		}
+	}
+	gfs2_bmap_destroy(sdp, bmap);
+}
+
+int main(int argc, char **argv)
+{
+	struct gfs2_sbd sbd;
+	uint64_t blocks = DEFAULT_BLOCKS, divisor = 8;
+	char desc[32];
+
+	if (argc > 1)
+		blocks = strtoull(argv[1], NULL, 0);
+	if (argc > 2)
+		divisor = strtoull(argv[2], NULL, 0);
+	if (!blocks || divisor < 2)
+		die("usage: bmapbench [blocks [divisor]]\n");
+	memset(&sbd, 0, sizeof(sbd));
+
+	printf("%"PRIu64" blocks, flat map is %"PRIu64"MB\n", blocks,
+	       BLOCKMAP_SIZE4(blocks) >> 20);
+	run(&sbd, "unlimited", blocks, BLOCKMAP_SIZE4(blocks) + 1);
+	sprintf(desc, "1/%"PRIu64" budget", divisor);
+	run(&sbd, desc, blocks, BLOCKMAP_SIZE4(blocks) / divisor);
+
+	if (failed) {
+		printf("%d failed\n", failed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
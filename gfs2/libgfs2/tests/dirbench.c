@@ -0,0 +1,191 @@
+/*
+ * Create 100,000 files in one directory of a file system built on a sparse
+ * image file, the way mkfs.gfs2 and fsck.gfs2's lost+found do it (createi
+ * looks each name up before adding it), then look every name up again.
+ * Checks that lookups find what was added, that deleted names go away,
+ * and that a directory index rebuilt from the leaves agrees with the one
+ * kept up to date by dir_add and gfs2_dirent_del.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "libgfs2.h"
+
+#define IMAGE_BLOCKS	(512 * 1024)	/* 2GB of 4k blocks */
+#define ENTRIES		(100 * 1000)
+#define DEL_EVERY	7
+
+static int failed;
+static uint64_t addrs[ENTRIES];
+
+/* For libgfs2's sake */
+void print_it(const char *label, const char *fmt, const char *fmt2, ...)
+{
+	va_list args;
+
+	va_start(args, fmt2);
+	printf("%s: ", label);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+static void check(const char *desc, uint64_t got, uint64_t want)
+{
+	printf("%-40s %10"PRIu64" (want %10"PRIu64") %s\n", desc, got, want,
+	       got == want ? "ok" : "FAIL");
+	if (got != want)
+		failed++;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void make_fs(struct gfs2_sbd *sdp, const char *path)
+{
+	memset(sdp, 0, sizeof(struct gfs2_sbd));
+	sdp->bsize = GFS2_DEFAULT_BSIZE;
+	sdp->rgsize = GFS2_DEFAULT_RGSIZE;
+	sdp->md.next_inum = 1;
+	osi_list_init(&sdp->rglist);
+
+	sdp->device_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (sdp->device_fd < 0)
+		die("can't create %s: %s\n", path, strerror(errno));
+	if (ftruncate(sdp->device_fd, (off_t)IMAGE_BLOCKS * sdp->bsize))
+		die("can't size %s: %s\n", path, strerror(errno));
+
+	if (compute_constants(sdp))
+		die("bad constants\n");
+	if (device_geometry(sdp) || fix_device_geometry(sdp))
+		die("bad geometry\n");
+	compute_rgrp_layout(sdp, TRUE);
+	build_rgrps(sdp, TRUE);
+	build_root(sdp);
+}
+
+static int name_of(char *buf, int x)
+{
+	return sprintf(buf, "file-%08x-%d", x * 2654435761U, x);
+}
+
+/* Look every name up; deleted ones (if <deleted>) must be missing */
+static unsigned int lookup_all(struct gfs2_inode *dip, int deleted)
+{
+	struct gfs2_inum inum;
+	unsigned int type, bad = 0;
+	char name[64];
+	int x, len, error;
+
+	for (x = 0; x < ENTRIES; x++) {
+		len = name_of(name, x);
+		error = dir_search(dip, name, len, &type, &inum);
+		if (deleted && x % DEL_EVERY == 0) {
+			if (error != -ENOENT)
+				bad++;
+		} else if (error || inum.no_addr != addrs[x] ||
+			   type != IF2DT(S_IFREG)) {
+			bad++;
+		}
+	}
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	struct gfs2_sbd sbd, *sdp = &sbd;
+	struct gfs2_inode *dip, *ip;
+	struct gfs2_inum inum;
+	const char *path = argc > 1 ? argv[1] : "dirbench.img";
+	char name[64];
+	int x, len, bad;
+	double start, create, lookup, rebuild;
+
+	make_fs(sdp, path);
+	dip = sdp->md.rooti;
+
+	start = now();
+	for (x = 0; x < ENTRIES; x++) {
+		name_of(name, x);
+		ip = createi(dip, name, S_IFREG | 0644, 0);
+		addrs[x] = ip->i_di.di_num.no_addr;
+		inode_put(&ip);
+	}
+	create = now() - start;
+
+	check("entries", dip->i_di.di_entries, ENTRIES + 2);
+	check("directory is hashed",
+	      !!(dip->i_di.di_flags & GFS2_DIF_EXHASH), 1);
+
+	/* createi of an existing name hands back the same inode */
+	name_of(name, ENTRIES / 2);
+	ip = createi(dip, name, S_IFREG | 0644, 0);
+	check("createi finds existing", ip->i_di.di_num.no_addr,
+	      addrs[ENTRIES / 2]);
+	inode_put(&ip);
+	check("entries after second createi", dip->i_di.di_entries,
+	      ENTRIES + 2);
+
+	start = now();
+	bad = lookup_all(dip, 0);
+	lookup = now() - start;
+	check("lookups wrong", bad, 0);
+	check("missing name",
+	      dir_search(dip, "nothere", 7, NULL, &inum) == -ENOENT, 1);
+	check("dot dot", dir_search(dip, "..", 2, NULL, &inum), 0);
+
+	/* Deletes have to show up without rebuilding the index */
+	bad = 0;
+	for (x = 0; x < ENTRIES; x += DEL_EVERY) {
+		len = name_of(name, x);
+		if (gfs2_dirent_del(dip, name, len))
+			bad++;
+	}
+	check("deletes failed", bad, 0);
+	check("lookups wrong after delete", lookup_all(dip, 1), 0);
+
+	/* Adding a name back after deleting it */
+	len = name_of(name, 0);
+	inum.no_formal_ino = sdp->md.next_inum++;
+	inum.no_addr = addrs[0];
+	dir_add(dip, name, len, &inum, IF2DT(S_IFREG));
+	check("re-added name", dir_search(dip, name, len, NULL, &inum), 0);
+	gfs2_dirent_del(dip, name, len);
+
+	/* And the same answers from an index read back from the leaves */
+	gfs2_dindex_free(dip);
+	start = now();
+	bad = lookup_all(dip, 1);
+	rebuild = now() - start;
+	check("lookups wrong after rebuild", bad, 0);
+
+	printf("%d createi:               %.3fs (%.0f/s)\n", ENTRIES,
+	       create, ENTRIES / create);
+	printf("%d lookups:               %.3fs (%.0f/s)\n", ENTRIES,
+	       lookup, ENTRIES / lookup);
+	printf("%d lookups after rebuild: %.3fs\n", ENTRIES, rebuild);
+
+	inode_put(&sdp->md.rooti);
+	close(sdp->device_fd);
+	unlink(path);
+
+	if (failed) {
+		printf("%d failed\n", failed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
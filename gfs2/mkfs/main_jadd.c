@@ -10,6 +10,7 @@
 #include <sys/file.h>
 #include <sys/vfs.h>
 #include <sys/mount.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
@@ -25,6 +26,12 @@
 #define BUF_SIZE 4096
 #define RANDOM(values) ((values) * (random() / (RAND_MAX + 1.0)))
 
+/* Journals and quota change files are written this many bytes at a time */
+#define CHUNK_SIZE (4 << 20)
+
+/* Most journals written at once by -j N */
+#define MAX_JOURNAL_WRITERS 8
+
 static void
 make_jdata(int fd, const char *value)
 {
@@ -44,12 +51,13 @@ make_jdata(int fd, const char *value)
 }
 
 static int
-rename2system(struct gfs2_sbd *sdp, const char *new_dir, const char *new_name)
+rename2system(struct gfs2_sbd *sdp, const char *old_name, const char *new_dir,
+	      const char *new_name)
 {
 	char oldpath[PATH_MAX], newpath[PATH_MAX];
 	int error = 0;
-	error = snprintf(oldpath, PATH_MAX, "%s/new_inode", 
-			 sdp->metafs_path);
+	error = snprintf(oldpath, PATH_MAX, "%s/%s",
+			 sdp->metafs_path, old_name);
 	if (error >= PATH_MAX)
 		die( _("rename2system (1)\n"));
 
@@ -193,13 +201,13 @@ print_results(struct gfs2_sbd *sdp)
 }
 
 static int
-create_new_inode(struct gfs2_sbd *sdp)
+create_new_inode(struct gfs2_sbd *sdp, const char *inode_name)
 {
 	char name[PATH_MAX];
 	int fd;
 	int error;
 
-	error = snprintf(name, PATH_MAX, "%s/new_inode", sdp->metafs_path);
+	error = snprintf(name, PATH_MAX, "%s/%s", sdp->metafs_path, inode_name);
 	if (error >= PATH_MAX)
 		die("create_new_inode (1)\n");
 
@@ -219,6 +227,57 @@ create_new_inode(struct gfs2_sbd *sdp)
 	return fd;
 }
 
+/**
+ * write_chunk - write out a buffer of whole blocks
+ * @fd: the file
+ * @buf: the blocks
+ * @len: the length of the buffer
+ * @blk: the file block number of the first block, for error messages
+ */
+static void
+write_chunk(int fd, const char *buf, size_t len, uint64_t blk)
+{
+	ssize_t rv;
+	size_t off = 0;
+
+	while (off < len) {
+		rv = write(fd, buf + off, len - off);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv <= 0) {
+			fprintf(stderr, _("write error: %s from %s:%d: "
+				"block %lld (0x%llx)\n"),
+				rv ? strerror(errno) : "short write",
+				__FUNCTION__, __LINE__,
+				(unsigned long long)blk,
+				(unsigned long long)blk);
+			exit(-1);
+		}
+		off += rv;
+	}
+}
+
+/**
+ * preallocate - ask for a file's blocks up front
+ * @fd: the file
+ * @len: the size it will be
+ *
+ * Where the kernel supports fallocate on gfs2 this gets the file its
+ * blocks in as few extents as possible before they're written.  If it
+ * doesn't, the writes allocate them as before.
+ */
+static void
+preallocate(int fd, off_t len)
+{
+	if (fallocate(fd, 0, 0, len) == 0)
+		return;
+	if (errno == ENOSPC)
+		die( _("not enough free space: %s\n"), strerror(errno));
+	if (errno != EOPNOTSUPP && errno != ENOSYS)
+		fprintf(stderr, _("fallocate failed, continuing: %s\n"),
+			strerror(errno));
+}
+
 static void
 add_ir(struct gfs2_sbd *sdp)
 {
@@ -226,7 +285,7 @@ add_ir(struct gfs2_sbd *sdp)
 	char new_name[256];
 	int error;
 
-	fd = create_new_inode(sdp);
+	fd = create_new_inode(sdp, "new_inode");
 
 	{
 		struct gfs2_inum_range ir;
@@ -244,7 +303,7 @@ add_ir(struct gfs2_sbd *sdp)
 	close(fd);
 	
 	sprintf(new_name, "inum_range%u", sdp->md.journals);
-	error = rename2system(sdp, "per_node", new_name);
+	error = rename2system(sdp, "new_inode", "per_node", new_name);
 	if (error < 0 && errno != EEXIST)
 		die( _("can't rename2system %s (%d): %s\n"), 
 		new_name, error, strerror(errno));
@@ -257,7 +316,7 @@ add_sc(struct gfs2_sbd *sdp)
 	char new_name[256];
 	int error;
 	
-	fd = create_new_inode(sdp);
+	fd = create_new_inode(sdp, "new_inode");
 	
 	{
 		struct gfs2_statfs_change sc;
@@ -276,7 +335,7 @@ add_sc(struct gfs2_sbd *sdp)
 	close(fd);
 	
 	sprintf(new_name, "statfs_change%u", sdp->md.journals);
-	error = rename2system(sdp, "per_node", new_name);
+	error = rename2system(sdp, "new_inode", "per_node", new_name);
 	if (error < 0 && errno != EEXIST)
 		die( _("can't rename2system %s (%d): %s\n"),
 		    new_name, error, strerror(errno));
@@ -289,52 +348,44 @@ add_qc(struct gfs2_sbd *sdp)
 	char new_name[256];
 	int error;
 
-	fd = create_new_inode(sdp);
+	fd = create_new_inode(sdp, "new_inode");
 
 	{
-		char buf[sdp->bsize];
 		unsigned int blocks =
 			sdp->qcsize << (20 - sdp->sd_sb.sb_bsize_shift);
-		unsigned int x;
+		unsigned int chunk = CHUNK_SIZE / sdp->bsize;
+		unsigned int x, n;
 		struct gfs2_meta_header mh;
 		struct gfs2_buffer_head dummy_bh;
+		char *buf;
 
-		dummy_bh.b_data = buf;
 		make_jdata(fd, "clear");
-		memset(buf, 0, sdp->bsize);
-
-		for (x=0; x<blocks; x++) {
-			if (write(fd, buf, sdp->bsize) != sdp->bsize) {
-				fprintf(stderr, _("write error: %s from %s:%d: "
-					"block %lld (0x%llx)\n"),
-					strerror(errno),
-					__FUNCTION__, __LINE__,
-					(unsigned long long)x,
-					(unsigned long long)x);
-				exit(-1);
-			}
-		}
+		preallocate(fd, (off_t)blocks * sdp->bsize);
 
-		lseek(fd, 0, SEEK_SET);
-		
+		if (chunk > blocks)
+			chunk = blocks;
+		buf = calloc(chunk, sdp->bsize);
+		if (!buf)
+			die( _("out of memory\n"));
+
+		/* Every block is the same, so the chunk is formatted once */
 		memset(&mh, 0, sizeof(struct gfs2_meta_header));
 		mh.mh_magic = GFS2_MAGIC;
 		mh.mh_type = GFS2_METATYPE_QC;
 		mh.mh_format = GFS2_FORMAT_QC;
-		gfs2_meta_header_out(&mh, &dummy_bh);
-
-		for (x=0; x<blocks; x++) {
-			if (write(fd, buf, sdp->bsize) != sdp->bsize) {
-				fprintf(stderr, _("write error: %s from %s:%d: "
-					"block %lld (0x%llx)\n"),
-					strerror(errno),
-					__FUNCTION__, __LINE__,
-					(unsigned long long)x,
-					(unsigned long long)x);
-				exit(-1);
-			}
+		for (x = 0; x < chunk; x++) {
+			dummy_bh.b_data = buf + x * sdp->bsize;
+			gfs2_meta_header_out(&mh, &dummy_bh);
 		}
 
+		for (x = 0; x < blocks; x += n) {
+			n = blocks - x;
+			if (n > chunk)
+				n = chunk;
+			write_chunk(fd, buf, (size_t)n * sdp->bsize, x);
+		}
+		free(buf);
+
 		error = fsync(fd);
 		if (error)
 			die( _("can't fsync: %s\n"),
@@ -344,7 +395,7 @@ add_qc(struct gfs2_sbd *sdp)
 	close(fd);
 	
 	sprintf(new_name, "quota_change%u", sdp->md.journals);
-	error = rename2system(sdp, "per_node", new_name);
+	error = rename2system(sdp, "new_inode", "per_node", new_name);
 	if (error < 0 && errno != EEXIST)
 		die( _("can't rename2system %s (%d): %s\n"),
 		    new_name, error, strerror(errno));
@@ -392,83 +443,206 @@ close:
 	sdp->orig_journals = existing_journals;
 }
 
-static void 
-add_j(struct gfs2_sbd *sdp)
+/**
+ * fill_journal - fill a new journal with unmount log headers
+ * @sdp: the superblock
+ * @fd: the journal's file
+ * @seq: the sequence number of the first log header
+ *
+ * The journal is written in a single pass: each chunk of log headers is
+ * formatted in memory and written out with one write().  The rest of each
+ * block is left zeroed.
+ */
+static void
+fill_journal(struct gfs2_sbd *sdp, int fd, uint64_t seq)
 {
-	int fd;
-	char new_name[256];
-	int error;
+	unsigned int blocks = sdp->jsize << (20 - sdp->sd_sb.sb_bsize_shift);
+	unsigned int chunk = CHUNK_SIZE / sdp->bsize;
+	unsigned int x, y, n;
+	struct gfs2_log_header lh;
+	struct gfs2_buffer_head dummy_bh;
+	uint32_t hash;
+	char *buf;
+
+	make_jdata(fd, "clear");
+	preallocate(fd, (off_t)blocks * sdp->bsize);
+
+	if (chunk > blocks)
+		chunk = blocks;
+	buf = calloc(chunk, sdp->bsize);
+	if (!buf)
+		die( _("out of memory\n"));
+
+	memset(&lh, 0, sizeof(struct gfs2_log_header));
+	lh.lh_header.mh_magic = GFS2_MAGIC;
+	lh.lh_header.mh_type = GFS2_METATYPE_LH;
+	lh.lh_header.mh_format = GFS2_FORMAT_LH;
+	lh.lh_flags = GFS2_LOG_HEAD_UNMOUNT;
+
+	for (x = 0; x < blocks; x += n) {
+		n = blocks - x;
+		if (n > chunk)
+			n = chunk;
+
+		for (y = 0; y < n; y++) {
+			dummy_bh.b_data = buf + y * sdp->bsize;
+			lh.lh_sequence = seq;
+			lh.lh_blkno = x + y;
+			gfs2_log_header_out(&lh, &dummy_bh);
+			hash = gfs2_disk_hash(dummy_bh.b_data,
+					      sizeof(struct gfs2_log_header));
+			((struct gfs2_log_header *)dummy_bh.b_data)->lh_hash =
+				cpu_to_be32(hash);
 
-	fd = create_new_inode(sdp);
+			if (++seq == blocks)
+				seq = 0;
+		}
 
-	{
-		char buf[sdp->bsize];
-		unsigned int blocks =
-			sdp->jsize << (20 - sdp->sd_sb.sb_bsize_shift);
-		unsigned int x;
-		struct gfs2_log_header lh;
-		uint64_t seq = RANDOM(blocks);
+		write_chunk(fd, buf, (size_t)n * sdp->bsize, x);
+	}
+	free(buf);
 
-		make_jdata(fd, "clear");
-		memset(buf, 0, sdp->bsize);
-		for (x=0; x<blocks; x++) {
-			if (write(fd, buf, sdp->bsize) != sdp->bsize) {
-				fprintf(stderr, _("write error: %s from %s:%d: "
-					"block %lld (0x%llx)\n"),
-					strerror(errno),
-					__FUNCTION__, __LINE__,
-					(unsigned long long)x,
-					(unsigned long long)x);
-				exit(-1);
-			}
-		}
+	if (fsync(fd))
+		die( _("can't fsync: %s\n"), strerror(errno));
+}
+
+/**
+ * start_journal - write a new journal in a child process
+ * @sdp: the superblock
+ * @jid: the journal number
+ *
+ * The journal is built under a temporary name of its own so that several
+ * can be written at once; add_journals() renames them into the jindex.
+ *
+ * Returns: the child's pid
+ */
+static pid_t
+start_journal(struct gfs2_sbd *sdp, unsigned int jid)
+{
+	char tmp_name[256];
+	unsigned int blocks = sdp->jsize << (20 - sdp->sd_sb.sb_bsize_shift);
+	uint64_t seq = RANDOM(blocks);
+	pid_t pid;
+	int fd;
+
+	sprintf(tmp_name, "new_journal%u", jid);
+	fd = create_new_inode(sdp, tmp_name);
+
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0)
+		die( _("can't fork: %s\n"), strerror(errno));
+	if (!pid) {
+		fill_journal(sdp, fd, seq);
+		close(fd);
+		exit(0);
+	}
+	close(fd);
+	return pid;
+}
 
-		lseek(fd, 0, SEEK_SET);
+static void
+unlink2system(struct gfs2_sbd *sdp, const char *dir, const char *name)
+{
+	char path[PATH_MAX];
+	int len;
 
-		memset(&lh, 0, sizeof(struct gfs2_log_header));
-		lh.lh_header.mh_magic = GFS2_MAGIC;
-		lh.lh_header.mh_type = GFS2_METATYPE_LH;
-		lh.lh_header.mh_format = GFS2_FORMAT_LH;
-		lh.lh_flags = GFS2_LOG_HEAD_UNMOUNT;
+	len = snprintf(path, sizeof(path), "%s/%s/%s",
+		       sdp->metafs_path, dir, name);
+	if (len < 0 || len >= sizeof(path))
+		return;
+	unlink(path);
+}
 
-		for (x=0; x<blocks; x++) {
-			uint32_t hash;
-			struct gfs2_buffer_head dummy_bh;
+/**
+ * remove_new_files - undo add_journals() after a journal write failed
+ * @sdp: the superblock
+ * @first: the first new journal
+ * @last: one past the last journal started
+ *
+ * The per_node files are all in place by then, so they go too.
+ */
+static void
+remove_new_files(struct gfs2_sbd *sdp, unsigned int first, unsigned int last)
+{
+	char name[256];
+	unsigned int jid;
+
+	for (jid = first; jid < last; jid++) {
+		sprintf(name, "new_journal%u", jid);
+		unlink2system(sdp, ".", name);
+		sprintf(name, "inum_range%u", jid);
+		unlink2system(sdp, "per_node", name);
+		sprintf(name, "statfs_change%u", jid);
+		unlink2system(sdp, "per_node", name);
+		sprintf(name, "quota_change%u", jid);
+		unlink2system(sdp, "per_node", name);
+	}
+}
 
-			dummy_bh.b_data = buf;
-			lh.lh_sequence = seq;
-			lh.lh_blkno = x;
-			gfs2_log_header_out(&lh, &dummy_bh);
-			hash = gfs2_disk_hash(buf, sizeof(struct gfs2_log_header));
-			((struct gfs2_log_header *)buf)->lh_hash = cpu_to_be32(hash);
-
-			if (write(fd, buf, sdp->bsize) != sdp->bsize) {
-				fprintf(stderr, _("write error: %s from %s:%d: "
-					"block %lld (0x%llx)\n"),
-					strerror(errno),
-					__FUNCTION__, __LINE__,
-					(unsigned long long)x,
-					(unsigned long long)x);
-				exit(-1);
-			}
+/**
+ * add_journals - create the new journals and their per_node files
+ * @sdp: the superblock
+ * @total: the number of journals there will be
+ *
+ * Up to MAX_JOURNAL_WRITERS journals are written concurrently by child
+ * processes while the per_node files are created here.  Only once every
+ * journal has been written are they renamed into the jindex, in order, so
+ * a failure never leaves a gap in the journal numbering.
+ */
+static void
+add_journals(struct gfs2_sbd *sdp, unsigned int total)
+{
+	char new_name[256], tmp_name[256];
+	unsigned int next = sdp->orig_journals, running = 0;
+	pid_t pid;
+	int status, failed = 0, error;
+
+	while (next < total && running < MAX_JOURNAL_WRITERS) {
+		start_journal(sdp, next++);
+		running++;
+	}
 
-			if (++seq == blocks)
-				seq = 0;
-		}
+	for (sdp->md.journals = sdp->orig_journals;
+	     sdp->md.journals < total;
+	     sdp->md.journals++) {
+		add_ir(sdp);
+		add_sc(sdp);
+		add_qc(sdp);
+	}
 
-		error = fsync(fd);
-		if (error)
-			die( _("can't fsync: %s\n"),
+	while (running) {
+		pid = wait(&status);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			die( _("can't wait for journal writers: %s\n"),
 			    strerror(errno));
+		}
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed++;
+		if (next < total && !failed) {
+			start_journal(sdp, next++);
+			running++;
+		}
 	}
 
-	close(fd);
-	
-	sprintf(new_name, "journal%u", sdp->md.journals);
-	error = rename2system(sdp, "jindex", new_name);
-	if (error < 0 && errno != EEXIST)
-		die( _("can't rename2system %s (%d): %s\n"),
-		    new_name, error, strerror(errno));
+	if (failed) {
+		remove_new_files(sdp, sdp->orig_journals, total);
+		die( _("failed to write %d new journal(s)\n"), failed);
+	}
+
+	for (sdp->md.journals = sdp->orig_journals;
+	     sdp->md.journals < total;
+	     sdp->md.journals++) {
+		sprintf(tmp_name, "new_journal%u", sdp->md.journals);
+		sprintf(new_name, "journal%u", sdp->md.journals);
+		error = rename2system(sdp, tmp_name, "jindex", new_name);
+		if (error < 0 && errno != EEXIST)
+			die( _("can't rename2system %s (%d): %s\n"),
+			    new_name, error, strerror(errno));
+	}
 }
 
 /**
@@ -520,14 +694,7 @@ void main_jadd(int argc, char *argv[])
 	find_current_journals(sdp);
 
 	total = sdp->orig_journals + sdp->md.journals;
-	for (sdp->md.journals = sdp->orig_journals; 
-	     sdp->md.journals < total;
-	     sdp->md.journals++) {
-		add_ir(sdp);
-		add_sc(sdp);
-		add_qc(sdp);
-		add_j(sdp);
-	}
+	add_journals(sdp, total);
 
 	close(sdp->path_fd);
 	cleanup_metafs(sdp);
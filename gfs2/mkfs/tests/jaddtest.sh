@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# Time gfs2_jadd adding journals to a lock_nolock file system on a
+# loopback image, then check the result with fsck.gfs2.
+#
+# Needs root, loop devices and the gfs2 kernel module; it is skipped
+# (exit 0 with a message) when any of them is missing.
+#
+# Usage: jaddtest.sh [journals [journal MB [image GB]]]
+#
+
+JOURNALS=${1:-4}
+JSIZE=${2:-128}
+IMGSIZE=${3:-4}
+
+MKFS=../mkfs.gfs2
+JADD=../gfs2_jadd
+FSCK=../../fsck/fsck.gfs2
+
+IMG=$(pwd)/jaddtest.img
+MNT=$(pwd)/jaddtest.mnt
+META=$(pwd)/jaddtest.meta
+
+LANG=C
+LC_ALL=C
+export LANG LC_ALL
+
+skip()
+{
+	echo "jaddtest skipped: $*"
+	exit 0
+}
+
+fail()
+{
+	echo "FAILED: $*"
+	cleanup
+	exit 1
+}
+
+cleanup()
+{
+	umount $META 2>/dev/null
+	umount $MNT 2>/dev/null
+	[ -n "$LOOP" ] && losetup -d $LOOP 2>/dev/null
+	rmdir $MNT $META 2>/dev/null
+	rm -f $IMG
+}
+
+count_journals()
+{
+	mount -t gfs2meta $MNT $META || fail "can't mount gfs2meta"
+	ls $META/jindex | grep -c '^journal'
+	umount $META
+}
+
+[ "$(id -u)" = 0 ] || skip "not root"
+[ -x $MKFS ] || skip "$MKFS not built"
+modprobe gfs2 2>/dev/null
+grep -qw gfs2 /proc/filesystems || skip "no gfs2 kernel module"
+
+trap cleanup INT TERM
+
+rm -f $IMG
+dd if=/dev/zero of=$IMG bs=1M count=0 seek=$((IMGSIZE * 1024)) 2>/dev/null ||
+	fail "can't create $IMG"
+LOOP=$(losetup -f --show $IMG) || skip "no loop devices"
+mkdir -p $MNT $META
+
+$MKFS -O -q -p lock_nolock -j 1 $LOOP || fail "mkfs.gfs2"
+mount -t gfs2 $LOOP $MNT || fail "can't mount $LOOP"
+
+echo "Adding $JOURNALS ${JSIZE}MB journals to a ${IMGSIZE}GB file system..."
+start=$(date +%s.%N)
+$JADD -q -j $JOURNALS -J $JSIZE $MNT || fail "gfs2_jadd"
+end=$(date +%s.%N)
+echo "gfs2_jadd: $(echo "$end - $start" | bc) seconds"
+
+n=$(count_journals)
+[ "$n" = $((JOURNALS + 1)) ] ||
+	fail "$n journals, expected $((JOURNALS + 1))"
+
+umount $MNT || fail "can't unmount $MNT"
+if [ -x $FSCK ]; then
+	$FSCK -n $LOOP > jaddtest.fsck 2>&1 ||
+		fail "fsck.gfs2 found problems, see jaddtest.fsck"
+	rm -f jaddtest.fsck
+fi
+
+cleanup
+echo "all passed"
+exit 0
@@ -10,6 +10,21 @@ static int comms_nodes[MAX_NODES];
 static int comms_nodes_count;
 static char mg_name[DLM_LOCKSPACE_LEN+1];
 
+/* What we've put in spaces/<name>/nodes/ for each lockspace, so a new
+   member list only costs the mkdir/rmdir of the nodes that changed.  Read
+   from configfs the first time a lockspace is set, and again after an
+   error leaves us unsure what's there. */
+
+struct space_nodes {
+	struct list_head list;
+	char name[DLM_LOCKSPACE_LEN+1];
+	struct nodemap members;
+};
+
+static LIST_HEAD(space_nodes_list);
+static struct nodemap new_map;
+static struct nodemap renew_map;
+
 #define DLM_SYSFS_DIR "/sys/kernel/dlm"
 #define CLUSTER_DIR   "/sys/kernel/config/dlm/cluster"
 #define SPACES_DIR    "/sys/kernel/config/dlm/cluster/spaces"
@@ -292,12 +307,73 @@ static int update_dir_members(char *name)
 	return 0;
 }
 
-static int id_exists(int id, int count, int *array)
+static struct space_nodes *find_space_nodes(char *name)
 {
-	int i;
+	struct space_nodes *sn;
+
+	list_for_each_entry(sn, &space_nodes_list, list) {
+		if (!strcmp(sn->name, name))
+			return sn;
+	}
+	return NULL;
+}
+
+static void drop_space_nodes(char *name)
+{
+	struct space_nodes *sn;
+
+	sn = find_space_nodes(name);
+	if (!sn)
+		return;
+
+	list_del(&sn->list);
+	nodemap_free(&sn->members);
+	free(sn);
+}
+
+static struct space_nodes *get_space_nodes(char *name)
+{
+	struct space_nodes *sn;
+	int i, rv;
+
+	sn = find_space_nodes(name);
+	if (sn)
+		return sn;
+
+	rv = update_dir_members(name);
+	if (rv)
+		return NULL;
+
+	sn = malloc(sizeof(struct space_nodes));
+	if (!sn) {
+		log_error("get_space_nodes %s no mem", name);
+		return NULL;
+	}
+	memset(sn, 0, sizeof(struct space_nodes));
+	strncpy(sn->name, name, DLM_LOCKSPACE_LEN);
+
+	for (i = 0; i < dir_members_count; i++) {
+		if (nodemap_set(&sn->members, dir_members[i]) < 0) {
+			nodemap_free(&sn->members);
+			free(sn);
+			return NULL;
+		}
+	}
+
+	list_add(&sn->list, &space_nodes_list);
+	return sn;
+}
+
+static int set_map(struct nodemap *map, int count, int *array)
+{
+	int i, rv;
+
+	nodemap_zero(map);
+
 	for (i = 0; i < count; i++) {
-		if (array[i] == id)
-			return 1;
+		rv = nodemap_set(map, array[i]);
+		if (rv < 0)
+			return rv;
 	}
 	return 0;
 }
@@ -338,9 +414,11 @@ static int path_exists(const char *path)
 int set_configfs_members(char *name, int new_count, int *new_members,
 			 int renew_count, int *renew_members)
 {
+	struct space_nodes *sn;
+	struct nodemap tmp;
 	char path[PATH_MAX];
 	char buf[32];
-	int i, w, fd, rv, id, old_count, *old_members;
+	int i, w, fd, rv, id;
 	int do_renew;
 
 	/*
@@ -359,17 +437,20 @@ int set_configfs_members(char *name, int new_count, int *new_members,
 	 * remove/add lockspace members
 	 */
 
-	rv = update_dir_members(name);
+	sn = get_space_nodes(name);
+	if (!sn)
+		return -1;
+
+	rv = set_map(&new_map, new_count, new_members);
 	if (rv)
-		return rv;
+		goto out;
 
-	old_members = dir_members;
-	old_count = dir_members_count;
+	rv = set_map(&renew_map, renew_count, renew_members);
+	if (rv)
+		goto out;
 
-	for (i = 0; i < old_count; i++) {
-		id = old_members[i];
-		if (id_exists(id, new_count, new_members))
-			continue;
+	for (id = nodemap_next(&sn->members, &new_map, 0); id;
+	     id = nodemap_next(&sn->members, &new_map, id)) {
 
 		memset(path, 0, PATH_MAX);
 		snprintf(path, PATH_MAX, "%s/%s/nodes/%d",
@@ -405,9 +486,9 @@ int set_configfs_members(char *name, int new_count, int *new_members,
 
 		do_renew = 0;
 
-		if (id_exists(id, renew_count, renew_members))
+		if (nodemap_test(&renew_map, id))
 			do_renew = 1;
-		else if (id_exists(id, old_count, old_members))
+		else if (nodemap_test(&sn->members, id))
 			continue;
 
 		if (!is_cluster_member(id))
@@ -491,6 +572,16 @@ int set_configfs_members(char *name, int new_count, int *new_members,
 
 	rv = 0;
  out:
+	if (rv || !new_count) {
+		/* reread configfs next time */
+		drop_space_nodes(name);
+	} else {
+		/* new_map is now what's in configfs; the old members'
+		   memory is reused for the next new_map */
+		tmp = sn->members;
+		sn->members = new_map;
+		new_map = tmp;
+	}
 	return rv;
 }
 
@@ -583,6 +674,8 @@ static void clear_configfs_space_nodes(char *name)
 	char path[PATH_MAX];
 	int i, rv;
 
+	drop_space_nodes(name);
+
 	rv = update_dir_members(name);
 	if (rv < 0)
 		return;
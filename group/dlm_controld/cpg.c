@@ -102,6 +102,43 @@ static struct list_head daemon_nodes;
 static struct cpg_address daemon_member[MAX_NODES];
 static int daemon_member_count;
 
+/* From daemon protocol 1.2, lockspaces don't each join a cpg of their own.
+   A node announces that it's joining or leaving a lockspace on the daemon
+   cpg, failed nodes are taken from daemon cpg confchgs, and lockspace
+   messages are sent on the daemon cpg with the lockspace global_id.  When
+   a node fails, every lockspace it was in gets its change from the one
+   confchg, and the start messages for all of them go out together in a
+   DLM_MSG_BATCH.  Each node works out the members of a lockspace itself;
+   one that's joining is told them by the existing members (ls_members),
+   and holds back anything else for the lockspace until it has been. */
+
+#define MUX_NONE	0	/* our ls_join hasn't been delivered */
+#define MUX_JOINING	1	/* waiting for ls_members */
+#define MUX_MEMBER	2
+
+static int ls_mux;
+
+struct mux_saved {
+	struct list_head list;
+	int left_count;		/* buf is left_count cpg_address's, or */
+	int len;		/* buf is a message of len */
+	char buf[0];
+};
+
+/* messages queued to go out in one DLM_MSG_BATCH, each preceded by a
+   batch_entry and padded to 8 bytes */
+
+#define BATCH_MAX	(64 * 1024)
+
+struct batch_entry {
+	uint32_t len;
+	uint32_t pad;
+};
+
+static char *batch_buf;
+static int batch_len;
+static int batch_count;
+
 static void log_config(const struct cpg_name *group_name,
 		       const struct cpg_address *member_list,
 		       size_t member_list_entries,
@@ -211,6 +248,14 @@ const char *msg_name(int type)
 		return "deadlk_checkpoint_ready";
 	case DLM_MSG_DEADLK_CANCEL_LOCK:
 		return "deadlk_cancel_lock";
+	case DLM_MSG_LS_JOIN:
+		return "ls_join";
+	case DLM_MSG_LS_LEAVE:
+		return "ls_leave";
+	case DLM_MSG_LS_MEMBERS:
+		return "ls_members";
+	case DLM_MSG_BATCH:
+		return "batch";
 	default:
 		return "unknown";
 	}
@@ -248,6 +293,80 @@ static int _send_message(cpg_handle_t h, void *buf, int len, int type)
 	return 0;
 }
 
+static void send_daemon_message(char *buf, int len, int type)
+{
+	/* keep everything we send in the order we sent it */
+	send_batched_messages();
+	_send_message(cpg_handle_daemon, buf, len, type);
+}
+
+/* the header of buf is already in wire order */
+
+static void batch_message(char *buf, int len, int type)
+{
+	struct batch_entry *be;
+	int size = sizeof(struct batch_entry) + ((len + 7) & ~7);
+
+	if (!batch_buf)
+		batch_buf = malloc(BATCH_MAX);
+
+	if (!batch_buf || sizeof(struct dlm_header) + size > BATCH_MAX) {
+		send_daemon_message(buf, len, type);
+		return;
+	}
+
+	if (batch_len + size > BATCH_MAX)
+		send_batched_messages();
+
+	if (!batch_len)
+		batch_len = sizeof(struct dlm_header);
+
+	be = (struct batch_entry *)(batch_buf + batch_len);
+	memset(be, 0, size);
+	be->len = cpu_to_le32(len);
+	memcpy(batch_buf + batch_len + sizeof(*be), buf, len);
+
+	batch_len += size;
+	batch_count++;
+}
+
+/* called from the main loop after each round of processing */
+
+void send_batched_messages(void)
+{
+	struct dlm_header *hd;
+	struct batch_entry *be;
+	int count = batch_count, len = batch_len;
+
+	if (!count)
+		return;
+	batch_count = 0;
+	batch_len = 0;
+
+	/* one message is sent as itself */
+
+	if (count == 1) {
+		be = (struct batch_entry *)(batch_buf + sizeof(*hd));
+		hd = (struct dlm_header *)(batch_buf + sizeof(*hd) + sizeof(*be));
+		_send_message(cpg_handle_daemon, hd, le32_to_cpu(be->len),
+			      le16_to_cpu(hd->type));
+		return;
+	}
+
+	hd = (struct dlm_header *)batch_buf;
+	memset(hd, 0, sizeof(*hd));
+	hd->version[0]  = cpu_to_le16(our_protocol.daemon_run[0]);
+	hd->version[1]  = cpu_to_le16(our_protocol.daemon_run[1]);
+	hd->version[2]  = cpu_to_le16(our_protocol.daemon_run[2]);
+	hd->type        = cpu_to_le16(DLM_MSG_BATCH);
+	hd->nodeid      = cpu_to_le32(our_nodeid);
+	hd->msgdata     = cpu_to_le32(count);
+
+	log_debug("send_batch count %d len %d", count, len);
+
+	_send_message(cpg_handle_daemon, batch_buf, len, DLM_MSG_BATCH);
+}
+
 /* header fields caller needs to set: type, to_nodeid, flags, msgdata */
 
 void dlm_send_message(struct lockspace *ls, char *buf, int len)
@@ -266,7 +385,15 @@ void dlm_send_message(struct lockspace *ls, char *buf, int len)
 	hd->msgdata     = cpu_to_le32(hd->msgdata);
 	hd->msgdata2    = cpu_to_le32(hd->msgdata2);
 
-	_send_message(ls->cpg_handle, buf, len, type);
+	/* the start (and plocks_stored) messages for all the lockspaces
+	   that a confchg changes go out together */
+
+	if (!ls_mux)
+		_send_message(ls->cpg_handle, buf, len, type);
+	else if (type == DLM_MSG_START || type == DLM_MSG_PLOCKS_STORED)
+		batch_message(buf, len, type);
+	else
+		send_daemon_message(buf, len, type);
 }
 
 static struct member *find_memb(struct change *cg, int nodeid)
@@ -321,12 +448,18 @@ static void free_ls(struct lockspace *ls)
 {
 	struct change *cg, *cg_safe;
 	struct node *node, *node_safe;
+	struct mux_saved *ms, *ms_safe;
 
 	list_for_each_entry_safe(cg, cg_safe, &ls->changes, list) {
 		list_del(&cg->list);
 		free_cg(cg);
 	}
 
+	list_for_each_entry_safe(ms, ms_safe, &ls->mux_saved, list) {
+		list_del(&ms->list);
+		free(ms);
+	}
+
 	if (ls->started_change)
 		free_cg(ls->started_change);
 
@@ -1502,8 +1635,10 @@ static int we_left(const struct cpg_address *left_list,
 	return 0;
 }
 
-static void confchg_cb(cpg_handle_t handle,
-		       const struct cpg_name *group_name,
+/* a membership change from the lockspace cpg, or made up from the daemon
+   cpg (mux_confchg); frees ls if it's for our own leave */
+
+static void ls_confchg(struct lockspace *ls,
 		       const struct cpg_address *member_list,
 		       size_t member_list_entries,
 		       const struct cpg_address *left_list,
@@ -1511,31 +1646,21 @@ static void confchg_cb(cpg_handle_t handle,
 		       const struct cpg_address *joined_list,
 		       size_t joined_list_entries)
 {
-	struct lockspace *ls;
 	struct change *cg;
 	struct member *memb;
 	int rv;
 
-	log_config(group_name, member_list, member_list_entries,
-		   left_list, left_list_entries,
-		   joined_list, joined_list_entries);
-
-	ls = find_ls_handle(handle);
-	if (!ls) {
-		log_error("confchg_cb no lockspace for cpg %s",
-			  group_name->value);
-		return;
-	}
-
 	if (ls->leaving && we_left(left_list, left_list_entries)) {
-		/* we called cpg_leave(), and this should be the final
-		   cpg callback we receive */
+		/* we called cpg_leave() or sent ls_leave, and this should be
+		   the final membership change we see */
 		log_group(ls, "confchg for our leave");
 		stop_kernel(ls, 0);
 		set_configfs_members(ls->name, 0, NULL, 0, NULL);
 		set_sysfs_event_done(ls->name, 0);
-		cpg_finalize(ls->cpg_handle);
-		client_dead(ls->cpg_client);
+		if (!ls_mux) {
+			cpg_finalize(ls->cpg_handle);
+			client_dead(ls->cpg_client);
+		}
 		purge_plocks(ls, our_nodeid, 1);
 		list_del(&ls->list);
 		free_ls(ls);
@@ -1561,6 +1686,33 @@ static void confchg_cb(cpg_handle_t handle,
 
 }
 
+static void confchg_cb(cpg_handle_t handle,
+		       const struct cpg_name *group_name,
+		       const struct cpg_address *member_list,
+		       size_t member_list_entries,
+		       const struct cpg_address *left_list,
+		       size_t left_list_entries,
+		       const struct cpg_address *joined_list,
+		       size_t joined_list_entries)
+{
+	struct lockspace *ls;
+
+	log_config(group_name, member_list, member_list_entries,
+		   left_list, left_list_entries,
+		   joined_list, joined_list_entries);
+
+	ls = find_ls_handle(handle);
+	if (!ls) {
+		log_error("confchg_cb no lockspace for cpg %s",
+			  group_name->value);
+		return;
+	}
+
+	ls_confchg(ls, member_list, member_list_entries,
+		   left_list, left_list_entries,
+		   joined_list, joined_list_entries);
+}
+
 static void dlm_header_in(struct dlm_header *hd)
 {
 	hd->version[0]  = le16_to_cpu(hd->version[0]);
@@ -1581,44 +1733,11 @@ static void dlm_header_in(struct dlm_header *hd)
    ignoring plock messages to saving plock messages to apply on top of the
    plock state that we read. */
 
-static void deliver_cb(cpg_handle_t handle,
-		       const struct cpg_name *group_name,
-		       uint32_t nodeid, uint32_t pid,
-		       void *data, size_t len)
+static void receive_ls_message(struct lockspace *ls, struct dlm_header *hd,
+			       int len)
 {
-	struct lockspace *ls;
-	struct dlm_header *hd;
 	int ignore_plock;
 
-	ls = find_ls_handle(handle);
-	if (!ls) {
-		log_error("deliver_cb no ls for cpg %s", group_name->value);
-		return;
-	}
-
-	if (len < sizeof(*hd)) {
-		log_error("deliver_cb short message %zd", len);
-		return;
-	}
-
-	hd = (struct dlm_header *)data;
-	dlm_header_in(hd);
-
-	if (hd->version[0] != our_protocol.daemon_run[0] ||
-	    hd->version[1] != our_protocol.daemon_run[1]) {
-		log_error("reject message from %d version %u.%u.%u vs %u.%u.%u",
-			  nodeid, hd->version[0], hd->version[1],
-			  hd->version[2], our_protocol.daemon_run[0],
-			  our_protocol.daemon_run[1],
-			  our_protocol.daemon_run[2]);
-		return;
-	}
-
-	if (hd->nodeid != nodeid) {
-		log_error("bad msg nodeid %d %d", hd->nodeid, nodeid);
-		return;
-	}
-
 	ignore_plock = 0;
 
 	switch (hd->type) {
@@ -1637,7 +1756,7 @@ static void deliver_cb(cpg_handle_t handle,
 			receive_plock(ls, hd, len);
 		else
 			log_error("msg %d nodeid %d enable_plock %d",
-				  hd->type, nodeid, cfgd_enable_plock);
+				  hd->type, hd->nodeid, cfgd_enable_plock);
 		break;
 
 	case DLM_MSG_PLOCK_OWN:
@@ -1651,7 +1770,7 @@ static void deliver_cb(cpg_handle_t handle,
 			receive_own(ls, hd, len);
 		else
 			log_error("msg %d nodeid %d enable_plock %d owner %d",
-				  hd->type, nodeid, cfgd_enable_plock,
+				  hd->type, hd->nodeid, cfgd_enable_plock,
 				  cfgd_plock_ownership);
 		break;
 
@@ -1666,7 +1785,7 @@ static void deliver_cb(cpg_handle_t handle,
 			receive_drop(ls, hd, len);
 		else
 			log_error("msg %d nodeid %d enable_plock %d owner %d",
-				  hd->type, nodeid, cfgd_enable_plock,
+				  hd->type, hd->nodeid, cfgd_enable_plock,
 				  cfgd_plock_ownership);
 		break;
 
@@ -1682,7 +1801,7 @@ static void deliver_cb(cpg_handle_t handle,
 			receive_sync(ls, hd, len);
 		else
 			log_error("msg %d nodeid %d enable_plock %d owner %d",
-				  hd->type, nodeid, cfgd_enable_plock,
+				  hd->type, hd->nodeid, cfgd_enable_plock,
 				  cfgd_plock_ownership);
 		break;
 
@@ -1693,7 +1812,7 @@ static void deliver_cb(cpg_handle_t handle,
 			receive_plocks_stored(ls, hd, len);
 		else
 			log_error("msg %d nodeid %d enable_plock %d",
-				  hd->type, nodeid, cfgd_enable_plock);
+				  hd->type, hd->nodeid, cfgd_enable_plock);
 		break;
 
 	case DLM_MSG_DEADLK_CYCLE_START:
@@ -1701,7 +1820,7 @@ static void deliver_cb(cpg_handle_t handle,
 			receive_cycle_start(ls, hd, len);
 		else
 			log_error("msg %d nodeid %d enable_deadlk %d",
-				  hd->type, nodeid, cfgd_enable_deadlk);
+				  hd->type, hd->nodeid, cfgd_enable_deadlk);
 		break;
 
 	case DLM_MSG_DEADLK_CYCLE_END:
@@ -1709,7 +1828,7 @@ static void deliver_cb(cpg_handle_t handle,
 			receive_cycle_end(ls, hd, len);
 		else
 			log_error("msg %d nodeid %d enable_deadlk %d",
-				  hd->type, nodeid, cfgd_enable_deadlk);
+				  hd->type, hd->nodeid, cfgd_enable_deadlk);
 		break;
 
 	case DLM_MSG_DEADLK_CHECKPOINT_READY:
@@ -1717,7 +1836,7 @@ static void deliver_cb(cpg_handle_t handle,
 			receive_checkpoint_ready(ls, hd, len);
 		else
 			log_error("msg %d nodeid %d enable_deadlk %d",
-				  hd->type, nodeid, cfgd_enable_deadlk);
+				  hd->type, hd->nodeid, cfgd_enable_deadlk);
 		break;
 
 	case DLM_MSG_DEADLK_CANCEL_LOCK:
@@ -1725,7 +1844,7 @@ static void deliver_cb(cpg_handle_t handle,
 			receive_cancel_lock(ls, hd, len);
 		else
 			log_error("msg %d nodeid %d enable_deadlk %d",
-				  hd->type, nodeid, cfgd_enable_deadlk);
+				  hd->type, hd->nodeid, cfgd_enable_deadlk);
 		break;
 
 	default:
@@ -1734,11 +1853,51 @@ static void deliver_cb(cpg_handle_t handle,
 
 	if (ignore_plock)
 		log_plock(ls, "msg %s nodeid %d need_plock ignore",
-			  msg_name(hd->type), nodeid);
+			  msg_name(hd->type), hd->nodeid);
 
 	apply_changes(ls);
 }
 
+static void deliver_cb(cpg_handle_t handle,
+		       const struct cpg_name *group_name,
+		       uint32_t nodeid, uint32_t pid,
+		       void *data, size_t len)
+{
+	struct lockspace *ls;
+	struct dlm_header *hd;
+
+	ls = find_ls_handle(handle);
+	if (!ls) {
+		log_error("deliver_cb no ls for cpg %s", group_name->value);
+		return;
+	}
+
+	if (len < sizeof(*hd)) {
+		log_error("deliver_cb short message %zd", len);
+		return;
+	}
+
+	hd = (struct dlm_header *)data;
+	dlm_header_in(hd);
+
+	if (hd->version[0] != our_protocol.daemon_run[0] ||
+	    hd->version[1] != our_protocol.daemon_run[1]) {
+		log_error("reject message from %d version %u.%u.%u vs %u.%u.%u",
+			  nodeid, hd->version[0], hd->version[1],
+			  hd->version[2], our_protocol.daemon_run[0],
+			  our_protocol.daemon_run[1],
+			  our_protocol.daemon_run[2]);
+		return;
+	}
+
+	if (hd->nodeid != nodeid) {
+		log_error("bad msg nodeid %d %d", hd->nodeid, nodeid);
+		return;
+	}
+
+	receive_ls_message(ls, hd, len);
+}
+
 static cpg_callbacks_t cpg_callbacks = {
 	.cpg_deliver_fn = deliver_cb,
 	.cpg_confchg_fn = confchg_cb,
@@ -1789,6 +1948,468 @@ static void process_cpg_lockspace(int ci)
 	update_flow_control_status();
 }
 
+static int mux_find(int *ids, int count, int nodeid)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (ids[i] == nodeid)
+			return i;
+	}
+	return -1;
+}
+
+static void mux_remove(int *ids, int *count, int nodeid)
+{
+	int i = mux_find(ids, *count, nodeid);
+
+	if (i < 0)
+		return;
+	ids[i] = ids[--(*count)];
+}
+
+static void send_mux(int type, uint32_t global_id, uint32_t msgdata,
+		     int *ids, int count)
+{
+	struct dlm_header *hd;
+	struct id_info *id;
+	char *buf;
+	int i, len;
+
+	len = sizeof(struct dlm_header) + count * sizeof(struct id_info);
+
+	buf = malloc(len);
+	if (!buf) {
+		log_error("send_mux %s no mem %d", msg_name(type), len);
+		return;
+	}
+	memset(buf, 0, len);
+
+	hd = (struct dlm_header *)buf;
+	id = (struct id_info *)(buf + sizeof(*hd));
+
+	hd->version[0]  = cpu_to_le16(our_protocol.daemon_run[0]);
+	hd->version[1]  = cpu_to_le16(our_protocol.daemon_run[1]);
+	hd->version[2]  = cpu_to_le16(our_protocol.daemon_run[2]);
+	hd->type        = cpu_to_le16(type);
+	hd->nodeid      = cpu_to_le32(our_nodeid);
+	hd->global_id   = cpu_to_le32(global_id);
+	hd->msgdata     = cpu_to_le32(msgdata);
+	hd->msgdata2    = cpu_to_le32(count);
+
+	for (i = 0; i < count; i++)
+		id[i].nodeid = cpu_to_le32(ids[i]);
+
+	/* joining or leaving many lockspaces, and answering others doing
+	   so, is batched like starts; we may still be in set_protocol()
+	   here, answering ls_join with no lockspaces */
+
+	if (our_protocol.daemon_run[0])
+		batch_message(buf, len, type);
+	else
+		send_daemon_message(buf, len, type);
+
+	free(buf);
+}
+
+/* pass a change to mux_members through the same code as a confchg from
+   a lockspace cpg */
+
+static void mux_confchg(struct lockspace *ls,
+			const struct cpg_address *left_list,
+			size_t left_list_entries,
+			const struct cpg_address *joined_list,
+			size_t joined_list_entries)
+{
+	struct cpg_address member_list[MAX_NODES];
+	struct cpg_name name;
+	int i;
+
+	memset(member_list, 0, sizeof(member_list));
+	for (i = 0; i < ls->mux_count; i++)
+		member_list[i].nodeid = ls->mux_members[i];
+
+	memset(&name, 0, sizeof(name));
+	sprintf(name.value, "dlm:ls:%s", ls->name);
+	name.length = strlen(name.value) + 1;
+
+	log_config(&name, member_list, ls->mux_count,
+		   left_list, left_list_entries,
+		   joined_list, joined_list_entries);
+
+	ls_confchg(ls, member_list, ls->mux_count,
+		   left_list, left_list_entries,
+		   joined_list, joined_list_entries);
+}
+
+static void mux_save(struct lockspace *ls, void *buf, int len,
+		     int left_count)
+{
+	struct mux_saved *ms;
+
+	ms = malloc(sizeof(struct mux_saved) + len);
+	if (!ms) {
+		log_error("mux_save no mem %d", len);
+		return;
+	}
+	memset(ms, 0, sizeof(struct mux_saved));
+	ms->left_count = left_count;
+	ms->len = len;
+	memcpy(ms->buf, buf, len);
+	list_add_tail(&ms->list, &ls->mux_saved);
+}
+
+/* nodes removed from the daemon cpg */
+
+static void mux_left(struct lockspace *ls, const struct cpg_address *left_list,
+		     size_t left_list_entries)
+{
+	struct cpg_address left[MAX_NODES];
+	int i, count = 0;
+
+	for (i = 0; i < left_list_entries; i++) {
+		if (mux_find(ls->mux_members, ls->mux_count,
+			     left_list[i].nodeid) < 0)
+			continue;
+		mux_remove(ls->mux_members, &ls->mux_count,
+			   left_list[i].nodeid);
+		left[count++] = left_list[i];
+	}
+
+	if (count)
+		mux_confchg(ls, left, count, NULL, 0);
+}
+
+static void deliver_mux(struct dlm_header *hd, int len);
+
+/* we know who the members were when our ls_join was delivered (just us if
+   ids is NULL); now go through everything we held back since */
+
+static void mux_join_done(struct lockspace *ls, int *ids, int count)
+{
+	struct cpg_address joined;
+	struct mux_saved *ms;
+	struct dlm_header *hd;
+	int our_leave;
+
+	ls->mux_state = MUX_MEMBER;
+	ls->mux_wait_count = 0;
+
+	if (ids) {
+		memcpy(ls->mux_members, ids, count * sizeof(int));
+		ls->mux_count = count;
+	} else {
+		ls->mux_members[0] = our_nodeid;
+		ls->mux_count = 1;
+	}
+
+	log_group(ls, "mux join members %d", ls->mux_count);
+
+	memset(&joined, 0, sizeof(joined));
+	joined.nodeid = our_nodeid;
+	joined.reason = CPG_REASON_JOIN;
+	mux_confchg(ls, NULL, 0, &joined, 1);
+
+	while (!list_empty(&ls->mux_saved)) {
+		ms = list_first_entry(&ls->mux_saved, struct mux_saved, list);
+		list_del(&ms->list);
+
+		if (ms->left_count) {
+			mux_left(ls, (struct cpg_address *)ms->buf,
+				 ms->left_count);
+			free(ms);
+			continue;
+		}
+
+		/* ls is freed by our own leave */
+		hd = (struct dlm_header *)ms->buf;
+		our_leave = (hd->type == DLM_MSG_LS_LEAVE &&
+			     hd->nodeid == our_nodeid);
+
+		deliver_mux(hd, ms->len);
+		free(ms);
+
+		if (our_leave)
+			return;
+	}
+}
+
+static void mux_join_check(struct lockspace *ls)
+{
+	if (ls->mux_wait_count) {
+		log_group(ls, "mux join wait for %d nodes",
+			  ls->mux_wait_count);
+		return;
+	}
+	mux_join_done(ls, NULL, 0);
+}
+
+/* Every daemon answers an ls_join with ls_members: the members, joiner
+   included, if it's a member itself, otherwise an empty list.  The joiner
+   takes the first non-empty answer, or if every node in the daemon cpg
+   says it isn't a member (or leaves the cpg first), it's alone. */
+
+static void receive_ls_join(struct dlm_header *hd, int len)
+{
+	struct lockspace *ls;
+	struct cpg_address joined;
+	int i;
+
+	ls = find_ls_id(hd->global_id);
+
+	if (hd->nodeid == our_nodeid) {
+		if (!ls || ls->mux_state != MUX_NONE) {
+			log_error("receive_ls_join %x no lockspace",
+				  hd->global_id);
+			return;
+		}
+
+		ls->mux_state = MUX_JOINING;
+		ls->mux_wait_count = 0;
+
+		for (i = 0; i < daemon_member_count; i++) {
+			if (daemon_member[i].nodeid == our_nodeid)
+				continue;
+			ls->mux_wait[ls->mux_wait_count++] =
+				daemon_member[i].nodeid;
+		}
+
+		mux_join_check(ls);
+		return;
+	}
+
+	if (ls && ls->mux_state == MUX_JOINING) {
+		mux_save(ls, hd, len, 0);
+		return;
+	}
+
+	if (!ls || ls->mux_state == MUX_NONE) {
+		send_mux(DLM_MSG_LS_MEMBERS, hd->global_id, hd->nodeid,
+			 NULL, 0);
+		return;
+	}
+
+	if (mux_find(ls->mux_members, ls->mux_count, hd->nodeid) >= 0) {
+		log_error("receive_ls_join %s nodeid %d already member",
+			  ls->name, hd->nodeid);
+	} else if (ls->mux_count == MAX_NODES) {
+		log_error("receive_ls_join %s nodeid %d too many members",
+			  ls->name, hd->nodeid);
+	} else {
+		ls->mux_members[ls->mux_count++] = hd->nodeid;
+
+		memset(&joined, 0, sizeof(joined));
+		joined.nodeid = hd->nodeid;
+		joined.reason = CPG_REASON_JOIN;
+		mux_confchg(ls, NULL, 0, &joined, 1);
+	}
+
+	send_mux(DLM_MSG_LS_MEMBERS, hd->global_id, hd->nodeid,
+		 ls->mux_members, ls->mux_count);
+}
+
+static void receive_ls_leave(struct dlm_header *hd, int len)
+{
+	struct lockspace *ls;
+	struct cpg_address left;
+
+	ls = find_ls_id(hd->global_id);
+	if (!ls || ls->mux_state == MUX_NONE)
+		return;
+
+	if (ls->mux_state == MUX_JOINING) {
+		mux_save(ls, hd, len, 0);
+		return;
+	}
+
+	if (mux_find(ls->mux_members, ls->mux_count, hd->nodeid) < 0) {
+		log_error("receive_ls_leave %s nodeid %d not member",
+			  ls->name, hd->nodeid);
+		return;
+	}
+	mux_remove(ls->mux_members, &ls->mux_count, hd->nodeid);
+
+	memset(&left, 0, sizeof(left));
+	left.nodeid = hd->nodeid;
+	left.reason = CPG_REASON_LEAVE;
+	mux_confchg(ls, &left, 1, NULL, 0);
+}
+
+static void receive_ls_members(struct dlm_header *hd, int len)
+{
+	struct lockspace *ls;
+	struct id_info *id;
+	int ids[MAX_NODES];
+	int i, count = hd->msgdata2;
+
+	if (hd->msgdata != our_nodeid)
+		return;
+
+	ls = find_ls_id(hd->global_id);
+	if (!ls || ls->mux_state != MUX_JOINING)
+		return;
+
+	if (count > MAX_NODES ||
+	    len < sizeof(struct dlm_header) + count * sizeof(struct id_info)) {
+		log_error("receive_ls_members %s bad count %d len %d from %d",
+			  ls->name, count, len, hd->nodeid);
+		return;
+	}
+
+	mux_remove(ls->mux_wait, &ls->mux_wait_count, hd->nodeid);
+
+	if (!count) {
+		mux_join_check(ls);
+		return;
+	}
+
+	id = (struct id_info *)((char *)hd + sizeof(struct dlm_header));
+	for (i = 0; i < count; i++) {
+		id_info_in(id);
+		ids[i] = id->nodeid;
+		id++;
+	}
+
+	if (mux_find(ids, count, our_nodeid) < 0) {
+		log_error("receive_ls_members %s from %d without us",
+			  ls->name, hd->nodeid);
+		return;
+	}
+
+	log_group(ls, "receive_ls_members from %d count %d",
+		  hd->nodeid, count);
+
+	mux_join_done(ls, ids, count);
+}
+
+/* a message from the daemon cpg, or from a batch, other than protocol */
+
+static void deliver_mux(struct dlm_header *hd, int len)
+{
+	struct lockspace *ls;
+
+	switch (hd->type) {
+	case DLM_MSG_LS_JOIN:
+		receive_ls_join(hd, len);
+		return;
+	case DLM_MSG_LS_LEAVE:
+		receive_ls_leave(hd, len);
+		return;
+	case DLM_MSG_LS_MEMBERS:
+		receive_ls_members(hd, len);
+		return;
+	}
+
+	if (hd->version[0] != our_protocol.daemon_run[0] ||
+	    hd->version[1] != our_protocol.daemon_run[1]) {
+		log_error("reject message from %d version %u.%u.%u vs %u.%u.%u",
+			  hd->nodeid, hd->version[0], hd->version[1],
+			  hd->version[2], our_protocol.daemon_run[0],
+			  our_protocol.daemon_run[1],
+			  our_protocol.daemon_run[2]);
+		return;
+	}
+
+	/* we're not in this lockspace */
+
+	ls = find_ls_id(hd->global_id);
+	if (!ls || ls->mux_state == MUX_NONE)
+		return;
+
+	if (ls->mux_state == MUX_JOINING) {
+		mux_save(ls, hd, len, 0);
+		return;
+	}
+
+	receive_ls_message(ls, hd, len);
+}
+
+static void receive_batch(struct dlm_header *hd, int len)
+{
+	struct batch_entry *be;
+	struct dlm_header *ehd;
+	int i, elen, pos = sizeof(struct dlm_header);
+
+	for (i = 0; i < hd->msgdata; i++) {
+		if (pos + sizeof(*be) + sizeof(*ehd) > len)
+			goto bad;
+
+		be = (struct batch_entry *)((char *)hd + pos);
+		elen = le32_to_cpu(be->len);
+		if (elen < sizeof(*ehd) || pos + sizeof(*be) + elen > len)
+			goto bad;
+
+		ehd = (struct dlm_header *)((char *)be + sizeof(*be));
+		dlm_header_in(ehd);
+
+		if (ehd->nodeid != hd->nodeid)
+			log_error("bad batch msg nodeid %d %d",
+				  ehd->nodeid, hd->nodeid);
+		else
+			deliver_mux(ehd, elen);
+
+		pos += sizeof(*be) + ((elen + 7) & ~7);
+	}
+	return;
+
+ bad:
+	log_error("receive_batch from %d bad entry %d of %u len %d",
+		  hd->nodeid, i, hd->msgdata, len);
+}
+
+/* the daemon cpg confchg removed nodes */
+
+static void mux_daemon_confchg(const struct cpg_address *left_list,
+			       size_t left_list_entries)
+{
+	struct lockspace *ls, *safe;
+	int i;
+
+	list_for_each_entry_safe(ls, safe, &lockspaces, list) {
+		switch (ls->mux_state) {
+		case MUX_JOINING:
+			for (i = 0; i < left_list_entries; i++)
+				mux_remove(ls->mux_wait, &ls->mux_wait_count,
+					   left_list[i].nodeid);
+			mux_save(ls, (void *)left_list,
+				 left_list_entries * sizeof(struct cpg_address),
+				 left_list_entries);
+			mux_join_check(ls);
+			break;
+		case MUX_MEMBER:
+			mux_left(ls, left_list, left_list_entries);
+			break;
+		}
+	}
+}
+
+static int mux_join_lockspace(struct lockspace *ls)
+{
+	char name[CPG_MAX_NAME_LENGTH];
+
+	snprintf(name, sizeof(name), "dlm:ls:%s", ls->name);
+	ls->global_id = cpgname_to_crc(name, strlen(name) + 1);
+
+	/* lockspaces are told apart by global_id alone on the daemon cpg */
+
+	if (find_ls_id(ls->global_id)) {
+		log_error("dlm_join_lockspace %s global_id %x in use",
+			  ls->name, ls->global_id);
+		set_sysfs_event_done(ls->name, -EEXIST);
+		free_ls(ls);
+		return -EEXIST;
+	}
+
+	list_add(&ls->list, &lockspaces);
+
+	ls->kernel_stopped = 1;
+	ls->need_plocks = 1;
+	ls->joining = 1;
+
+	send_mux(DLM_MSG_LS_JOIN, ls->global_id, 0, NULL, 0);
+	return 0;
+}
+
 /* received an "online" uevent from dlm-kernel */
 
 int dlm_join_lockspace(struct lockspace *ls)
@@ -1806,6 +2427,9 @@ int dlm_join_lockspace(struct lockspace *ls)
 		goto fail_free;
 	}
 
+	if (ls_mux)
+		return mux_join_lockspace(ls);
+
 	error = cpg_initialize(&h, &cpg_callbacks);
 	if (error != CPG_OK) {
 		log_error("cpg_initialize error %d", error);
@@ -1870,6 +2494,11 @@ int dlm_leave_lockspace(struct lockspace *ls)
 
 	ls->leaving = 1;
 
+	if (ls_mux) {
+		send_mux(DLM_MSG_LS_LEAVE, ls->global_id, 0, NULL, 0);
+		return 0;
+	}
+
 	memset(&name, 0, sizeof(name));
 	sprintf(name.value, "dlm:ls:%s", ls->name);
 	name.length = strlen(name.value) + 1;
@@ -2234,6 +2863,9 @@ int set_protocol(void)
 		return -1;
 	}
 
+	/* lockspaces share the daemon cpg from daemon protocol 1.2 */
+	ls_mux = (our_protocol.daemon_run[1] >= 2);
+
 	log_debug("daemon run %u.%u.%u max %u.%u.%u "
 		  "kernel run %u.%u.%u max %u.%u.%u",
 		  our_protocol.daemon_run[0],
@@ -2249,6 +2881,8 @@ int set_protocol(void)
 		  our_protocol.kernel_max[1],
 		  our_protocol.kernel_max[2]);
 
+	log_debug("lockspace cpgs %s", ls_mux ? "multiplexed" : "separate");
+
 	send_protocol(&our_protocol);
 	return 0;
 }
@@ -2268,13 +2902,20 @@ static void deliver_cb_daemon(cpg_handle_t handle,
 	hd = (struct dlm_header *)data;
 	dlm_header_in(hd);
 
-	switch (hd->type) {
-	case DLM_MSG_PROTOCOL:
+	if (hd->type == DLM_MSG_PROTOCOL) {
 		receive_protocol(hd, len);
-		break;
-	default:
-		log_error("deliver_cb_daemon unknown msg type %d", hd->type);
+		return;
+	}
+
+	if (hd->nodeid != nodeid) {
+		log_error("bad msg nodeid %d %d", hd->nodeid, nodeid);
+		return;
 	}
+
+	if (hd->type == DLM_MSG_BATCH)
+		receive_batch(hd, len);
+	else
+		deliver_mux(hd, len);
 }
 
 static void confchg_cb_daemon(cpg_handle_t handle,
@@ -2302,6 +2943,9 @@ static void confchg_cb_daemon(cpg_handle_t handle,
 		daemon_member[i] = member_list[i];
 		add_node_daemon(member_list[i].nodeid);
 	}
+
+	if (ls_mux && left_list_entries)
+		mux_daemon_confchg(left_list, left_list_entries);
 }
 
 static cpg_callbacks_t cpg_callbacks_daemon = {
@@ -2316,6 +2960,10 @@ void process_cpg_daemon(int ci)
 	error = cpg_dispatch(cpg_handle_daemon, CPG_DISPATCH_ALL);
 	if (error != CPG_OK)
 		log_error("daemon cpg_dispatch error %d", error);
+
+	/* plock messages are sent here too */
+	if (ls_mux)
+		update_flow_control_status();
 }
 
 int setup_cpg_daemon(void)
@@ -2328,7 +2976,7 @@ int setup_cpg_daemon(void)
 
 	memset(&our_protocol, 0, sizeof(our_protocol));
 	our_protocol.daemon_max[0] = 1;
-	our_protocol.daemon_max[1] = 1;
+	our_protocol.daemon_max[1] = 2;
 	our_protocol.daemon_max[2] = 1;
 	our_protocol.kernel_max[0] = 1;
 	our_protocol.kernel_max[1] = 1;
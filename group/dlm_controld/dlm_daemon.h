@@ -160,7 +160,11 @@ enum {
 	DLM_MSG_DEADLK_CYCLE_START,
 	DLM_MSG_DEADLK_CYCLE_END,
 	DLM_MSG_DEADLK_CHECKPOINT_READY,
-	DLM_MSG_DEADLK_CANCEL_LOCK
+	DLM_MSG_DEADLK_CANCEL_LOCK,
+	DLM_MSG_LS_JOIN,
+	DLM_MSG_LS_LEAVE,
+	DLM_MSG_LS_MEMBERS,
+	DLM_MSG_BATCH
 };
 
 /* dlm_header flags */
@@ -183,6 +187,19 @@ struct dlm_header {
 	uint64_t pad;
 };
 
+/* set of nodeids, see nodemap.c */
+
+struct nodemap_word {
+	unsigned int		index;	/* nodeid / bits per word */
+	unsigned long		bits;
+};
+
+struct nodemap {
+	int			count;
+	int			alloc;
+	struct nodemap_word	*words;
+};
+
 struct lockspace {
 	struct list_head	list;
 	char			name[DLM_LOCKSPACE_LEN+1];
@@ -203,6 +220,16 @@ struct lockspace {
 	struct list_head	changes;
 	struct list_head	node_history;
 
+	/* membership kept from daemon cpg messages when lockspaces
+	   don't have their own cpg */
+
+	int			mux_state;
+	int			mux_count;
+	int			mux_members[MAX_NODES];
+	int			mux_wait_count;
+	int			mux_wait[MAX_NODES];
+	struct list_head	mux_saved;
+
 	/* plock stuff */
 
 	int			plock_ckpt_node;
@@ -270,6 +297,7 @@ void close_cpg_daemon(void);
 void process_cpg_daemon(int ci);
 int set_protocol(void);
 void process_lockspace_changes(void);
+void send_batched_messages(void);
 void dlm_send_message(struct lockspace *ls, char *buf, int len);
 int dlm_join_lockspace(struct lockspace *ls);
 int dlm_leave_lockspace(struct lockspace *ls);
@@ -328,6 +356,14 @@ int fence_in_progress(int *count);
 int setup_netlink(void);
 void process_netlink(int ci);
 
+/* nodemap.c */
+int nodemap_set(struct nodemap *map, int nodeid);
+void nodemap_clear(struct nodemap *map, int nodeid);
+int nodemap_test(struct nodemap *map, int nodeid);
+void nodemap_zero(struct nodemap *map);
+void nodemap_free(struct nodemap *map);
+int nodemap_next(struct nodemap *map, struct nodemap *except, int after);
+
 /* plock.c */
 int setup_plocks(void);
 void close_plocks(void);
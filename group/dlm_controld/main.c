@@ -162,6 +162,7 @@ static struct lockspace *create_ls(char *name)
 
 	INIT_LIST_HEAD(&ls->changes);
 	INIT_LIST_HEAD(&ls->node_history);
+	INIT_LIST_HEAD(&ls->mux_saved);
 	INIT_LIST_HEAD(&ls->saved_messages);
 	INIT_LIST_HEAD(&ls->plock_resources);
 	INIT_LIST_HEAD(&ls->deadlk_nodes);
@@ -1050,6 +1051,8 @@ static void loop(void)
 				poll_timeout = 1000;
 		}
 
+		send_batched_messages();
+
 		query_unlock();
 	}
  out:
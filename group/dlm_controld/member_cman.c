@@ -7,11 +7,30 @@
 
 static cman_handle_t	ch;
 static cman_handle_t	ch_admin;
-static cman_node_t      old_nodes[MAX_NODES];
-static int              old_node_count;
 static cman_node_t      cman_nodes[MAX_NODES];
 static int              cman_node_count;
 
+/* nodeids of cluster members now, and before the last statechange */
+
+static struct nodemap   cluster_map;
+static struct nodemap   old_map;
+
+/* fencing state pushed to us by fenced; it's queried instead until the
+   first notifications have arrived, or if fenced can't send them */
+
+struct fenced_time {
+	int nodeid;
+	uint64_t last_fenced_time;
+};
+
+static int              fenced_ci = -1;
+static int              fenced_nosys;
+static int              fenced_synced;
+static int              fenced_result;
+static int              fenced_victim_count;
+static struct fenced_time fenced_times[MAX_NODES];
+static int              fenced_times_count;
+
 void kick_node_from_cluster(int nodeid)
 {
 	if (!nodeid) {
@@ -26,25 +45,9 @@ void kick_node_from_cluster(int nodeid)
         stonith_api_kick_cs_helper(nodeid, 300, 1);
 }
 
-static int is_member(cman_node_t *node_list, int count, int nodeid)
-{
-	int i;
-
-	for (i = 0; i < count; i++) {
-		if (node_list[i].cn_nodeid == nodeid)
-			return node_list[i].cn_member;
-	}
-	return 0;
-}
-
-static int is_old_member(int nodeid)
-{
-	return is_member(old_nodes, old_node_count, nodeid);
-}
-
 int is_cluster_member(int nodeid)
 {
-	return is_member(cman_nodes, cman_node_count, nodeid);
+	return nodemap_test(&cluster_map, nodeid);
 }
 
 static cman_node_t *find_cman_node(int nodeid)
@@ -68,20 +71,111 @@ char *nodeid2name(int nodeid)
 	return cn->cn_name;
 }
 
+static void fenced_dead(int ci)
+{
+	log_debug("fenced notifications closed");
+	client_dead(ci);
+	fenced_ci = -1;
+	fenced_synced = 0;
+	fenced_times_count = 0;
+}
+
+static void save_fenced_time(struct fenced_node *node)
+{
+	int i;
+
+	for (i = 0; i < fenced_times_count; i++) {
+		if (fenced_times[i].nodeid == node->nodeid)
+			break;
+	}
+	if (i == MAX_NODES) {
+		log_error("save_fenced_time no room for nodeid %d",
+			  node->nodeid);
+		return;
+	}
+	if (i == fenced_times_count)
+		fenced_times_count++;
+
+	fenced_times[i].nodeid = node->nodeid;
+	fenced_times[i].last_fenced_time = node->last_fenced_time;
+}
+
+/* fenced sends the domain info, and the info for one node, when a victim
+   is added or done; the main loop then goes on to retry anything waiting
+   for fencing */
+
+static void process_fenced(int ci)
+{
+	struct fenced_node node;
+	struct fenced_domain domain;
+	int rv;
+
+	memset(&node, 0, sizeof(node));
+	memset(&domain, 0, sizeof(domain));
+
+	rv = fenced_notify_read(client_fd(ci), &node, &domain);
+
+	/* -ENOENT is no fence domain, which is just what a query would say */
+
+	if (rv == -ENOSYS) {
+		log_debug("fenced notifications not supported");
+		fenced_nosys = 1;
+	}
+	if (rv < 0 && rv != -ENOENT) {
+		fenced_dead(ci);
+		return;
+	}
+
+	fenced_result = rv;
+	fenced_victim_count = domain.victim_count;
+
+	/* the initial state ends with nodeid 0 */
+
+	if (!node.nodeid) {
+		if (!fenced_synced)
+			log_debug("fenced notifications victims %d result %d",
+				  fenced_victim_count, fenced_result);
+		fenced_synced = 1;
+		return;
+	}
+
+	save_fenced_time(&node);
+}
+
+static void fenced_subscribe(void)
+{
+	int fd;
+
+	if (fenced_nosys)
+		return;
+
+	fd = fenced_notify_connect();
+	if (fd < 0)
+		return;
+
+	fenced_ci = client_add(fd, process_fenced, fenced_dead);
+}
+
 /* add a configfs dir for cluster members that don't have one,
    del the configfs dir for cluster members that are now gone */
 
 static void statechange(void)
 {
-	int i, j, rv;
+	int i, j, rv, nodeid;
 	struct cman_node_address addrs[MAX_NODE_ADDRESSES];
 	int num_addrs;
 	struct cman_node_address *addrptr = addrs;
+	struct nodemap tmp;
 
 	cluster_quorate = cman_is_quorate(ch);
 
-	old_node_count = cman_node_count;
-	memcpy(&old_nodes, &cman_nodes, sizeof(old_nodes));
+	/* the current map becomes the old one; the old one's memory is
+	   reused for the new one */
+
+	tmp = old_map;
+	old_map = cluster_map;
+	cluster_map = tmp;
+	nodemap_zero(&cluster_map);
 
 	cman_node_count = 0;
 	memset(&cman_nodes, 0, sizeof(cman_nodes));
@@ -99,22 +193,27 @@ static void statechange(void)
 		}
 	}
 
-	for (i = 0; i < old_node_count; i++) {
-		if (old_nodes[i].cn_member &&
-		    !is_cluster_member(old_nodes[i].cn_nodeid)) {
+	for (i = 0; i < cman_node_count; i++) {
+		if (cman_nodes[i].cn_member)
+			nodemap_set(&cluster_map, cman_nodes[i].cn_nodeid);
+	}
 
-			log_debug("cluster node %d removed",
-				  old_nodes[i].cn_nodeid);
+	for (nodeid = nodemap_next(&old_map, &cluster_map, 0); nodeid;
+	     nodeid = nodemap_next(&old_map, &cluster_map, nodeid)) {
 
-			node_history_cluster_remove(old_nodes[i].cn_nodeid);
+		log_debug("cluster node %d removed", nodeid);
 
-			del_configfs_node(old_nodes[i].cn_nodeid);
-		}
+		node_history_cluster_remove(nodeid);
+
+		del_configfs_node(nodeid);
 	}
 
+	/* the added nodes are walked in cman_nodes rather than the map
+	   since their addresses are needed */
+
 	for (i = 0; i < cman_node_count; i++) {
 		if (cman_nodes[i].cn_member &&
-		    !is_old_member(cman_nodes[i].cn_nodeid)) {
+		    !nodemap_test(&old_map, cman_nodes[i].cn_nodeid)) {
 
 			rv = cman_get_node_addrs(ch, cman_nodes[i].cn_nodeid,
 						 MAX_NODE_ADDRESSES,
@@ -231,10 +330,12 @@ int setup_cluster(void)
 	}
 	our_nodeid = node.cn_nodeid;
 
-	old_node_count = 0;
-	memset(&old_nodes, 0, sizeof(old_nodes));
+	nodemap_zero(&old_map);
+	nodemap_zero(&cluster_map);
 	cman_node_count = 0;
 	memset(&cman_nodes, 0, sizeof(cman_nodes));
+
+	fenced_subscribe();
  out:
 	return fd;
 }
@@ -243,6 +344,8 @@ void close_cluster(void)
 {
 	cman_finish(ch);
 	cman_finish(ch_admin);
+	nodemap_free(&cluster_map);
+	nodemap_free(&old_map);
 }
 
 /* Force re-read of cman nodes */
@@ -254,7 +357,22 @@ void update_cluster(void)
 int fence_node_time(int nodeid, uint64_t *last_fenced_time)
 {
 	struct fenced_node nodeinfo;
-	int rv;
+	int i, rv;
+
+	if (fenced_synced) {
+		if (fenced_result < 0)
+			return fenced_result;
+
+		*last_fenced_time = 0;
+		for (i = 0; i < fenced_times_count; i++) {
+			if (fenced_times[i].nodeid == nodeid) {
+				*last_fenced_time =
+					fenced_times[i].last_fenced_time;
+				break;
+			}
+		}
+		goto out;
+	}
 
 	memset(&nodeinfo, 0, sizeof(nodeinfo));
 
@@ -263,6 +381,7 @@ int fence_node_time(int nodeid, uint64_t *last_fenced_time)
 		return rv;
 
 	*last_fenced_time = nodeinfo.last_fenced_time;
+ out:
         if(*last_fenced_time == 0) {
             /* Wrapper for dlopen() and friends */
             *last_fenced_time = stonith_api_time_cs_helper(nodeid, 0);
@@ -275,6 +394,15 @@ int fence_in_progress(int *count)
 	struct fenced_domain domain;
 	int rv;
 
+	if (fenced_synced) {
+		*count = fenced_victim_count;
+		return fenced_result;
+	}
+
+	/* fenced may not have been running when we started */
+	if (fenced_ci < 0)
+		fenced_subscribe();
+
 	memset(&domain, 0, sizeof(domain));
 
 	rv = fenced_domain_info(&domain);
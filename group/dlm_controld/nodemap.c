@@ -0,0 +1,142 @@
+#include "dlm_daemon.h"
+
+/* Sets of nodeids, one bit per nodeid.  Nodeids aren't necessarily small
+   or dense (cman makes them from IP addresses when cluster.conf doesn't
+   give them), so only the words of the bitmap with a bit set are kept,
+   sorted by their position in the whole bitmap.  Nodeid 0 is never a
+   member and can't be set. */
+
+#define NODEMAP_BITS	(8 * sizeof(unsigned long))
+
+/* index of the first word at or after word number index */
+
+static int find_word(struct nodemap *map, unsigned int index)
+{
+	int lo = 0, hi = map->count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (map->words[mid].index < index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int nodemap_set(struct nodemap *map, int nodeid)
+{
+	struct nodemap_word *words;
+	unsigned int index;
+	int i, alloc;
+
+	if (nodeid <= 0)
+		return -EINVAL;
+
+	index = nodeid / NODEMAP_BITS;
+	i = find_word(map, index);
+
+	if (i == map->count || map->words[i].index != index) {
+		if (map->count == map->alloc) {
+			alloc = map->alloc ? map->alloc * 2 : 4;
+			words = realloc(map->words, alloc * sizeof(*words));
+			if (!words) {
+				log_error("nodemap_set %d no mem", nodeid);
+				return -ENOMEM;
+			}
+			map->words = words;
+			map->alloc = alloc;
+		}
+		memmove(&map->words[i + 1], &map->words[i],
+			(map->count - i) * sizeof(*words));
+		map->words[i].index = index;
+		map->words[i].bits = 0;
+		map->count++;
+	}
+
+	map->words[i].bits |= 1UL << (nodeid % NODEMAP_BITS);
+	return 0;
+}
+
+void nodemap_clear(struct nodemap *map, int nodeid)
+{
+	unsigned int index;
+	int i;
+
+	if (nodeid <= 0)
+		return;
+
+	index = nodeid / NODEMAP_BITS;
+	i = find_word(map, index);
+	if (i < map->count && map->words[i].index == index)
+		map->words[i].bits &= ~(1UL << (nodeid % NODEMAP_BITS));
+}
+
+int nodemap_test(struct nodemap *map, int nodeid)
+{
+	unsigned int index;
+	int i;
+
+	if (nodeid <= 0)
+		return 0;
+
+	index = nodeid / NODEMAP_BITS;
+	i = find_word(map, index);
+	if (i == map->count || map->words[i].index != index)
+		return 0;
+
+	return !!(map->words[i].bits & (1UL << (nodeid % NODEMAP_BITS)));
+}
+
+/* empty the map, keeping its memory for reuse */
+
+void nodemap_zero(struct nodemap *map)
+{
+	map->count = 0;
+}
+
+void nodemap_free(struct nodemap *map)
+{
+	free(map->words);
+	memset(map, 0, sizeof(struct nodemap));
+}
+
+/* The smallest nodeid greater than after that is in map but not in except
+   (which may be NULL), or 0 if there's none.  Walking a map with after =
+   0, the first result, the second, ... gives the nodes added or removed
+   between two maps, comparing them a word at a time. */
+
+int nodemap_next(struct nodemap *map, struct nodemap *except, int after)
+{
+	unsigned long word;
+	unsigned int start;
+	int i, j = -1;
+
+	if (after < 0)
+		after = 0;
+
+	start = (unsigned int)after + 1;
+
+	for (i = find_word(map, start / NODEMAP_BITS); i < map->count; i++) {
+		word = map->words[i].bits;
+
+		if (map->words[i].index == start / NODEMAP_BITS)
+			word &= ~0UL << (start % NODEMAP_BITS);
+
+		if (word && except) {
+			if (j < 0)
+				j = find_word(except, map->words[i].index);
+			while (j < except->count &&
+			       except->words[j].index < map->words[i].index)
+				j++;
+			if (j < except->count &&
+			    except->words[j].index == map->words[i].index)
+				word &= ~except->words[j].bits;
+		}
+
+		if (word)
+			return map->words[i].index * NODEMAP_BITS +
+			       __builtin_ctzl(word);
+	}
+	return 0;
+}
@@ -0,0 +1,766 @@
+/* Simulate a cluster of dlm_controld daemons with hundreds of lockspaces
+   and check that every lockspace is started on every member with the same
+   members after concurrent joins, leaves and node failures.  The real
+   cpg.c message and confchg handling is run for every node; cpg, the
+   kernel, fenced and the rest of the daemon are replaced by a fake that
+   delivers the events of every cpg in one total order, as corosync does.
+
+   Each scenario runs with lockspaces sharing the daemon cpg (daemon
+   protocol 1.2) and with a cpg per lockspace (1.1), and the number of
+   messages and confchgs each one took is printed. */
+
+#include "cpg.c"
+
+#define SIM_NODES	4
+#define SIM_LS		500
+#define SIM_GROUPS	(SIM_LS + 1)	/* group 0 is the daemon cpg */
+#define MAX_HANDLES	(SIM_NODES * SIM_GROUPS * 4)
+#define EV_MSG		1
+#define EV_CONFCHG	2
+
+/* daemon globals from main.c and config.c */
+
+int daemon_debug_opt;
+int daemon_quit;
+int cluster_down;
+int poll_fencing;
+int poll_quorum;
+int poll_fs;
+int cluster_quorate = 1;
+int our_nodeid;
+char daemon_debug_buf[256];
+char log_plock_line[256];
+struct list_head lockspaces;
+int cfgd_enable_fencing = 1;
+int cfgd_enable_quorum;
+int cfgd_enable_deadlk;
+int cfgd_enable_plock = 1;
+int cfgd_plock_debug;
+int cfgd_plock_ownership;
+
+struct sim_node {
+	int nodeid;
+	int up;
+	int gen;		/* daemon restarts */
+	int fail_pending;	/* waiting to be fenced */
+	time_t fenced;
+
+	/* cpg.c and main.c state of this node's daemon */
+	struct list_head lockspaces;
+	struct list_head daemon_nodes;
+	struct protocol our_protocol;
+	struct cpg_address daemon_member[MAX_NODES];
+	int daemon_member_count;
+	cpg_handle_t cpg_handle_daemon;
+	int ls_mux;
+	char *batch_buf;
+	int batch_len;
+	int batch_count;
+	int poll_fencing;
+	int poll_quorum;
+	int poll_fs;
+
+	/* the kernel's view of each lockspace */
+	int running[SIM_LS];
+	int members[SIM_LS];	/* bit per node index */
+};
+
+struct event {
+	struct event *next;
+	int type;
+	int group;
+	int from;
+	int len;
+	char *buf;
+	int to_count;
+	int to[SIM_NODES];
+	int to_gen[SIM_NODES];
+	struct cpg_address member[SIM_NODES];
+	int member_count;
+	struct cpg_address left[SIM_NODES];
+	int left_count;
+	struct cpg_address joined[SIM_NODES];
+	int joined_count;
+};
+
+struct fake_handle {
+	int node;
+	int group;
+	cpg_callbacks_t *cb;
+};
+
+static struct sim_node nodes[SIM_NODES];
+static struct sim_node *cur;
+static struct event *ev_first, *ev_last;
+static struct fake_handle handles[MAX_HANDLES];
+static int handle_count;
+static int in_group[SIM_GROUPS][SIM_NODES];
+static cpg_handle_t group_handle[SIM_GROUPS][SIM_NODES];
+static int expect[SIM_LS];	/* bit per node index */
+static int mcasts, mcast_bytes, confchgs;
+static int failed;
+
+static void save_node(void)
+{
+	struct sim_node *n = cur;
+
+	if (!n)
+		return;
+
+	INIT_LIST_HEAD(&n->lockspaces);
+	list_splice_init(&lockspaces, &n->lockspaces);
+	INIT_LIST_HEAD(&n->daemon_nodes);
+	list_splice_init(&daemon_nodes, &n->daemon_nodes);
+	n->our_protocol = our_protocol;
+	memcpy(n->daemon_member, daemon_member, sizeof(daemon_member));
+	n->daemon_member_count = daemon_member_count;
+	n->cpg_handle_daemon = cpg_handle_daemon;
+	n->ls_mux = ls_mux;
+	n->batch_buf = batch_buf;
+	n->batch_len = batch_len;
+	n->batch_count = batch_count;
+	n->poll_fencing = poll_fencing;
+	n->poll_quorum = poll_quorum;
+	n->poll_fs = poll_fs;
+	cur = NULL;
+}
+
+static void set_node(struct sim_node *n)
+{
+	if (cur == n)
+		return;
+	save_node();
+	cur = n;
+
+	INIT_LIST_HEAD(&lockspaces);
+	list_splice_init(&n->lockspaces, &lockspaces);
+	INIT_LIST_HEAD(&daemon_nodes);
+	list_splice_init(&n->daemon_nodes, &daemon_nodes);
+	our_protocol = n->our_protocol;
+	memcpy(daemon_member, n->daemon_member, sizeof(daemon_member));
+	daemon_member_count = n->daemon_member_count;
+	cpg_handle_daemon = n->cpg_handle_daemon;
+	ls_mux = n->ls_mux;
+	batch_buf = n->batch_buf;
+	batch_len = n->batch_len;
+	batch_count = n->batch_count;
+	poll_fencing = n->poll_fencing;
+	poll_quorum = n->poll_quorum;
+	poll_fs = n->poll_fs;
+	our_nodeid = n->nodeid;
+}
+
+static void check(const char *desc, int got, int want)
+{
+	printf("%-52s %5d (want %5d) %s\n", desc, got, want,
+	       got == want ? "ok" : "FAIL");
+	if (got != want)
+		failed++;
+}
+
+static int ls_index(const char *name)
+{
+	return atoi(name + 2);
+}
+
+/* fake daemon, kernel and fenced interfaces */
+
+void daemon_dump_save(void) { }
+void log_plock_save(void) { }
+void client_dead(int ci) { }
+void kick_node_from_cluster(int nodeid) { }
+int is_cluster_member(int nodeid) { return 0; }
+
+int client_add(int fd, void (*workfn)(int ci), void (*deadfn)(int ci))
+{
+	return fd;
+}
+
+static struct lockspace *create_ls(char *name)
+{
+	struct lockspace *ls;
+
+	ls = calloc(1, sizeof(*ls));
+	strncpy(ls->name, name, DLM_LOCKSPACE_LEN);
+
+	INIT_LIST_HEAD(&ls->changes);
+	INIT_LIST_HEAD(&ls->node_history);
+	INIT_LIST_HEAD(&ls->mux_saved);
+	INIT_LIST_HEAD(&ls->saved_messages);
+	INIT_LIST_HEAD(&ls->plock_resources);
+	INIT_LIST_HEAD(&ls->deadlk_nodes);
+	INIT_LIST_HEAD(&ls->transactions);
+	INIT_LIST_HEAD(&ls->resources);
+	return ls;
+}
+
+struct lockspace *find_ls(char *name)
+{
+	struct lockspace *ls;
+
+	list_for_each_entry(ls, &lockspaces, list) {
+		if (!strcmp(ls->name, name))
+			return ls;
+	}
+	return NULL;
+}
+
+struct lockspace *find_ls_id(uint32_t id)
+{
+	struct lockspace *ls;
+
+	list_for_each_entry(ls, &lockspaces, list) {
+		if (ls->global_id == id)
+			return ls;
+	}
+	return NULL;
+}
+
+int fence_node_time(int nodeid, uint64_t *last_fenced_time)
+{
+	*last_fenced_time = nodes[nodeid - 1].fenced;
+	return 0;
+}
+
+int fence_in_progress(int *count)
+{
+	int i;
+
+	*count = 0;
+	for (i = 0; i < SIM_NODES; i++)
+		*count += nodes[i].fail_pending;
+	return 0;
+}
+
+int set_sysfs_control(char *name, int val)
+{
+	cur->running[ls_index(name)] = val;
+	return 0;
+}
+
+int set_sysfs_event_done(char *name, int val) { return 0; }
+int set_sysfs_id(char *name, uint32_t id) { return 0; }
+
+int set_configfs_members(char *name, int new_count, int *new_members,
+			 int renew_num, int *renew_members)
+{
+	int i, bits = 0;
+
+	for (i = 0; i < new_count; i++)
+		bits |= 1 << (new_members[i] - 1);
+	cur->members[ls_index(name)] = bits;
+	return 0;
+}
+
+void store_plocks(struct lockspace *ls, uint32_t *sig) { *sig = 0; }
+void retrieve_plocks(struct lockspace *ls, uint32_t *sig) { *sig = 0; }
+void purge_plocks(struct lockspace *ls, int nodeid, int unmount) { }
+void process_saved_plocks(struct lockspace *ls) { }
+void close_plock_checkpoint(struct lockspace *ls) { }
+void receive_plock(struct lockspace *ls, struct dlm_header *hd, int len) { }
+void receive_own(struct lockspace *ls, struct dlm_header *hd, int len) { }
+void receive_sync(struct lockspace *ls, struct dlm_header *hd, int len) { }
+void receive_drop(struct lockspace *ls, struct dlm_header *hd, int len) { }
+
+void receive_checkpoint_ready(struct lockspace *ls, struct dlm_header *hd,
+			      int len) { }
+void receive_cycle_start(struct lockspace *ls, struct dlm_header *hd,
+			 int len) { }
+void receive_cycle_end(struct lockspace *ls, struct dlm_header *hd,
+		       int len) { }
+void receive_cancel_lock(struct lockspace *ls, struct dlm_header *hd,
+			 int len) { }
+
+void deadlk_confchg(struct lockspace *ls,
+		    const struct cpg_address *member_list,
+		    size_t member_list_entries,
+		    const struct cpg_address *left_list,
+		    size_t left_list_entries,
+		    const struct cpg_address *joined_list,
+		    size_t joined_list_entries) { }
+
+/* fake cpg: one totally ordered event queue for all the groups */
+
+static int group_of(const struct cpg_name *name)
+{
+	if (!strcmp(name->value, "dlm:controld"))
+		return 0;
+	return atoi(name->value + strlen("dlm:ls:ls")) + 1;
+}
+
+static void group_cpg_name(int group, struct cpg_name *name)
+{
+	memset(name, 0, sizeof(*name));
+	if (!group)
+		sprintf(name->value, "dlm:controld");
+	else
+		sprintf(name->value, "dlm:ls:ls%03d", group - 1);
+	name->length = strlen(name->value) + 1;
+}
+
+static struct event *new_event(int type, int group)
+{
+	struct event *ev;
+	int i;
+
+	ev = calloc(1, sizeof(struct event));
+	ev->type = type;
+	ev->group = group;
+
+	for (i = 0; i < SIM_NODES; i++) {
+		if (!in_group[group][i])
+			continue;
+		ev->to[ev->to_count] = i;
+		ev->to_gen[ev->to_count] = nodes[i].gen;
+		ev->to_count++;
+		ev->member[ev->member_count].nodeid = nodes[i].nodeid;
+		ev->member[ev->member_count].pid = 1;
+		ev->member_count++;
+	}
+
+	if (ev_last)
+		ev_last->next = ev;
+	else
+		ev_first = ev;
+	ev_last = ev;
+	return ev;
+}
+
+cpg_error_t cpg_initialize(cpg_handle_t *h, cpg_callbacks_t *cb)
+{
+	handles[handle_count].node = cur - nodes;
+	handles[handle_count].cb = cb;
+	*h = ++handle_count;
+	return CPG_OK;
+}
+
+cpg_error_t cpg_fd_get(cpg_handle_t h, int *fd)
+{
+	*fd = h;
+	return CPG_OK;
+}
+
+cpg_error_t cpg_join(cpg_handle_t h, const struct cpg_name *name)
+{
+	struct fake_handle *fh = &handles[h - 1];
+	struct event *ev;
+
+	fh->group = group_of(name);
+	group_handle[fh->group][fh->node] = h;
+	in_group[fh->group][fh->node] = 1;
+
+	ev = new_event(EV_CONFCHG, fh->group);
+	ev->joined[0].nodeid = nodes[fh->node].nodeid;
+	ev->joined[0].pid = 1;
+	ev->joined[0].reason = CPG_REASON_JOIN;
+	ev->joined_count = 1;
+	return CPG_OK;
+}
+
+cpg_error_t cpg_leave(cpg_handle_t h, const struct cpg_name *name)
+{
+	struct fake_handle *fh = &handles[h - 1];
+	struct event *ev;
+	int i;
+
+	/* the leaving node sees the confchg for its own leave */
+
+	ev = new_event(EV_CONFCHG, fh->group);
+	for (i = 0; i < ev->member_count; i++) {
+		if (ev->member[i].nodeid == nodes[fh->node].nodeid)
+			ev->member[i] = ev->member[--ev->member_count];
+	}
+	ev->left[0].nodeid = nodes[fh->node].nodeid;
+	ev->left[0].pid = 1;
+	ev->left[0].reason = CPG_REASON_LEAVE;
+	ev->left_count = 1;
+
+	in_group[fh->group][fh->node] = 0;
+	return CPG_OK;
+}
+
+cpg_error_t cpg_mcast_joined(cpg_handle_t h, int type,
+			     const struct iovec *iov, unsigned int iov_len)
+{
+	struct fake_handle *fh = &handles[h - 1];
+	struct event *ev = new_event(EV_MSG, fh->group);
+
+	ev->from = fh->node;
+	ev->len = iov[0].iov_len;
+	ev->buf = malloc(ev->len);
+	memcpy(ev->buf, iov[0].iov_base, ev->len);
+
+	mcasts++;
+	mcast_bytes += ev->len;
+	return CPG_OK;
+}
+
+cpg_error_t cpg_flow_control_state_get(cpg_handle_t h,
+				       cpg_flow_control_state_t *state)
+{
+	*state = 0;
+	return CPG_OK;
+}
+
+cpg_error_t cpg_finalize(cpg_handle_t h) { return CPG_OK; }
+cpg_error_t cpg_dispatch(cpg_handle_t h, int flags)
+{
+	return CPG_OK;
+}
+
+static void deliver(struct event *ev)
+{
+	struct sim_node *n;
+	struct cpg_name name;
+	cpg_handle_t h;
+	char *buf;
+	int i;
+
+	group_cpg_name(ev->group, &name);
+
+	for (i = 0; i < ev->to_count; i++) {
+		n = &nodes[ev->to[i]];
+		if (!n->up || n->gen != ev->to_gen[i])
+			continue;
+		set_node(n);
+		h = group_handle[ev->group][ev->to[i]];
+
+		if (ev->type == EV_CONFCHG) {
+			confchgs++;
+			handles[h - 1].cb->cpg_confchg_fn(h, &name,
+				ev->member, ev->member_count,
+				ev->left, ev->left_count,
+				ev->joined, ev->joined_count);
+		} else {
+			/* deliver_cb converts the header in place */
+			buf = malloc(ev->len);
+			memcpy(buf, ev->buf, ev->len);
+			handles[h - 1].cb->cpg_deliver_fn(h, &name,
+				nodes[ev->from].nodeid, 1, buf, ev->len);
+			free(buf);
+		}
+	}
+}
+
+/* the end of each daemon's main loop */
+
+static void loop_end(void)
+{
+	int i;
+
+	for (i = 0; i < SIM_NODES; i++) {
+		if (!nodes[i].up)
+			continue;
+		set_node(&nodes[i]);
+		if (poll_fencing || poll_quorum || poll_fs)
+			process_lockspace_changes();
+		send_batched_messages();
+	}
+}
+
+/* cpg_dispatch(CPG_DISPATCH_ALL) delivers everything queued up to now,
+   up to max events */
+
+static int dispatch(int max)
+{
+	struct event *ev, *end = ev_last;
+	int count = 0;
+
+	while (ev_first && count < max) {
+		ev = ev_first;
+		ev_first = ev->next;
+		if (!ev_first)
+			ev_last = NULL;
+		deliver(ev);
+		free(ev->buf);
+		free(ev);
+		count++;
+		if (ev == end)
+			break;
+	}
+	loop_end();
+	return count;
+}
+
+/* deliver everything, with a poll timeout on every node whenever the
+   queue is empty, until nothing more happens */
+
+static void run(void)
+{
+	for (;;) {
+		if (ev_first) {
+			dispatch(INT_MAX);
+			continue;
+		}
+		loop_end();
+		if (!ev_first)
+			break;
+	}
+}
+
+static void run_events(int count)
+{
+	while (ev_first && count > 0)
+		count -= dispatch(count);
+}
+
+static void start_daemon(int i, int mux)
+{
+	struct sim_node *n = &nodes[i];
+
+	int gen = n->gen;
+
+	/* a new daemon, so old events for this node are dropped */
+	save_node();
+	memset(n, 0, sizeof(*n));
+	n->nodeid = i + 1;
+	n->up = 1;
+	n->gen = gen + 1;
+	INIT_LIST_HEAD(&n->lockspaces);
+	INIT_LIST_HEAD(&n->daemon_nodes);
+	set_node(n);
+
+	setup_cpg_daemon();
+
+	/* the protocol a running cluster would have agreed on */
+	our_protocol.daemon_run[0] = 1;
+	our_protocol.daemon_run[1] = mux ? 2 : 1;
+	our_protocol.daemon_run[2] = 1;
+	our_protocol.kernel_run[0] = 1;
+	our_protocol.kernel_run[1] = 1;
+	our_protocol.kernel_run[2] = 1;
+	set_protocol();
+}
+
+static void join_ls(int i, int l)
+{
+	struct lockspace *ls;
+	char name[16];
+
+	set_node(&nodes[i]);
+	sprintf(name, "ls%03d", l);
+	ls = create_ls(name);
+	dlm_join_lockspace(ls);
+	expect[l] |= 1 << i;
+}
+
+static void leave_ls(int i, int l)
+{
+	char name[16];
+
+	set_node(&nodes[i]);
+	sprintf(name, "ls%03d", l);
+	dlm_leave_lockspace(find_ls(name));
+	expect[l] &= ~(1 << i);
+}
+
+/* the daemon is killed and the node removed from every cpg it was in */
+
+static void fail_node(int i)
+{
+	struct lockspace *ls, *safe;
+	struct node *node, *nsafe;
+	struct event *ev;
+	int g, l;
+
+	set_node(&nodes[i]);
+	list_for_each_entry_safe(ls, safe, &lockspaces, list) {
+		list_del(&ls->list);
+		free_ls(ls);
+	}
+	list_for_each_entry_safe(node, nsafe, &daemon_nodes, list) {
+		list_del(&node->list);
+		free(node);
+	}
+	free(batch_buf);
+	batch_buf = NULL;
+	batch_len = batch_count = 0;
+	save_node();
+
+	nodes[i].up = 0;
+	nodes[i].fail_pending = 1;
+	nodes[i].fenced = 0;
+
+	for (g = 0; g < SIM_GROUPS; g++) {
+		if (!in_group[g][i])
+			continue;
+		in_group[g][i] = 0;
+
+		ev = new_event(EV_CONFCHG, g);
+		ev->left[0].nodeid = nodes[i].nodeid;
+		ev->left[0].pid = 1;
+		ev->left[0].reason = CPG_REASON_NODEDOWN;
+		ev->left_count = 1;
+	}
+
+	for (l = 0; l < SIM_LS; l++)
+		expect[l] &= ~(1 << i);
+}
+
+static void fence_node(int i)
+{
+	nodes[i].fail_pending = 0;
+	nodes[i].fenced = time(NULL);
+}
+
+/* the lockspaces on every running node match expect[], and all are
+   started */
+
+static void check_lockspaces(const char *desc)
+{
+	struct lockspace *ls;
+	char str[80];
+	int i, l, count, bad = 0, stopped = 0, need_plocks = 0;
+
+	for (i = 0; i < SIM_NODES; i++) {
+		if (!nodes[i].up)
+			continue;
+		set_node(&nodes[i]);
+
+		count = 0;
+		list_for_each_entry(ls, &lockspaces, list) {
+			l = ls_index(ls->name);
+			count++;
+			if (!(expect[l] & (1 << i)) ||
+			    nodes[i].members[l] != expect[l] ||
+			    !list_empty(&ls->changes))
+				bad++;
+			if (!nodes[i].running[l])
+				stopped++;
+			if (ls->need_plocks)
+				need_plocks++;
+		}
+
+		for (l = 0; l < SIM_LS; l++) {
+			if (expect[l] & (1 << i))
+				count--;
+		}
+		if (count)
+			bad++;
+	}
+
+	snprintf(str, sizeof(str), "%s: wrong members", desc);
+	check(str, bad, 0);
+	snprintf(str, sizeof(str), "%s: stopped", desc);
+	check(str, stopped, 0);
+	snprintf(str, sizeof(str), "%s: waiting for plocks", desc);
+	check(str, need_plocks, 0);
+}
+
+static int count_stopped(void)
+{
+	int i, l, stopped = 0;
+
+	for (i = 0; i < SIM_NODES; i++) {
+		if (!nodes[i].up)
+			continue;
+		for (l = 0; l < SIM_LS; l++) {
+			if ((expect[l] & (1 << i)) && !nodes[i].running[l])
+				stopped++;
+		}
+	}
+	return stopped;
+}
+
+static void reset_counts(void)
+{
+	mcasts = 0;
+	mcast_bytes = 0;
+	confchgs = 0;
+}
+
+static void print_counts(const char *mode, const char *desc)
+{
+	printf("%-9s %-28s %6d messages %9d bytes %6d confchgs\n",
+	       mode, desc, mcasts, mcast_bytes, confchgs);
+}
+
+static void scenario(int mux)
+{
+	const char *mode = mux ? "shared" : "separate";
+	int i, l;
+
+	printf("lockspaces on %s cpgs\n", mux ? "the daemon" : "separate");
+
+	memset(in_group, 0, sizeof(in_group));
+	memset(group_handle, 0, sizeof(group_handle));
+	memset(expect, 0, sizeof(expect));
+	handle_count = 0;
+
+	for (i = 0; i < SIM_NODES; i++)
+		start_daemon(i, mux);
+	run();
+	check("protocol", ls_mux, mux);
+
+	/* every node joins every lockspace at once */
+
+	reset_counts();
+	for (l = 0; l < SIM_LS; l++) {
+		for (i = 0; i < SIM_NODES; i++)
+			join_ls(i, l);
+	}
+	run();
+	print_counts(mode, "all join");
+	check_lockspaces("all join");
+
+	/* nothing is restarted until the failed node is fenced */
+
+	reset_counts();
+	fail_node(SIM_NODES - 1);
+	run();
+	check("node fails: started before fencing", count_stopped(),
+	      SIM_LS * (SIM_NODES - 1));
+	fence_node(SIM_NODES - 1);
+	run();
+	print_counts(mode, "node fails");
+	check_lockspaces("node fails");
+
+	/* a start from each survivor and a plocks_stored from the ckpt
+	   node, for all the lockspaces at once when batched */
+	check("node fails: messages", mcasts,
+	      mux ? SIM_NODES : SIM_LS * SIM_NODES);
+
+	/* the failed node comes back and joins everything while node 1
+	   leaves some lockspaces, and another node fails part way through */
+
+	reset_counts();
+	start_daemon(SIM_NODES - 1, mux);
+	for (l = 0; l < SIM_LS; l++) {
+		join_ls(SIM_NODES - 1, l);
+		if (l < SIM_LS / 5)
+			leave_ls(0, l);
+	}
+	/* while every lockspace is still waiting for starts (far fewer
+	   events when they're batched) */
+	run_events(mux ? 10 : 300);
+	fail_node(SIM_NODES - 2);
+	run();
+	fence_node(SIM_NODES - 2);
+	run();
+	print_counts(mode, "rejoin, leave, fail");
+	check_lockspaces("rejoin, leave, fail");
+
+
+	for (i = 0; i < SIM_NODES; i++) {
+		if (nodes[i].up)
+			fail_node(i);
+		fence_node(i);
+	}
+	run();
+}
+
+int main(int argc, char **argv)
+{
+	INIT_LIST_HEAD(&lockspaces);
+	INIT_LIST_HEAD(&daemon_nodes);
+
+	scenario(1);
+	scenario(0);
+
+	if (failed) {
+		printf("%d failed\n", failed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
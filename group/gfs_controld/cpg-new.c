@@ -3,6 +3,7 @@
 #include "libdlmcontrol.h"
 
 #define MAX_JOURNALS 256
+#define MAX_LOCAL_RECOVERIES 4
 
 uint32_t cpgname_to_crc(const char *data, int len);
 
@@ -103,6 +104,10 @@ struct journal {
 	int local_recovery_done;
 	int local_recovery_result;
 	int failed_recovery_count;
+
+	int recover_slot;		/* position among journals to recover */
+	int tried_count;
+	int tried_nodeids[MAX_NODES];	/* nodes whose recovery failed */
 };
 
 struct node {
@@ -225,12 +230,14 @@ static int daemon_member_count;
    new nodes: instantiate existing state to match old nodes
    old nodes: update state per the changes in the completed start cycle
    all nodes: assign jids to new members
+   all nodes: assign journals needing recovery to mounted members
    all nodes: clear all change structs
 
    else !first_recovery_needed,
    new nodes: instantiate existing state to match old nodes
    old nodes: update state per the changes in the completed start cycle
    all nodes: assign jids to new members
+   all nodes: assign journals needing recovery to mounted members
    all nodes: clear all change structs
 
    <new changes that arrive from here on result in going back to the top>
@@ -248,7 +255,8 @@ static int daemon_member_count;
 
    else !first_recovery_needed,
    all nodes: if there are no journals to recover, goto start kernel
-   old nodes: tell kernel to recover jids, send message with each result
+   old nodes: tell kernel to recover the jids assigned to them, send message
+              with each result; a failed jid moves on to the next node
    all nodes: wait for all recoveries to be done
    all nodes: start kernel
    new nodes: tell mount.gfs to mount(2)
@@ -1496,6 +1504,17 @@ static void receive_mount_done(struct mountgroup *mg, struct gfs_header *hd,
 	node->kernel_mount_error = hd->msgdata;
 }
 
+static int tried_recovery(struct journal *j, int nodeid)
+{
+	int i;
+
+	for (i = 0; i < j->tried_count; i++) {
+		if (j->tried_nodeids[i] == nodeid)
+			return 1;
+	}
+	return 0;
+}
+
 static void receive_recovery_result(struct mountgroup *mg,
 				    struct gfs_header *hd, int len)
 {
@@ -1525,6 +1544,12 @@ static void receive_recovery_result(struct mountgroup *mg,
 		j->failed_recovery_count++;
 		log_group(mg, "jid %d failed_recovery_count %d", jid,
 			  j->failed_recovery_count);
+
+		/* the journal is reassigned to the next node that hasn't
+		   tried it yet, see journal_recovery_node() */
+
+		if (!tried_recovery(j, hd->nodeid) && j->tried_count < MAX_NODES)
+			j->tried_nodeids[j->tried_count++] = hd->nodeid;
 	}
 }
 
@@ -2089,6 +2114,83 @@ static void apply_saved_messages(struct mountgroup *mg)
 	}
 }
 
+/* A node can recover journals once its kernel mount has succeeded, unless
+   it's a spectator or withdrawing.  All of these are set from messages or
+   start cycles, so every node comes to the same answer. */
+
+static int can_recover(struct mountgroup *mg, struct change *cg, int nodeid)
+{
+	struct node *node;
+
+	if (!cg || !find_memb(cg, nodeid))
+		return 0;
+
+	node = get_node_history(mg, nodeid);
+	if (!node)
+		return 0;
+
+	return node->kernel_mount_done && !node->kernel_mount_error &&
+	       !node->spectator && !node->withdraw;
+}
+
+static int nodeid_compare(const void *va, const void *vb)
+{
+	const int *a = va;
+	const int *b = vb;
+
+	return *a - *b;
+}
+
+/* Spread the journals needing recovery across the members that can recover
+   them: the nodeids of the recoverers are sorted, the journals are numbered
+   in jid order, and journal slot n starts with recoverer n (mod count), see
+   journal_recovery_node().  This is run by all nodes at the same point in
+   the start cycle, so they all end up with the same assignments without any
+   extra messages.  The record of failed attempts is cleared so that nodes
+   can retry journals they failed before the membership changed. */
+
+static void assign_recoveries(struct mountgroup *mg)
+{
+	struct change *cg;
+	struct member *memb;
+	struct journal *j;
+	int jid, slot = 0;
+
+	cg = list_first_entry(&mg->changes, struct change, list);
+
+	mg->recover_node_count = 0;
+
+	list_for_each_entry(memb, &cg->members, list) {
+		if (!can_recover(mg, cg, memb->nodeid))
+			continue;
+		if (mg->recover_node_count == MAX_NODES)
+			break;
+		mg->recover_nodes[mg->recover_node_count++] = memb->nodeid;
+	}
+
+	qsort(mg->recover_nodes, mg->recover_node_count, sizeof(int),
+	      nodeid_compare);
+
+	for (jid = 0; jid < MAX_JOURNALS; jid++) {
+		j = find_journal(mg, jid);
+		if (!j)
+			continue;
+
+		j->tried_count = 0;
+		j->local_recovery_done = 0;
+
+		if (!j->needs_recovery)
+			continue;
+
+		j->recover_slot = slot++;
+
+		log_group(mg, "assign_recoveries jid %d slot %d nodeid %d",
+			  j->jid, j->recover_slot, mg->recover_node_count ?
+			  mg->recover_nodes[j->recover_slot %
+					    mg->recover_node_count] : 0);
+	}
+}
+
 /* this is run immediately after receiving the final start message in a start
    cycle, so all nodes will run this in the same sequence wrt other messages
    and confchgs */
@@ -2176,6 +2278,8 @@ static void sync_state(struct mountgroup *mg)
 		set_failed_journals(mg);
 		create_new_journals(mg);
 	}
+
+	assign_recoveries(mg);
 }
 
 static void apply_changes(struct mountgroup *mg)
@@ -2222,6 +2326,9 @@ void process_recovery_uevent(char *name, int jid, int recover_status,
 		return;
 	}
 
+	if (jid >= 0)
+		mg->uevent_has_jid = 1;
+
 	if (jid < 0) {
 		/* for back compat, sysfs file deprecated */
 		rv = read_sysfs_int(mg, "recover_done", &jid);
@@ -2252,20 +2359,22 @@ void process_recovery_uevent(char *name, int jid, int recover_status,
 			return;
 		}
 
-		mg->local_recovery_busy = 0;
-
-		if (mg->local_recovery_jid != jid) {
-			log_error("recovery_uevent jid %d expected %d", jid,
-				  mg->local_recovery_jid);
-			return;
-		}
-
 		j = find_journal(mg, jid);
 		if (!j) {
 			log_error("recovery_uevent no journal %d", jid);
 			return;
 		}
 
+		if (!j->local_recovery_busy) {
+			log_error("recovery_uevent jid %d not expected, "
+				  "local_recovery_busy %d", jid,
+				  mg->local_recovery_busy);
+			return;
+		}
+
+		j->local_recovery_busy = 0;
+		mg->local_recovery_busy--;
+
 		log_group(mg, "recovery_uevent jid %d status %d "
 			  "local_recovery_done %d needs_recovery %d",
 			  jid, recover_status, j->local_recovery_done,
@@ -2317,20 +2426,21 @@ void process_recovery_uevent(char *name, int jid, int recover_status,
 	apply_changes_recovery(mg);
 }
 
-static void start_journal_recovery(struct mountgroup *mg, int jid)
+static int start_journal_recovery(struct mountgroup *mg, struct journal *j)
 {
 	int rv;
 
-	log_group(mg, "start_journal_recovery jid %d", jid);
+	log_group(mg, "start_journal_recovery jid %d", j->jid);
 
-	rv = set_sysfs(mg, "recover", jid);
+	rv = set_sysfs(mg, "recover", j->jid);
 	if (rv < 0) {
-		log_error("start_journal_recovery %d error %d", jid, rv);
-		return;
+		log_error("start_journal_recovery %d error %d", j->jid, rv);
+		return rv;
 	}
 
-	mg->local_recovery_busy = 1;
-	mg->local_recovery_jid = jid;
+	j->local_recovery_busy = 1;
+	mg->local_recovery_busy++;
+	return 0;
 }
 
 static int wait_recoveries_done(struct mountgroup *mg)
@@ -2353,52 +2463,69 @@ static int wait_recoveries_done(struct mountgroup *mg)
 	return 1;
 }
 
-/* pick a jid that has not been successfully recovered by someone else
-   (received recovery_result success message) and hasn't been recovered
-   by us (local record); if nothing to recover, return 0 */
+/* Returns the node that should recover the journal: the first recoverer,
+   starting from the journal's slot, that is still able to and hasn't failed
+   it already.  If all the recoverers from the start cycle have failed it,
+   or there were none, it falls to the lowest member that has mounted since.
+   Returns 0 if no one is left to try; the journal then waits for a new
+   member as before. */
 
-static int pick_journal_to_recover(struct mountgroup *mg, int *jid)
+static int journal_recovery_node(struct mountgroup *mg, struct journal *j)
 {
-	struct journal *j;
+	struct change *cg = mg->started_change;
+	struct member *memb;
+	int i, nodeid, count = mg->recover_node_count;
+	int low = 0;
 
-	list_for_each_entry(j, &mg->journals, list) {
-		if (j->needs_recovery && !j->local_recovery_done) {
-			*jid = j->jid;
-			return 1;
-		}
+	for (i = 0; i < count; i++) {
+		nodeid = mg->recover_nodes[(j->recover_slot + i) % count];
+		if (can_recover(mg, cg, nodeid) && !tried_recovery(j, nodeid))
+			return nodeid;
 	}
 
-#if 0
-	/* FIXME: do something so this doesn't happen so regularly; maybe
-	   retry only after all nodes have failed */
+	if (!cg)
+		return 0;
 
-	/* Retry recoveries that failed the first time.  This is necessary
-	   at times for withrawn journals when all nodes fail the recovery
-	   (fail to get journal lock) before the withdrawing node has had a
-	   chance to clear its dlm locks for the withdrawn journal.
-	   32 max retries is random, and includes attempts by all nodes. */
+	list_for_each_entry(memb, &cg->members, list) {
+		if (!can_recover(mg, cg, memb->nodeid))
+			continue;
+		if (tried_recovery(j, memb->nodeid))
+			continue;
+		if (!low || memb->nodeid < low)
+			low = memb->nodeid;
+	}
+	return low;
+}
+
+/* pick the lowest slot jid that has not been successfully recovered by
+   someone else (received recovery_result success message), is assigned to
+   us, and isn't being (or hasn't been) recovered by us (local record); if
+   nothing to recover, return NULL */
+
+static struct journal *pick_journal_to_recover(struct mountgroup *mg)
+{
+	struct journal *j, *pick = NULL;
 
 	list_for_each_entry(j, &mg->journals, list) {
-		if (j->needs_recovery && j->local_recovery_done &&
-		    (j->local_recovery_result == LM_RD_GAVEUP) &&
-		    (j->failed_recovery_count > 1) &&
-		    (j->failed_recovery_count < 32)) {
-			log_group(mg, "retrying jid %d recovery", j->jid);
-			*jid = j->jid;
-			sleep(1); /* might this cause problems? */
-			return 1;
-		}
+		if (!j->needs_recovery || j->local_recovery_busy ||
+		    j->local_recovery_done)
+			continue;
+		if (pick && pick->recover_slot < j->recover_slot)
+			continue;
+		if (journal_recovery_node(mg, j) != our_nodeid)
+			continue;
+		pick = j;
 	}
-#endif
 
-	return 0;
+	return pick;
 }
 
 /* processing that happens after all changes have been dealt with */
 
 static void apply_recovery(struct mountgroup *mg)
 {
-	int jid;
+	struct journal *j;
+	int max;
 
 	if (mg->first_recovery_needed) {
 		if (mg->first_recovery_master == our_nodeid &&
@@ -2412,17 +2539,27 @@ static void apply_recovery(struct mountgroup *mg)
 
 	/* The normal non-first-recovery mode.  When a recovery_done message
 	   is received, check whether any more journals need recovery.  If
-	   so, start recovery on the next one, if not, start the kernel. */
+	   so, start recovery on the ones assigned to us, up to
+	   MAX_LOCAL_RECOVERIES at once, if not, start the kernel.
+
+	   Only one recovery at a time until a uevent has come with the jid
+	   in it: an old kernel's single recover_done sysfs value can't say
+	   which of several finished recoveries a uevent is for. */
+
+	max = mg->uevent_has_jid ? MAX_LOCAL_RECOVERIES : 1;
 
 	if (!wait_recoveries_done(mg)) {
 		if (!mg->kernel_mount_done || mg->kernel_mount_error)
 			return;
 		if (mg->spectator)
 			return;
-		if (mg->local_recovery_busy)
-			return;
-		if (pick_journal_to_recover(mg, &jid))
-			start_journal_recovery(mg, jid);
+		while (mg->local_recovery_busy < max) {
+			j = pick_journal_to_recover(mg);
+			if (!j)
+				break;
+			if (start_journal_recovery(mg, j) < 0)
+				break;
+		}
 	} else {
 		if (!mg->kernel_stopped)
 			return;
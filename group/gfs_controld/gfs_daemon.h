@@ -164,8 +164,10 @@ struct mountgroup {
 	int			first_recovery_needed;
 	int			first_recovery_master;
 	int			first_recovery_msg;
-	int			local_recovery_jid;
-	int			local_recovery_busy;
+	int			local_recovery_busy;	/* count */
+	int			uevent_has_jid;	/* more than one can be busy */
+	int			recover_node_count;
+	int			recover_nodes[MAX_NODES];
 
 	/* cpg-old stuff for rhel5/stable2 compat */
 
@@ -0,0 +1,659 @@
+/* Simulate a mountgroup of many nodes and check how journal recovery is
+   spread across the survivors after multiple failures.  The real cpg-new.c
+   message and confchg handling is run for every node; cpg, dlm_controld,
+   sysfs and mount(2) are replaced by a fake that delivers every event to
+   all group members in the same order, as cpg would.
+
+   Kernel recoveries started through the "recover" sysfs file all complete
+   together in one "round", so the number of rounds is the length of the
+   recovery when every journal takes the same time to replay.  The kernel
+   either puts the jid and status in each recovery_done uevent, or, like
+   an old one, only in the recover_done/recover_status sysfs files. */
+
+#include "cpg-new.c"
+
+#define SIM_NODES	20
+#define MAX_EVENTS	4096
+#define EV_MSG		1
+#define EV_CONFCHG	2
+
+/* daemon globals from main.c */
+
+int daemon_debug_opt;
+int daemon_quit;
+int cluster_down;
+int poll_dlm;
+int our_nodeid;
+char daemon_debug_buf[256];
+cpg_handle_t cpg_handle_daemon;
+struct list_head mountgroups;
+struct list_head withdrawn_mounts;
+
+struct sim_node {
+	int nodeid;
+	int joined;
+	int dead;
+	struct mountgroup *mg;
+
+	int register_pending;
+	int notify_nodeid;
+	int mount_pending;
+
+	int recovering[MAX_JOURNALS];
+	int recover_count;
+	int max_recover_count;
+	int recovered;
+	int give_up;		/* kernel fails every recovery */
+	int sysfs_recover_done;
+	int sysfs_recover_status;
+};
+
+struct event {
+	int type;
+	int from;
+	int len;
+	char *buf;
+	int to_count;
+	int to[SIM_NODES];
+	struct cpg_address member[SIM_NODES];
+	int member_count;
+	struct cpg_address left[SIM_NODES];
+	int left_count;
+	struct cpg_address joined[SIM_NODES];
+	int joined_count;
+};
+
+static struct sim_node nodes[SIM_NODES];
+static struct event *events[MAX_EVENTS];
+static int ev_head, ev_tail;
+static struct cpg_name group_name = { 14, "gfs:mount:sim" };
+static int failed;
+static int inconsistent;
+static int duplicates;
+static int hold_kernel;
+static int sysfs_uevents;	/* uevents without JID= and RECOVERY= */
+
+static struct sim_node *cur;
+
+static void set_node(struct sim_node *n)
+{
+	cur = n;
+	our_nodeid = n->nodeid;
+	INIT_LIST_HEAD(&mountgroups);
+	list_add(&n->mg->list, &mountgroups);
+}
+
+static void check(const char *desc, int got, int want)
+{
+	printf("%-44s %4d (want %4d) %s\n", desc, got, want,
+	       got == want ? "ok" : "FAIL");
+	if (got != want)
+		failed++;
+}
+
+/* fake daemon and kernel interfaces */
+
+void daemon_dump_save(void) { }
+void kick_node_from_cluster(int nodeid) { }
+void update_flow_control_status(void) { }
+void client_dead(int ci) { }
+
+int client_add(int fd, void (*workfn)(int ci), void (*deadfn)(int ci))
+{
+	return fd;
+}
+
+struct mountgroup *find_mg(char *name)
+{
+	if (cur && !strcmp(cur->mg->name, name))
+		return cur->mg;
+	return NULL;
+}
+
+void client_reply_join_full(struct mountgroup *mg, int result)
+{
+	cur->mount_pending = 1;
+}
+
+int read_sysfs_int(struct mountgroup *mg, const char *field, int *val_out)
+{
+	if (!sysfs_uevents)
+		return -1;
+
+	if (!strcmp(field, "recover_done"))
+		*val_out = cur->sysfs_recover_done;
+	else if (!strcmp(field, "recover_status"))
+		*val_out = cur->sysfs_recover_status;
+	else if (!strcmp(field, "first_done"))
+		*val_out = cur->mg->first_mounter;
+	else
+		return -1;
+	return 0;
+}
+
+int set_sysfs(struct mountgroup *mg, const char *field, int val)
+{
+	int i;
+
+	if (strcmp(field, "recover"))
+		return 0;
+
+	/* no one else may be replaying this journal right now */
+	for (i = 0; i < SIM_NODES; i++) {
+		if (&nodes[i] != cur && !nodes[i].dead &&
+		    nodes[i].recovering[val])
+			duplicates++;
+	}
+
+	cur->recovering[val] = 1;
+	cur->recover_count++;
+	if (cur->recover_count > cur->max_recover_count)
+		cur->max_recover_count = cur->recover_count;
+	return 0;
+}
+
+int dlmc_fs_connect(void) { return 0; }
+int dlmc_fs_unregister(int fd, char *name) { return 0; }
+
+int dlmc_fs_register(int fd, char *name)
+{
+	cur->register_pending = 1;
+	return 0;
+}
+
+int dlmc_fs_notified(int fd, char *name, int nodeid)
+{
+	cur->notify_nodeid = nodeid;
+	return 0;
+}
+
+int dlmc_fs_result(int fd, char *name, int *type, int *nodeid, int *result)
+{
+	strcpy(name, cur->mg->name);
+	*result = 0;
+	if (cur->register_pending) {
+		cur->register_pending = 0;
+		*type = DLMC_RESULT_REGISTER;
+		*nodeid = 0;
+	} else {
+		*type = DLMC_RESULT_NOTIFIED;
+		*nodeid = cur->notify_nodeid;
+		cur->notify_nodeid = 0;
+	}
+	return 0;
+}
+
+/* fake cpg: one totally ordered event queue for the group */
+
+static struct sim_node *handle_node(cpg_handle_t h)
+{
+	return &nodes[h - 1];
+}
+
+static struct event *new_event(int type)
+{
+	struct event *ev;
+	int i;
+
+	ev = calloc(1, sizeof(struct event));
+	ev->type = type;
+
+	for (i = 0; i < SIM_NODES; i++) {
+		if (!nodes[i].joined)
+			continue;
+		ev->to[ev->to_count++] = i;
+		ev->member[ev->member_count].nodeid = nodes[i].nodeid;
+		ev->member[ev->member_count].pid = 1;
+		ev->member_count++;
+	}
+
+	events[ev_tail++ % MAX_EVENTS] = ev;
+	return ev;
+}
+
+cpg_error_t cpg_initialize(cpg_handle_t *h, cpg_callbacks_t *cb)
+{
+	*h = cur - nodes + 1;
+	return CPG_OK;
+}
+
+cpg_error_t cpg_fd_get(cpg_handle_t h, int *fd)
+{
+	*fd = h;
+	return CPG_OK;
+}
+
+cpg_error_t cpg_join(cpg_handle_t h, const struct cpg_name *name)
+{
+	struct sim_node *n = handle_node(h);
+	struct event *ev;
+
+	n->joined = 1;
+	ev = new_event(EV_CONFCHG);
+	ev->joined[0].nodeid = n->nodeid;
+	ev->joined[0].reason = CPG_REASON_JOIN;
+	ev->joined_count = 1;
+	return CPG_OK;
+}
+
+cpg_error_t cpg_mcast_joined(cpg_handle_t h, int type,
+			     const struct iovec *iov, unsigned int iov_len)
+{
+	struct event *ev = new_event(EV_MSG);
+
+	ev->from = handle_node(h)->nodeid;
+	ev->len = iov[0].iov_len;
+	ev->buf = malloc(ev->len);
+	memcpy(ev->buf, iov[0].iov_base, ev->len);
+	return CPG_OK;
+}
+
+cpg_error_t cpg_leave(cpg_handle_t h, const struct cpg_name *name)
+{
+	return CPG_OK;
+}
+
+cpg_error_t cpg_finalize(cpg_handle_t h)
+{
+	return CPG_OK;
+}
+
+cpg_error_t cpg_dispatch(cpg_handle_t h, int flags)
+{
+	return CPG_OK;
+}
+
+/* Every node that has completed a start cycle and has no change in
+   progress has seen the same messages, so must agree on who recovers
+   each journal. */
+
+static void check_assignments(void)
+{
+	struct journal *j;
+	int assign[MAX_JOURNALS];
+	int i, jid, first = 1;
+
+	for (i = 0; i < SIM_NODES; i++) {
+		if (!nodes[i].joined)
+			continue;
+		if (!nodes[i].mg->started_count ||
+		    !list_empty(&nodes[i].mg->changes))
+			return;
+	}
+
+	for (i = 0; i < SIM_NODES; i++) {
+		if (!nodes[i].joined)
+			continue;
+		set_node(&nodes[i]);
+
+		for (jid = 0; jid < MAX_JOURNALS; jid++) {
+			j = find_journal(cur->mg, jid);
+			if (!j || !j->needs_recovery) {
+				if (!first && assign[jid] != -1)
+					inconsistent++;
+				assign[jid] = -1;
+				continue;
+			}
+			if (!first && assign[jid] != journal_recovery_node(cur->mg, j))
+				inconsistent++;
+			assign[jid] = journal_recovery_node(cur->mg, j);
+		}
+		first = 0;
+	}
+}
+
+static void deliver(struct event *ev)
+{
+	struct sim_node *n;
+	char *buf;
+	int i;
+
+	for (i = 0; i < ev->to_count; i++) {
+		n = &nodes[ev->to[i]];
+		if (n->dead)
+			continue;
+		set_node(n);
+
+		if (ev->type == EV_CONFCHG) {
+			confchg_cb(n - nodes + 1, &group_name,
+				   ev->member, ev->member_count,
+				   ev->left, ev->left_count,
+				   ev->joined, ev->joined_count);
+		} else {
+			/* deliver_cb converts the header in place */
+			buf = malloc(ev->len);
+			memcpy(buf, ev->buf, ev->len);
+			deliver_cb(n - nodes + 1, &group_name, ev->from, 1,
+				   buf, ev->len);
+			free(buf);
+		}
+	}
+
+	check_assignments();
+}
+
+/* the local work a node's daemon does in response to dlm_controld,
+   mount.gfs and the kernel; returns 1 if there was anything to do */
+
+static int run_local(struct sim_node *n)
+{
+	struct mountgroup *mg = n->mg;
+
+	set_node(n);
+
+	if (n->register_pending || n->notify_nodeid) {
+		process_dlmcontrol(0);
+		return 1;
+	}
+
+	if (n->mount_pending) {
+		n->mount_pending = 0;
+		mg->kernel_mount_done = 1;
+		mg->kernel_mount_error = 0;
+		if (mg->first_mounter && sysfs_uevents) {
+			n->sysfs_recover_done = mg->our_jid;
+			n->sysfs_recover_status = LM_RD_SUCCESS;
+			process_recovery_uevent(mg->name, -1, -1, -1);
+		} else if (mg->first_mounter) {
+			process_recovery_uevent(mg->name, mg->our_jid,
+						LM_RD_SUCCESS, 1);
+		}
+		gfs_mount_done(mg);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* complete every outstanding kernel recovery on every node */
+
+static int run_kernel(void)
+{
+	struct sim_node *n;
+	int round[MAX_JOURNALS];
+	int i, jid, count, done = 0;
+
+	for (i = 0; i < SIM_NODES; i++) {
+		n = &nodes[i];
+		if (n->dead || !n->recover_count)
+			continue;
+		set_node(n);
+
+		/* recoveries started by the uevents below are in the next
+		   round */
+		memcpy(round, n->recovering, sizeof(round));
+
+		for (jid = 0, count = 0; jid < MAX_JOURNALS; jid++) {
+			if (!round[jid])
+				continue;
+			n->recovering[jid] = 0;
+			n->recover_count--;
+			if (!n->give_up)
+				n->recovered++;
+			done++;
+
+			if (sysfs_uevents) {
+				/* all of them finish before the first
+				   uevent is handled */
+				n->sysfs_recover_done = jid;
+				n->sysfs_recover_status = n->give_up ?
+						LM_RD_GAVEUP : LM_RD_SUCCESS;
+				count++;
+				continue;
+			}
+			process_recovery_uevent(n->mg->name, jid, n->give_up ?
+						LM_RD_GAVEUP : LM_RD_SUCCESS, 0);
+		}
+
+		while (count--)
+			process_recovery_uevent(n->mg->name, -1, -1, 0);
+	}
+	return done;
+}
+
+/* run everything to completion, returning the number of recovery rounds */
+
+static int run(void)
+{
+	int i, busy, rounds = 0;
+
+	for (;;) {
+		if (ev_head != ev_tail) {
+			deliver(events[ev_head % MAX_EVENTS]);
+			free(events[ev_head % MAX_EVENTS]->buf);
+			free(events[ev_head % MAX_EVENTS]);
+			ev_head++;
+			continue;
+		}
+
+		busy = 0;
+		for (i = 0; i < SIM_NODES; i++) {
+			if (nodes[i].joined && !nodes[i].dead)
+				busy += run_local(&nodes[i]);
+		}
+		if (busy)
+			continue;
+
+		if (hold_kernel)
+			break;
+
+		if (!run_kernel())
+			break;
+		rounds++;
+	}
+	return rounds;
+}
+
+static void mount_node(int i)
+{
+	struct sim_node *n = &nodes[i];
+
+	/* what create_mg() in main.c does for a new mount */
+	n->mg = calloc(1, sizeof(struct mountgroup));
+	INIT_LIST_HEAD(&n->mg->changes);
+	INIT_LIST_HEAD(&n->mg->journals);
+	INIT_LIST_HEAD(&n->mg->node_history);
+	strcpy(n->mg->name, "sim");
+
+	set_node(n);
+	gfs_join_mountgroup(n->mg);
+	run();
+}
+
+static void fail_nodes(int *list, int count)
+{
+	struct event *ev;
+	int i, k;
+
+	for (i = 0; i < count; i++) {
+		nodes[list[i]].joined = 0;
+		nodes[list[i]].dead = 1;
+	}
+
+	ev = new_event(EV_CONFCHG);
+	for (i = 0; i < count; i++) {
+		k = ev->left_count++;
+		ev->left[k].nodeid = nodes[list[i]].nodeid;
+		ev->left[k].reason = CPG_REASON_NODEDOWN;
+	}
+}
+
+static int all_started(void)
+{
+	int i;
+
+	for (i = 0; i < SIM_NODES; i++) {
+		if (!nodes[i].joined)
+			continue;
+		if (nodes[i].mg->kernel_stopped)
+			return 0;
+	}
+	return 1;
+}
+
+static int recoverer_count(void)
+{
+	int i, count = 0;
+
+	for (i = 0; i < SIM_NODES; i++)
+		if (nodes[i].joined && nodes[i].recovered)
+			count++;
+	return count;
+}
+
+static int recovered_count(void)
+{
+	int i, count = 0;
+
+	for (i = 0; i < SIM_NODES; i++)
+		count += nodes[i].recovered;
+	return count;
+}
+
+static int max_concurrent(void)
+{
+	int i, max = 0;
+
+	for (i = 0; i < SIM_NODES; i++)
+		if (nodes[i].max_recover_count > max)
+			max = nodes[i].max_recover_count;
+	return max;
+}
+
+static void reset_counts(void)
+{
+	int i;
+
+	for (i = 0; i < SIM_NODES; i++) {
+		nodes[i].recovered = 0;
+		nodes[i].max_recover_count = 0;
+	}
+}
+
+static int outstanding_node(void)
+{
+	int i;
+
+	for (i = 0; i < SIM_NODES; i++)
+		if (nodes[i].joined && nodes[i].recover_count)
+			return i;
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	int list[SIM_NODES];
+	int i, rounds, busy, survivor;
+
+	if (argc > 1 && !strcmp(argv[1], "-D"))
+		daemon_debug_opt = 1;
+
+	INIT_LIST_HEAD(&withdrawn_mounts);
+
+	for (i = 0; i < SIM_NODES; i++)
+		nodes[i].nodeid = i + 1;
+
+	for (i = 0; i < SIM_NODES; i++)
+		mount_node(i);
+
+	check("nodes mounted", all_started(), 1);
+
+	/* six nodes fail together, six survivors recover one each */
+
+	for (i = 0; i < 6; i++)
+		list[i] = 14 + i;
+	fail_nodes(list, 6);
+	rounds = run();
+	check("6 failed: all started", all_started(), 1);
+	check("6 failed: recovery rounds", rounds, 1);
+	check("6 failed: nodes recovering", recoverer_count(), 6);
+
+	/* the kernel on node 1 can't recover anything, so the journal
+	   assigned to it moves on to another node */
+
+	reset_counts();
+	nodes[0].give_up = 1;
+	for (i = 0; i < 4; i++)
+		list[i] = 10 + i;
+	fail_nodes(list, 4);
+	rounds = run();
+	nodes[0].give_up = 0;
+	check("4 failed, one gives up: all started", all_started(), 1);
+	check("4 failed, one gives up: rounds", rounds, 2);
+	check("4 failed, one gives up: journals recovered",
+	      recovered_count(), 4);
+	check("4 failed, one gives up: node 1 recovered", nodes[0].recovered, 0);
+
+	/* the node recovering a journal fails before it's done */
+
+	reset_counts();
+	hold_kernel = 1;
+	list[0] = 9;
+	fail_nodes(list, 1);
+	run();
+	busy = outstanding_node();
+	check("assignee fails: recovery started", busy >= 0, 1);
+	list[0] = busy;
+	fail_nodes(list, 1);
+	hold_kernel = 0;
+	rounds = run();
+	check("assignee fails: all started", all_started(), 1);
+	check("assignee fails: rounds", rounds, 1);
+	check("assignee fails: nodes recovering", recoverer_count(), 2);
+
+	/* everyone but the lowest node fails, it has more journals to
+	   recover than it runs at once */
+
+	reset_counts();
+	survivor = -1;
+	busy = 0;
+	for (i = 0; i < SIM_NODES; i++) {
+		if (!nodes[i].joined)
+			continue;
+		if (survivor < 0)
+			survivor = i;
+		else
+			list[busy++] = i;
+	}
+	fail_nodes(list, busy);
+	rounds = run();
+	check("one survivor: all started", all_started(), 1);
+	check("one survivor: journals recovered", nodes[survivor].recovered,
+	      busy);
+	check("one survivor: concurrent recoveries", max_concurrent(),
+	      MAX_LOCAL_RECOVERIES);
+	check("one survivor: rounds", rounds,
+	      (busy + MAX_LOCAL_RECOVERIES - 1) / MAX_LOCAL_RECOVERIES);
+
+	/* again from scratch, with a kernel whose uevents don't say which
+	   journal is done: one recovery at a time */
+
+	memset(nodes, 0, sizeof(nodes));
+	for (i = 0; i < SIM_NODES; i++)
+		nodes[i].nodeid = i + 1;
+	sysfs_uevents = 1;
+
+	for (i = 0; i < SIM_NODES; i++)
+		mount_node(i);
+	check("sysfs uevents: nodes mounted", all_started(), 1);
+
+	for (i = 1; i < SIM_NODES; i++)
+		list[i - 1] = i;
+	fail_nodes(list, SIM_NODES - 1);
+	rounds = run();
+	check("sysfs uevents: all started", all_started(), 1);
+	check("sysfs uevents: journals recovered", nodes[0].recovered,
+	      SIM_NODES - 1);
+	check("sysfs uevents: concurrent recoveries", max_concurrent(), 1);
+	check("sysfs uevents: rounds", rounds, SIM_NODES - 1);
+
+	check("inconsistent assignments", inconsistent, 0);
+	check("journals recovered by two nodes at once", duplicates, 0);
+
+	if (failed) {
+		printf("%d failed\n", failed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
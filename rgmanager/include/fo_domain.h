@@ -1,6 +1,8 @@
 #ifndef _FO_DOMAIN_H
 #define _FO_DOMAIN_H
 
+#include <members.h>
+
 /*
  * Fail-over domain states
  */
@@ -32,6 +34,32 @@ typedef struct _fod {
 	int	_pad_; /* align */
 } fod_t;
 
+/*
+   Placement table: each service's failover domain, resolved when the
+   configuration is loaded, with the domain's nodes sorted by priority.
+ */
+#define FP_NODOMAIN		0	/* No (existing) domain: always BEST */
+#define FP_DOMAIN		1
+#define FP_UNRESOLVED		2	/* Domain node without a node ID; use
+					   node_should_start() */
+
+typedef struct _fod_place {
+	char		*fp_name;	/* Service name */
+	unsigned int	fp_hash;
+	int		fp_state;	/* FP_* */
+	int		fp_flags;	/* FOD_* flags of the domain */
+	int		fp_count;
+	int		*fp_nodes;	/* Node IDs, most preferred first */
+	int		*fp_prios;	/* ... and their priorities */
+} fod_place_t;
+
+typedef struct _fod_table {
+	fod_place_t	*ft_places;
+	fod_place_t	**ft_slots;	/* Hashed by service name */
+	int		ft_count;
+	int		ft_size;	/* Slots; a power of 2 */
+} fod_table_t;
+
  
 /*
    Construct/deconstruct failover domains
@@ -46,4 +74,14 @@ int node_domain_set(fod_t **domains, char *name, int **ret,
 		    int *retlen, int *flags);
 int node_domain_set_safe(char *domainname, int **ret, int *retlen, int *flags);
 
+/*
+   Placement table
+ */
+fod_table_t *build_placement(fod_t **domains, char **rg_names,
+			     char **domainnames, int count);
+void destroy_placement(fod_table_t *table);
+fod_place_t *find_placement(fod_table_t *table, const char *rg_name);
+int place_should_start(fod_place_t *place, int nodeid, memb_mask_t *online,
+		       rg_state_t *svc_state);
+
 #endif
@@ -9,6 +9,13 @@ typedef enum {
 	NODE_STATE_CLEAN = 2
 } node_state_t;
 
+/* Online node IDs from a member list, as a bitmap */
+typedef struct _memb_mask {
+	int		mm_max;		/* node IDs below this are covered */
+	int		_pad_;
+	uint32_t	*mm_bits;
+} memb_mask_t;
+
 
 int get_my_nodeid(cman_handle_t h);
 int my_id(void);
@@ -36,4 +43,8 @@ cluster_member_list_t *member_list_dup(cluster_member_list_t *old);
 cluster_member_list_t *member_list(void);
 void member_list_update(cluster_member_list_t *new_ml);
 
+int memb_mask_init(memb_mask_t *mask, cluster_member_list_t *ml);
+void memb_mask_free(memb_mask_t *mask);
+int memb_mask_online(memb_mask_t *mask, int nodeid);
+
 #endif
@@ -177,6 +177,13 @@ void send_response(int ret, int node, request_t *req);
 void send_ret(msgctx_t *ctx, char *name, int ret, int orig_request,
 	      int new_owner);
 
+/* from rg_inquiry.c */
+#define INQUIRY_BATCH 16	/* contexts inquire_nodes() holds open */
+int inquire_owner(msgctx_t **ctxs, int count, const char *svcName,
+		  int timeout);
+int inquire_nodes(const int *nodeids, int count, const char *svcName,
+		  int timeout, int (*open_ctx)(int nodeid, msgctx_t *ctx));
+
 /* from rg_state.c */
 int set_rg_state(const char *name, rg_state_t *svcblk);
 int get_rg_state(const char *servicename, rg_state_t *svcblk);
@@ -68,6 +68,7 @@ typedef struct _resource_child {
 	int	rc_stoplevel;
 	int	rc_forbid;
 	int	rc_flags;
+	int	rc_parallel;	/** # of this type to start/stop at once */
 } resource_child_t;
 
 
@@ -105,6 +106,8 @@ typedef struct _resource {
 	int	r_refs;
 	int	r_incarnations;	/** Number of instances running locally */
 	int	_pad_; /* align */
+	struct _resource_key *	r_keys;	/** Our primary/unique keys */
+	struct _resource_index * r_index; /** Key index of our list */
 } resource_t;
 
 
@@ -120,7 +123,7 @@ typedef struct _rg_node {
 	int	rn_last_status;
 	int 	rn_last_depth;
 	int	rn_checked;
-	int	rn_pad;
+	int	rn_parallel; /* # of children to start/stop at once */
 } resource_node_t;
 
 
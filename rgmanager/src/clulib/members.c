@@ -501,3 +501,66 @@ member_list_dup(cluster_member_list_t *orig)
 	return ret;
 }
 
+
+
+/**
+  Build a bitmap of the online node IDs in a member list, so that
+  repeated "is this node online" questions against the same list don't
+  each have to walk it.  The mask is a snapshot; later changes to the
+  list (e.g. memb_mark_down) are not reflected in it.
+
+  @param mask		Mask to fill in.
+  @param ml		Member list.
+  @return		0 on success, -1 if out of memory.
+ */
+int
+memb_mask_init(memb_mask_t *mask, cluster_member_list_t *ml)
+{
+	int x, nodeid, max = 0;
+
+	memset(mask, 0, sizeof(*mask));
+	if (!ml)
+		return 0;
+
+	for (x = 0; x < ml->cml_count; x++) {
+		if (ml->cml_members[x].cn_member &&
+		    ml->cml_members[x].cn_nodeid >= max)
+			max = ml->cml_members[x].cn_nodeid + 1;
+	}
+
+	if (!max)
+		return 0;
+
+	mask->mm_bits = calloc((max + 31) / 32, sizeof(uint32_t));
+	if (!mask->mm_bits)
+		return -1;
+	mask->mm_max = max;
+
+	for (x = 0; x < ml->cml_count; x++) {
+		nodeid = ml->cml_members[x].cn_nodeid;
+		if (!ml->cml_members[x].cn_member || nodeid < 0)
+			continue;
+		mask->mm_bits[nodeid / 32] |= (1U << (nodeid % 32));
+	}
+
+	return 0;
+}
+
+
+void
+memb_mask_free(memb_mask_t *mask)
+{
+	if (mask->mm_bits)
+		free(mask->mm_bits);
+	mask->mm_bits = NULL;
+	mask->mm_max = 0;
+}
+
+
+int
+memb_mask_online(memb_mask_t *mask, int nodeid)
+{
+	if (nodeid < 0 || nodeid >= mask->mm_max)
+		return 0;
+	return !!(mask->mm_bits[nodeid / 32] & (1U << (nodeid % 32)));
+}
@@ -640,3 +640,263 @@ node_should_start(int nodeid, cluster_member_list_t *membership,
 	/* not reached */
 	return FOD_ILLEGAL;
 }
+
+
+static unsigned int
+place_hash(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name)
+		hash = (hash * 33) ^ (unsigned char)*name++;
+	return hash;
+}
+
+
+/**
+ * Fill in one service's placement from its failover domain.  The
+ * domain's nodes are copied in order of priority, lowest value (most
+ * preferred) first; unordered domains' nodes all have priority 0.
+ *
+ * @return		0 on success, -1 if out of memory.
+ */
+static int
+place_domain(fod_place_t *place, fod_t **domains, const char *domainname)
+{
+	fod_t *fod = NULL;
+	fod_node_t *fodn;
+	int found = 0, x, y;
+
+	place->fp_state = FP_NODOMAIN;
+	if (!domainname)
+		return 0;
+
+	list_do(domains, fod) {
+		if (!strcasecmp(fod->fd_name, domainname)) {
+			found = 1;
+			break;
+		}
+	} while (!list_done(domains, fod));
+
+	if (!found) {
+		logt_print(LOG_WARNING, "#66: Domain '%s' specified for resource "
+		       "group %s nonexistent!\n", domainname, place->fp_name);
+		return 0;
+	}
+
+	place->fp_state = FP_DOMAIN;
+	place->fp_flags = fod->fd_flags;
+
+	list_for(&fod->fd_nodes, fodn, x) { }
+	if (!x)
+		return 0;
+
+	place->fp_nodes = malloc(sizeof(int) * x);
+	place->fp_prios = malloc(sizeof(int) * x);
+	if (!place->fp_nodes || !place->fp_prios)
+		return -1;
+
+	list_for(&fod->fd_nodes, fodn, x) {
+		/* node_in_domain() matches by name; we match by ID */
+		if (fodn->fdn_nodeid <= 0)
+			place->fp_state = FP_UNRESOLVED;
+
+		/* Insert sorted; equal priorities stay in config order */
+		for (y = place->fp_count;
+		     y > 0 && place->fp_prios[y - 1] > fodn->fdn_prio; y--) {
+			place->fp_nodes[y] = place->fp_nodes[y - 1];
+			place->fp_prios[y] = place->fp_prios[y - 1];
+		}
+		place->fp_nodes[y] = fodn->fdn_nodeid;
+		place->fp_prios[y] = fodn->fdn_prio;
+		++place->fp_count;
+	}
+
+	return 0;
+}
+
+
+void
+destroy_placement(fod_table_t *table)
+{
+	int x;
+
+	if (!table)
+		return;
+
+	if (table->ft_places) {
+		for (x = 0; x < table->ft_count; x++) {
+			if (table->ft_places[x].fp_name)
+				free(table->ft_places[x].fp_name);
+			if (table->ft_places[x].fp_nodes)
+				free(table->ft_places[x].fp_nodes);
+			if (table->ft_places[x].fp_prios)
+				free(table->ft_places[x].fp_prios);
+		}
+		free(table->ft_places);
+	}
+	if (table->ft_slots)
+		free(table->ft_slots);
+	free(table);
+}
+
+
+/**
+ * Resolve each service's failover domain ahead of time, so the
+ * decisions node_should_start() makes can be answered from a membership
+ * mask without looking anything up by name.  Build a new table whenever
+ * the services or domains change.
+ *
+ * @param domains	List of failover domains.
+ * @param rg_names	Service names.
+ * @param domainnames	Each service's "domain" attribute, or NULL if it
+ *			has none.
+ * @param count		Number of services.
+ * @return		New table, or NULL if out of memory.
+ */
+fod_table_t *
+build_placement(fod_t **domains, char **rg_names, char **domainnames,
+		int count)
+{
+	fod_table_t *table;
+	fod_place_t *place;
+	unsigned int slot;
+	int x;
+
+	table = malloc(sizeof(*table));
+	if (!table)
+		return NULL;
+	memset(table, 0, sizeof(*table));
+
+	table->ft_size = 16;
+	while (table->ft_size < count * 2)
+		table->ft_size <<= 1;
+
+	table->ft_slots = calloc(table->ft_size, sizeof(fod_place_t *));
+	table->ft_places = calloc(count ? count : 1, sizeof(fod_place_t));
+	if (!table->ft_slots || !table->ft_places)
+		goto out_fail;
+
+	for (x = 0; x < count; x++) {
+		place = &table->ft_places[table->ft_count++];
+		place->fp_name = strdup(rg_names[x]);
+		if (!place->fp_name)
+			goto out_fail;
+		place->fp_hash = place_hash(place->fp_name);
+
+		if (place_domain(place, domains, domainnames[x]) != 0)
+			goto out_fail;
+
+		/* Open addressing; the table is at most half full */
+		slot = place->fp_hash & (table->ft_size - 1);
+		while (table->ft_slots[slot])
+			slot = (slot + 1) & (table->ft_size - 1);
+		table->ft_slots[slot] = place;
+	}
+
+	return table;
+
+out_fail:
+	destroy_placement(table);
+	return NULL;
+}
+
+
+fod_place_t *
+find_placement(fod_table_t *table, const char *rg_name)
+{
+	fod_place_t *place;
+	unsigned int hash, slot;
+
+	if (!table)
+		return NULL;
+
+	hash = place_hash(rg_name);
+	slot = hash & (table->ft_size - 1);
+	while ((place = table->ft_slots[slot])) {
+		if (place->fp_hash == hash && !strcmp(place->fp_name, rg_name))
+			return place;
+		slot = (slot + 1) & (table->ft_size - 1);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * node_should_start(), from a placement table entry and a membership
+ * mask.  Gives the same answers without a domain lookup or a lock.
+ *
+ * @param place		The service's placement; must not be
+ *			FP_UNRESOLVED.
+ * @param nodeid	The node ID in question.
+ * @param online	Current membership mask.
+ * @param svc_state	Current state of the service.  Only used if the
+ *			domain is nofailback; NULL there means the state
+ *			could not be read, which is FOD_BEST.
+ * @return		FOD_ILLEGAL .. FOD_BEST
+ */
+int
+place_should_start(fod_place_t *place, int nodeid, memb_mask_t *online,
+		   rg_state_t *svc_state)
+{
+	int x, online_prio = -1, myprio = -1;
+	int ordered, restricted, nofailback;
+	int owned_by_node = 0, started = 0, no_owner = 0;
+
+	if (!memb_mask_online(online, nodeid))
+		return FOD_ILLEGAL;
+
+	if (place->fp_state == FP_NODOMAIN)
+		return FOD_BEST;
+
+	nofailback = !!(place->fp_flags & FOD_NOFAILBACK);
+	restricted = !!(place->fp_flags & FOD_RESTRICTED);
+	ordered = !!(place->fp_flags & FOD_ORDERED);
+
+	if (nofailback) {
+		if (!svc_state)
+			return FOD_BEST;
+		if (svc_state->rs_state == RG_STATE_STARTED)
+			started = 1;
+		if (svc_state->rs_owner == (uint32_t)nodeid)
+			owned_by_node = 1;
+		if (!memb_mask_online(online, (int)svc_state->rs_owner))
+			no_owner = 1;
+	}
+
+	/* The first online node has the lowest priority value of those
+	   online.  We're online, so we'll be found if we're a member. */
+	for (x = 0; x < place->fp_count; x++) {
+		if (!memb_mask_online(online, place->fp_nodes[x]))
+			continue;
+		if (online_prio < 0)
+			online_prio = place->fp_prios[x];
+		if (place->fp_nodes[x] == nodeid) {
+			myprio = place->fp_prios[x];
+			break;
+		}
+	}
+
+	if (online_prio < 0)
+		/* No domain members online */
+		return restricted ? FOD_ILLEGAL : FOD_BEST;
+
+	if (myprio < 0)
+		/* Not a member, but a member is online */
+		return restricted ? FOD_ILLEGAL : FOD_GOOD;
+
+	if (myprio > online_prio) {
+		/* Member, but not the most preferred one online */
+		if (!ordered)
+			return FOD_BEST;
+		if (nofailback && started && owned_by_node && !no_owner)
+			return FOD_BEST;
+		return FOD_BETTER;
+	}
+
+	/* Most preferred online member */
+	if (nofailback && started && !owned_by_node && !no_owner)
+		return FOD_BETTER;
+	return FOD_BEST;
+}
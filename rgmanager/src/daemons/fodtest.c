@@ -0,0 +1,374 @@
+/*
+  Failover domain placement table test.  Makes up random failover
+  domains and services, then compares what place_should_start() says
+  about each node against node_should_start() over random memberships
+  and service states.  The group property, cluster lock and service
+  state calls node_should_start() makes are answered from the same
+  made-up data.
+
+  Exits nonzero on any disagreement.  Not installed; 'make check' runs
+  it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <list.h>
+#include <resgroup.h>
+#include <members.h>
+#include <fo_domain.h>
+#include <restart_counter.h>
+#include <reslist.h>
+#include <groups.h>
+#include <ccs.h>
+
+#define MAX_NODES	16
+#define MAX_DOMAINS	8
+#define MAX_SERVICES	32
+
+static int failures;
+
+/* Current service state, for node_should_start()'s get_rg_state() */
+static rg_state_t cur_state;
+
+/* Service name -> domain attribute; NULL if it has none */
+static char *svc_names[MAX_SERVICES];
+static char *svc_domains[MAX_SERVICES];
+static int nservices;
+
+
+int
+ccs_get(int __attribute__((unused)) desc,
+	const char __attribute__((unused)) *query,
+	char __attribute__((unused)) **rtn)
+{
+	return -1;
+}
+
+
+int
+group_property(const char *groupname, const char *property, char *ret,
+	       size_t len)
+{
+	int x;
+
+	if (strcasecmp(property, "domain"))
+		return -1;
+
+	for (x = 0; x < nservices; x++) {
+		if (strcmp(svc_names[x], groupname))
+			continue;
+		if (!svc_domains[x])
+			return -1;
+		strncpy(ret, svc_domains[x], len);
+		return 0;
+	}
+
+	return -1;
+}
+
+
+int
+rg_lock(const char __attribute__((unused)) *name,
+	struct dlm_lksb __attribute__((unused)) *p)
+{
+	return 0;
+}
+
+
+int
+rg_unlock(struct dlm_lksb __attribute__((unused)) *p)
+{
+	return 0;
+}
+
+
+int
+get_rg_state(const char *name, rg_state_t *svcblk)
+{
+	memcpy(svcblk, &cur_state, sizeof(*svcblk));
+	strncpy(svcblk->rs_name, name, sizeof(svcblk->rs_name) - 1);
+	return 0;
+}
+
+
+/**
+  Make up <count> domains over the given node IDs, with random flags,
+  members and priorities.  Unordered domains' priorities are 0, as
+  construct_domains() leaves them.
+ */
+static void
+make_domains(fod_t **domains, int count, int *nodeids, int nnodes)
+{
+	fod_t *fod;
+	fod_node_t *fodn;
+	char buf[64];
+	int x, y;
+
+	for (x = 0; x < count; x++) {
+		fod = calloc(1, sizeof(*fod));
+		snprintf(buf, sizeof(buf), "domain%d", x);
+		fod->fd_name = strdup(buf);
+		fod->fd_flags = random() & (FOD_ORDERED | FOD_RESTRICTED |
+					    FOD_NOFAILBACK);
+
+		/* Every so often, an empty domain */
+		for (y = 0; y < nnodes && (x % 7); y++) {
+			if (random() % 3 == 0)
+				continue;
+
+			fodn = calloc(1, sizeof(*fodn));
+			snprintf(buf, sizeof(buf), "node%d", nodeids[y]);
+			fodn->fdn_name = strdup(buf);
+			fodn->fdn_nodeid = nodeids[y];
+			if (fod->fd_flags & FOD_ORDERED)
+				fodn->fdn_prio = random() % 4;
+			list_insert(&fod->fd_nodes, fodn);
+		}
+
+		list_insert(domains, fod);
+	}
+}
+
+
+/**
+  Services with no domain, one of the domains (in whatever case), or a
+  domain which doesn't exist.
+ */
+static void
+make_services(int count, int ndomains)
+{
+	char buf[64];
+	int x, d;
+
+	for (x = 0; x < count; x++) {
+		snprintf(buf, sizeof(buf), "service:svc%d", x);
+		svc_names[x] = strdup(buf);
+
+		d = random() % (ndomains + 2);
+		if (d == ndomains) {
+			svc_domains[x] = NULL;
+			continue;
+		}
+		if (d == ndomains + 1)
+			snprintf(buf, sizeof(buf), "nodomain%d", x);
+		else
+			snprintf(buf, sizeof(buf), (x & 1) ? "DOMAIN%d" :
+				 "domain%d", d);
+		svc_domains[x] = strdup(buf);
+	}
+	nservices = count;
+}
+
+
+static void
+random_membership(cluster_member_list_t *ml)
+{
+	int x;
+
+	for (x = 0; x < ml->cml_count; x++)
+		ml->cml_members[x].cn_member = !!(random() % 3);
+}
+
+
+static void
+random_state(int *nodeids, int nnodes)
+{
+	static const int states[] = {
+		RG_STATE_STARTED, RG_STATE_STARTED, RG_STATE_STOPPED,
+		RG_STATE_STARTING, RG_STATE_FAILED
+	};
+	int x;
+
+	memset(&cur_state, 0, sizeof(cur_state));
+	cur_state.rs_state = states[random() % 5];
+
+	/* Owner: a node in the cluster, nobody, or a node we don't know */
+	x = random() % (nnodes + 2);
+	if (x < nnodes)
+		cur_state.rs_owner = nodeids[x];
+	else if (x == nnodes)
+		cur_state.rs_owner = 0;
+	else
+		cur_state.rs_owner = 1000;
+}
+
+
+static const char *
+flag_str(int flags)
+{
+	static char buf[8];
+
+	snprintf(buf, sizeof(buf), "%c%c%c",
+		 (flags & FOD_ORDERED) ? 'O' : '-',
+		 (flags & FOD_RESTRICTED) ? 'R' : '-',
+		 (flags & FOD_NOFAILBACK) ? 'N' : '-');
+	return buf;
+}
+
+
+/**
+  One made-up cluster: nodes, domains and services, then <rounds>
+  memberships.  Every node, and one not in the cluster, is asked about
+  every service, each time with a different service state.
+ */
+static void
+run_config(int rounds, int *checked, int *unresolved)
+{
+	fod_t *domains = NULL, *fod;
+	fod_table_t *table;
+	fod_place_t *place;
+	cluster_member_list_t ml;
+	memb_mask_t online;
+	int nodeids[MAX_NODES + 1];
+	int nnodes, ndomains, r, x, y, a, b;
+
+	/* Node IDs needn't be dense */
+	nnodes = 2 + random() % (MAX_NODES - 1);
+	for (x = 0, y = 0; x < nnodes; x++) {
+		y += 1 + random() % 40;
+		nodeids[x] = y;
+	}
+	nodeids[nnodes] = y + 1;
+
+	memset(&ml, 0, sizeof(ml));
+	ml.cml_count = nnodes;
+	ml.cml_members = calloc(MAX_NODES, sizeof(cman_node_t));
+	if (!ml.cml_members) {
+		printf("Out of memory\n");
+		exit(1);
+	}
+	for (x = 0; x < nnodes; x++) {
+		ml.cml_members[x].cn_nodeid = nodeids[x];
+		snprintf(ml.cml_members[x].cn_name,
+			 sizeof(ml.cml_members[x].cn_name), "node%d",
+			 nodeids[x]);
+	}
+
+	ndomains = 1 + random() % MAX_DOMAINS;
+	make_domains(&domains, ndomains, nodeids, nnodes);
+	make_services(1 + random() % MAX_SERVICES, ndomains);
+
+	/* Sometimes a domain node has no node ID, and can only be
+	   matched by name */
+	if (random() % 4 == 0) {
+		list_do(&domains, fod) {
+			if (fod->fd_nodes) {
+				fod->fd_nodes->fdn_nodeid = -1;
+				break;
+			}
+		} while (!list_done(&domains, fod));
+	}
+
+	table = build_placement(&domains, svc_names, svc_domains, nservices);
+	if (!table) {
+		printf("Out of memory\n");
+		exit(1);
+	}
+
+	for (r = 0; r < rounds; r++) {
+		random_membership(&ml);
+		if (memb_mask_init(&online, &ml) != 0) {
+			printf("Out of memory\n");
+			exit(1);
+		}
+
+		for (x = 0; x < nservices; x++) {
+			place = find_placement(table, svc_names[x]);
+			if (!place) {
+				if (failures++ < 10)
+					printf("FAIL %s not in table\n",
+					       svc_names[x]);
+				continue;
+			}
+			if (place->fp_state == FP_UNRESOLVED) {
+				++*unresolved;
+				continue;
+			}
+
+			for (y = 0; y <= nnodes; y++) {
+				random_state(nodeids, nnodes);
+
+				a = node_should_start(nodeids[y], &ml,
+						      svc_names[x], &domains);
+				b = place_should_start(place, nodeids[y],
+						       &online, &cur_state);
+				++*checked;
+				if (a == b)
+					continue;
+
+				if (failures++ < 10)
+					printf("FAIL %s (%s %s) node %d: "
+					       "node_should_start %d, "
+					       "table %d\n", svc_names[x],
+					       svc_domains[x] ? svc_domains[x] :
+					       "no domain",
+					       flag_str(place->fp_flags),
+					       nodeids[y], a, b);
+			}
+		}
+
+		memb_mask_free(&online);
+	}
+
+	if (find_placement(table, "service:nothere")) {
+		printf("FAIL found a service which doesn't exist\n");
+		++failures;
+	}
+
+	destroy_placement(table);
+	deconstruct_domains(&domains);
+	for (x = 0; x < nservices; x++) {
+		free(svc_names[x]);
+		if (svc_domains[x])
+			free(svc_domains[x]);
+	}
+	free(ml.cml_members);
+}
+
+
+static void
+usage(const char *arg0)
+{
+	printf("usage: %s [-s seed] [-c configs] [-n rounds]\n", arg0);
+	exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	int seed = 1, configs = 100, rounds = 200;
+	int x, opt, checked = 0, unresolved = 0;
+
+	while ((opt = getopt(argc, argv, "s:c:n:h")) != EOF) {
+		switch (opt) {
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'c':
+			configs = atoi(optarg);
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	srandom(seed);
+	for (x = 0; x < configs; x++)
+		run_config(rounds, &checked, &unresolved);
+
+	printf("%d configurations: %d decisions compared, %d unresolved "
+	       "services skipped\n", configs, checked, unresolved);
+
+	if (failures) {
+		printf("%d failed\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
@@ -30,6 +30,7 @@ static resource_t *_resources = NULL;
 static resource_rule_t *_rules = NULL;
 static resource_node_t *_tree = NULL;
 static fod_t *_domains = NULL;
+static fod_table_t *_placement = NULL;
 
 #ifdef WRAP_LOCKS
 pthread_mutex_t config_mutex = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
@@ -50,6 +51,98 @@ struct status_arg {
 };
 
 
+/**
+   node_should_start(), answered from the placement table when we can.
+   Nofailback domains need the service's state; we use our local copy
+   rather than taking the cluster lock for it.  Requires read lock.
+
+   @param online	Mask of the online members of membership, or NULL
+			to build one for this call.
+   @see node_should_start, place_should_start
+ */
+static int
+_node_should_start(uint32_t nodeid, cluster_member_list_t *membership,
+		   memb_mask_t *online, const char *rg_name)
+{
+	fod_place_t *place;
+	rg_state_t svc_state;
+	memb_mask_t mask;
+	int ret;
+
+	place = find_placement(_placement, rg_name);
+	if (!place || place->fp_state == FP_UNRESOLVED)
+		goto slow;
+
+	if ((place->fp_flags & FOD_NOFAILBACK) &&
+	    get_rg_state_local(rg_name, &svc_state) != 0)
+		goto slow;
+
+	if (online)
+		return place_should_start(place, nodeid, online, &svc_state);
+
+	if (memb_mask_init(&mask, membership) != 0)
+		goto slow;
+	ret = place_should_start(place, nodeid, &mask, &svc_state);
+	memb_mask_free(&mask);
+	return ret;
+
+slow:
+	return node_should_start(nodeid, membership, rg_name, &_domains);
+}
+
+
+/**
+   Rebuild the placement table from the current services and domains.
+   Requires write lock.  If we run out of memory, there is no table and
+   everything goes through node_should_start().
+ */
+static void
+_build_placement(void)
+{
+	resource_node_t *node;
+	char **names = NULL, **domains = NULL, domainname[128];
+	int x, count = 0;
+
+	destroy_placement(_placement);
+	_placement = NULL;
+
+	list_for(&_tree, node, count) { }
+
+	names = calloc(count ? count : 1, sizeof(char *));
+	domains = calloc(count ? count : 1, sizeof(char *));
+	if (!names || !domains)
+		goto out;
+
+	list_for(&_tree, node, x) {
+		names[x] = malloc(64);
+		if (!names[x])
+			goto out;
+		res_build_name(names[x], 64, node->rn_resource);
+
+		memset(domainname, 0, sizeof(domainname));
+		if (_group_property(names[x], "domain", domainname,
+				    sizeof(domainname) - 1) != 0)
+			continue;
+		domains[x] = strdup(domainname);
+		if (!domains[x])
+			goto out;
+	}
+
+	_placement = build_placement(&_domains, names, domains, count);
+out:
+	for (x = 0; x < count; x++) {
+		if (names && names[x])
+			free(names[x]);
+		if (domains && domains[x])
+			free(domains[x]);
+	}
+	if (names)
+		free(names);
+	if (domains)
+		free(domains);
+}
+
+
 /**
    See if a given node ID should start a resource, given cluster membership
 
@@ -62,7 +155,7 @@ node_should_start_safe(uint32_t nodeid, cluster_member_list_t *membership,
 	int ret;
 
 	pthread_rwlock_rdlock(&resource_lock);
-	ret = node_should_start(nodeid, membership, rg_name, &_domains);
+	ret = _node_should_start(nodeid, membership, NULL, rg_name);
 	pthread_rwlock_unlock(&resource_lock);
 
 	return ret;
@@ -311,6 +404,7 @@ best_target_node(cluster_member_list_t *allowed, uint32_t owner,
 	char *val;
 	resource_t *res;
 	int exclusive;
+	memb_mask_t online, *onlinep = &online;
 
 	if (lock)
 		pthread_rwlock_rdlock(&resource_lock);
@@ -318,6 +412,9 @@ best_target_node(cluster_member_list_t *allowed, uint32_t owner,
 	if (lock)
 		pthread_rwlock_unlock(&resource_lock);
 
+	if (memb_mask_init(&online, allowed) != 0)
+		onlinep = NULL;
+
 	for (x=0; x < allowed->cml_count; x++) {
 		if (!allowed->cml_members[x].cn_member)
 			continue;
@@ -330,7 +427,7 @@ best_target_node(cluster_member_list_t *allowed, uint32_t owner,
 		
 		if (lock)
 			pthread_rwlock_rdlock(&resource_lock);
-		score = node_should_start(nodeid, allowed, rg_name, &_domains);
+		score = _node_should_start(nodeid, allowed, onlinep, rg_name);
 		if (!score) { /* Illegal -- failover domain constraint */
 			if (lock)
 				pthread_rwlock_unlock(&resource_lock);
@@ -369,6 +466,8 @@ best_target_node(cluster_member_list_t *allowed, uint32_t owner,
 		highscore = score;
 	}
 
+	if (onlinep)
+		memb_mask_free(onlinep);
 	return highnode;
 }
 
@@ -459,7 +558,7 @@ out_free:
  */
 static void
 consider_start(resource_node_t *node, char *svcName, rg_state_t *svcStatus,
-	       cluster_member_list_t *membership)
+	       cluster_member_list_t *membership, memb_mask_t *online)
 {
 	char *val;
 	cman_node_t *mp;
@@ -560,8 +659,8 @@ consider_start(resource_node_t *node, char *svcName, rg_state_t *svcStatus,
 	 * Start any stopped services, or started services
 	 * that are owned by a down node.
 	 */
-	fod_ret = node_should_start(mp->cn_nodeid, membership,
-				    svcName, &_domains);
+	fod_ret = _node_should_start(mp->cn_nodeid, membership, online,
+				     svcName);
 	if (fod_ret == FOD_BEST)
 		rt_enqueue_request(svcName, RG_START, NULL, 0, mp->cn_nodeid,
 				   0, 0);
@@ -572,7 +671,7 @@ consider_start(resource_node_t *node, char *svcName, rg_state_t *svcStatus,
 
 static void
 consider_relocate(const char *svcName, rg_state_t *svcStatus, uint32_t nodeid,
-		  cluster_member_list_t *membership)
+		  cluster_member_list_t *membership, memb_mask_t *online)
 {
 	int a, b, req = RG_RELOCATE;
 
@@ -595,8 +694,8 @@ consider_relocate(const char *svcName, rg_state_t *svcStatus, uint32_t nodeid,
 		return;
 	}
 #endif
-	a = node_should_start(nodeid, membership, svcName, &_domains);
-	b = node_should_start(my_id(), membership, svcName, &_domains);
+	a = _node_should_start(nodeid, membership, online, svcName);
+	b = _node_should_start(my_id(), membership, online, svcName);
 
 	if (a <= b)
 		return;
@@ -683,6 +782,7 @@ eval_groups(int local, uint32_t nodeid, int nodeStatus)
 	resource_node_t *node;
 	rg_state_t svcStatus;
 	cluster_member_list_t *membership;
+	memb_mask_t online, *onlinep = &online;
 	int ret;
 
 	if (rg_locked()) {
@@ -692,6 +792,8 @@ eval_groups(int local, uint32_t nodeid, int nodeStatus)
 	}
 
 	membership = member_list();
+	if (memb_mask_init(&online, membership) != 0)
+		onlinep = NULL;
 
 	pthread_rwlock_rdlock(&resource_lock);
 
@@ -712,6 +814,8 @@ eval_groups(int local, uint32_t nodeid, int nodeStatus)
 			       strerror(-ret));
 			pthread_rwlock_unlock(&resource_lock);
 			free_member_list(membership);
+			if (onlinep)
+				memb_mask_free(onlinep);
 			return ret;
 		}
 		
@@ -746,7 +850,8 @@ eval_groups(int local, uint32_t nodeid, int nodeStatus)
 		if ((local && nodeStatus) ||
 		    svcStatus.rs_state == RG_STATE_STOPPED) {
 
-			consider_start(node, svcName, &svcStatus, membership);
+			consider_start(node, svcName, &svcStatus, membership,
+				       onlinep);
 
 		} else if (!local && !nodeStatus) {
 
@@ -754,7 +859,8 @@ eval_groups(int local, uint32_t nodeid, int nodeStatus)
 			 * Start any stopped services, or started services
 			 * that are owned by a down node.
 			 */
-			consider_start(node, svcName, &svcStatus, membership);
+			consider_start(node, svcName, &svcStatus, membership,
+				       onlinep);
 
 			/*
 			 * TODO
@@ -765,13 +871,15 @@ eval_groups(int local, uint32_t nodeid, int nodeStatus)
 			/* Send to the node if that ndoe is a better
 			   owner for this service */
 			consider_relocate(svcName, &svcStatus, nodeid,
-					  membership);
+					  membership, onlinep);
 		}
 
 	} while (!list_done(&_tree, node));
 
 	pthread_rwlock_unlock(&resource_lock);
 	free_member_list(membership);
+	if (onlinep)
+		memb_mask_free(onlinep);
 
 	logt_print(LOG_DEBUG, "Event (%d:%d:%d) Processed\n", local,
 	       (int)nodeid, nodeStatus);
@@ -794,6 +902,7 @@ group_event(const char __attribute__ ((unused)) *rg_name,
 	resource_node_t *node;
 	rg_state_t svcStatus;
 	cluster_member_list_t *membership;
+	memb_mask_t online, *onlinep = &online;
 	int depend;
 
 	if (rg_locked()) {
@@ -805,6 +914,8 @@ group_event(const char __attribute__ ((unused)) *rg_name,
 	membership = member_list();
 	if (!membership)
 		return -1;
+	if (memb_mask_init(&online, membership) != 0)
+		onlinep = NULL;
 
 	pthread_rwlock_rdlock(&resource_lock);
 
@@ -853,7 +964,8 @@ group_event(const char __attribute__ ((unused)) *rg_name,
 			       "%s\n", svcName,
 			       rg_state_str(svcStatus.rs_state),
 			       nodeName);
-			consider_start(node, svcName, &svcStatus, membership);
+			consider_start(node, svcName, &svcStatus, membership,
+				       onlinep);
 			continue;
 		}
 		
@@ -875,6 +987,8 @@ group_event(const char __attribute__ ((unused)) *rg_name,
 
 	pthread_rwlock_unlock(&resource_lock);
 	free_member_list(membership);
+	if (onlinep)
+		memb_mask_free(onlinep);
 
 	return 0;
 }
@@ -1759,6 +1873,7 @@ init_resource_groups(int reconfigure, int do_init)
 	if (_domains)
 		deconstruct_domains(&_domains);
 	_domains = domains;
+	_build_placement();
 	if (master_event_table)
 		deconstruct_events(&master_event_table);
 	master_event_table = evt;
@@ -1921,6 +2036,8 @@ kill_resource_groups(void)
 	destroy_resources(&_resources);
 	destroy_resource_rules(&_rules);
 	deconstruct_domains(&_domains);
+	destroy_placement(_placement);
+	_placement = NULL;
 
 	pthread_rwlock_unlock(&resource_lock);
 }
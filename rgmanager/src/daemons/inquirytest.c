@@ -0,0 +1,335 @@
+/*
+  Test for inquire_owner(), the status inquiry get_new_owner() sends
+  when a migratory service has left this node.  Each "node" is a thread
+  on the far end of a local socket pair, wrapped in an MSG_SOCKET
+  context, which answers after a delay, answers and says it doesn't
+  have the service, hangs up, or never answers at all.
+
+  Checks that the first node with the service is found without waiting
+  for the slow ones, that the answers are waited for together rather
+  than one after another, and that a node which never answers only
+  costs the shared timeout.  Then inquire_nodes(), the batches it opens
+  contexts in and what it does when it runs out of them.  Not installed;
+  'make check' runs it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <rg_types.h>
+#include <resgroup.h>
+#include <platform.h>
+#include <msgsimple.h>
+#include <message.h>
+
+#define MAX_PEERS	16
+#define MAX_NODES	40
+
+/* What a peer does with the inquiry */
+#define P_NOTHERE	0	/* answers RG_EFAIL */
+#define P_HERE		1	/* answers RG_SUCCESS, with its node ID */
+#define P_HANGUP	2	/* closes the connection */
+#define P_SILENT	3	/* never answers */
+#define P_EMPTY		4	/* answers, but it's received as 0 bytes */
+
+struct peer {
+	pthread_t	p_thread;
+	msgctx_t	p_ctx;		/* far end */
+	int		p_nodeid;
+	int		p_action;
+	int		p_delay_ms;
+};
+
+static int failures;
+
+/* Socket contexts, with msg_close() counted and with msg_receive()
+   returning 0 for P_EMPTY */
+static msg_ops_t counted_ops, empty_ops;
+static msg_close_t sock_close;
+static msg_receive_t sock_receive;
+static int ctx_held, ctx_most;
+
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static int
+counted_close(msgctx_t *ctx)
+{
+	--ctx_held;
+	return sock_close(ctx);
+}
+
+
+static int
+empty_receive(msgctx_t *ctx, void *msg, size_t maxlen, int timeout)
+{
+	sock_receive(ctx, msg, maxlen, timeout);
+	return 0;
+}
+
+
+static void
+sock_ctx(msgctx_t *ctx, int fd)
+{
+	sock_msg_init(ctx);
+	ctx->u.local_info.sockfd = fd;
+	ctx->flags = (SKF_READ | SKF_WRITE);
+
+	if (!sock_close) {
+		sock_close = ctx->ops->mo_close;
+		sock_receive = ctx->ops->mo_receive;
+		counted_ops = *ctx->ops;
+		counted_ops.mo_close = counted_close;
+		empty_ops = *ctx->ops;
+		empty_ops.mo_receive = empty_receive;
+	}
+}
+
+
+static void *
+peer_thread(void *arg)
+{
+	struct peer *p = arg;
+	SmMessageSt msg;
+	char buf[64];
+
+	if (msg_receive(&p->p_ctx, &msg, sizeof(msg), 5) != sizeof(msg)) {
+		printf("FAIL node %d: no inquiry\n", p->p_nodeid);
+		++failures;
+		goto out;
+	}
+	swab_SmMessageSt(&msg);
+	if (msg.sm_data.d_action != RG_STATUS_INQUIRY ||
+	    strcmp(msg.sm_data.d_svcName, "vm:guest")) {
+		printf("FAIL node %d: bad inquiry\n", p->p_nodeid);
+		++failures;
+	}
+
+	usleep(p->p_delay_ms * 1000);
+
+	switch(p->p_action) {
+	case P_HANGUP:
+		goto out;
+	case P_SILENT:
+		break;
+	default:
+		msg.sm_data.d_ret = (p->p_action == P_HERE) ?
+				    RG_SUCCESS : RG_EFAIL;
+		msg.sm_data.d_svcOwner = (p->p_action == P_HERE) ?
+					 p->p_nodeid : -1;
+		swab_SmMessageSt(&msg);
+		msg_send(&p->p_ctx, &msg, sizeof(msg));
+		break;
+	}
+
+	/* Wait for the asking side to hang up */
+	while (read(p->p_ctx.u.local_info.sockfd, buf, sizeof(buf)) > 0);
+out:
+	msg_close(&p->p_ctx);
+	return NULL;
+}
+
+
+/**
+  Start one peer per action/delay pair, ask them, and check the answer
+  and how long it took.
+ */
+static void
+run(const char *desc, int timeout, int want_owner, double min_secs,
+    double max_secs, int npeers, const int *actions, const int *delays)
+{
+	struct peer peers[MAX_PEERS];
+	msgctx_t ctxs[MAX_PEERS], *open_ctxs[MAX_PEERS];
+	int x, fds[2], owner;
+	double start, elapsed;
+
+	for (x = 0; x < npeers; x++) {
+		if (socketpair(PF_LOCAL, SOCK_STREAM, 0, fds) < 0) {
+			perror("socketpair");
+			exit(1);
+		}
+		sock_ctx(&ctxs[x], fds[0]);
+		if (actions[x] == P_EMPTY)
+			ctxs[x].ops = &empty_ops;
+		open_ctxs[x] = &ctxs[x];
+
+		sock_ctx(&peers[x].p_ctx, fds[1]);
+		peers[x].p_nodeid = x + 1;
+		peers[x].p_action = actions[x];
+		peers[x].p_delay_ms = delays[x];
+		pthread_create(&peers[x].p_thread, NULL, peer_thread,
+			       &peers[x]);
+	}
+
+	start = now();
+	owner = inquire_owner(open_ctxs, npeers, "vm:guest", timeout);
+	elapsed = now() - start;
+
+	for (x = 0; x < npeers; x++)
+		msg_close(&ctxs[x]);
+	for (x = 0; x < npeers; x++)
+		pthread_join(peers[x].p_thread, NULL);
+
+	if (owner != want_owner || elapsed < min_secs || elapsed > max_secs) {
+		printf("FAIL %s: owner %d in %.2fs, expected %d in "
+		       "%.1f-%.1fs\n", desc, owner, elapsed, want_owner,
+		       min_secs, max_secs);
+		++failures;
+		return;
+	}
+	printf("%s: owner %d in %.2fs\n", desc, owner, elapsed);
+}
+
+
+/* Contexts for inquire_nodes(), each with a peer started for its node.
+   Opening fails once ctx_limit of them are held, as msg_open() does when
+   the daemon is out of contexts. */
+
+static struct peer node_peers[MAX_NODES];
+static int node_owner, ctx_limit, nopened;
+
+
+static int
+open_peer(int nodeid, msgctx_t *ctx)
+{
+	struct peer *p = &node_peers[nopened];
+	int fds[2];
+
+	if (ctx_held >= ctx_limit)
+		return -1;
+
+	if (socketpair(PF_LOCAL, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+	sock_ctx(ctx, fds[0]);
+	ctx->ops = &counted_ops;
+
+	sock_ctx(&p->p_ctx, fds[1]);
+	p->p_nodeid = nodeid;
+	p->p_action = (nodeid == node_owner) ? P_HERE : P_NOTHERE;
+	p->p_delay_ms = 100;
+	pthread_create(&p->p_thread, NULL, peer_thread, p);
+
+	++nopened;
+	if (++ctx_held > ctx_most)
+		ctx_most = ctx_held;
+	return 0;
+}
+
+
+static void
+run_nodes(const char *desc, int nnodes, int limit, int owner_node,
+	  int want_owner, int want_opened, int max_held)
+{
+	int nodeids[MAX_NODES];
+	int x, owner;
+
+	for (x = 0; x < nnodes; x++)
+		nodeids[x] = x + 1;
+	node_owner = owner_node;
+	ctx_limit = limit;
+	ctx_held = ctx_most = nopened = 0;
+
+	owner = inquire_nodes(nodeids, nnodes, "vm:guest", 5, open_peer);
+
+	for (x = 0; x < nopened; x++)
+		pthread_join(node_peers[x].p_thread, NULL);
+
+	if (owner != want_owner || nopened != want_opened ||
+	    ctx_most > max_held || ctx_held) {
+		printf("FAIL %s: owner %d, %d opened, at most %d held, %d "
+		       "left open; expected %d, %d opened, at most %d held\n",
+		       desc, owner, nopened, ctx_most, ctx_held, want_owner,
+		       want_opened, max_held);
+		++failures;
+		return;
+	}
+	printf("%s: owner %d, %d opened, at most %d held\n", desc, owner,
+	       nopened, ctx_most);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	static const int one_here[] =
+		{ P_NOTHERE, P_NOTHERE, P_NOTHERE, P_NOTHERE,
+		  P_NOTHERE, P_HERE, P_NOTHERE, P_NOTHERE };
+	static const int nowhere[] =
+		{ P_NOTHERE, P_NOTHERE, P_NOTHERE, P_NOTHERE,
+		  P_NOTHERE, P_NOTHERE, P_NOTHERE, P_NOTHERE };
+	static const int second[] =
+		{ 1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000 };
+	static const int silent_first[] = { P_SILENT, P_HERE };
+	static const int silent_nothere[] =
+		{ P_SILENT, P_NOTHERE, P_HANGUP, P_NOTHERE };
+	static const int all_here[] = { P_HERE, P_HERE, P_HERE };
+	static const int staggered[] = { 1500, 300, 900 };
+	static const int hangup[] = { P_HANGUP, P_HANGUP, P_HERE };
+	static const int quick[] = { 0, 100, 500 };
+	static const int slow[] = { 1500, 500, 0, 500 };
+	static const int empty[] = { P_EMPTY, P_NOTHERE };
+
+	/* Peers answering after we've stopped listening */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Eight nodes taking a second each; asked one after another,
+	   that would be eight seconds */
+	run("8 nodes, 1 has it", 10, 6, 0.9, 2.5, 8, one_here, second);
+	run("8 nodes, none have it", 10, -1, 0.9, 2.5, 8, nowhere, second);
+
+	/* Whoever answers first wins */
+	run("3 nodes have it", 10, 2, 0.2, 0.8, 3, all_here, staggered);
+
+	/* A node that doesn't answer doesn't hold up one that does */
+	run("hung node, then owner", 10, 2, 0.4, 1.5, 2, silent_first,
+	    staggered + 1);
+
+	/* ... but if nobody has the service, we wait for the timeout */
+	run("hung node, nobody has it", 2, -1, 1.9, 3.5, 4, silent_nothere,
+	    slow);
+
+	/* Closed connections count as answers */
+	run("two nodes hang up", 10, 3, 0.4, 1.5, 3, hangup, quick);
+
+	/* Receiving nothing is as good as no answer */
+	run("empty answer", 5, -1, 0, 1.0, 2, empty, quick);
+
+	run("no nodes", 10, -1, 0, 0.5, 0, NULL, NULL);
+
+	/* The owner is in the third batch */
+	run_nodes("40 nodes in batches", 40, MAX_NODES, 37, 37, 40,
+		  INQUIRY_BATCH);
+	/* ... and found in the first, the rest aren't asked */
+	run_nodes("owner in the first batch", 40, MAX_NODES, 3, 3,
+		  INQUIRY_BATCH, INQUIRY_BATCH);
+	run_nodes("40 nodes, nobody has it", 40, MAX_NODES, 0, -1, 40,
+		  INQUIRY_BATCH);
+
+	/* Out of contexts: ask the nodes whose contexts did open, then
+	   carry on with the rest */
+	run_nodes("3 contexts to spare", 10, 3, 9, 9, 9, 3);
+
+	/* None at all: say nobody has it, as before */
+	run_nodes("no contexts", 5, 0, 1, -1, 0, 0);
+
+	if (failures) {
+		printf("%d failed\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
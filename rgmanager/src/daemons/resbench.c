@@ -0,0 +1,282 @@
+/*
+  Resource list load benchmark.  Builds a synthetic configuration of
+  <count> resources (file systems, IP addresses and the services which
+  use them) in memory, stores each one the way load_resources() and
+  build_resource_tree() do, then resolves every reference the service
+  trees would make.  The rules carry primary, unique and required
+  attributes like the real agents', so the collision checks are the
+  same ones a cluster.conf of that size would go through.
+
+  Exits nonzero if a lookup finds the wrong resource or a collision is
+  missed.  Not installed; 'make check' runs it.
+ */
+#include <libxml/parser.h>
+#include <libxml/xmlmemory.h>
+#include <libxml/xpath.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <list.h>
+#include <restart_counter.h>
+#include <reslist.h>
+
+#ifndef NO_CCS
+#error "Can not be built with CCS support."
+#endif
+
+
+static resource_attr_t fs_attrs[] = {
+	{ (char *)"name", NULL, RA_PRIMARY | RA_UNIQUE, 0 },
+	{ (char *)"device", NULL, RA_UNIQUE | RA_REQUIRED, 0 },
+	{ (char *)"mountpoint", NULL, RA_UNIQUE, 0 },
+	{ (char *)"fstype", NULL, 0, 0 },
+	{ NULL, NULL, 0, 0 }
+};
+
+static resource_attr_t ip_attrs[] = {
+	{ (char *)"address", NULL, RA_PRIMARY | RA_UNIQUE, 0 },
+	{ (char *)"monitor_link", NULL, 0, 0 },
+	{ NULL, NULL, 0, 0 }
+};
+
+static resource_attr_t svc_attrs[] = {
+	{ (char *)"name", NULL, RA_PRIMARY | RA_UNIQUE | RA_REQUIRED, 0 },
+	{ (char *)"domain", NULL, 0, 0 },
+	{ NULL, NULL, 0, 0 }
+};
+
+static resource_rule_t rules[] = {
+	{ .rr_type = (char *)"fs", .rr_attrs = fs_attrs },
+	{ .rr_type = (char *)"ip", .rr_attrs = ip_attrs },
+	{ .rr_type = (char *)"service", .rr_attrs = svc_attrs },
+};
+
+#define FS	0
+#define IP	1
+#define SVC	2
+
+static int failures;
+
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void
+check(int cond, const char *what, int x)
+{
+	if (cond)
+		return;
+	if (failures++ < 10)
+		printf("FAIL %s (%d)\n", what, x);
+}
+
+
+/**
+  Make a resource of the given type from its attribute values, in rule
+  order.  Values are printf formats taking <x>.
+ */
+static resource_t *
+make_resource(int type, int x, ...)
+{
+	resource_rule_t *rule = &rules[type];
+	resource_t *res;
+	const char *fmt;
+	char buf[128];
+	va_list ap;
+	int i;
+
+	res = calloc(1, sizeof(*res));
+	if (!res) {
+		printf("Out of memory\n");
+		exit(1);
+	}
+	pthread_mutex_init(&res->r_mutex, NULL);
+	res->r_rule = rule;
+
+	va_start(ap, x);
+	for (i = 0; rule->rr_attrs[i].ra_name; i++) {
+		fmt = va_arg(ap, const char *);
+		snprintf(buf, sizeof(buf), fmt, x);
+		if (store_attribute(&res->r_attrs,
+				    strdup(rule->rr_attrs[i].ra_name),
+				    strdup(buf),
+				    rule->rr_attrs[i].ra_flags) != 0) {
+			printf("Out of memory\n");
+			exit(1);
+		}
+	}
+	va_end(ap);
+
+	return res;
+}
+
+
+static resource_t *
+make_fs(int x)
+{
+	return make_resource(FS, x, "fs%d", "/dev/vg/lv%d", "/mnt/%d",
+			     "ext3");
+}
+
+
+static resource_t *
+make_ip(int x)
+{
+	return make_resource(IP, x, "10.%d.0.1", "1");
+}
+
+
+static resource_t *
+make_svc(int x)
+{
+	return make_resource(SVC, x, "svc%d", "dom");
+}
+
+
+static void
+usage(const char *arg0)
+{
+	printf("usage: %s [-n count]\n", arg0);
+	exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	resource_t *reslist = NULL, *res, **byname;
+	char ref[64];
+	double start, t_store, t_ref, t_root;
+	int count = 10000, nsvc, nfs, x, opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != EOF) {
+		switch (opt) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* Each service gets two file systems and two addresses */
+	nsvc = count / 5;
+	nfs = nsvc * 2;
+	if (nsvc < 1)
+		usage(argv[0]);
+
+	byname = calloc(nfs, sizeof(*byname));
+	if (!byname) {
+		printf("Out of memory\n");
+		return 1;
+	}
+
+	/* load_resources(): <resources> section, then the services */
+	start = now();
+	for (x = 0; x < nfs; x++) {
+		res = make_fs(x);
+		byname[x] = res;
+		check(store_resource(&reslist, res) == 0, "store fs", x);
+		res = make_ip(x);
+		check(store_resource(&reslist, res) == 0, "store ip", x);
+	}
+	for (x = 0; x < nsvc; x++)
+		check(store_resource(&reslist, make_svc(x)) == 0,
+		      "store service", x);
+	t_store = now() - start;
+
+	/* build_resource_tree(): every child is a ref= */
+	start = now();
+	for (x = 0; x < nfs; x++) {
+		snprintf(ref, sizeof(ref), "fs%d", x);
+		check(find_resource_by_ref(&reslist, "fs", ref) == byname[x],
+		      "fs by name", x);
+		snprintf(ref, sizeof(ref), "10.%d.0.1", x);
+		res = find_resource_by_ref(&reslist, "ip", ref);
+		check(res && !strcmp(primary_attr_value(res), ref),
+		      "ip by address", x);
+	}
+	t_ref = now() - start;
+
+	start = now();
+	for (x = 0; x < nsvc; x++) {
+		snprintf(ref, sizeof(ref), "svc%d", x);
+		res = find_root_by_ref(&reslist, ref);
+		check(res && !strcmp(primary_attr_value(res), ref),
+		      "service by name", x);
+		snprintf(ref, sizeof(ref), "service:svc%d", x);
+		check(find_root_by_ref(&reslist, ref) == res,
+		      "service by type:name", x);
+	}
+	t_root = now() - start;
+
+	/* Unique and required attributes are references too, but the
+	   primary one wins */
+	check(find_resource_by_ref(&reslist, "fs", "/dev/vg/lv3") == byname[3],
+	      "fs by device", 3);
+	check(find_resource_by_ref(&reslist, "fs", "/mnt/3") == NULL,
+	      "fs by mountpoint (not required)", 3);
+	check(find_resource_by_ref(&reslist, "fs", "ext3") == NULL,
+	      "fs by fstype (not unique)", 3);
+	check(find_resource_by_ref(&reslist, "ip", "fs3") == NULL,
+	      "wrong type", 3);
+	check(find_root_by_ref(&reslist, "fs:fs3") == byname[3],
+	      "root lookup of another type", 3);
+	check(find_root_by_ref(&reslist, "svc-none") == NULL,
+	      "no such service", 0);
+
+	/* Collisions; each of these has one key already in use */
+	res = make_fs(nfs);
+	free(res->r_attrs[0].ra_value);
+	res->r_attrs[0].ra_value = strdup("fs1");
+	check(store_resource(&reslist, res) != 0, "primary collision", 1);
+	destroy_resource(res);
+
+	res = make_fs(nfs);
+	free(res->r_attrs[2].ra_value);
+	res->r_attrs[2].ra_value = strdup("/mnt/1");
+	check(store_resource(&reslist, res) != 0, "unique collision", 1);
+	destroy_resource(res);
+
+	res = make_fs(nfs);
+	free(res->r_attrs[3].ra_value);
+	res->r_attrs[3].ra_value = strdup("ext4");
+	check(store_resource(&reslist, res) == 0, "non-unique attr", 1);
+
+	/* An ip whose address happens to be an fs name is fine */
+	res = make_ip(nfs);
+	free(res->r_attrs[0].ra_value);
+	res->r_attrs[0].ra_value = strdup("fs1");
+	check(store_resource(&reslist, res) == 0, "same value, other type",
+	      1);
+	check(find_resource_by_ref(&reslist, "fs", "fs1") == byname[1],
+	      "fs by name after ip", 1);
+	check(find_resource_by_ref(&reslist, "ip", "fs1") == res,
+	      "ip by name of fs", 1);
+
+	printf("%d resources (%d services)\n", nfs * 2 + nsvc, nsvc);
+	printf("store_resource:       %.3fs\n", t_store);
+	printf("find_resource_by_ref: %.3fs (%d lookups)\n", t_ref, nfs * 2);
+	printf("find_root_by_ref:     %.3fs (%d lookups)\n", t_root, nsvc * 2);
+
+	destroy_resources(&reslist);
+	free(byname);
+
+	if (failures) {
+		printf("%d failed\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
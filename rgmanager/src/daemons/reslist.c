@@ -244,6 +244,210 @@ rescmp(resource_t *left, resource_t *right)
 }
 
 
+/*
+   Primary and unique attribute values of the resources in a list are
+   kept in a hash table keyed by (type, value), so that checking a new
+   resource for collisions and resolving references doesn't have to
+   walk the whole list.  The table is shared by all the resources in
+   the list; each resource carries its own keys.  Keys with the same
+   type and value stay in the order their resources were stored.
+ */
+typedef struct _resource_key {
+	struct _resource_key *rk_next;
+	resource_t	*rk_res;
+	int		rk_attr;	/** Index into rk_res->r_attrs */
+	unsigned int	rk_hash;
+} resource_key_t;
+
+typedef struct _resource_index {
+	resource_key_t	**ri_buckets;
+	unsigned int	ri_size;	/** power of 2 */
+	unsigned int	ri_count;
+} resource_index_t;
+
+#define RI_MINSIZE	64
+
+
+static unsigned int
+res_key_hash(const char *type, const char *value)
+{
+	unsigned int h = 5381;
+
+	while (*type)
+		h = (h * 33) ^ (unsigned char)*type++;
+	h = (h * 33);
+	while (*value)
+		h = (h * 33) ^ (unsigned char)*value++;
+
+	return h;
+}
+
+
+static inline int
+res_key_match(resource_key_t *key, unsigned int hash, const char *type,
+	      const char *value)
+{
+	resource_t *res = key->rk_res;
+
+	return key->rk_hash == hash &&
+	       !strcmp(res->r_attrs[key->rk_attr].ra_value, value) &&
+	       !strcmp(res->r_rule->rr_type, type);
+}
+
+
+static inline int
+res_key_attr(resource_attr_t *ra)
+{
+	return ra->ra_value && (ra->ra_flags & (RA_PRIMARY | RA_UNIQUE));
+}
+
+
+/**
+   Return the first key in a list's index for <type>/<value>; walk the
+   rest with res_key_next().
+ */
+static resource_key_t *
+res_key_first(resource_t **reslist, const char *type, const char *value,
+	      unsigned int *hash)
+{
+	resource_index_t *idx;
+	resource_key_t *key;
+
+	if (!*reslist || !(idx = (*reslist)->r_index))
+		return NULL;
+
+	*hash = res_key_hash(type, value);
+	for (key = idx->ri_buckets[*hash & (idx->ri_size - 1)]; key;
+	     key = key->rk_next) {
+		if (res_key_match(key, *hash, type, value))
+			return key;
+	}
+
+	return NULL;
+}
+
+
+static resource_key_t *
+res_key_next(resource_key_t *key, unsigned int hash, const char *type,
+	     const char *value)
+{
+	for (key = key->rk_next; key; key = key->rk_next) {
+		if (res_key_match(key, hash, type, value))
+			return key;
+	}
+
+	return NULL;
+}
+
+
+static void
+res_index_grow(resource_index_t *idx)
+{
+	resource_key_t **buckets, **tail, *key, *next;
+	unsigned int size, x;
+
+	size = idx->ri_size * 4;
+	buckets = calloc(size, sizeof(*buckets));
+	if (!buckets)
+		/* Slower, but still correct */
+		return;
+
+	/* Keep each chain's order; keys with the same hash end up in
+	   the same new chain */
+	for (x = 0; x < idx->ri_size; x++) {
+		for (key = idx->ri_buckets[x]; key; key = next) {
+			next = key->rk_next;
+			key->rk_next = NULL;
+			for (tail = &buckets[key->rk_hash & (size - 1)];
+			     *tail; tail = &(*tail)->rk_next);
+			*tail = key;
+		}
+	}
+
+	free(idx->ri_buckets);
+	idx->ri_buckets = buckets;
+	idx->ri_size = size;
+}
+
+
+/**
+   Add a resource's primary and unique keys to the index of the list
+   it is about to join, creating the index if this is the first
+   resource.
+
+   @return		0 on success, -1 if out of memory.
+ */
+static int
+res_index_add(resource_t **reslist, resource_t *res)
+{
+	resource_index_t *idx;
+	resource_key_t *key, **tail;
+	int x, y, nkeys = 0;
+
+	for (x = 0; res->r_attrs && res->r_attrs[x].ra_name; x++)
+		if (res_key_attr(&res->r_attrs[x]))
+			++nkeys;
+
+	if (*reslist) {
+		idx = (*reslist)->r_index;
+	} else {
+		idx = malloc(sizeof(*idx));
+		if (!idx)
+			return -1;
+		idx->ri_buckets = calloc(RI_MINSIZE, sizeof(*idx->ri_buckets));
+		if (!idx->ri_buckets) {
+			free(idx);
+			return -1;
+		}
+		idx->ri_size = RI_MINSIZE;
+		idx->ri_count = 0;
+	}
+
+	if (nkeys) {
+		res->r_keys = calloc(nkeys, sizeof(*res->r_keys));
+		if (!res->r_keys) {
+			if (!*reslist) {
+				free(idx->ri_buckets);
+				free(idx);
+			}
+			return -1;
+		}
+	}
+
+	if (idx->ri_count + nkeys > idx->ri_size * 2)
+		res_index_grow(idx);
+
+	for (x = 0, y = 0; res->r_attrs && res->r_attrs[x].ra_name; x++) {
+		if (!res_key_attr(&res->r_attrs[x]))
+			continue;
+
+		key = &res->r_keys[y++];
+		key->rk_res = res;
+		key->rk_attr = x;
+		key->rk_hash = res_key_hash(res->r_rule->rr_type,
+					    res->r_attrs[x].ra_value);
+		for (tail = &idx->ri_buckets[key->rk_hash &
+					     (idx->ri_size - 1)];
+		     *tail; tail = &(*tail)->rk_next);
+		*tail = key;
+	}
+	idx->ri_count += nkeys;
+
+	res->r_index = idx;
+	return 0;
+}
+
+
+static void
+res_index_free(resource_index_t *idx)
+{
+	if (!idx)
+		return;
+	free(idx->ri_buckets);
+	free(idx);
+}
+
+
 /**
    Find a resource given its reference.  A reference is the value of the
    primary attribute.
@@ -256,30 +460,20 @@ rescmp(resource_t *left, resource_t *right)
 resource_t *
 find_resource_by_ref(resource_t **reslist, const char *type, const char *ref)
 {
-	resource_t *curr;
+	resource_key_t *key;
 	resource_t *first_possible = NULL;
-	int x, flags = RA_UNIQUE|RA_REQUIRED;
+	unsigned int hash;
+	int flags = RA_UNIQUE|RA_REQUIRED, ra_flags;
 
-	list_do(reslist, curr) {
-		if (strcmp(curr->r_rule->rr_type, type))
-			continue;
+	for (key = res_key_first(reslist, type, ref, &hash); key;
+	     key = res_key_next(key, hash, type, ref)) {
+		ra_flags = key->rk_res->r_attrs[key->rk_attr].ra_flags;
 
-		/*
-		   This should be one operation - the primary attr
-		   is generally at the head of the array.
-		 */
-		for (x = 0; curr->r_attrs && curr->r_attrs[x].ra_name;
-		     x++) {
-			if (strcmp(ref, curr->r_attrs[x].ra_value))
-				continue;
-			if (((curr->r_attrs[x].ra_flags & flags) == flags) &&
-		    	    !first_possible)
-				first_possible = curr;
-			if (!(curr->r_attrs[x].ra_flags & RA_PRIMARY))
-				continue;
-			return curr;
-		}
-	} while (!list_done(reslist, curr));
+		if (ra_flags & RA_PRIMARY)
+			return key->rk_res;
+		if (((ra_flags & flags) == flags) && !first_possible)
+			first_possible = key->rk_res;
+	}
 
 	return first_possible;
 }
@@ -297,11 +491,11 @@ find_resource_by_ref(resource_t **reslist, const char *type, const char *ref)
 resource_t *
 find_root_by_ref(resource_t **reslist, const char *ref)
 {
-	resource_t *curr;
+	resource_key_t *key;
 	char ref_buf[128];
 	char *type;
 	char *name = (char *)ref;
-	int x;
+	unsigned int hash;
 
 	snprintf(ref_buf, sizeof(ref_buf), "%s", ref);
 
@@ -315,25 +509,11 @@ find_root_by_ref(resource_t **reslist, const char *ref)
 		name = (char *)ref;
 	}
 
-	list_do(reslist, curr) {
-
-		/*
-		   This should be one operation - the primary attr
-		   is generally at the head of the array.
-		 */
-		for (x = 0; curr->r_attrs && curr->r_attrs[x].ra_name;
-		     x++) {
-			if (strcmp(type, curr->r_rule->rr_type))
-				continue;
-			if (!(curr->r_attrs[x].ra_flags & RA_PRIMARY))
-				continue;
-			if (strcmp(name, curr->r_attrs[x].ra_value))
-				continue;
-
-			return curr;
-		}
-	} while (!list_done(reslist, curr));
-
+	for (key = res_key_first(reslist, type, name, &hash); key;
+	     key = res_key_next(key, hash, type, name)) {
+		if (key->rk_res->r_attrs[key->rk_attr].ra_flags & RA_PRIMARY)
+			return key->rk_res;
+	}
 
 	return NULL;
 }
@@ -342,8 +522,6 @@ find_root_by_ref(resource_t **reslist, const char *ref)
 /**
    Store a resource in the resource list if it's legal to do so.
    Otherwise, don't store it.
-   Note: This function needs to be rewritten; it's way too long and way
-   too indented.
 
    @param reslist	Resource list to store the new resource.
    @param newres	Resource to store
@@ -352,70 +530,51 @@ find_root_by_ref(resource_t **reslist, const char *ref)
 int
 store_resource(resource_t **reslist, resource_t *newres)
 {
-	resource_t *curr;
-	int x, y;
-
-	if (!*reslist) {
-		/* first resource */
-		list_insert(reslist, newres);
-		return 0;
-	}
+	resource_key_t *key;
+	resource_attr_t *ra;
+	const char *type = newres->r_rule->rr_type;
+	unsigned int hash;
+	int x;
 
-	list_do(reslist, curr) {
+	for (x = 0; newres->r_attrs && newres->r_attrs[x].ra_name; x++) {
+		/*
+		   Look for conflicting primary/unique keys
+		 */
+		ra = &newres->r_attrs[x];
+		if (!res_key_attr(ra))
+			continue;
 
-		if (strcmp(curr->r_rule->rr_type, newres->r_rule->rr_type))
-		    	continue;
+		for (key = res_key_first(reslist, type, ra->ra_value, &hash);
+		     key; key = res_key_next(key, hash, type, ra->ra_value)) {
+			if (key->rk_res->r_attrs[key->rk_attr].ra_flags &
+			    RA_INHERIT)
+				continue;
+			if (strcmp(key->rk_res->r_attrs[key->rk_attr].ra_name,
+				   ra->ra_name))
+				continue;
 
-		for (x = 0; newres->r_attrs && newres->r_attrs[x].ra_name;
-		     x++) {
 			/*
-			   Look for conflicting primary/unique keys
+			   Unique/primary is not unique
 			 */
-			if (!(newres->r_attrs[x].ra_flags &
-			    (RA_PRIMARY | RA_UNIQUE)))
-				continue;
-
-			for (y = 0; curr->r_attrs[y].ra_name; y++) {
-				if (curr->r_attrs[y].ra_flags & RA_INHERIT)
-					continue;
-
-				if (strcmp(curr->r_attrs[y].ra_name,
-					   newres->r_attrs[x].ra_name))
-					continue;
-				if (!strcmp(curr->r_attrs[y].ra_value,
-					    newres->r_attrs[x].ra_value)) {
-					/*
-					   Unique/primary is not unique
-					 */
 #ifdef NO_CCS
-					printf("Error: "
-                                               "%s attribute collision. "
-                                               "type=%s attr=%s value=%s\n",
-					       (newres->r_attrs[x].ra_flags&
-                                                RA_PRIMARY)?"Primary":
-                                               "Unique",
-					       newres->r_rule->rr_type,
-					       newres->r_attrs[x].ra_name,
-					       newres->r_attrs[x].ra_value
-					       );
+			printf("Error: "
+			       "%s attribute collision. "
+			       "type=%s attr=%s value=%s\n",
+			       (ra->ra_flags & RA_PRIMARY)?"Primary":"Unique",
+			       type, ra->ra_name, ra->ra_value);
 #else 
-					logt_print(LOG_ERR,
-                                               "%s attribute collision. "
-                                               "type=%s attr=%s value=%s\n",
-					       (newres->r_attrs[x].ra_flags&
-                                                RA_PRIMARY)?"Primary":
-                                               "Unique",
-					       newres->r_rule->rr_type,
-					       newres->r_attrs[x].ra_name,
-					       newres->r_attrs[x].ra_value
-					       );
+			logt_print(LOG_ERR,
+				   "%s attribute collision. "
+				   "type=%s attr=%s value=%s\n",
+				   (ra->ra_flags & RA_PRIMARY)?"Primary":"Unique",
+				   type, ra->ra_name, ra->ra_value);
 #endif
-					return -1;
-				}
-				break;
-			}
+			return -1;
 		}
-	} while (!list_done(reslist, curr));
+	}
+
+	if (res_index_add(reslist, newres) != 0)
+		return -1;
 
 	list_insert(reslist, newres);
 	return 0;
@@ -516,6 +675,9 @@ destroy_resource(resource_t *res)
 		free(res->r_actions);
 	}
 
+	if (res->r_keys)
+		free(res->r_keys);
+
 	free(res);
 }
 
@@ -530,11 +692,17 @@ void
 destroy_resources(resource_t **list)
 {
 	resource_t *res;
+	resource_index_t *idx = NULL;
+
+	if (*list)
+		idx = (*list)->r_index;
 
 	while ((res = *list)) {
 		list_remove(list, res);
 		destroy_resource(res);
 	}
+
+	res_index_free(idx);
 }
 
 
@@ -880,6 +1048,7 @@ load_resources(int ccsfd, resource_t **reslist, resource_rule_t **rulelist)
 #endif
 
 			       destroy_resource(newres);
+			       continue;
 		       }
 
 		       /* Just information */
@@ -513,11 +513,13 @@ store_attribute(resource_attr_t **attrsp, char *name, char *value, int flags)
    @param stop		Stop level
    @param forbid	Do NOT allow this child type to exist
    @param flags		set to 1 to note that it was defined inline
+   @param parallel	Max. # of children of this type to start or
+			stop at once
    @return		0 on success, nonzero on failure
  */
 static int
 store_childtype(resource_child_t **childp, char *name, int start,
-		int stop, int forbid, int flags)
+		int stop, int forbid, int flags, int parallel)
 {
 	int x = 0;
 	resource_child_t *child = *childp;
@@ -534,6 +536,7 @@ store_childtype(resource_child_t **childp, char *name, int start,
 		child[0].rc_stoplevel = stop;
 		child[0].rc_forbid = forbid;
 		child[0].rc_flags = flags;
+		child[0].rc_parallel = parallel;
 		child[1].rc_name = NULL;
 
 		*childp = child;
@@ -551,6 +554,7 @@ store_childtype(resource_child_t **childp, char *name, int start,
 	child[x].rc_stoplevel = stop;
 	child[x].rc_forbid = forbid;
 	child[x].rc_flags = flags;
+	child[x].rc_parallel = parallel;
 	child[x+1].rc_name = NULL;
 
 	*childp = child;
@@ -671,6 +675,11 @@ children:
 				fprintf(fp, " stoplevel = %d",
 				       rr->rr_childtypes[x].rc_stoplevel);
 			}
+
+			if (rr->rr_childtypes[x].rc_parallel > 1) {
+				fprintf(fp, " parallel = %d",
+				       rr->rr_childtypes[x].rc_parallel);
+			}
 			fprintf(fp, " ] ");
 		}
 
@@ -842,7 +851,7 @@ _get_childtypes(xmlDocPtr doc, xmlXPathContextPtr ctx, char *base,
 		resource_rule_t *rr)
 {
 	char *ret, *childname, xpath[256];
-	int x, startlevel = 0, stoplevel = 0, forbid = 0;
+	int x, startlevel = 0, stoplevel = 0, forbid = 0, parallel = 0;
 
 	for (x = 1; 1; x++) {
 		snprintf(xpath, sizeof(xpath), "%s/child[%d]/@type",
@@ -852,7 +861,7 @@ _get_childtypes(xmlDocPtr doc, xmlXPathContextPtr ctx, char *base,
 		if (!ret)
 			break;
 
-		startlevel = stoplevel = forbid = 0;
+		startlevel = stoplevel = forbid = parallel = 0;
 		childname = ret;
 
 		/*
@@ -886,13 +895,25 @@ _get_childtypes(xmlDocPtr doc, xmlXPathContextPtr ctx, char *base,
 			free(ret);
 		}
 
+		/*
+		   How many children of this type may be started or
+		   stopped at the same time
+		 */
+		snprintf(xpath, sizeof(xpath), "%s/child[%d]/@parallel",
+			 base, x);
+		if ((ret = xpath_get_one(doc,ctx,xpath))) {
+			parallel = atoi(ret);
+			free(ret);
+		}
+
 		/*
 		   Store the attribute.  We'll ensure all required
 		   attributes are present soon.
 		 */
 		if (childname)
 			store_childtype(&rr->rr_childtypes, childname,
-					startlevel, stoplevel, forbid, 0);
+					startlevel, stoplevel, forbid, 0,
+					parallel);
 	}
 
 	return 0;
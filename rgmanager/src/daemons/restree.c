@@ -663,6 +663,21 @@ do_load_resource(int ccsfd, char *base,
 		free(ref);
 	}
 
+	/* Children to start/stop at once; inherited by the subtree */
+	if (parent)
+		node->rn_parallel = parent->rn_parallel;
+	snprintf(tok, sizeof(tok), "%s/@__parallel", base);
+#ifndef NO_CCS
+	if (ccs_get(ccsfd, tok, &ref) == 0) {
+#else
+	if (conf_get(tok, &ref) == 0) {
+#endif
+		node->rn_parallel = atoi(ref);
+		if (node->rn_parallel < 0)
+			node->rn_parallel = 0;
+		free(ref);
+	}
+
 	/* per-resource-node failures / expire times */
 	snprintf(tok, sizeof(tok), "%s/@__max_failures", base);
 #ifndef NO_CCS
@@ -1041,6 +1056,197 @@ dump_resource_tree(FILE *fp, resource_node_t **tree)
 }
 
 
+/**
+   Operations which may be done on several siblings at once.  Status
+   checks stay serial; their results drive recovery.
+ */
+static inline int
+parallel_op(int op)
+{
+	return (op == RS_START || op == RS_STOP ||
+		op == RS_CONDSTART || op == RS_CONDSTOP);
+}
+
+
+/* Level of a child type for an operation; 0 if it has none */
+static inline int
+child_level(resource_rule_t *rule, const char *type, int op)
+{
+	int x;
+
+	for (x = 0; rule->rr_childtypes &&
+	     rule->rr_childtypes[x].rc_name; x++) {
+		if (strcmp(rule->rr_childtypes[x].rc_name, type))
+			continue;
+		if (op == RS_STOP)
+			return rule->rr_childtypes[x].rc_stoplevel;
+		return rule->rr_childtypes[x].rc_startlevel;
+	}
+
+	return 0;
+}
+
+
+static inline int
+in_batch(resource_rule_t *rule, resource_node_t *child, char *type, int op,
+	 int level)
+{
+	char *ctype = child->rn_resource->r_rule->rr_type;
+
+	if (type)
+		return !strcmp(ctype, type);
+	return child_level(rule, ctype, op) == level;
+}
+
+
+/*
+   Helper threads in use by all resource trees at once.  When none are
+   left, a batch is simply run by the thread which asked for it.
+ */
+#define MAX_CHILD_HELPERS	64
+static pthread_mutex_t helper_lock = PTHREAD_MUTEX_INITIALIZER;
+static int helpers = 0;
+
+typedef struct _child_batch {
+	pthread_mutex_t	cb_lock;
+	resource_node_t	**cb_nodes;
+	resource_t	*cb_first;
+	void		*cb_ret;
+	int		cb_count;
+	int		cb_next;
+	int		cb_op;
+	int		cb_rv;
+} child_batch_t;
+
+
+static void *
+child_batch_worker(void *arg)
+{
+	child_batch_t *cb = (child_batch_t *)arg;
+	resource_node_t *child;
+	int rv;
+
+	pthread_mutex_lock(&cb->cb_lock);
+	while (cb->cb_next < cb->cb_count) {
+		/* As in the serial case, nothing more is started once
+		   something has failed; a stop always runs to the end */
+		if ((cb->cb_rv & SFL_FAILURE) && cb->cb_op != RS_STOP)
+			break;
+
+		child = cb->cb_nodes[cb->cb_next++];
+		pthread_mutex_unlock(&cb->cb_lock);
+
+		rv = _res_op_internal(&child, cb->cb_first,
+				      child->rn_resource->r_rule->rr_type,
+				      cb->cb_ret, cb->cb_op, child);
+
+		pthread_mutex_lock(&cb->cb_lock);
+		cb->cb_rv |= rv;
+	}
+	pthread_mutex_unlock(&cb->cb_lock);
+
+	return NULL;
+}
+
+
+/**
+   Perform an operation on the children of a node at one level, up to
+   <width> of them at once.  The calling thread works on the batch too,
+   so it completes even if no helper threads can be had.
+
+   @param node		Parent node
+   @param first		As for _res_op
+   @param type		Only do children of this type; NULL for every
+   			child type at <level>
+   @param level		Start or stop level
+   @param width		Maximum number of children to do at once
+   @return		Flags from _res_op_internal, OR'd together
+ */
+static int
+_res_op_parallel(resource_node_t *node, resource_t *first, char *type,
+		 void *ret, int op, int level, int width)
+{
+	resource_rule_t *rule = node->rn_resource->r_rule;
+	resource_node_t *child;
+	child_batch_t cb;
+	pthread_attr_t attrs;
+	pthread_t *threads;
+	int x, count = 0, started = 0;
+
+	memset(&cb, 0, sizeof(cb));
+
+	list_for(&node->rn_child, child, x) {
+		if (in_batch(rule, child, type, op, level))
+			++count;
+	}
+	if (!count)
+		return 0;
+
+	cb.cb_nodes = malloc(sizeof(resource_node_t *) * count);
+	threads = malloc(sizeof(pthread_t) * width);
+	if (!cb.cb_nodes || !threads) {
+		free(cb.cb_nodes);
+		free(threads);
+		return SFL_FAILURE;
+	}
+
+	/* Stops are handed out last-first, like _res_op does them */
+	if (op == RS_STOP) {
+		list_for_rev(&node->rn_child, child, x) {
+			if (in_batch(rule, child, type, op, level))
+				cb.cb_nodes[cb.cb_count++] = child;
+		}
+	} else {
+		list_for(&node->rn_child, child, x) {
+			if (in_batch(rule, child, type, op, level))
+				cb.cb_nodes[cb.cb_count++] = child;
+		}
+	}
+
+	pthread_mutex_init(&cb.cb_lock, NULL);
+	cb.cb_first = first;
+	cb.cb_ret = ret;
+	cb.cb_op = op;
+
+	pthread_attr_init(&attrs);
+	pthread_attr_setstacksize(&attrs, 262144);
+	for (x = 1; x < width && x < count; x++) {
+		pthread_mutex_lock(&helper_lock);
+		if (helpers >= MAX_CHILD_HELPERS) {
+			pthread_mutex_unlock(&helper_lock);
+			break;
+		}
+		++helpers;
+		pthread_mutex_unlock(&helper_lock);
+
+		if (pthread_create(&threads[started], &attrs,
+				   child_batch_worker, &cb) != 0) {
+			pthread_mutex_lock(&helper_lock);
+			--helpers;
+			pthread_mutex_unlock(&helper_lock);
+			break;
+		}
+		++started;
+	}
+	pthread_attr_destroy(&attrs);
+
+	child_batch_worker(&cb);
+
+	for (x = 0; x < started; x++)
+		pthread_join(threads[x], NULL);
+
+	pthread_mutex_lock(&helper_lock);
+	helpers -= started;
+	pthread_mutex_unlock(&helper_lock);
+
+	pthread_mutex_destroy(&cb.cb_lock);
+	free(cb.cb_nodes);
+	free(threads);
+
+	return cb.cb_rv;
+}
+
+
 static inline int
 _do_child_levels(resource_node_t **tree, resource_t *first, void *ret,
 		 int op)
@@ -1052,6 +1258,16 @@ _do_child_levels(resource_node_t **tree, resource_t *first, void *ret,
 
 	for (l = 1; l <= RESOURCE_MAX_LEVELS; l++) {
 
+		/* Children at the same level have no ordering between
+		   them, so with __parallel they all go at once */
+		if (node->rn_parallel > 1 && parallel_op(op)) {
+			rv |= _res_op_parallel(node, first, NULL, ret, op, l,
+					       node->rn_parallel);
+			if (rv != 0 && op != RS_STOP)
+				return rv;
+			continue;
+		}
+
 		for (x = 0; rule->rr_childtypes &&
 		     rule->rr_childtypes[x].rc_name; x++) {
 
@@ -1071,9 +1287,16 @@ _do_child_levels(resource_node_t **tree, resource_t *first, void *ret,
 #endif
 
 			/* Do op on all children at our level */
-			rv |= _res_op(&node->rn_child, first,
-			     	     rule->rr_childtypes[x].rc_name, 
-		     		     ret, op);
+			if (rule->rr_childtypes[x].rc_parallel > 1 &&
+			    parallel_op(op))
+				rv |= _res_op_parallel(node, first,
+					rule->rr_childtypes[x].rc_name,
+					ret, op, l,
+					rule->rr_childtypes[x].rc_parallel);
+			else
+				rv |= _res_op(&node->rn_child, first,
+					     rule->rr_childtypes[x].rc_name, 
+					     ret, op);
 
 			if (rv & SFL_FAILURE && op != RS_STOP)
 				return rv;
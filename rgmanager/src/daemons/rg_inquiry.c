@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <rg_types.h>
+#include <resgroup.h>
+#include <platform.h>
+#include <msgsimple.h>
+#include <message.h>
+
+
+/**
+ * Ask a set of nodes whether they are running a service, all at once.
+ * The status inquiry is sent over every context before any answer is
+ * read, so a slow node costs no more than the slowest answer we wait
+ * for, rather than adding its delay to everyone else's.
+ *
+ * @param ctxs		Open contexts, one per node to ask.
+ * @param count		Number of contexts.
+ * @param svcName	Service to ask about.
+ * @param timeout	Seconds to wait for all the answers together.
+ * @return		Node ID from the first node claiming to run the
+ *			service, or -1 if none did before the timeout.
+ */
+int
+inquire_owner(msgctx_t **ctxs, int count, const char *svcName, int timeout)
+{
+	SmMessageSt msgp, response;
+	struct timeval now, end, tv;
+	fd_set rfds;
+	char *waiting;
+	int x, max, n, left = 0, ret = -1;
+
+	if (count <= 0)
+		return -1;
+
+	waiting = calloc(count, sizeof(*waiting));
+	if (!waiting)
+		return -1;
+
+	/* Build message */
+	msgp.sm_hdr.gh_magic = GENERIC_HDR_MAGIC;
+	msgp.sm_hdr.gh_command = RG_ACTION_REQUEST;
+	msgp.sm_hdr.gh_arg1 = RG_STATUS_INQUIRY;
+	msgp.sm_hdr.gh_length = sizeof(msgp);
+	msgp.sm_data.d_action = RG_STATUS_INQUIRY;
+	strncpy(msgp.sm_data.d_svcName, svcName,
+		sizeof(msgp.sm_data.d_svcName));
+	msgp.sm_data.d_svcOwner = 0;
+	msgp.sm_data.d_ret = 0;
+
+	swab_SmMessageSt(&msgp);
+
+	for (x = 0; x < count; x++) {
+		if (msg_send(ctxs[x], &msgp, sizeof(msgp)) < 0)
+			continue;
+		waiting[x] = 1;
+		++left;
+	}
+
+	gettimeofday(&end, NULL);
+	end.tv_sec += timeout;
+
+	while (left && ret < 0) {
+		gettimeofday(&now, NULL);
+		if (!timercmp(&now, &end, <))
+			break;
+		timersub(&end, &now, &tv);
+
+		FD_ZERO(&rfds);
+		max = -1;
+		for (x = 0; x < count; x++)
+			if (waiting[x])
+				msg_fd_set(ctxs[x], &rfds, &max);
+
+		n = select(max + 1, &rfds, NULL, NULL, &tv);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		for (x = 0; x < count && ret < 0; x++) {
+			if (!waiting[x] || msg_fd_isset(ctxs[x], &rfds) <= 0)
+				continue;
+
+			/* Anything but an answer (including nothing at
+			   all) means this node isn't going to tell us */
+			n = msg_receive(ctxs[x], &response, sizeof(response),
+					0);
+			waiting[x] = 0;
+			--left;
+
+			if (n != sizeof(response))
+				continue;
+
+			swab_SmMessageSt(&response);
+			if (response.sm_data.d_ret == RG_SUCCESS)
+				ret = response.sm_data.d_svcOwner;
+		}
+	}
+
+	free(waiting);
+	return ret;
+}
+
+
+/**
+ * Ask a list of nodes whether they are running a service, INQUIRY_BATCH
+ * of them at a time: contexts are shared by the whole daemon, and there
+ * are only MAX_CONTEXTS of them.  If a context can't be opened, the nodes
+ * whose contexts are open are asked, and the rest are tried again after
+ * those are closed.
+ *
+ * @param nodeids	Nodes to ask.
+ * @param count		Number of nodes.
+ * @param svcName	Service to ask about.
+ * @param timeout	Seconds to wait for each batch's answers.
+ * @param open_ctx	Opens a context to a node; returns < 0 on failure.
+ * @return		Node ID from the first node claiming to run the
+ *			service, or -1 if none did, or if no context could
+ *			be opened at all.
+ */
+int
+inquire_nodes(const int *nodeids, int count, const char *svcName,
+	      int timeout, int (*open_ctx)(int nodeid, msgctx_t *ctx))
+{
+	msgctx_t ctxs[INQUIRY_BATCH];
+	msgctx_t *open_ctxs[INQUIRY_BATCH];
+	int x = 0, n, ret = -1;
+
+	while (x < count && ret < 0) {
+		for (n = 0; x < count && n < INQUIRY_BATCH; x++, n++) {
+			if (open_ctx(nodeids[x], &ctxs[n]) < 0)
+				break;
+			open_ctxs[n] = &ctxs[n];
+		}
+
+		/* failed to open: better to claim false successful
+		   status rather than claim a failure and possibly
+		   end up with a service on >1 node */
+		if (!n)
+			break;
+
+		ret = inquire_owner(open_ctxs, n, svcName, timeout);
+
+		while (n)
+			msg_close(open_ctxs[--n]);
+	}
+
+	return ret;
+}
@@ -12,6 +12,7 @@
 #include <vf.h>
 #endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <resgroup.h>
 #include <logging.h>
@@ -1019,10 +1020,18 @@ svc_migrate(const char *svcName, int target)
 }
 
 
+static int
+open_member_ctx(int nodeid, msgctx_t *ctx)
+{
+	return msg_open(MSG_CLUSTER, nodeid, RG_PORT, ctx, 2 * cluster_timeout);
+}
+
+
 /**
  * Ask the other nodes if they've seen this service.  This can be used
  * to allow users the ability to use non-rgmanager tools to migrate
- * a virtual machine to another node in the cluster.
+ * a virtual machine to another node in the cluster.  The members are
+ * asked INQUIRY_BATCH at a time; see inquire_nodes().
  * 
  * Returns the node ID of the new owner, if any.  -1 if no one in the
  * cluster has seen the service.
@@ -1030,26 +1039,19 @@ svc_migrate(const char *svcName, int target)
 static int
 get_new_owner(const char *svcName)
 {
-	SmMessageSt msgp, response;
-	msgctx_t ctx;
 	cluster_member_list_t *membership;
-	int x, ret = -1, me = my_id();
+	int *nodeids;
+	int x, count = 0, ret = -1, me = my_id();
 
-	/* Build message */
-	msgp.sm_hdr.gh_magic = GENERIC_HDR_MAGIC;
-	msgp.sm_hdr.gh_command = RG_ACTION_REQUEST;
-	msgp.sm_hdr.gh_arg1 = RG_STATUS_INQUIRY;
-	msgp.sm_hdr.gh_length = sizeof(msgp);
-	msgp.sm_data.d_action = RG_STATUS_INQUIRY;
-	strncpy(msgp.sm_data.d_svcName, svcName,
-		sizeof(msgp.sm_data.d_svcName));
-	msgp.sm_data.d_svcOwner = 0;
-	msgp.sm_data.d_ret = 0;
+	membership = member_list();
+	if (!membership)
+		return -1;
 
-	swab_SmMessageSt(&msgp);
+	nodeids = malloc(sizeof(*nodeids) * membership->cml_count);
+	if (!nodeids)
+		goto out;
 
-	membership = member_list();
-	for (x = 0; x < membership->cml_count && ret < 0; x++) {
+	for (x = 0; x < membership->cml_count; x++) {
 
 		/* don't query down members */
 		if (!membership->cml_members[x].cn_member)
@@ -1058,29 +1060,12 @@ get_new_owner(const char *svcName)
 		if (membership->cml_members[x].cn_nodeid == me)
 			continue;
 
-		if (msg_open(MSG_CLUSTER, membership->cml_members[x].cn_nodeid,
-			     RG_PORT, &ctx, 2 * cluster_timeout) < 0) {
-			/* failed to open: better to claim false successful
-			   status rather than claim a failure and possibly
-			   end up with a service on >1 node */
-			goto out;
-		}
-
-		msg_send(&ctx, &msgp, sizeof(msgp));
-		if (msg_receive(&ctx, &response, sizeof (response), 10) !=
-		    		sizeof(response))
-			goto cont;
-
-		swab_SmMessageSt(&response);
-		if (response.sm_data.d_ret == RG_SUCCESS)
-			ret = response.sm_data.d_svcOwner;
-		else
-			ret = -1;
-
-cont:
-		msg_close(&ctx);
+		nodeids[count++] = membership->cml_members[x].cn_nodeid;
 	}
 
+	ret = inquire_nodes(nodeids, count, svcName, 10, open_member_ctx);
+	free(nodeids);
+
 out:
 	free_member_list(membership);
 	
@@ -0,0 +1,4 @@
+#!/bin/sh
+PTEST_TYPE=ptest_app
+PTEST_CHILDREN=
+. $(dirname $0)/ptest-lib
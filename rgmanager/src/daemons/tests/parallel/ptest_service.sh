@@ -0,0 +1,13 @@
+#!/bin/sh
+#
+# fs and ip are unordered siblings at level 1 and app comes after them.
+# vol is also at level 1, and may be started or stopped three at a time
+# whether or not the service asks for __parallel.
+#
+PTEST_TYPE=ptest_service
+PTEST_CHILDREN='
+        <child type="ptest_fs" start="1" stop="2"/>
+        <child type="ptest_ip" start="1" stop="2"/>
+        <child type="ptest_vol" start="1" stop="2" parallel="3"/>
+        <child type="ptest_app" start="2" stop="1"/>'
+. $(dirname $0)/ptest-lib
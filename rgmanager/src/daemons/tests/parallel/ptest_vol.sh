@@ -0,0 +1,4 @@
+#!/bin/sh
+PTEST_TYPE=ptest_vol
+PTEST_CHILDREN=
+. $(dirname $0)/ptest-lib
@@ -120,3 +120,78 @@ for t in $TESTS; do
 	prev=$t
 	echo OK
 done
+
+
+#
+# Parallel start/stop tests.  The agents in parallel/ sleep, and log
+# when each operation begins and ends.
+#
+AGENTS=$(pwd)/parallel
+
+# evtime <first|last> <begin|end> <op> <resource regex>
+evtime()
+{
+	awk -v w=$1 -v e=$2 -v o=$3 -v r="$4" '
+		$2 == e && $3 == o && $4 ~ r {
+			if (t == "" || (w == "first" && $1 < t) ||
+			    (w == "last" && $1 > t))
+				t = $1
+		}
+		END { print t }' parallel.log
+}
+
+# before <time> <time>
+before()
+{
+	awk -v a="$1" -v b="$2" 'BEGIN { exit !(a != "" && b != "" && a <= b) }'
+}
+
+# partest <service> <phase> <description> <test>...
+partest()
+{
+	declare svc=$1 phase=$2 desc=$3
+	shift 3
+
+	echo -n "  Checking $phase of $svc ($desc)..."
+	rm -f parallel.log
+	../rg_test $AGENTS test parallel.conf $phase ptest_service $svc \
+		> parallel.out 2> parallel.out.stderr
+	while [ -n "$1" ]; do
+		if ! eval "$1"; then
+			echo "FAILED"
+			echo "*** Parallel test failed: $1"
+			echo
+			cat parallel.out parallel.log
+			exit 1
+		fi
+		shift
+	done
+	if grep -q "allocation trace" parallel.out.stderr; then
+		echo "FAILED - memory leak"
+		cat parallel.out.stderr
+		exit 1
+	fi
+	rm -f parallel.log parallel.out parallel.out.stderr
+	echo OK
+}
+
+partest par start "level 1 at once, then level 2" \
+	'before $(evtime last begin start "fs|ip") $(evtime first end start "fs|ip")' \
+	'before $(evtime last end start "fs|ip") $(evtime first begin start app1)'
+
+partest par stop "level 1 at once, then level 2" \
+	'before $(evtime last end stop app1) $(evtime first begin stop "fs|ip")' \
+	'before $(evtime last begin stop "fs|ip") $(evtime first end stop "fs|ip")'
+
+partest parfail start "failure stops the start" \
+	'grep -q "Failed to start parfail" parallel.out' \
+	'grep -q "end start ptest_fs:fs3" parallel.log' \
+	'! grep -q "start ptest_app:app2" parallel.log'
+
+partest pertype start "three vols at once" \
+	'before $(evtime last begin start vol) $(evtime first end start vol)' \
+	'before $(evtime last end start vol) $(evtime first begin start app3)'
+
+partest serial start "one at a time" \
+	'before $(evtime first end start fs5) $(evtime first begin start fs6)' \
+	'before $(evtime first end start fs6) $(evtime first begin start app4)'
@@ -117,6 +117,13 @@ If set to 1, failure of a status operation of this resource or any of its
 children will be considered non-fatal unless a restart of this resource and
 all of its children also fails.
 
+.TP
+.B __parallel
+If set to more than 1, children of this resource which share a start or stop
+level are started and stopped up to this many at a time instead of one after
+another.  Levels are still done in order, and nothing more is started once a
+start has failed.  Inherited by all children unless they set it themselves.
+
 .SH ACTIONS
 <xsl:apply-templates select="actions"/>
 
@@ -32,6 +32,9 @@
       &lt;optional&gt;
         &lt;attribute name="__enforce_timeouts" rha:description="Consider a timeout for operations as fatal."/&gt;
       &lt;/optional&gt;
+      &lt;optional&gt;
+        &lt;attribute name="__parallel" rha:description="Number of unordered child resources to start or stop at once."/&gt;
+      &lt;/optional&gt;
       &lt;optional&gt;
         &lt;attribute name="__max_failures" rha:description="Maximum number of failures before returning a failure to a status check."/&gt;
       &lt;/optional&gt;